@@ -1,8 +1,11 @@
-// mkpattern.cpp -- convertor of TeX hyphenation files to FBReader format
+// mkpattern.cpp -- convertor of TeX hyphenation files to FBReader format,
+// and compiler of FBReader format files to crengine binary format
 // (c) Vadim Lopatin, 2011
 
 #include <stdlib.h>
+#include <string.h>
 #include <crengine.h>
+#include <hyphman.h>
 
 class Convertor {
     FILE * out;
@@ -54,9 +57,9 @@ public:
 private:
     void addPattern(lString32 pattern) {
         if (pattern[0] == '.')
-            pattern[0] = ' ';
+            pattern.modify()[0] = ' ';
         if (pattern[pattern.length()-1] == '.')
-            pattern[pattern.length()-1] = ' ';
+            pattern.modify()[pattern.length()-1] = ' ';
         fprintf(out, "  <pattern>%s</pattern>\n", LCSTR(pattern));
     }
     void start() {
@@ -65,13 +68,43 @@ private:
     }
 };
 
+// compile .pattern (or AlReader .pdb) dictionary to the binary format
+// used by crengine with no parsing
+static int compile(const char * srcName, const char * dstName)
+{
+    LVStreamRef src = LVOpenFileStream(srcName, LVOM_READ);
+    if (src.isNull()) {
+        printf("File %s is not found\n", srcName);
+        return -2;
+    }
+    LVStreamRef dst = LVOpenFileStream(dstName, LVOM_WRITE);
+    if (dst.isNull()) {
+        printf("Cannot create file %s\n", dstName);
+        return -2;
+    }
+    if (!HyphMan::compileDictionary(src, dst)) {
+        printf("Cannot compile hyphenation patterns from %s\n", srcName);
+        return -3;
+    }
+    return 0;
+}
+
 int main(int argc, char* argv[])
 {
-    if (argc < 2) {
+    if (argc < 3) {
         printf("Hyphenation pattern convertor\n");
         printf("usage: mkpattern <srclistfile.tex> <dstfile.pattern>\n");
+        printf("       mkpattern -c <srcfile.pattern> <dstfile.pattern>\n");
+        printf("  -c: compile patterns to binary format, to be used in place of the original file\n");
         return -1;
     }
+    if (!strcmp(argv[1], "-c")) {
+        if (argc < 4) {
+            printf("usage: mkpattern -c <srcfile.pattern> <dstfile.pattern>\n");
+            return -1;
+        }
+        return compile(argv[2], argv[3]);
+    }
     FILE * src = fopen(argv[1], "rb");
     if (!src) {
         printf("File %s is not found\n", argv[1]);
@@ -3,6 +3,7 @@
 
 #include "crlocks.h"
 
+#if (CR_THREAD_SAFE==1)
 
 #include "lvref.h"
 #include "lvqueue.h"
@@ -36,5 +37,6 @@ public:
     virtual void run();
 };
 
+#endif // CR_THREAD_SAFE==1
 
 #endif // CRCONCURRENT_H
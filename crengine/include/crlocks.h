@@ -3,10 +3,55 @@
 
 #include "crsetup.h"
 
-#if 0
+/*
+    Thread safety (CR_THREAD_SAFE==1, THREAD_SAFE cmake option)
+
+    - LVRef / LVFastRef reference counters are atomic: references to the
+      same object may be copied and released from several threads, but a
+      single reference variable must not be modified concurrently (use
+      LVProtectedRef / LVProtectedFastRef for that).
+    - Font manager operations are serialized by FONT_MAN_GUARD.
+    - Each font instance (LVFreeTypeFace, LVFontBoldTransform) has its own
+      lock, so different fonts measure and draw text concurrently; calls on
+      the same font instance are serialized. A locked font instance may take
+      FONT_MAN_GUARD (to get its fallback fonts), so the font manager never
+      locks a font instance while holding it.
+    - Glyph cache hits only need the font instance lock. The global glyph
+      cache is protected by FONT_GLYPH_CACHE_GUARD, taken when glyphs are
+      added or removed; glyphs of a font instance locked by another thread
+      are never evicted.
+    - The cache of decoded and scaled images used by LVDrawBuf::Draw() is
+      shared by all threads, and protected by IMAGE_BITMAP_CACHE_GUARD.
+      Images are decoded without holding it, and cached bitmaps are
+      reference counted, so they can be evicted while being drawn.
+    - ldomDocument is NOT thread safe: all operations on one document
+      (loading, rendering, drawing, searching, cache swapping) must be done
+      from one thread at a time, usually under LVDocView::getMutex(), as
+      its storage chunks are loaded and unpacked lazily, even by const
+      looking accessors. Different documents can be used from different
+      threads concurrently.
+    - When rendering a whole document, final blocks made of plain text are
+      formatted ahead by worker threads (FinalBlockFormatPool in
+      lvrend.cpp): their source text is added from the DOM by the rendering
+      thread, workers only measure and lay out that text.
+    - Cache file blocks saved by ldomDocument (swapToCache(), updateMap())
+      are copied to a queue, and packed and written by writer threads of
+      its CacheFile, which only holds its own lock while writing to the
+      file. LVDocView::waitCacheWrites() tells when they are written, and
+      LVDocView::syncCache() saves the document and waits for its cache
+      file to be complete on disk (e.g. before the app is suspended).
+
+    CRSetupEngineConcurrency() is called by InitFontManager(), using
+    mutexes from concurrencyProvider when set, or built-in ones.
+*/
+
+#if (CR_THREAD_SAFE==1)
 
 #include "lvautoptr.h"
 
+/// thread local storage for static scratch buffers
+#define CR_THREAD_LOCAL thread_local
+
 class CRMutex {
 public:
     virtual ~CRMutex() {}
@@ -56,22 +101,19 @@ public:
 
 
 extern CRMutex * _refMutex;
-extern CRMutex * _fontMutex;
 extern CRMutex * _fontManMutex;
 extern CRMutex * _fontGlyphCacheMutex;
-extern CRMutex * _fontLocalGlyphCacheMutex;
+extern CRMutex * _imageBitmapCacheMutex;
 extern CRMutex * _crengineMutex;
 
 // use REF_GUARD to acquire LVProtectedRef mutex
 #define REF_GUARD CRGuard _refGuard(_refMutex); CR_UNUSED(_refGuard);
-// use FONT_GUARD to acquire font operations mutex
-#define FONT_GUARD CRGuard _fontGuard(_fontMutex); CR_UNUSED(_fontGuard);
 // use FONT_MAN_GUARD to acquire font manager mutex
 #define FONT_MAN_GUARD CRGuard _fontManGuard(_fontManMutex); CR_UNUSED(_fontManGuard);
 // use FONT_GLYPH_CACHE_GUARD to acquire font global glyph cache operations mutex
 #define FONT_GLYPH_CACHE_GUARD CRGuard _fontGlyphCacheGuard(_fontGlyphCacheMutex); CR_UNUSED(_fontGlyphCacheGuard);
-// use FONT_LOCAL_GLYPH_CACHE_GUARD to acquire font global glyph cache operations mutex
-#define FONT_LOCAL_GLYPH_CACHE_GUARD CRGuard _fontLocalGlyphCacheGuard(_fontLocalGlyphCacheMutex); CR_UNUSED(_fontLocalGlyphCacheGuard);
+// use IMAGE_BITMAP_CACHE_GUARD to acquire decoded images cache mutex
+#define IMAGE_BITMAP_CACHE_GUARD CRGuard _imageBitmapCacheGuard(_imageBitmapCacheMutex); CR_UNUSED(_imageBitmapCacheGuard);
 // use CRENGINE_GUARD to acquire crengine drawing lock
 #define CRENGINE_GUARD CRGuard _crengineGuard(_crengineMutex); CR_UNUSED(_crengineMutex);
 
@@ -80,11 +122,12 @@ void CRSetupEngineConcurrency();
 
 #else
 
+#define CR_THREAD_LOCAL
+
 #define REF_GUARD
-#define FONT_GUARD
 #define FONT_MAN_GUARD
 #define FONT_GLYPH_CACHE_GUARD
-#define FONT_LOCAL_GLYPH_CACHE_GUARD
+#define IMAGE_BITMAP_CACHE_GUARD
 #define CRENGINE_GUARD
 
 #endif
@@ -21,6 +21,7 @@
 /// Images.
 #define ARBITRARY_IMAGE_SCALE_ENABLED        1
 #define MAX_IMAGE_SCALE_MUL                  2
+#define IMAGE_BITMAP_CACHE_SIZE              0x1000000 // 16.0 MiB, of decoded and scaled images
 #define USE_GIF                              @USE_GIF@
 #define USE_LIBJPEG                          @USE_LIBJPEG@
 #define USE_LIBPNG                           @USE_LIBPNG@
@@ -50,17 +51,20 @@
 #define USE_ANSI_FILES                       0
 #define FILE_STREAM_BUFFER_SIZE              0x20000   // 128.0 KiB
 #define ZIP_STREAM_BUFFER_SIZE               0x40000   // 256.0 KiB
+#define ZIP_STREAM_CACHE_MAX_SIZE            0x40000   // 256.0 KiB, smaller members are kept decoded when seeked back
+#define ZIP_STREAM_CHECKPOINT_INTERVAL       0x100000  // 1.0 MiB, of decoded data between seek checkpoints
 
 /// System.
-#define CR_USE_THREADS                       0
+#define CR_THREAD_SAFE                       @USE_THREAD_SAFE@ // see crlocks.h
+#define CR_USE_THREADS                       CR_THREAD_SAFE
 #define LDOM_USE_OWN_MEM_MAN                 @USE_OWN_MEM_MAN@
 
 /// Text.
 #define USE_LIMITED_FONT_SIZES_SET           0
 #define USE_BITMAP_FONTS                     0
 #define USE_WIN32_FONTS                      0
-#define USE_GLYPHCACHE_HASHTABLE             0
 #define GLYPH_CACHE_SIZE                     0x40000   // 256.0 KiB
+#define HB_SHAPING_CACHE_SIZE                0x40000   // 256.0 KiB, per font instance
 #define ALLOW_KERNING                        1
 #define USE_FONTCONFIG                       @USE_FONTCONFIG@
 #define USE_FREETYPE                         @USE_FREETYPE@
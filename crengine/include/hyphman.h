@@ -158,6 +158,9 @@ public:
     static bool isEnabled();
     static HyphMethod * getHyphMethodForDictionary( lString32 id, int leftHyphenMin=HYPHMETHOD_DEFAULT_HYPHEN_MIN,
                                                         int rightHyphenMin=HYPHMETHOD_DEFAULT_HYPHEN_MIN );
+    /// compile .pattern or .pdb dictionary to a binary format, loaded (mapped) with no parsing
+    /// when used in place of the original dictionary file
+    static bool compileDictionary( LVStreamRef src, LVStreamRef dst );
 
     HyphMan();
     ~HyphMan();
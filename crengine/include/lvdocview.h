@@ -48,7 +48,7 @@ typedef enum {
 #endif//#ifndef CR_ENABLE_PAGE_IMAGE_CACHE
 
 #if CR_ENABLE_PAGE_IMAGE_CACHE==1
-/// Page imege holder which allows to unlock mutex after destruction
+/// Page image holder, releasing the image under the cache mutex after destruction
 class LVDocImageHolder
 {
 private:
@@ -67,109 +67,115 @@ public:
     }
     ~LVDocImageHolder()
     {
+        LVLock lock( _mutex );
         _drawbuf = NULL;
-        _mutex.unlock();
     }
 };
 
 typedef LVRef<LVDocImageHolder> LVDocImageRef;
 
+/// page image cache statistics
+struct LVDocViewImageCacheStats
+{
+    int hits;            ///< requested page image was ready
+    int waits;           ///< requested page image was queued or being rendered
+    int misses;          ///< requested page image was not in cache
+    lUInt64 waitTimeMs;  ///< total time spent waiting for page images being rendered
+    int rendered;        ///< number of page images rendered
+    int cancelled;       ///< number of queued page images dropped before being rendered
+    int evicted;         ///< number of page images dropped to fit the limits
+    LVDocViewImageCacheStats()
+    : hits(0), waits(0), misses(0), waitTimeMs(0), rendered(0), cancelled(0), evicted(0)
+    {
+    }
+};
+
 /// page image cache
+/// Keeps up to maxPages rendered page images, within a memory budget of
+/// maxBytes, and renders queued pages ahead of time on a persistent worker
+/// thread (or synchronously when CR_USE_THREADS is not enabled).
+/// Drawing needs the document, so the worker holds the view mutex while it
+/// renders: there is at most one, see LVDocView::setPageDrawBands() to draw
+/// each page on several threads.
 class LVDocViewImageCache
 {
     private:
-        LVMutex _mutex;
         class Item {
             public:
                 LVRef<LVDrawBuf> _drawbuf;
-                LVRef<LVThread> _thread;
                 int _offset;
                 int _page;
-                bool _ready;
-                bool _valid;
+                lUInt32 _size;
+                lUInt32 _lastUse;
+                bool _ready;     // rendered
+                bool _rendering; // being rendered by a worker
+                bool _stale;     // dropped by clear() while being rendered
+                bool matches( int offset, int page ) const {
+                    return (_offset == offset && offset!=-1) || (_page==page && page!=-1);
+                }
         };
-        Item _items[2];
-        int _last;
+        class Worker;
+        LVDocView * _view;
+        LVMutex _mutex;
+        LVCondition _cond; // signaled when a page is queued, rendered or dropped
+        LVPtrVector<Item> _items; // ready, queued and being rendered pages
+        LVPtrVector<Worker> _workers;
+        lUInt32 _useCounter;
+        lUInt32 _totalSize;
+        int _maxPages;
+        lUInt32 _maxBytes;
+        int _threadCount;
+        bool _stopped;
+        LVDocViewImageCacheStats _stats;
+        int find( int offset, int page );
+        /// drop least recently used pages until limits are met, keeping item keep
+        void evict( Item * keep );
+        /// remove item from list, deleting it unless a worker is rendering it
+        void drop( int index );
+        /// returns true if a page is queued (caller must hold mutex)
+        bool hasQueuedJob();
+        /// take next queued page (caller must hold mutex), NULL if none
+        Item * nextJob();
+        /// render item (must be called without the mutex held, takes the view mutex)
+        void render( Item * item );
+        /// mark rendered item as ready (caller must hold mutex)
+        void finish( Item * item );
+        void startWorkers();
+        void stopWorkers();
+        /// worker thread loop
+        void run();
     public:
         /// return mutex
         LVMutex & getMutex() { return _mutex; }
-        /// set page to cache
-        void set( int offset, int page, LVRef<LVDrawBuf> drawbuf, LVRef<LVThread> thread )
-        {
-            LVLock lock( _mutex );
-            _last = (_last + 1) & 1;
-            _items[_last]._ready = false;
-            _items[_last]._thread = thread;
-            _items[_last]._drawbuf = drawbuf;
-            _items[_last]._offset = offset;
-            _items[_last]._page = page;
-            _items[_last]._valid = true;
-        }
-        /// return page image, wait until ready
-        LVRef<LVDrawBuf> getWithoutLock( int offset, int page )
-        {
-            for ( int i=0; i<2; i++ ) {
-                if ( _items[i]._valid &&
-                     ( (_items[i]._offset == offset && offset!=-1)
-                      || (_items[i]._page==page && page!=-1)) ) {
-                    if ( !_items[i]._ready ) {
-                        _items[i]._thread->join();
-                        _items[i]._thread = NULL;
-                        _items[i]._ready = true;
-                    }
-                    _last = i;
-                    return _items[i]._drawbuf;
-                }
-            }
-            return LVRef<LVDrawBuf>();
-        }
-        /// return page image, wait until ready
-        LVDocImageRef get( int offset, int page )
-        {
-            _mutex.lock();
-            LVRef<LVDrawBuf> buf = getWithoutLock( offset, page );
-            if ( !buf.isNull() )
-                return LVDocImageRef( new LVDocImageHolder(getWithoutLock( offset, page ), _mutex) );
-            return LVDocImageRef( NULL );
-        }
-        bool has( int offset, int page )
-        {
-            _mutex.lock();
-            for ( int i=0; i<2; i++ ) {
-                if ( _items[i]._valid && ( (_items[i]._offset == offset && offset!=-1)
-                      || (_items[i]._page==page && page!=-1)) ) {
-                    return true;
-                }
-            }
-            return false;
-        }
-        void clear()
-        {
-            LVLock lock( _mutex );
-            for ( int i=0; i<2; i++ ) {
-                if ( _items[i]._valid && !_items[i]._ready ) {
-                    _items[i]._thread->join();
-                }
-                _items[i]._thread.Clear();
-                _items[i]._valid = false;
-                _items[i]._drawbuf.Clear();
-                _items[i]._offset = -1;
-                _items[i]._page = -1;
-            }
-        }
-        LVDocViewImageCache()
-        : _last(0)
-        {
-            for ( int i=0; i<2; i++ )
-                _items[i]._valid = false;
-        }
-        ~LVDocViewImageCache()
-        {
-            clear();
-        }
+        /// set cache limits and number of worker threads (more than 1 is treated as 1, see above);
+        /// when the thread count changes, it waits for the worker, which takes the view mutex:
+        /// not to be called with the view mutex held
+        void setLimits( int maxPages, lUInt32 maxBytes, int threadCount );
+        int getMaxPages() const { return _maxPages; }
+        /// returns true if queued pages are rendered in background
+        bool hasWorker() const;
+        /// queue page for rendering, if not yet in cache; buffer will receive page image
+        void set( int offset, int page, LVRef<LVDrawBuf> drawbuf );
+        /// return page image, rendering it now if queued, or waiting until the worker is done with it
+        LVDocImageRef get( int offset, int page, bool updateStats = true );
+        /// returns true if page is ready, queued or being rendered, marking it as recently used
+        bool has( int offset, int page );
+        /// returns true if page image is rendered and available without waiting
+        bool isReady( int offset, int page );
+        /// drop all page images, and cancel queued jobs (pages being rendered are discarded when done)
+        void clear();
+        /// stop worker thread; called before view destruction, not to be called with the view mutex held
+        void stop();
+        /// returns statistics
+        LVDocViewImageCacheStats getStats();
+        /// reset statistics counters
+        void resetStats();
+        LVDocViewImageCache( LVDocView * view );
+        ~LVDocViewImageCache();
 };
 #endif
 
+
 class LVPageWordSelector {
     LVDocView * _docview;
     ldomWordExList _words;
@@ -246,7 +252,6 @@ typedef LVArray<int> LVBookMarkPercentInfo;
 */
 class LVDocView : public CacheLoadingCallback
 {
-    friend class LVDrawThread;
 private:
     int m_bitsPerPixel;
     int m_dx;
@@ -343,6 +348,12 @@ private:
     LVMutex _mutex;
 #if CR_ENABLE_PAGE_IMAGE_CACHE==1
     LVDocViewImageCache m_imageCache;
+    int m_imageCacheLastPos; // page (or position in scroll mode) of last getPageImage(0)
+    int m_imageCacheDirection; // last page turn direction: 1=forward, -1=backward
+#endif
+    int m_pageDrawBands; // number of bands pages are drawn in, by as many threads
+#if (CR_THREAD_SAFE==1)
+    LVAutoPtr<LVDrawBandPool> m_drawBandPool;
 #endif
 
 
@@ -389,6 +400,8 @@ private:
     void insertBookmarkPercentInfo(int start_page, int end_y, int percent);
 
     void updateDocStyleSheet();
+    /// draws page to image buffer, or to recording buffer drawing it in bands
+    void drawPageContentTo( LVDrawBuf * drawBuf, LVRendPageInfo & page, lvRect * pageRect, int pageCount, int basePage, bool hasTwoVisiblePages, bool isRightPage, bool isLastPage );
 
 protected:
     /// returns document offset for next page
@@ -443,6 +456,15 @@ public:
     ContinuousOperationResult updateCache(CRTimerUtil & maxTime);
     /// save unsaved data to cache file (if one is created), w/o timeout
     ContinuousOperationResult updateCache();
+    /// wait for data saved to cache file to be written to disk, with timeout option
+    /// (with THREAD_SAFE, it is written by background threads after updateCache() returns)
+    ContinuousOperationResult waitCacheWrites(CRTimerUtil & maxTime);
+    /// save unsaved data to cache file, and wait for it to be on disk (e.g. before the app is suspended)
+    ContinuousOperationResult syncCache();
+    /// with progressive rendering, render the parts of the document not yet rendered, with timeout option
+    ContinuousOperationResult continueProgressiveRendering(CRTimerUtil & maxTime);
+    /// returns false while progressive rendering has parts of the document not yet rendered
+    bool isPageNumberingFinal() { return !m_doc || !m_doc->getPendingFragmentsCount(); }
 
     /// returns selected (marked) ranges
     ldomMarkedRangeList * getMarkedRanges() { return &m_markRanges; }
@@ -590,9 +612,25 @@ public:
     LVDocImageRef getPageImage( int delta );
     /// returns true if current page image is ready
     bool IsDrawed();
-    /// cache page image (render in background if necessary) (0=current, -1=prev, 1=next)
+    /// get cache key of page image (0=current, -1=prev, 1=next; any page delta in page mode)
+    bool getPageImageKey( int delta, int & offset, int & page );
+    /// cache page image (render in background if necessary) (0=current, -1=prev, 1=next; any page delta in page mode)
     void cachePageImage( int delta );
+    /// queue rendering of pages around current one, mostly in last page turn direction
+    void cachePageImages();
+    /// set number of cached page images, their memory budget, and number of render threads
+    /// (0 or 1: any larger count is treated as 1, as the render thread holds the view mutex
+    /// while drawing - see setPageDrawBands() for drawing a page on several threads).
+    /// Changing the thread count waits for the render thread, which may be waiting for the
+    /// view mutex: must not be called with the view mutex held.
+    void setPageImageCacheParams( int maxPages, lUInt32 maxBytes, int threadCount );
+    /// returns page image cache hit/miss/wait counters
+    LVDocViewImageCacheStats getPageImageCacheStats() { return m_imageCache.getStats(); }
 #endif
+    /// set number of horizontal bands pages are drawn in, each by its own thread (0 or 1: no threads)
+    void setPageDrawBands( int bands );
+    /// returns number of horizontal bands pages are drawn in
+    int getPageDrawBands() const { return m_pageDrawBands; }
     /// return view mutex
     LVMutex & getMutex() { return _mutex; }
     /// update selection ranges
@@ -802,6 +840,10 @@ public:
     lUInt32 getFileCRC32() {
         return (lUInt32)m_doc_props->getIntDef(DOC_PROP_FILE_CRC32, 0);
     }
+    /// returns book content fingerprint (0 unless useFileFingerprintAsCacheKey(true) was called)
+    lUInt64 getFileFingerprint() {
+        return (lUInt64)m_doc_props->getInt64Def(DOC_PROP_FILE_FINGERPRINT, 0);
+    }
 
     /// return alt document properties
     CRPropRef getAltDocProps() { return m_alt_doc_props; }
@@ -40,6 +40,9 @@
 #define PROP_EMBEDDED_STYLES         "crengine.doc.embedded.styles.enabled"
 #define PROP_EMBEDDED_FONTS          "crengine.doc.embedded.fonts.enabled"
 #define PROP_NONLINEAR_PAGEBREAK     "crengine.doc.nonlinear.pagebreak.force"
+#define PROP_TEXT_SEARCH_INDEX       "crengine.doc.text.search.index.enabled"
+#define PROP_LAYOUT_PROFILES_MAX_COUNT "crengine.doc.layout.profiles.max.count"
+#define PROP_LAYOUT_PROFILES_MAX_SIZE  "crengine.doc.layout.profiles.max.size"
 #define PROP_DISPLAY_INVERSE         "crengine.display.inverse"
 #define PROP_DISPLAY_FULL_UPDATE_INTERVAL "crengine.display.full.update.interval"
 #define PROP_DISPLAY_TURBO_UPDATE_MODE "crengine.display.turbo.update"
@@ -96,6 +99,7 @@
 #define PROP_RENDER_SCALE_FONT_WITH_DPI "crengine.render.scale.font.with.dpi"
 #define PROP_RENDER_BLOCK_RENDERING_FLAGS "crengine.render.block.rendering.flags"
 #define PROP_REQUESTED_DOM_VERSION      "crengine.render.requested_dom_version"
+#define PROP_RENDER_PROGRESSIVE         "crengine.render.progressive.enabled"
 
 #define PROP_CACHE_VALIDATION_ENABLED  "crengine.cache.validation.enabled"
 #define PROP_MIN_FILE_SIZE_TO_CACHE  "crengine.cache.filesize.min"
@@ -27,6 +27,11 @@ extern "C" {
 
 #include "lvtypes.h"
 #include "lvimg.h"
+#if (CR_THREAD_SAFE==1)
+#include "lvarray.h"
+#include "lvptrvec.h"
+#include "lvthread.h"
+#endif
 
 enum cr_rotate_angle_t {
     CR_ROTATE_ANGLE_0 = 0,
@@ -37,6 +42,7 @@ enum cr_rotate_angle_t {
 
 class LVFont;
 class GLDrawBuf; // workaround for no-rtti builds
+class LVBaseDrawBuf;
 
 /// Abstract drawing buffer
 class LVDrawBuf : public CacheableObject
@@ -247,6 +253,9 @@ public:
     /// virtual destructor
     virtual ~LVDrawBuf() { }
     virtual GLDrawBuf * asGLDrawBuf() { return NULL; }
+    /// returns a new buffer drawing on the same pixels, with the same settings but its own
+    /// clip and colors (to have other threads draw other rows), NULL if not supported
+    virtual LVBaseDrawBuf * createView() { return NULL; }
 };
 
 /// LVDrawBufferBase
@@ -268,6 +277,7 @@ protected:
     bool _smoothImages;
     int _drawnImagesCount;
     int _drawnImagesSurface;
+    friend class LVRecordingDrawBuf;
 public:
     /// set to true for drawing in Paged mode, false for Scroll mode
     virtual void setHidePartialGlyphs( bool hide ) { _hidePartialGlyphs = hide; }
@@ -324,6 +334,9 @@ public:
     /// Get surface of images drawn on buffer
     int getDrawnImagesSurface() const { return _drawnImagesSurface; }
 
+    /// copies drawing settings (colors, clip, images and glyphs options) of another buffer
+    void copySettings( const LVBaseDrawBuf & buf );
+
     LVBaseDrawBuf() : _dx(0), _dy(0), _rowsize(0), _data(NULL), _drawExtraInfo(NULL), _hidePartialGlyphs(true),
                         _invertImages(false), _invertColors(false), _ditherImages(false), _smoothImages(false),
                         _drawnImagesCount(0), _drawnImagesSurface(0) { }
@@ -443,6 +456,8 @@ public:
     LVGrayDrawBuf(int dx, int dy, int bpp=2, void * auxdata = NULL );
     /// destructor
     virtual ~LVGrayDrawBuf();
+    /// returns a new buffer drawing on the same pixels
+    virtual LVBaseDrawBuf * createView();
 #if 0
     /// convert to 1-bit bitmap
     void ConvertToBitmap(bool flgDither);
@@ -497,14 +512,14 @@ lUInt32 combineColors( lUInt32 foreColor, lUInt32 backColor );
 // & https://github.com/ImageMagick/ImageMagick/blob/ecfeac404e75f304004f0566557848c53030bad6/MagickCore/threshold.c#L1627
 // NOTE: As the references imply, this is straight from ImageMagick,
 //       with only minor simplifications to enforce Q8 & avoid fp maths.
+// c.f., https://github.com/ImageMagick/ImageMagick/blob/ecfeac404e75f304004f0566557848c53030bad6/config/thresholds.xml#L107
+static const lUInt8 threshold_map_o8x8[] = { 1,  49, 13, 61, 4,  52, 16, 64, 33, 17, 45, 29, 36, 20, 48, 32,
+					      9,  57, 5,  53, 12, 60, 8,  56, 41, 25, 37, 21, 44, 28, 40, 24,
+					      3,  51, 15, 63, 2,  50, 14, 62, 35, 19, 47, 31, 34, 18, 46, 30,
+					      11, 59, 7,  55, 10, 58, 6,  54, 43, 27, 39, 23, 42, 26, 38, 22 };
+
 static inline lUInt8 dither_o8x8(int x, int y, lUInt8 v)
 {
-	// c.f., https://github.com/ImageMagick/ImageMagick/blob/ecfeac404e75f304004f0566557848c53030bad6/config/thresholds.xml#L107
-	static const lUInt8 threshold_map_o8x8[] = { 1,  49, 13, 61, 4,  52, 16, 64, 33, 17, 45, 29, 36, 20, 48, 32,
-						      9,  57, 5,  53, 12, 60, 8,  56, 41, 25, 37, 21, 44, 28, 40, 24,
-						      3,  51, 15, 63, 2,  50, 14, 62, 35, 19, 47, 31, 34, 18, 46, 30,
-						      11, 59, 7,  55, 10, 58, 6,  54, 43, 27, 39, 23, 42, 26, 38, 22 };
-
 	// Constants:
 	// Quantum = 8; Levels = 16; map Divisor = 65
 	// QuantumRange = 0xFF
@@ -535,6 +550,17 @@ namespace CRe {
 lUInt8* qSmoothScaleImage(const lUInt8* __restrict src, int sw, int sh, bool ignore_alpha, int dw, int dh);
 }
 
+/// Returns source of img decoded and scaled to width x height, from a process-wide
+/// cache of recently drawn images (used by LVDrawBuf::Draw(), which then only dithers
+/// and blends it), scaling it like LVDrawBuf::Draw() does, or like an IMG_TRANSFORM_STRETCH
+/// LVCreateStretchFilledTransform() if stretch is true. Returns img (or its stretch
+/// transform) if it can't be cached: not read from a stream, 9-patch, or too large.
+LVImageSourceRef LVGetCachedScaledImage( LVImageSourceRef img, int width, int height, bool smooth, bool stretch=false );
+/// sets max total size of cached decoded images (IMAGE_BITMAP_CACHE_SIZE by default), 0 to disable
+void LVSetImageBitmapCacheSize( int maxSize );
+/// frees cached decoded images
+void LVClearImageBitmapCache();
+
 /// 32-bit RGB buffer
 class LVColorDrawBuf : public LVBaseDrawBuf
 {
@@ -597,6 +623,8 @@ public:
     LVColorDrawBuf(int dx, int dy, lUInt8 * externalBuffer, int bpp=32 );
     /// destructor
     virtual ~LVColorDrawBuf();
+    /// returns a new buffer drawing on the same pixels
+    virtual LVBaseDrawBuf * createView();
 #if 0
     /// convert to 1-bit bitmap
     void ConvertToBitmap(bool flgDither);
@@ -860,5 +888,112 @@ public:
     }
 };
 
+#if (CR_THREAD_SAFE==1)
+
+class LVDrawBandJob;
+
+/// Worker threads drawing horizontal bands of a buffer (see LVRecordingDrawBuf)
+class LVDrawBandPool
+{
+    class Worker;
+    LVPtrVector<Worker> _workers;
+    LVMutex _mutex;
+    LVCondition _cond;     // signaled when bands are queued or drawn
+    LVMutex _runMutex;     // one run() at a time
+    LVDrawBandJob * _job;
+    int _count;            // bands of current job
+    int _next;             // next band to draw
+    int _done;             // bands drawn
+    bool _stopped;
+    /// worker thread loop
+    void work();
+public:
+    /// draws count bands of job on worker threads and this one, returns when all are drawn
+    void run( LVDrawBandJob * job, int count );
+    int getThreadCount() const { return _workers.length(); }
+    /// creates pool with specified number of worker threads
+    explicit LVDrawBandPool( int threads );
+    ~LVDrawBandPool();
+};
+
+/// Draw buffer recording what is drawn on it, to draw it afterwards on a LVGrayDrawBuf
+/// or LVColorDrawBuf target split in horizontal bands, drawn by several threads.
+/// Each band gets the recorded operations in order, clipped to its rows, so the result
+/// is the same as when drawing on the target directly: only filling, blending glyphs
+/// and plotting decoded images is split, what is drawn (from a document, which is not
+/// thread safe) is computed once. Operations that can't be split (clearing, drawing
+/// images that aren't cached decoded bitmaps...) are drawn by the calling thread on
+/// the target, after the bands drawn before them are done.
+/// Images and glyphs settings of the buffer must not change while recording.
+class LVRecordingDrawBuf : public LVBaseDrawBuf
+{
+    enum OpType {
+        OP_CLEAR,
+        OP_INVERT,
+        OP_FILL_RECT,
+        OP_INVERT_RECT,
+        OP_DRAW_LINE,
+        OP_DRAW_BITMAP,
+        OP_DRAW_COLOR_GLYPH,
+        OP_DRAW_IMAGE
+    };
+    struct Op {
+        OpType type;
+        bool serial;        // drawn on the target by the calling thread
+        bool hidePartialGlyphs;
+        lvRect clip;
+        lUInt32 textColor;
+        lUInt32 backgroundColor;
+        int x0, y0, x1, y1; // rectangle or line, or position and size of bitmap or image
+        lUInt32 color;      // fill or line color, or bitmap palette[0]
+        bool hasPalette;    // bitmap drawn with palette (only palette[0] is used)
+        bool dither;
+        int length1, length2, direction; // line pattern
+        int pitch;          // color glyph row size
+        int bitmap;         // offset of bitmap copy in _bitmaps
+        LVImageSourceRef img;
+    };
+    LVDrawBuf * _target;
+    int _bpp;
+    LVPtrVector<LVBaseDrawBuf> _views; // one per band
+    LVArray<Op> _ops;
+    lUInt8 * _bitmaps;      // copies of drawn bitmaps (glyphs may be evicted from cache before drawn)
+    int _bitmapsSize;
+    int _bitmapsLength;
+    Op & addOp( OpType type, bool serial );
+    int addBitmap( const lUInt8 * bitmap, int width, int height, int pitch );
+    void drawOp( LVDrawBuf * buf, const Op & op ) const;
+    friend class LVRecordingDrawBandJob;
+public:
+    /// returns true if target supports drawing in bands (is a memory buffer)
+    bool canDrawBands() const { return _views.length() > 1; }
+    /// draws recorded operations on target, in bands drawn by pool threads, and clears them;
+    /// the target gets the state (colors, clip...) left by them
+    void drawBands( LVDrawBandPool * pool );
+
+    virtual void Rotate( cr_rotate_angle_t angle ) { CR_UNUSED(angle); }
+    virtual lUInt32 GetWhiteColor() const { return _target->GetWhiteColor(); }
+    virtual lUInt32 GetBlackColor() const { return _target->GetBlackColor(); }
+    virtual void Invert();
+    virtual int GetBitsPerPixel() const { return _bpp; }
+    virtual void Clear( lUInt32 color );
+    // Pixels are not available until drawn on the target
+    virtual lUInt32 GetPixel( int x, int y ) const { CR_UNUSED2(x, y); return 0; }
+    virtual lUInt8 * GetScanLine( int y ) const { CR_UNUSED(y); return NULL; }
+    virtual void FillRect( int x0, int y0, int x1, int y1, lUInt32 color );
+    virtual void InvertRect( int x0, int y0, int x1, int y1 );
+    virtual void Resize( int dx, int dy ) { CR_UNUSED2(dx, dy); }
+    virtual void Draw( LVImageSourceRef img, int x, int y, int width, int height, bool dither );
+    virtual void Draw( int x, int y, const lUInt8 * bitmap, int width, int height, const lUInt32 * __restrict palette );
+    virtual void DrawColorGlyph( int x, int y, const lUInt8 * bitmap, int width, int height, int pitch, const lUInt32 * __restrict palette );
+    virtual void DrawLine( int x0, int y0, int x1, int y1, lUInt32 color0, int length1=1, int length2=0, int direction=0 );
+
+    /// creates buffer recording for target (with its size and settings), to draw in bands
+    LVRecordingDrawBuf( LVDrawBuf * target, int bands );
+    virtual ~LVRecordingDrawBuf();
+};
+
+#endif
+
 #endif
 
@@ -30,6 +30,7 @@
 #include "hyphman.h"
 #include "lvdrawbuf.h"
 #include "textlang.h"
+#include "lvthread.h"
 
 #if !defined(__SYMBIAN32__) && defined(_WIN32)
 extern "C" {
@@ -37,12 +38,8 @@ extern "C" {
 }
 #endif
 
-#if USE_GLYPHCACHE_HASHTABLE==1
-#include "lvhashtable.h"
-#define GLYPHCACHE_TABLE_SZ         256
-#endif
-
 struct LVFontGlyphCacheItem;
+struct LVFontGlyphSlab;
 
 union GlyphCacheItemData {
 	lChar32 ch;
@@ -51,86 +48,97 @@ union GlyphCacheItemData {
 #endif
 };
 
-#if USE_GLYPHCACHE_HASHTABLE == 1
-inline lUInt32 getHash(GlyphCacheItemData data)
-{
-    return getHash(*((lUInt32*)&data));
-}
+/// glyph bitmaps size classes allocated from slabs (bigger ones are malloc'ed)
+#define GLYPH_SLAB_CLASS_COUNT 20
 
-// Note: this may cause some issue when building on Win32 (or anywhere lChar32
-// is not 32bits), see https://github.com/buggins/coolreader/pull/117
-inline bool operator==(GlyphCacheItemData data1, GlyphCacheItemData data2)
+/// CLOCK "recently used" flag of a cached glyph, set by lookups without the global cache lock
+struct LVFontGlyphCacheRefFlag
 {
-    return (*((lUInt32*)&data1)) == (*((lUInt32*)&data2));
-}
+#if (CR_THREAD_SAFE==1)
+    std::atomic<lUInt8> _value;
+    void set( bool v ) { _value.store( v, std::memory_order_relaxed ); }
+    bool get() const { return _value.load( std::memory_order_relaxed ) != 0; }
+#else
+    lUInt8 _value;
+    void set( bool v ) { _value = v; }
+    bool get() const { return _value != 0; }
 #endif
+};
 
+/// Limits the total size of glyphs cached by all font instances
+/**
+    Cached glyphs are kept in a CLOCK ring: cache hits only set the
+    item referenced flag, so they don't need FONT_GLYPH_CACHE_GUARD,
+    which is taken only when glyphs are added or removed.
+    Glyph items are allocated from per size class slabs.
+*/
 class LVFontGlobalGlyphCache
 {
 private:
-    LVFontGlyphCacheItem * head;
-    LVFontGlyphCacheItem * tail;
+    LVFontGlyphCacheItem ** items; // CLOCK ring
+    int count;
+    int capacity;
+    int hand;
     int size;
     int max_size;
+    LVFontGlyphSlab * slabs[GLYPH_SLAB_CLASS_COUNT]; // slabs having free chunks
     void removeNoLock( LVFontGlyphCacheItem * item );
-    void putNoLock( LVFontGlyphCacheItem * item );
+    void evictNoLock( int sz );
+    LVFontGlyphCacheItem * allocNoLock( int sz );
+    void freeNoLock( LVFontGlyphCacheItem * item );
+    void freeEmptySlabsNoLock();
 public:
-    LVFontGlobalGlyphCache( int maxSize )
-        : head(NULL), tail(NULL), size(0), max_size(maxSize )
-    {
-    }
-    ~LVFontGlobalGlyphCache()
-    {
-        clear();
-    }
+    LVFontGlobalGlyphCache( int maxSize );
+    ~LVFontGlobalGlyphCache();
+    /// allocate item (not yet cached) with room for a bitmap of specified size
+    LVFontGlyphCacheItem * alloc( int sz );
+    /// add item to cache, evicting not recently used glyphs when over max size
     void put( LVFontGlyphCacheItem * item );
+    /// remove item from cache, and free it
     void remove( LVFontGlyphCacheItem * item );
-#if USE_GLYPHCACHE_HASHTABLE != 1
-    void refresh( LVFontGlyphCacheItem * item );
-#endif
     void clear();
 };
 
+/// Glyph cache of a font instance, protected by the font instance lock
 class LVFontLocalGlyphCache
 {
 private:
     LVFontGlobalGlyphCache *global_cache;
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    LVHashTable<GlyphCacheItemData, struct LVFontGlyphCacheItem*> hashTable;
-#else
-    LVFontGlyphCacheItem * head;
-    LVFontGlyphCacheItem * tail;
-#endif
-    //int size;
+    LVMutex * owner_mutex; // lock of the font instance owning this cache
+    LVFontGlyphCacheItem ** table; // open addressing hash table, by char or glyph index
+    int table_size;
+    int count;
+    LVFontGlyphCacheItem * find( lUInt32 key );
+    void resize( int newSize );
 public:
-    LVFontLocalGlyphCache( LVFontGlobalGlyphCache * globalCache )
-    : global_cache(globalCache),
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    hashTable(GLYPHCACHE_TABLE_SZ)
-#else
-    head(NULL), tail(NULL)
-#endif
+    LVFontLocalGlyphCache( LVFontGlobalGlyphCache * globalCache, LVMutex * ownerMutex = NULL )
+    : global_cache(globalCache), owner_mutex(ownerMutex), table(NULL), table_size(0), count(0)
     {}
     ~LVFontLocalGlyphCache()
     {
         clear();
+        free( table );
     }
+    LVFontGlobalGlyphCache * getGlobalCache() { return global_cache; }
     void clear();
-    LVFontGlyphCacheItem * getByChar(lChar32 ch);
+    LVFontGlyphCacheItem * getByChar(lChar32 ch) { return find( ch ); }
     #if USE_HARFBUZZ==1
-    LVFontGlyphCacheItem * getByIndex(lUInt32 index);
+    LVFontGlyphCacheItem * getByIndex(lUInt32 index) { return find( index ); }
     #endif
     void put( LVFontGlyphCacheItem * item );
+    /// remove from table, but don't delete
     void remove( LVFontGlyphCacheItem * item );
+    /// lock owner font instance, if not used by another thread (for global cache eviction)
+    bool tryLock() { return !owner_mutex || owner_mutex->trylock(); }
+    void unlock() { if ( owner_mutex ) owner_mutex->unlock(); }
 };
 
 struct LVFontGlyphCacheItem
 {
-    LVFontGlyphCacheItem * prev_global;
-    LVFontGlyphCacheItem * next_global;
-    LVFontGlyphCacheItem * prev_local;
-    LVFontGlyphCacheItem * next_local;
     LVFontLocalGlyphCache * local_cache;
+    LVFontGlyphSlab * slab; // NULL if not allocated from a slab
+    int clock_index;        // position in global cache CLOCK ring
+    LVFontGlyphCacheRefFlag referenced;
     GlyphCacheItemData data;
     lUInt16 bmp_width;
     lUInt16 bmp_height;
@@ -143,6 +151,7 @@ struct LVFontGlyphCacheItem
     //       This is usually 16 on 64-bit and 8 otherwise (c.f., https://www.gnu.org/software/libc/manual/html_node/Aligned-Memory-Blocks.html).
     //       It's also 16 on x86 on recent glibcs (c.f., https://sourceware.org/bugzilla/show_bug.cgi?id=21120).
     //       We just use 16 everywhere, as this turned out to be mildly helpful on armv7 (c.f., https://github.com/koreader/crengine/pull/441).
+    //       (Slab chunks are multiple of 16 bytes, so this also holds for them.)
     alignas(16) lUInt8 bmp[1];
     //=======================================================================
     int getSize() const
@@ -155,54 +164,30 @@ struct LVFontGlyphCacheItem
     static LVFontGlyphCacheItem * newItem( LVFontLocalGlyphCache * local_cache, lChar32 ch, int w, int h, int pitch = 0, lUInt8 pixfmt = 1 )
     {
         if (!pitch) pitch = w * pixfmt;
-        LVFontGlyphCacheItem * item = (LVFontGlyphCacheItem *)malloc( offsetof(LVFontGlyphCacheItem, bmp)
-                                                                        + (pitch * h) );
-	if (item) {
-	    item->data.ch = ch;
-	    item->bmp_width = (lUInt16)w;
-	    item->bmp_height = (lUInt16)h;
-	    item->bmp_pitch = (lUInt16)pitch;
-	    item->bmp_pixelformat = pixfmt;
-	    item->origin_x =   0;
-	    item->origin_y =   0;
-	    item->advance =    0;
-	    item->prev_global = NULL;
-	    item->next_global = NULL;
-	    item->prev_local = NULL;
-	    item->next_local = NULL;
-	    item->local_cache = local_cache;
-        }
-        return item;
-    }
-    #if USE_HARFBUZZ==1
-    static LVFontGlyphCacheItem *newItem(LVFontLocalGlyphCache* local_cache, lUInt32 glyph_index, int w, int h, int pitch = 0, lUInt8 pixfmt = 1)
-    {
-        if (!pitch) pitch = w * pixfmt;
-        LVFontGlyphCacheItem * item = (LVFontGlyphCacheItem *)malloc( offsetof(LVFontGlyphCacheItem, bmp)
-                                                                        + (pitch * h) );
+        LVFontGlyphCacheItem * item = local_cache->getGlobalCache()->alloc( offsetof(LVFontGlyphCacheItem, bmp)
+                                                                            + (pitch * h) );
         if (item) {
-            item->data.gindex = glyph_index;
-            item->bmp_width = (lUInt16) w;
-            item->bmp_height = (lUInt16) h;
-            item->bmp_pitch = (lUInt16) pitch;
+            item->data.ch = ch;
+            item->bmp_width = (lUInt16)w;
+            item->bmp_height = (lUInt16)h;
+            item->bmp_pitch = (lUInt16)pitch;
             item->bmp_pixelformat = pixfmt;
-            item->origin_x = 0;
-            item->origin_y = 0;
-            item->advance = 0;
-            item->prev_global = NULL;
-            item->next_global = NULL;
-            item->prev_local = NULL;
-            item->next_local = NULL;
+            item->origin_x =   0;
+            item->origin_y =   0;
+            item->advance =    0;
+            item->clock_index = -1;
+            item->referenced.set(false);
             item->local_cache = local_cache;
         }
         return item;
     }
-    #endif
-    static void freeItem( LVFontGlyphCacheItem * item )
+    #if USE_HARFBUZZ==1
+    static LVFontGlyphCacheItem *newItem(LVFontLocalGlyphCache* local_cache, lUInt32 glyph_index, int w, int h, int pitch = 0, lUInt8 pixfmt = 1)
     {
-        if (item)
-            free( item );
+        // glyph_index shares its storage with ch
+        return newItem(local_cache, (lChar32)glyph_index, w, h, pitch, pixfmt);
     }
+    #endif
 };
 
 #if USE_HARFBUZZ==1
@@ -742,6 +727,17 @@ public:
 };
 
 /// font manager interface class
+/// HarfBuzz shaping cache statistics, for all font instances
+struct LVFontShapingCacheStats
+{
+    int hits;
+    int misses;
+    int evictions;
+    int items;
+    int size; // bytes
+    LVFontShapingCacheStats() : hits(0), misses(0), evictions(0), items(0), size(0) { }
+};
+
 class LVFontManager
 {
 protected:
@@ -769,6 +765,11 @@ public:
     virtual LVFontRef GetFallbackFont(int /*size*/) { return LVFontRef(); }
     /// returns fallback font for specified size, weight and italic
     virtual LVFontRef GetFallbackFont(int size, int weight=400, bool italic=false, lString8 forFaceName=lString8::empty_str ) { return LVFontRef(); }
+    /// sets file used to remember faces found in font files, and loads it: RegisterFont()
+    /// then only opens font files that are new or modified since they were last scanned
+    virtual bool SetFontRegistryIndexFile( lString8 /*fileName*/ ) { return false; }
+    /// writes font registry index file if it was changed (also done when font manager is destroyed)
+    virtual bool SaveFontRegistryIndex() { return false; }
     /// registers font by name
     virtual bool RegisterFont( lString8 name ) = 0;
     /// registers font by name and face
@@ -788,6 +789,10 @@ public:
     virtual lUInt32 GetFontListHash(int /*documentId*/) { return 0; }
     /// clear glyph cache
     virtual void clearGlyphCache() { }
+    /// get HarfBuzz shaping cache statistics
+    virtual void getShapingCacheStats( LVFontShapingCacheStats & stats ) { stats = LVFontShapingCacheStats(); }
+    /// reset HarfBuzz shaping cache hits, misses and evictions counters
+    virtual void resetShapingCacheStats() { }
 
     /// get antialiasing mode
     virtual int GetAntialiasMode() { return _antialiasMode; }
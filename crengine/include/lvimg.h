@@ -63,6 +63,10 @@ public:
     virtual bool OnLineDecoded( LVImageSource * obj, int y, lUInt32 * __restrict data ) = 0;
     virtual void OnEndDecode( LVImageSource * obj, bool errors ) = 0;
     virtual bool GetTargetSize(int & width, int & height) const { return false; };
+    /// called before OnStartDecode() by raster decoders able to shrink while decoding,
+    /// when GetTargetSize() asks for less than the image size: lines will then be
+    /// width x height (never smaller than the target) - return false to get full size lines
+    virtual bool OnScaledDecode( LVImageSource * obj, int width, int height ) { return false; }
 };
 
 struct CR9PatchInfo {
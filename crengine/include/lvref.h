@@ -41,7 +41,7 @@ extern ldomMemManStorage * pmsREF;
 */
 class ref_count_rec_t {
 public:
-    int _refcount;
+    lvref_counter_t _refcount;
     void * _obj;
     static ref_count_rec_t null_ref;
     static ref_count_rec_t protected_null_ref;
@@ -66,7 +66,7 @@ public:
 /// sample ref counter implementation for LVFastRef
 class LVRefCounter
 {
-    int refCount;
+    lvref_counter_t refCount;
 public:
     LVRefCounter() : refCount(0) { }
     void AddRef() { refCount++; }
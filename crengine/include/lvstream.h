@@ -281,6 +281,11 @@ public:
     /// calculate crc32 code for stream, returns 0 for error or empty stream
     inline lUInt32 getcrc32() { lUInt32 res = 0; getcrc32( res ); return res; }
 
+    /// calculate fast content fingerprint for stream (xxHash of size, head, tail and sampled blocks), if possible
+    virtual lverror_t getFingerprint( lUInt64 & dst );
+    /// calculate fast content fingerprint for stream, returns 0 for error
+    inline lUInt64 getFingerprint() { lUInt64 res = 0; getFingerprint( res ); return res; }
+
     /// set write bytes limit to call flush(true) automatically after writing of each sz bytes
     virtual void setAutoSyncSize(lvsize_t /*sz*/) { }
 
@@ -438,6 +443,7 @@ protected:
     lvopen_mode_t          m_mode;
     lUInt32 _crc;
     bool _crcFailed;
+    lUInt64 _fingerprint;
     lvsize_t _autosyncLimit;
     lvsize_t _bytesWritten;
     virtual void handleAutoSync(lvsize_t bytesWritten) {
@@ -449,9 +455,11 @@ protected:
             _bytesWritten = 0;
         }
     }
+    /// fingerprint of file stream, remembered by file path, size and modification time
+    lverror_t getFileFingerprint( lUInt64 & dst );
 
 public:
-    LVNamedStream() : m_mode(LVOM_ERROR), _crc(0), _crcFailed(false), _autosyncLimit(0), _bytesWritten(0) { }
+    LVNamedStream() : m_mode(LVOM_ERROR), _crc(0), _crcFailed(false), _fingerprint(0), _autosyncLimit(0), _bytesWritten(0) { }
     /// set write bytes limit to call flush(true) automatically after writing of each sz bytes
     virtual void setAutoSyncSize(lvsize_t sz) { _autosyncLimit = sz; }
     /// returns stream/container name, may be NULL if unknown
@@ -465,6 +473,8 @@ public:
     }
     /// calculate crc32 code for stream, if possible
     virtual lverror_t getcrc32( lUInt32 & dst );
+    /// calculate fast content fingerprint for stream, if possible
+    virtual lverror_t getFingerprint( lUInt64 & dst );
 };
 
 
@@ -889,6 +899,8 @@ bool LVDeleteDirectory( lString8 filename );
 bool LVRenameFile(lString32 oldname, lString32 newname);
 /// rename file
 bool LVRenameFile(lString8 oldname, lString8 newname);
+/// get file size and last modification time (seconds since epoch), returns false if file is not found
+bool LVGetFileStat(const lString8 & pathName, lUInt64 & size, lUInt64 & mtime);
 
 /// copies content of in stream to out stream
 lvsize_t LVPumpStream( LVStreamRef out, LVStreamRef in );
@@ -354,7 +354,7 @@ private:
     };
     lInt32 size;   // 0 for free chunk
     lInt32 len;    // count of chars in string
-    int nref;      // reference counter
+    lvref_counter_t nref; // reference counter
 
     lstring_chunk_t() {}
 
@@ -1224,6 +1224,13 @@ lString32 Utf8ToUnicode( const lString8 & str );
 lString32 Utf8ToUnicode( const char * s );
 /// converts utf-8 string fragment to wide unicode string
 lString32 Utf8ToUnicode( const char * s, int sz );
+/// returns number of chars in utf-8 string fragment
+int Utf8CharCount( const lChar8 * str, int len );
+/// converts utf-8 string fragment to wide unicode string, into dst, reusing its buffer when not shared
+void Utf8ToUnicode( const char * s, int sz, lString32 & dst );
+/// decodes count chars from char index start of utf-8 string fragment, as Utf8ToUnicode() would
+/// (the fragment must have at least start+count chars, see Utf8CharCount())
+void Utf8DecodeChars( const lChar8 * s, int start, lChar32 * dst, int count );
 /// converts utf-8 string fragment to wide unicode string
 void Utf8ToUnicode(const lUInt8 * src,  int &srclen, lChar32 * dst, int &dstlen);
 /// decodes path like "file%20name" to "file name"
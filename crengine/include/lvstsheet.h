@@ -173,6 +173,8 @@ public:
     bool checkNextRules( const ldomNode * node, bool allow_cache=true ) const;
     /// Some selector rule types do the full rules chain check themselves
     bool isFullChecking() const { return _type == cssrt_ancessor || _type == cssrt_predsibling; }
+    /// key of the id, class or attribute name this rule requires on the node, 0 if none
+    lUInt32 getBucketKey() const;
     lUInt32 getHash() const;
     lUInt32 getWeight() const;
 };
@@ -205,6 +207,8 @@ public:
     lUInt16 getElementNameId() const { return _id; }
     bool check( const ldomNode * node, bool allow_cache=true ) const;
     bool quickClassCheck(const lUInt32 *classHashes, size_t size) const;
+    /// key of the id, class or attribute name required by the first rule, 0 if none (see LVStyleSheet::apply())
+    lUInt32 getBucketKey() const;
     void applyToPseudoElement( const ldomNode * node, css_style_rec_t * style ) const;
     void apply( const ldomNode * node, css_style_rec_t * style ) const
     {
@@ -294,6 +298,19 @@ private:
 
     void set(LVPtrVector<LVCssSelector> & v );
 
+    // Selectors of each _selectors chain bucketed by getBucketKey(), so that
+    // apply() only checks the ones that may match a node. Built on first
+    // apply(), dropped on any change of _selectors.
+    struct SelectorIndex;
+    mutable SelectorIndex * _index;
+    const SelectorIndex * getIndex() const;
+    void dropIndex();
+    // selector matching statistics
+    mutable lUInt32 _styled_nodes_count;
+    mutable lUInt32 _tested_selectors_count;
+    // no assignment (would share _index)
+    LVStyleSheet & operator = ( const LVStyleSheet & );
+
     LVArray<LVFontFaceDecl> _fontFaceDecls;
     // Off by default. Two distinct consumers opt a given LVStyleSheet
     // instance in:
@@ -347,6 +364,7 @@ public:
 
     /// remove all rules from stylesheet
     void clear() {
+        dropIndex();
         _selector_count = 0;
         _selector_count_stack.clear();
         _selectors.clear();
@@ -356,9 +374,12 @@ public:
     /// set document to retrieve ID values from
     void setDocument( lxmlDocBase * doc ) { _doc = doc; }
     /// constructor
-    LVStyleSheet( lxmlDocBase * doc=NULL, bool nested=false ) : _doc(doc) , _nested(nested) , _selector_count(0) { }
+    LVStyleSheet( lxmlDocBase * doc=NULL, bool nested=false ) : _doc(doc) , _nested(nested) , _selector_count(0)
+        , _index(NULL), _styled_nodes_count(0), _tested_selectors_count(0) { }
     /// copy constructor
     LVStyleSheet( LVStyleSheet & sheet );
+    /// destructor
+    ~LVStyleSheet() { dropIndex(); }
     /// parse stylesheet, compile and add found rules to sheet
     bool parseAndAdvance( const char * &str, bool useragent_sheet=false, lString32 codeBase=lString32::empty_str );
     bool parse( const char * str, bool useragent_sheet=false, lString32 codeBase=lString32::empty_str ) {
@@ -368,6 +389,15 @@ public:
     }
     /// apply stylesheet to node style
     void apply( const ldomNode * node, css_style_rec_t * style ) const;
+    /// number of nodes styled, and of selectors checked against them, since last reset
+    void getApplyStats( lUInt32 & nodes, lUInt32 & selectors ) const {
+        nodes = _styled_nodes_count;
+        selectors = _tested_selectors_count;
+    }
+    void resetApplyStats() {
+        _styled_nodes_count = 0;
+        _tested_selectors_count = 0;
+    }
     /// calculate hash
     lUInt32 getHash() const;
     void merge(const LVStyleSheet &other);
@@ -130,7 +130,7 @@ enum css_style_rec_important_bit {
 */
 typedef struct css_style_rec_tag css_style_rec_t;
 struct css_style_rec_tag {
-    int                  refCount; // for reference counting
+    lvref_counter_t      refCount; // for reference counting
     lUInt32              hash; // cache calculated hash value here
     lUInt32              important[NB_IMP_SLOTS];  // bitmap for !important (used only by LVCssDeclaration)
     lUInt32              importance[NB_IMP_SLOTS]; // bitmap for important bit's importance/origin
@@ -22,6 +22,7 @@
 
 #if defined(_LINUX)
 #include <pthread.h>
+#include <time.h>
 
 class LVThread {
 private:
@@ -69,13 +70,20 @@ public:
 };
 
 class LVMutex {
+    friend class LVCondition;
 private:
     pthread_mutex_t _mutex;
     bool _valid;
 public:
     LVMutex()
     {
-        _valid = ( pthread_mutex_init(&_mutex, NULL) !=0 );
+        // recursive, like the win32 mutex: LVDocView methods holding
+        // the view mutex call each other
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init( &attr );
+        pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+        _valid = ( pthread_mutex_init(&_mutex, &attr) == 0 );
+        pthread_mutexattr_destroy( &attr );
     }
     ~LVMutex()
     {
@@ -101,6 +109,54 @@ public:
     }
 };
 
+/// condition variable, to be used with a locked LVMutex
+class LVCondition {
+private:
+    pthread_cond_t _cond;
+    bool _valid;
+public:
+    LVCondition()
+    {
+        _valid = ( pthread_cond_init(&_cond, NULL) == 0 );
+    }
+    ~LVCondition()
+    {
+        if ( _valid )
+            pthread_cond_destroy( &_cond );
+    }
+    /// unlock mutex, wait for notification, lock mutex again
+    void wait( LVMutex & mutex )
+    {
+        if ( _valid && mutex._valid )
+            pthread_cond_wait( &_cond, &mutex._mutex );
+    }
+    /// same as wait(), but returns false if not notified in timeoutMillis
+    bool wait( LVMutex & mutex, int timeoutMillis )
+    {
+        if ( !_valid || !mutex._valid )
+            return false;
+        timespec ts;
+        clock_gettime( CLOCK_REALTIME, &ts );
+        ts.tv_sec += timeoutMillis / 1000;
+        ts.tv_nsec += (long)(timeoutMillis % 1000) * 1000000;
+        if ( ts.tv_nsec >= 1000000000 ) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        return pthread_cond_timedwait( &_cond, &mutex._mutex, &ts ) == 0;
+    }
+    void notify()
+    {
+        if ( _valid )
+            pthread_cond_signal( &_cond );
+    }
+    void notifyAll()
+    {
+        if ( _valid )
+            pthread_cond_broadcast( &_cond );
+    }
+};
+
 #elif defined(_WIN32)
 
 class LVThread {
@@ -154,41 +210,66 @@ class LVThread {
 };
 
 class LVMutex {
+    friend class LVCondition;
     private:
-        HANDLE _mutex;
-        bool _valid;
+        // (a critical section, rather than a mutex handle, for LVCondition:
+        // recursive too, LVDocView methods holding the view mutex call each other)
+        CRITICAL_SECTION _cs;
     public:
         LVMutex()
         {
-            _mutex = CreateMutex( NULL, FALSE, NULL );
-            _valid = (_mutex != NULL);
+            InitializeCriticalSection( &_cs );
         }
         ~LVMutex()
         {
-            if ( _valid )
-                CloseHandle( _mutex );
+            DeleteCriticalSection( &_cs );
         }
         bool lock()
         {
-            if ( _valid ) {
-                return WaitForSingleObject( _mutex, INFINITE ) == WAIT_OBJECT_0;
-            }
-            return false;
+            EnterCriticalSection( &_cs );
+            return true;
         }
         bool trylock()
         {
-            if ( _valid ){
-                return WaitForSingleObject( _mutex, 0 ) == WAIT_OBJECT_0;
-            }
-            return false;
+            return TryEnterCriticalSection( &_cs ) != 0;
         }
         void unlock()
         {
-            if ( _valid )
-                ReleaseMutex( _mutex );
+            LeaveCriticalSection( &_cs );
         }
 };
 
+/// condition variable, to be used with a locked LVMutex
+class LVCondition {
+    private:
+        CONDITION_VARIABLE _cond;
+    public:
+        LVCondition()
+        {
+            InitializeConditionVariable( &_cond );
+        }
+        ~LVCondition()
+        {
+        }
+        /// unlock mutex, wait for notification, lock mutex again
+        void wait( LVMutex & mutex )
+        {
+            SleepConditionVariableCS( &_cond, &mutex._cs, INFINITE );
+        }
+        /// same as wait(), but returns false if not notified in timeoutMillis
+        bool wait( LVMutex & mutex, int timeoutMillis )
+        {
+            return SleepConditionVariableCS( &_cond, &mutex._cs, (DWORD)timeoutMillis ) != 0;
+        }
+        void notify()
+        {
+            WakeConditionVariable( &_cond );
+        }
+        void notifyAll()
+        {
+            WakeAllConditionVariable( &_cond );
+        }
+};
 
 #endif
 
@@ -242,6 +323,29 @@ class LVMutex {
         }
 };
 
+class LVCondition {
+    public:
+        LVCondition()
+        {
+        }
+        ~LVCondition()
+        {
+        }
+        void wait( LVMutex & )
+        {
+        }
+        bool wait( LVMutex &, int )
+        {
+            return true;
+        }
+        void notify()
+        {
+        }
+        void notifyAll()
+        {
+        }
+};
+
 #endif
 
 class LVLock {
@@ -113,6 +113,7 @@ extern const int gDOMVersionCurrent;
 #define DOC_PROP_FILE_FORMAT     "doc.file.format"
 #define DOC_PROP_FILE_FORMAT_ID  "doc.file.format.id"
 #define DOC_PROP_FILE_CRC32      "doc.file.crc32"
+#define DOC_PROP_FILE_FINGERPRINT "doc.file.fingerprint"
 #define DOC_PROP_CODE_BASE       "doc.file.code.base"
 #define DOC_PROP_COVER_FILE      "doc.cover.file"
 
@@ -121,6 +122,7 @@ extern const int gDOMVersionCurrent;
 #define DEF_UNUSED_SPACE_THRESHOLD_PERCENT 5
 #define DEF_MAX_ADDED_LETTER_SPACING_PERCENT 0
 #define DEF_CJK_WIDTH_SCALE_PERCENT 100
+#define DEF_LAYOUT_PROFILES_MAX_SIZE 0x1000000 // 16MB for all layout profiles of a document
 
 #define NODE_DISPLAY_STYLE_HASH_UNINITIALIZED 0xFFFFFFFF
 
@@ -308,6 +310,8 @@ public:
     virtual void OnFormatProgress(int /*percent*/) { }
     /// document fully loaded and rendered (follows OnFormatEnd(), or OnLoadFileEnd() when loaded from cache)
     virtual void OnDocumentReady() { }
+    /// progressive rendering finished: the whole document is rendered, page numbers are final
+    virtual void OnPageNumbersFinal() { }
     /// format progress, called with values 0..100
     virtual void OnExportProgress(int /*percent*/) { }
     /// Override to handle external links
@@ -336,6 +340,7 @@ public:
 
 
 class ldomTextStorageChunk;
+class ldomTextView;
 class ldomTextStorageChunkBuilder;
 struct ElementDataStorageItem;
 class CacheFile;
@@ -401,6 +406,8 @@ public:
     lString8 getText( lUInt32 address );
     /// get pointer to text data
     TextDataStorageItem * getTextItem( lUInt32 addr );
+    /// set view to text by address, pinning its chunk
+    void getTextView( lUInt32 address, ldomTextView & view );
     /// get pointer to element data
     ElementDataStorageItem * getElem( lUInt32 addr );
     /// change node's parent, returns true if modified
@@ -433,6 +440,7 @@ public:
 class ldomTextStorageChunk
 {
     friend class ldomDataStorageManager;
+    friend class ldomTextView;
     ldomDataStorageManager * _manager;
     ldomTextStorageChunk * _nextRecent;
     ldomTextStorageChunk * _prevRecent;
@@ -442,6 +450,7 @@ class ldomTextStorageChunk
     lUInt16 _index;  /// ? index of chunk in storage
     char _type;       /// type, to show in log
     bool _saved;
+    int _pinCount;    /// number of ldomTextView using _buf: don't swap it out
 
     void setunpacked( const lUInt8 * buf, int bufsize );
     /// pack data, and remove unpacked
@@ -492,6 +501,54 @@ public:
     ~ldomTextStorageChunk();
 };
 
+/// read-only view over text node utf8 text, without copying it
+/**
+    Keeps storage chunk of persistent text node pinned in memory, so it is not
+    swapped out by compact() while the view is alive. View must not outlive
+    its document, and text nodes must not be modified while it is alive.
+*/
+class ldomTextView
+{
+    friend struct ldomNode;
+    friend class ldomDataStorageManager;
+    ldomTextStorageChunk * _chunk;
+    const lChar8 * _text;
+    int _len;
+    lString8 _holder; /// text of mutable (NT_TEXT) node
+    void set( ldomTextStorageChunk * chunk, const lChar8 * text, int len )
+    {
+        reset();
+        _chunk = chunk;
+        _text = text;
+        _len = len;
+        if ( _chunk )
+            _chunk->_pinCount++;
+    }
+    // non copyable
+    ldomTextView( const ldomTextView & );
+    ldomTextView & operator = ( const ldomTextView & );
+public:
+    ldomTextView() : _chunk(NULL), _text(NULL), _len(0) { }
+    ~ldomTextView() { reset(); }
+    /// release text, unpin chunk
+    void reset()
+    {
+        if ( _chunk )
+            _chunk->_pinCount--;
+        _chunk = NULL;
+        _text = NULL;
+        _len = 0;
+        _holder.clear();
+    }
+    /// utf8 text, not zero terminated
+    const lChar8 * data() const { return _text; }
+    /// utf8 text length, bytes
+    int length() const { return _len; }
+    bool empty() const { return _len == 0; }
+    /// decodes text to dst, reusing dst buffer
+    void decode( lString32 & dst ) const { Utf8ToUnicode( _text, _len, dst ); }
+};
+
 // forward declaration
 struct ldomNode;
 
@@ -781,6 +838,8 @@ public:
     void invalidateCacheFile() { _cacheFileLeaveAsDirty = true; }
     /// get cache file full path
     lString32 getCacheFilePath();
+    /// wait for cache file writes queued by swapToCache() and updateMap() to be done
+    ContinuousOperationResult waitCacheWrites( CRTimerUtil & maxTime );
 #endif
 
     /// minimize memory consumption
@@ -869,6 +928,8 @@ public:
 
     void push();
     void clear();
+    /// forget local changes, so they are not saved into the node
+    void discardChanges() { _modified = false; }
     RenderRectAccessor( ldomNode * node );
     ~RenderRectAccessor();
 };
@@ -1018,6 +1079,12 @@ public:
     inline lString32 getEffectiveText() const {
         return (getNodeId() == 1) ? getCloneNodeSource()->getText() : getText();
     }
+    inline void getEffectiveText( lString32 & dst ) const {
+        if ( getNodeId() == 1 )
+            getCloneNodeSource()->getText( dst );
+        else
+            getText( dst );
+    }
     inline lUInt16 getEffectiveNodeId() const {
         return (getNodeId() == 1) ? getCloneNodeSource()->getNodeId() : getNodeId();
     }
@@ -1191,6 +1258,10 @@ public:
     lString32 getText( lChar32 blockDelimiter = 0, int maxSize=0 ) const;
     /// returns text node text as utf8 string
     lString8 getText8( lChar8 blockDelimiter = 0, int maxSize=0 ) const;
+    /// returns text node text into dst, reusing dst buffer (element text is gathered as with getText())
+    void getText( lString32 & dst ) const;
+    /// sets view to text node utf8 text, without copying it
+    void getTextView( ldomTextView & view ) const;
     /// sets text node text as wide string
     void setText( lString32 );
     /// sets text node text as utf8 string
@@ -2431,6 +2502,10 @@ public:
     bool serialize( SerialBuf & buf );
     /// deserialize from byte array (pointer will be incremented by number of bytes read)
     bool deserialize( ldomDocument * doc, SerialBuf & buf );
+    /// serialize page numbers only, for a layout profile
+    void serializePages( SerialBuf & buf );
+    /// deserialize page numbers only, returns false if TOC structure doesn't match
+    bool deserializePages( SerialBuf & buf );
     /// get page number
     int getPage() { return _page; }
     /// get position percent * 100
@@ -2546,6 +2621,10 @@ public:
     bool serialize( SerialBuf & buf );
     /// deserialize from byte array (pointer will be incremented by number of bytes read)
     bool deserialize( ldomDocument * doc, SerialBuf & buf );
+    /// serialize page info only, for a layout profile
+    void serializePages( SerialBuf & buf );
+    /// deserialize page info only, returns false if page map doesn't match
+    bool deserializePages( SerialBuf & buf );
     /// returns child node count
     int getChildCount() const { return _children.length(); }
     /// returns child node by index
@@ -2674,6 +2753,69 @@ public:
     }
 };
 
+#if BUILD_LITE!=1
+/// vertical extent of a rendered final block, in absolute document coordinates
+struct ldomFinalBlockPos {
+    lInt32 top;        // box top
+    lInt32 bottom;     // box bottom, including its bottom overflow
+    lUInt32 dataIndex; // final node data index
+};
+
+/// memoized getRenderedWidths() content widths of an element (before its own
+/// margins, borders and paddings), with the context they were measured in
+struct ldomRenderedWidths {
+    lUInt32 renderingHash; // _doc_rendering_hash when measured, 0 if none
+    lInt32 rendFlags;
+    lInt32 direction;
+    lInt32 maxWidth;
+    lInt32 minWidth;
+};
+
+/// index entry of a layout rendered with other settings, saved in the cache file
+struct ldomLayoutProfileInfo {
+    lUInt32 renderingHash; // DocFileHeader::getRenderingHash() of the layout
+    lUInt32 size;          // serialized size, bytes
+    lUInt32 lastUsed;      // use counter when last saved or restored, for LRU eviction
+    lUInt32 slot;          // index of its cache file block
+};
+
+/// full-text search prefilter: trigram signatures of groups of consecutive text nodes
+/**
+    Text nodes are gathered, by text node index (dataIndex>>4), into groups of
+    about TEXT_SEARCH_INDEX_GROUP_CHARS chars. Each group gets a bit set of the
+    hashes of the lowercased trigrams of its text nodes (soft hyphens skipped,
+    not crossing node boundaries). A text node may contain a match only if
+    its group has all the trigrams of the searched text.
+    Nodes never added (or added again after their group was closed) are
+    always candidates.
+*/
+class ldomTextSearchIndex
+{
+    LVArray<lUInt32> _groupFirst; // first text node index of each group
+    LVArray<lUInt8> _bits;        // trigram bit sets, TEXT_SEARCH_INDEX_GROUP_BYTES per group
+    LVArray<lUInt32> _extra;      // sorted text node indexes added out of order: not indexed
+    lUInt32 _lastTextIndex;       // highest text node index added
+    int _groupChars;              // number of chars in last group
+    bool _modified;               // not saved to cache file
+    lString32 _buf;               // decoding buffer
+public:
+    ldomTextSearchIndex();
+    /// add text node utf8 text (decoded just like ldomNode::getText() does)
+    void addText( lUInt32 textIndex, const lChar8 * text, int len );
+    /// returns true if index has no group
+    bool empty() const { return _groupFirst.empty(); }
+    bool isModified() const { return _modified; }
+    void setModified( bool modified ) { _modified = modified; }
+    /// returns false if none of the literals is long enough to use the index,
+    /// otherwise sets candidates flag for each group
+    bool getCandidates( const lString32Collection & literals, LVArray<lUInt8> & candidates );
+    /// returns true if text node may contain a match, per getCandidates() result
+    bool mayContain( const LVArray<lUInt8> & candidates, lUInt32 textIndex ) const;
+    void serialize( SerialBuf & buf );
+    bool deserialize( SerialBuf & buf );
+};
+#endif
+
 class ldomDocument : public lxmlDocBase
 {
     friend class ldomDocumentWriter;
@@ -2707,6 +2849,51 @@ private:
     // mapping of DocFragment node dataIndex to the _doc_rendering_hash that this docFragment is currently rendered for
     LVHashTable<lUInt32, lUInt32> _rendered_fragments;
     LVRendPageList * _doc_pages; // pointer to LVDocView's m_pages
+    // Progressive rendering: partial rerendering of any document with fragments
+    // found by findRerenderingFragmentsParent(), all of them rendered by LVDocView
+    bool _progressive_rendering;
+    lUInt32 _rerendering_fragments_parent; // dataIndex of the fragments parent node
+    LVArray<lUInt32> _rerendering_fragments; // fragments dataIndex, in document order
+    ldomNode * findRerenderingFragmentsParent( bool docfragments_only );
+    bool isRerenderingFragmentsPathUsable( ldomNode * parent );
+    void initRerenderingFragmentsPathStyles();
+    void startPartialRerendering( ldomNode * parent );
+
+    // Final blocks y index: all erm_final nodes (not those embedded in another
+    // final node) in document order, saved in the cache file after the pages.
+    LVArray<ldomFinalBlockPos> _finalBlocks;
+    LVArray<lInt32> _finalBlocksEdges;     // sorted distinct tops and bottoms
+    bool _finalBlocksValid;
+    bool checkFinalBlockIndex();
+    void buildFinalBlockIndex();
+    void updateFinalBlockIndexLookups();
+    void serializeFinalBlockIndex( SerialBuf & buf );
+    bool deserializeFinalBlockIndex( SerialBuf & buf );
+
+    // getRenderedWidths() content widths by element index, in chunks allocated
+    // on demand (not saved): dropped on full rendering, and for an element and
+    // its parents when its style, font, rendering method, text or children change
+    LVArray<ldomRenderedWidths*> _renderedWidths;
+
+    // Full-text search index, optional: built while parsing, or on first
+    // search, saved in the cache file
+    bool _textSearchIndexEnabled;
+    ldomTextSearchIndex * _textSearchIndex;
+
+    // Layout profiles: layouts rendered with other settings, saved in the cache
+    // file when re-rendering, and restored instead of formatting the document
+    // again when switching back to these settings
+    int _layoutProfilesMaxCount;
+    int _layoutProfilesMaxSize;
+    bool _layoutProfilesLoaded;
+    lUInt32 _layoutProfilesUseCounter;
+    LVArray<ldomLayoutProfileInfo> _layoutProfiles;
+    bool loadLayoutProfilesIndex();
+    bool saveLayoutProfilesIndex();
+    int findLayoutProfile( lUInt32 renderingHash );
+    void removeLayoutProfile( int index );
+    bool saveLayoutProfile();
+    bool restoreLayoutProfile( LVRendPageList * pages );
 #endif
 
     lString32 _docStylesheetFileName;
@@ -2931,6 +3118,23 @@ public:
         return rerendering_delayed;
     }
     bool partialRender( ldomNode * node );
+    /// true if node is a fragment that can be partially rerendered
+    bool isRerenderingFragment( ldomNode * node ) {
+        lUInt32 hash;
+        return _partial_rerendering_enabled && _rendered_fragments.get(node->getDataIndex(), hash);
+    }
+
+    // Support for progressive rendering (partial rerendering of any document made of
+    // fragments starting on a new page, with fragments not yet rerendered done when
+    // the frontend is idle)
+    bool enableProgressiveRendering( bool enable );
+    bool isProgressiveRenderingEnabled() {
+        return _progressive_rendering;
+    }
+    /// returns number of fragments not yet rerendered for the current rendering settings
+    int getPendingFragmentsCount();
+    /// rerender pending fragments, starting from the one containing node and going forward, then backward
+    ContinuousOperationResult renderPendingFragments( ldomNode * node, CRTimerUtil & maxTime );
 #endif
     /// create xpointer from pointer string
     ldomXPointer createXPointer( const lString32 & xPointerStr );
@@ -2959,6 +3163,30 @@ public:
 #if BUILD_LITE!=1
     /// create xpointer from doc point
     ldomXPointer createXPointer( lvPoint pt, int direction=PT_DIR_EXACT, bool strictBounds=false, ldomNode * from_node=NULL );
+    /// get memoized getRenderedWidths() content widths of element, returns false if none for current rendering
+    bool getRenderedWidths( ldomNode * node, int direction, int rendFlags, int & maxWidth, int & minWidth );
+    /// memoize getRenderedWidths() content widths of element for current rendering
+    void setRenderedWidths( ldomNode * node, int direction, int rendFlags, int maxWidth, int minWidth );
+    /// drop memoized getRenderedWidths() content widths of element and its parents (its subtree changed)
+    void dropRenderedWidths( ldomNode * node );
+    /// drop all memoized getRenderedWidths() content widths
+    void clearRenderedWidths();
+    /// get the next y (before or after y) where createXPointer(lvPoint(x, y), PT_DIR_SCAN_*) may
+    /// resolve differently than at y: the closest final block top or bottom (y-1 or y+1 if unknown)
+    int getFinalBlockScanY( int y, bool forward );
+    /// enable full-text search index (call before loading document)
+    void setTextSearchIndexEnabled( bool enabled );
+    bool isTextSearchIndexEnabled() { return _textSearchIndexEnabled; }
+    /// returns full-text search index, building it if needed, NULL if disabled
+    ldomTextSearchIndex * getTextSearchIndex();
+    /// keep up to maxCount layouts rendered with other settings in the cache file, using at most maxSize bytes (0: disabled)
+    void setLayoutProfilesLimits( int maxCount, int maxSize );
+    /// returns number of layout profiles saved in the cache file
+    int getLayoutProfilesCount() { return loadLayoutProfilesIndex() ? _layoutProfiles.length() : 0; }
+    /// called on text node creation, to add it to search index
+    void onTextNodeAdded( ldomNode * node, const lString8 & text );
+    /// called when text node is modified: drop search index, to be rebuilt
+    void onTextNodeModified();
     /// get rendered block cache object
     CVRendBlockCache & getRendBlockCache() { return _renderedBlockCache; }
 
@@ -3293,6 +3521,10 @@ public:
     static LVStreamRef openExisting( lString32 filename, lUInt32 crc, lUInt32 docFlags, lString32 &cachePath );
     /// create new cache file
     static LVStreamRef createNew( lString32 filename, lUInt32 crc, lUInt32 docFlags, lUInt32 fileSize, lString32 &cachePath );
+    /// open existing cache file stream, by content fingerprint (see LVStream::getFingerprint())
+    static LVStreamRef openExisting( lString32 filename, lUInt64 fingerprint, lUInt32 docFlags, lString32 &cachePath );
+    /// create new cache file, by content fingerprint (see LVStream::getFingerprint())
+    static LVStreamRef createNew( lString32 filename, lUInt64 fingerprint, lUInt32 docFlags, lUInt32 fileSize, lString32 &cachePath );
     /// init document cache
     static bool init( lString32 cacheDir, lvsize_t maxSize );
     /// close document cache manager
@@ -3307,12 +3539,19 @@ public:
 /// unit test for DOM
 void runTinyDomUnitTests();
 
-/// pass true to enable CRC check for
+/// pass true to check CRCs of all cache file blocks when opening it (each block is checked on its first read anyway)
 void enableCacheFileContentsValidation(bool enable);
 
 /// pass false to not compress data in cache files
 void compressCachedData(bool enable);
 
+/// pass true to identify documents in cache by a fast sampled content fingerprint
+// (LVStream::getFingerprint(), DOC_PROP_FILE_FINGERPRINT) instead of the CRC32
+// of the whole file, which is then not computed (DOC_PROP_FILE_CRC32 is 0)
+void useFileFingerprintAsCacheKey(bool enable);
+/// returns true if documents are identified in cache by content fingerprint
+bool isFileFingerprintUsedAsCacheKey();
+
 /// increase the 4 hardcoded TEXT_CACHE_UNPACKED_SPACE, ELEM_CACHE_UNPACKED_SPACE,
 // RECT_CACHE_UNPACKED_SPACE and STYLE_CACHE_UNPACKED_SPACE by this factor
 void setStorageMaxUncompressedSizeFactor(float factor);
@@ -37,6 +37,27 @@ typedef unsigned char lUInt8;       ///< unsigned 8 bit int
 typedef char32_t lChar32;           ///< 32 bit char
 typedef char lChar8;                ///< 8 bit char
 
+#if (CR_THREAD_SAFE==1)
+#include <atomic>
+/// reference counter type: atomic in thread safe builds (copyable, unlike std::atomic)
+class lvref_counter_t {
+    std::atomic<int> _value;
+public:
+    lvref_counter_t( int value = 0 ) : _value(value) { }
+    lvref_counter_t( const lvref_counter_t & v ) : _value(v._value.load()) { }
+    lvref_counter_t & operator = ( const lvref_counter_t & v ) { _value = v._value.load(); return *this; }
+    int operator ++ () { return ++_value; }
+    int operator ++ (int) { return _value++; }
+    int operator -- () { return --_value; }
+    int operator -- (int) { return _value--; }
+    int operator += ( int v ) { return _value += v; }
+    int operator -= ( int v ) { return _value -= v; }
+    operator int () const { return _value; }
+};
+#else
+typedef int lvref_counter_t;
+#endif
+
 #if defined(_WIN32) && !defined(CYGWIN)
 typedef __int64 lInt64;             ///< signed 64 bit int
 typedef unsigned __int64 lUInt64;   ///< unsigned 64 bit int
@@ -2,31 +2,41 @@
 #include "crconcurrent.h"
 #include "lvptrvec.h"
 #include "lvstring.h"
+#include "lvthread.h"
+
+#if (CR_THREAD_SAFE==1)
 
 CRMutex * _refMutex = NULL;
-CRMutex * _fontMutex = NULL;
 CRMutex * _fontManMutex = NULL;
 CRMutex * _fontGlyphCacheMutex = NULL;
-CRMutex * _fontLocalGlyphCacheMutex = NULL;
+CRMutex * _imageBitmapCacheMutex = NULL;
 CRMutex * _crengineMutex = NULL;
 
+/// built-in (recursive) mutex, used when no concurrency provider is set
+class CRDefaultMutex : public CRMutex {
+    LVMutex _mutex;
+public:
+    virtual void acquire() { _mutex.lock(); }
+    virtual void release() { _mutex.unlock(); }
+};
+
+static CRMutex * createEngineMutex() {
+    if (concurrencyProvider)
+        return concurrencyProvider->createMutex();
+    return new CRDefaultMutex();
+}
+
 void CRSetupEngineConcurrency() {
-    if (!concurrencyProvider) {
-    	CRLog::error("CRSetupEngineConcurrency() : No concurrency provider is set");
-        return;
-    }
     if (!_refMutex)
-        _refMutex = concurrencyProvider->createMutex();
-    if (!_fontMutex)
-        _fontMutex = concurrencyProvider->createMutex();
+        _refMutex = createEngineMutex();
     if (!_fontManMutex)
-        _fontManMutex = concurrencyProvider->createMutex();
+        _fontManMutex = createEngineMutex();
     if (!_fontGlyphCacheMutex)
-        _fontGlyphCacheMutex = concurrencyProvider->createMutex();
-    if (!_fontLocalGlyphCacheMutex)
-        _fontLocalGlyphCacheMutex = concurrencyProvider->createMutex();
+        _fontGlyphCacheMutex = createEngineMutex();
+    if (!_imageBitmapCacheMutex)
+        _imageBitmapCacheMutex = createEngineMutex();
     if (!_crengineMutex)
-    	_crengineMutex = concurrencyProvider->createMutex();
+    	_crengineMutex = createEngineMutex();
 }
 
 CRConcurrencyProvider * concurrencyProvider = NULL;
@@ -90,3 +100,5 @@ void CRThreadExecutor::stop() {
     }
     _thread->join();
 }
+
+#endif // CR_THREAD_SAFE==1
@@ -2,6 +2,8 @@
 
 #include "../include/epubfmt.h"
 #include "../include/fb2def.h"
+#include "../include/lvthread.h"
+#include "../include/lvautoptr.h"
 
 #if (USE_ZLIB==1)
 #include <zlib.h>
@@ -916,6 +918,11 @@ public:
         return _has_unsupported_encrypted_items;
     }
 
+    bool isEncryptedItem(lString32 name) {
+        encryption_method_t encryption_method;
+        return _encrypted_items.get(name, encryption_method);
+    }
+
     bool open() {
         LVStreamRef stream = _container->OpenStream(U"META-INF/encryption.xml", LVOM_READ);
         if (stream.isNull())
@@ -1041,6 +1048,124 @@ LVStreamRef GetEpubCoverpage(LVContainerRef arc)
     return coverPageImageStream;
 }
 
+#if (CR_THREAD_SAFE==1)
+
+#define EPUB_SPINE_PREFETCH_THREADS 2  // worker threads reading spine items
+#define EPUB_SPINE_PREFETCH_AHEAD   8  // max spine items read ahead of the parser
+
+/// Reads upcoming spine items into memory streams on worker threads, while
+/// the previous ones are being parsed, so that inflating them doesn't delay
+/// DOM building. Each worker opens its own instance of the EPUB archive file,
+/// as archive streams can't be shared between threads. Items are still parsed
+/// in spine order on the calling thread, which gets the exact same bytes.
+/// Encrypted or obfuscated items are left to the main archive container.
+class EpubSpinePrefetcher {
+    class Worker : public LVThread {
+        EpubSpinePrefetcher * _prefetcher;
+    public:
+        Worker( EpubSpinePrefetcher * prefetcher ) : _prefetcher(prefetcher) { }
+        virtual void run() { _prefetcher->run(); }
+    };
+    struct Item {
+        lString32 name;
+        LVStreamRef stream;
+        bool skip;
+        bool done;
+        Item( lString32 itemName, bool skipItem ) : name(itemName), skip(skipItem), done(false) { }
+    };
+    lString32 _arcFileName;
+    LVPtrVector<Item> _items;
+    LVPtrVector<Worker> _workers;
+    LVMutex _mutex;
+    LVCondition _cond; // signaled when an item is taken or done
+    int _next;         // next item to be read by a worker
+    int _taken;        // items taken by the parser
+    bool _stopped;
+
+    void run() {
+        LVStreamRef arcStream = LVOpenFileStream(_arcFileName.c_str(), LVOM_READ);
+        LVContainerRef arc = arcStream.isNull() ? LVContainerRef() : LVOpenArchieve(arcStream);
+        _mutex.lock();
+        for (;;) {
+            while ( !_stopped && _next < _items.length() && _next - _taken >= EPUB_SPINE_PREFETCH_AHEAD )
+                _cond.wait(_mutex);
+            if ( _stopped || _next >= _items.length() )
+                break;
+            Item * item = _items[_next++];
+            _mutex.unlock();
+            LVStreamRef stream;
+            if ( !arc.isNull() && !item->skip ) {
+                LVStreamRef src = arc->OpenStream(item->name.c_str(), LVOM_READ);
+                if ( !src.isNull() ) {
+                    stream = LVCreateMemoryStream(src);
+                    if ( !stream.isNull() )
+                        stream->SetName(src->GetName());
+                }
+            }
+            _mutex.lock();
+            item->stream = stream;
+            item->done = true;
+            _cond.notifyAll();
+        }
+        _mutex.unlock();
+    }
+public:
+    EpubSpinePrefetcher( lString32 arcFileName )
+        : _arcFileName(arcFileName), _next(0), _taken(0), _stopped(false) { }
+    ~EpubSpinePrefetcher() {
+        stop();
+    }
+    /// add item to be read, before start(): items to skip are not read
+    /// by workers, but still take a slot so that take() order is kept
+    void add( lString32 name, bool skip ) {
+        _items.add(new Item(name, skip));
+    }
+    void start() {
+        for ( int i=0; i<EPUB_SPINE_PREFETCH_THREADS; i++ ) {
+            Worker * worker = new Worker(this);
+            _workers.add(worker);
+            worker->start();
+        }
+    }
+    void stop() {
+        {
+            LVLock lock(_mutex);
+            _stopped = true;
+            _cond.notifyAll();
+        }
+        for ( int i=0; i<_workers.length(); i++ )
+            _workers[i]->join();
+        _workers.clear();
+    }
+    /// get next item content, in the order items were added: returns
+    /// an empty ref if it could not be read (to be opened as usual)
+    LVStreamRef take() {
+        LVLock lock(_mutex);
+        if ( _taken >= _items.length() )
+            return LVStreamRef();
+        Item * item = _items[_taken];
+        while ( !item->done && !_stopped )
+            _cond.wait(_mutex);
+        LVStreamRef stream = item->stream;
+        item->stream.Clear();
+        _taken++;
+        _cond.notifyAll();
+        return stream;
+    }
+    /// returns the name of the EPUB file if it can be opened again by workers
+    static lString32 getArchiveFileName( LVStreamRef stream ) {
+        if ( stream.isNull() || !stream->GetName() )
+            return lString32::empty_str;
+        lString32 fileName(stream->GetName());
+        LVStreamRef copy = LVOpenFileStream(fileName.c_str(), LVOM_READ);
+        if ( copy.isNull() || copy->GetSize() != stream->GetSize() )
+            return lString32::empty_str;
+        return fileName;
+    }
+};
+
+#endif // CR_THREAD_SAFE==1
+
 bool ImportEpubDocument( LVStreamRef stream, ldomDocument * m_doc, LVDocViewCallback * progressCallback,
             CacheLoadingCallback * formatCallback, bool metadataOnly,
             const elem_def_t * node_scheme, const attr_def_t * attr_scheme, const ns_def_t * ns_scheme )
@@ -1606,6 +1731,23 @@ bool ImportEpubDocument( LVStreamRef stream, ldomDocument * m_doc, LVDocViewCall
             //CRLog::trace("subst: %s => %s", LCSTR(name), LCSTR(subst));
         }
     }
+#if (CR_THREAD_SAFE==1)
+    // Have spine items read (and inflated) ahead by worker threads
+    LVAutoPtr<EpubSpinePrefetcher> prefetcher;
+    if ( spineItemsNb > 1 ) {
+        lString32 arcFileName = EpubSpinePrefetcher::getArchiveFileName(stream);
+        if ( !arcFileName.empty() ) {
+            prefetcher = new EpubSpinePrefetcher(arcFileName);
+            for ( size_t i=0; i<spineItemsNb; i++ ) {
+                if (relaxed_spine || spineItems[i]->is_xhtml) {
+                    lString32 name = LVCombinePaths(codeBase, spineItems[i]->href);
+                    prefetcher->add(name, decryptor->isEncryptedItem(name));
+                }
+            }
+            prefetcher->start();
+        }
+    }
+#endif
     int lastProgressPercent = 5;
     for ( size_t i=0; i<spineItemsNb; i++ ) {
         if ( progressCallback ) {
@@ -1629,7 +1771,13 @@ bool ImportEpubDocument( LVStreamRef stream, ldomDocument * m_doc, LVDocViewCall
                 appender.setNonLinearFlag(spineItems[i]->nonlinear);
                 appender.setFragmentType(); // unset
                 CRLog::debug("Checking fragment: %s", LCSTR(name));
-                LVStreamRef stream = m_arc->OpenStream(name.c_str(), LVOM_READ);
+                LVStreamRef stream;
+#if (CR_THREAD_SAFE==1)
+                if ( !prefetcher.isNull() )
+                    stream = prefetcher->take();
+                if ( stream.isNull() )
+#endif
+                    stream = m_arc->OpenStream(name.c_str(), LVOM_READ);
                 if ( !stream.isNull() ) {
                     LVHTMLParser parser(stream, &appender);
                     if ( parser.CheckFormat() && parser.Parse() && appender.hasMetBaseTag() ) {
@@ -1690,6 +1838,10 @@ bool ImportEpubDocument( LVStreamRef stream, ldomDocument * m_doc, LVDocViewCall
         }
     }
 
+#if (CR_THREAD_SAFE==1)
+    prefetcher.clear();
+#endif
+
     // Clear any toc items possibly added while parsing the HTML
     m_doc->getToc()->clear();
     bool has_toc = false;
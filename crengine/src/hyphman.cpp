@@ -35,6 +35,7 @@
 
 #include "../include/lvtypes.h"
 #include "../include/lvstream.h"
+#include "../include/lvthread.h"
 #include "../include/hyphman.h"
 #include "../include/lvfnt.h"
 #include "../include/lvstring.h"
@@ -59,24 +60,57 @@ HyphDictionaryList * HyphMan::_dictList = NULL;
 // from all the numbers that give the quality of a split after previous char)
 // (35 is needed for German.pattern)
 #define MAX_PATTERN_SIZE  35
-#define PATTERN_HASH_SIZE 16384
+// Number of words whose patterns matching result is remembered by
+// each dictionary (a word replaces any other one with the same hash
+// modulo this size, which must be a power of 2)
+#define WORD_MASKS_CACHE_SIZE 2048
 class TexPattern;
+struct TexHyphTrieNode;
+
+// Patterns matching result for a word (with the added boundary spaces)
+struct TexHyphWordMask {
+    lUInt32 hash;
+    lUInt8 len;             // 0 if unused
+    bool found;             // whether any pattern matched
+    lChar32 word[MAX_REAL_WORD+2];
+    char mask[MAX_REAL_WORD+3];
+};
+
 class TexHyph : public HyphMethod
 {
-    TexPattern * table[PATTERN_HASH_SIZE];
+    // Compiled patterns (see TexHyphTrieHeader), either mapped or read from
+    // a compiled dictionary file, or compiled from the patterns when loading
+    LVStreamBufferRef _trieBuffer;
+    lUInt8 * _trieData;
+    const lUInt8 * _trie;
+    lUInt32 _trieSize;
+    const TexHyphTrieNode * _trieNodes;
+    lUInt32 _trieNodeCount;
+    const lUInt32 * _trieEdgeChars;
+    const lUInt32 * _trieEdgeTargets;
+    lUInt32 _trieEdgeCount;
+    const char * _trieValues;
+    lUInt32 _trieValuesSize;
     lUInt32 _hash;
     lUInt32 _pattern_count;
     lString32 _supported_modifiers;
+    // Patterns matching result of the last words, as the same words are
+    // hyphenated again and again (allocated on first use)
+    TexHyphWordMask * _word_masks;
+    LVMutex _word_masks_mutex;
+    bool compile( LVPtrVector<TexPattern> & patterns );
+    bool setTrie( const lUInt8 * data, lUInt32 size );
 public:
     int largest_overflowed_word;
     bool match( const lChar32 * str, char * mask );
     virtual bool hyphenate( const lChar32 * str, int len, const lUInt16 * widths, lUInt8 * flags, lUInt16 hyphCharWidth, lUInt16 maxWidth, size_t flagSize );
-    void addPattern( TexPattern * pattern );
     void checkForModifiers( lString32 str );
     TexHyph( lString32 id=HYPH_DICT_ID_DICTIONARY, int leftHyphenMin=HYPHMETHOD_DEFAULT_HYPHEN_MIN, int rightHyphenMin=HYPHMETHOD_DEFAULT_HYPHEN_MIN );
     virtual ~TexHyph();
     bool load( LVStreamRef stream );
     bool load( lString32 fileName );
+    /// write compiled patterns, to be loaded with no parsing
+    bool save( LVStreamRef stream );
     virtual lUInt32 getHash() { return _hash; }
     virtual lUInt32 getCount() { return _pattern_count; }
     virtual lUInt32 getSize();
@@ -152,7 +186,11 @@ public:
                 ( p->getType() != HDT_DICT_ALAN && p->getType() != HDT_DICT_TEX) )
             return LVStreamRef();
         lString32 filename = p->getFilename();
-        return LVOpenFileStream( filename.c_str(), LVOM_READ );
+        // Compiled dictionaries are used from the mapped file with no copy
+        LVStreamRef stream = LVMapFileStream( filename.c_str(), LVOM_READ, 0 );
+        if ( stream.isNull() )
+            stream = LVOpenFileStream( filename.c_str(), LVOM_READ );
+        return stream;
     }
 };
 
@@ -286,6 +324,18 @@ HyphMethod * HyphMan::getHyphMethodForDictionary( lString32 id, int leftHyphenMi
     return newmethod;
 }
 
+bool HyphMan::compileDictionary( LVStreamRef src, LVStreamRef dst )
+{
+    if ( src.isNull() || dst.isNull() )
+        return false;
+    TexHyph hyph;
+    if ( !hyph.load( src ) )
+        return false;
+    if ( hyph.largest_overflowed_word )
+        printf("CRE WARNING: some hyphenation patterns were too long and have been ignored: increase MAX_PATTERN_SIZE from %d to %d\n", MAX_PATTERN_SIZE, hyph.largest_overflowed_word);
+    return hyph.save( dst );
+}
+
 bool HyphDictionary::activate()
 {
     TextLangMan::setMainLangFromHyphDict( getId() );
@@ -525,73 +575,8 @@ public:
     lChar32 word[MAX_PATTERN_SIZE+1];
     char attr[MAX_PATTERN_SIZE+2];
     int overflowed; // 0, or size of complete word if larger than MAX_PATTERN_SIZE
-    TexPattern * next;
-
-    int cmp( TexPattern * v )
-    {
-        return lStr_cmp( word, v->word );
-    }
-
-    static int hash( const lChar32 * s )
-    {
-        return ((lUInt32)(((s[0] *31 + s[1])*31 + s[2]) * 31 + s[3])) % PATTERN_HASH_SIZE;
-    }
-
-    static int hash3( const lChar32 * s )
-    {
-        return ((lUInt32)(((s[0] *31 + s[1])*31 + s[2]) * 31 + 0)) % PATTERN_HASH_SIZE;
-    }
-
-    static int hash2( const lChar32 * s )
-    {
-        return ((lUInt32)(((s[0] *31 + s[1])*31 + 0) * 31 + 0)) % PATTERN_HASH_SIZE;
-    }
-
-    static int hash1( const lChar32 * s )
-    {
-        return ((lUInt32)(((s[0] *31 + 0)*31 + 0) * 31 + 0)) % PATTERN_HASH_SIZE;
-    }
-
-    int hash()
-    {
-        return ((lUInt32)(((word[0] *31 + word[1])*31 + word[2]) * 31 + word[3])) % PATTERN_HASH_SIZE;
-    }
 
-    bool match( const lChar32 * s, char * mask )
-    {
-        TexPattern * p = this;
-        bool found = false;
-        while ( p ) {
-            bool res = true;
-            for ( int i=2; p->word[i]; i++ )
-                if ( p->word[i]!=s[i] ) {
-                    res = false;
-                    break;
-                }
-            if ( res ) {
-                if ( p->word[0]==s[0] && (p->word[1]==0 || p->word[1]==s[1]) ) {
-#if DUMP_PATTERNS==1
-                    CRLog::debug("Pattern matched: %s %s on %s %s", LCSTR(lString32(p->word)), p->attr, LCSTR(lString32(s)), mask);
-#endif
-                    p->apply(mask);
-                    found = true;
-                }
-            }
-            p = p->next;
-        }
-        return found;
-    }
-
-    void apply( char * mask )
-    {
-        ;
-        for ( char * p = attr; *p && *mask; p++, mask++ ) {
-            if ( *mask < *p )
-                *mask = *p;
-        }
-    }
-
-    TexPattern( const lString32 &s ) : next( NULL )
+    TexPattern( const lString32 &s )
     {
         overflowed = 0;
         memset( word, 0, sizeof(word) );
@@ -695,9 +680,59 @@ public:
 
 };
 
+// Compiled patterns: a trie of the pattern words, with the pattern values
+// ('0'..'9' chars, as in TexPattern::attr) on the nodes ending a word.
+// Laid out as: header, nodes, edges chars, edges target nodes, supported
+// modifiers chars, and values (nul terminated strings), all in native
+// byte order, so that it can be used in place from a mapped file.
+#define TEX_HYPH_TRIE_MAGIC "CRHyph01" // 8 bytes, ending with format version
+#define TEX_HYPH_TRIE_BYTE_ORDER 0x01020304
+
+struct TexHyphTrieHeader {
+    char magic[8];          // TEX_HYPH_TRIE_MAGIC
+    lUInt32 byteOrder;      // TEX_HYPH_TRIE_BYTE_ORDER
+    lUInt32 hash;           // TexHyph::getHash() of the source dictionary
+    lUInt32 patternCount;
+    lUInt32 nodeCount;      // node 0 is the root
+    lUInt32 edgeCount;
+    lUInt32 modifierCount;
+    lUInt32 valuesSize;
+};
+
+struct TexHyphTrieNode {
+    lUInt32 firstEdge;      // edges to child nodes, sorted by char
+    lUInt32 edgeCount;
+    lUInt32 value;          // offset + 1 of pattern values, 0 if none
+};
+
+// Trie node used while compiling patterns
+struct TexHyphTrieBuildNode {
+    lChar32 ch;
+    int firstChild;
+    int lastChild;
+    int nextSibling;
+    lString8 value;
+    TexHyphTrieBuildNode( lChar32 c ) : ch(c), firstChild(-1), lastChild(-1), nextSibling(-1) { }
+};
+
+static int TexPattern_comparator( const TexPattern ** item1, const TexPattern ** item2 )
+{
+    return lStr_cmp( (*item1)->word, (*item2)->word );
+}
+
 TexHyph::TexHyph(lString32 id, int leftHyphenMin, int rightHyphenMin) : HyphMethod(id, leftHyphenMin, rightHyphenMin)
+    , _trieData(NULL)
+    , _trie(NULL)
+    , _trieSize(0)
+    , _trieNodes(NULL)
+    , _trieNodeCount(0)
+    , _trieEdgeChars(NULL)
+    , _trieEdgeTargets(NULL)
+    , _trieEdgeCount(0)
+    , _trieValues(NULL)
+    , _trieValuesSize(0)
+    , _word_masks(NULL)
 {
-    memset( table, 0, sizeof(table) );
     _hash = 123456;
     _pattern_count = 0;
     largest_overflowed_word = 0;
@@ -705,25 +740,166 @@ TexHyph::TexHyph(lString32 id, int leftHyphenMin, int rightHyphenMin) : HyphMeth
 
 TexHyph::~TexHyph()
 {
-    for ( int i=0; i<PATTERN_HASH_SIZE; i++ ) {
-        TexPattern * p = table[i];
-        while (p) {
-            TexPattern * tmp = p;
-            p = p->next;
-            delete tmp;
+    if ( _trieData )
+        free( _trieData );
+    if ( _word_masks )
+        free( _word_masks );
+}
+
+bool TexHyph::setTrie( const lUInt8 * data, lUInt32 size )
+{
+    if ( size < sizeof(TexHyphTrieHeader) )
+        return false;
+    const TexHyphTrieHeader * hdr = (const TexHyphTrieHeader *)data;
+    if ( memcmp( hdr->magic, TEX_HYPH_TRIE_MAGIC, sizeof(hdr->magic) ) != 0 )
+        return false;
+    if ( hdr->byteOrder != TEX_HYPH_TRIE_BYTE_ORDER ) {
+        CRLog::error("Compiled hyphenation dictionary with another byte order");
+        return false;
+    }
+    lUInt64 expectedSize = sizeof(TexHyphTrieHeader)
+                    + (lUInt64)hdr->nodeCount * sizeof(TexHyphTrieNode)
+                    + (lUInt64)hdr->edgeCount * sizeof(lUInt32) * 2
+                    + (lUInt64)hdr->modifierCount * sizeof(lUInt32)
+                    + hdr->valuesSize;
+    if ( hdr->nodeCount == 0 || expectedSize != size )
+        return false;
+    if ( hdr->valuesSize > 0 && data[size-1] != 0 )
+        return false; // values must be nul terminated
+    _trie = data;
+    _trieSize = size;
+    const lUInt8 * p = data + sizeof(TexHyphTrieHeader);
+    _trieNodes = (const TexHyphTrieNode *)p;
+    _trieNodeCount = hdr->nodeCount;
+    p += hdr->nodeCount * sizeof(TexHyphTrieNode);
+    _trieEdgeChars = (const lUInt32 *)p;
+    _trieEdgeCount = hdr->edgeCount;
+    p += hdr->edgeCount * sizeof(lUInt32);
+    _trieEdgeTargets = (const lUInt32 *)p;
+    p += hdr->edgeCount * sizeof(lUInt32);
+    const lUInt32 * modifiers = (const lUInt32 *)p;
+    _supported_modifiers.clear();
+    for ( lUInt32 i=0; i<hdr->modifierCount; i++ )
+        _supported_modifiers << (lChar32)modifiers[i];
+    p += hdr->modifierCount * sizeof(lUInt32);
+    _trieValues = (const char *)p;
+    _trieValuesSize = hdr->valuesSize;
+    _hash = hdr->hash;
+    _pattern_count = hdr->patternCount;
+    return true;
+}
+
+bool TexHyph::compile( LVPtrVector<TexPattern> & patterns )
+{
+    // Build the trie from the sorted pattern words: a word's chars
+    // already in the trie are then always along the last added children
+    patterns.sort( TexPattern_comparator );
+    LVPtrVector<TexHyphTrieBuildNode> nodes;
+    nodes.add( new TexHyphTrieBuildNode(0) );
+    for ( int i=0; i<patterns.length(); i++ ) {
+        TexPattern * pattern = patterns[i];
+        if ( !pattern->word[0] )
+            continue;
+        int n = 0;
+        for ( const lChar32 * s = pattern->word; *s; s++ ) {
+            int child = nodes[n]->lastChild;
+            if ( child < 0 || nodes[child]->ch != *s ) {
+                child = nodes.length();
+                nodes.add( new TexHyphTrieBuildNode(*s) );
+                if ( nodes[n]->lastChild < 0 )
+                    nodes[n]->firstChild = child;
+                else
+                    nodes[nodes[n]->lastChild]->nextSibling = child;
+                nodes[n]->lastChild = child;
+            }
+            n = child;
+        }
+        // Same word in multiple patterns: keep the max value at each position,
+        // which is what applying them all would give
+        lString8 & value = nodes[n]->value;
+        if ( value.empty() ) {
+            value = lString8( pattern->attr );
+        }
+        else {
+            for ( int k=0; pattern->attr[k]; k++ ) {
+                if ( k >= value.length() )
+                    value << pattern->attr[k];
+                else if ( value[k] < pattern->attr[k] )
+                    value.modify()[k] = pattern->attr[k];
+            }
+        }
+    }
+    // Number nodes breadth first, so that the edges to the children
+    // of each node are contiguous
+    LVArray<int> order;
+    order.add( 0 );
+    int edgeCount = 0;
+    lUInt32 valuesSize = 0;
+    for ( int i=0; i<order.length(); i++ ) {
+        TexHyphTrieBuildNode * node = nodes[order[i]];
+        for ( int child = node->firstChild; child >= 0; child = nodes[child]->nextSibling ) {
+            order.add( child );
+            edgeCount++;
+        }
+        if ( !node->value.empty() )
+            valuesSize += node->value.length() + 1;
+    }
+    int nodeCount = order.length();
+    int modifierCount = _supported_modifiers.length();
+    lUInt32 size = sizeof(TexHyphTrieHeader) + nodeCount * sizeof(TexHyphTrieNode)
+                    + edgeCount * sizeof(lUInt32) * 2 + modifierCount * sizeof(lUInt32) + valuesSize;
+    lUInt8 * data = (lUInt8 *)calloc( size, 1 );
+    if ( !data )
+        return false;
+    TexHyphTrieHeader * hdr = (TexHyphTrieHeader *)data;
+    memcpy( hdr->magic, TEX_HYPH_TRIE_MAGIC, sizeof(hdr->magic) );
+    hdr->byteOrder = TEX_HYPH_TRIE_BYTE_ORDER;
+    hdr->hash = _hash;
+    hdr->patternCount = _pattern_count;
+    hdr->nodeCount = nodeCount;
+    hdr->edgeCount = edgeCount;
+    hdr->modifierCount = modifierCount;
+    hdr->valuesSize = valuesSize;
+    TexHyphTrieNode * trieNodes = (TexHyphTrieNode *)(data + sizeof(TexHyphTrieHeader));
+    lUInt32 * edgeChars = (lUInt32 *)(trieNodes + nodeCount);
+    lUInt32 * edgeTargets = edgeChars + edgeCount;
+    lUInt32 * modifiers = edgeTargets + edgeCount;
+    char * values = (char *)(modifiers + modifierCount);
+    for ( int i=0; i<modifierCount; i++ )
+        modifiers[i] = _supported_modifiers[i];
+    int edge = 0;
+    int target = 1;
+    lUInt32 valuesPos = 0;
+    for ( int i=0; i<nodeCount; i++ ) {
+        TexHyphTrieBuildNode * node = nodes[order[i]];
+        trieNodes[i].firstEdge = edge;
+        for ( int child = node->firstChild; child >= 0; child = nodes[child]->nextSibling ) {
+            edgeChars[edge] = nodes[child]->ch;
+            edgeTargets[edge] = target++; // children are numbered in this same order
+            edge++;
+        }
+        trieNodes[i].edgeCount = edge - trieNodes[i].firstEdge;
+        if ( !node->value.empty() ) {
+            trieNodes[i].value = valuesPos + 1;
+            memcpy( values + valuesPos, node->value.c_str(), node->value.length() + 1 );
+            valuesPos += node->value.length() + 1;
         }
     }
+    if ( _trieData )
+        free( _trieData );
+    _trieData = data;
+    _trieBuffer.Clear();
+    return setTrie( data, size );
 }
 
-void TexHyph::addPattern( TexPattern * pattern )
+bool TexHyph::save( LVStreamRef stream )
 {
-    int h = pattern->hash();
-    TexPattern * * p = &table[h];
-    while ( *p && pattern->cmp(*p)<0 )
-        p = &((*p)->next);
-    pattern->next = *p;
-    *p = pattern;
-    _pattern_count++;
+    if ( !_trie || stream.isNull() )
+        return false;
+    lvsize_t bytesWritten = 0;
+    if ( stream->Write( _trie, _trieSize, &bytesWritten ) != LVERR_OK || bytesWritten != _trieSize )
+        return false;
+    return true;
 }
 
 void TexHyph::checkForModifiers( lString32 str )
@@ -739,11 +915,30 @@ void TexHyph::checkForModifiers( lString32 str )
 }
 
 lUInt32 TexHyph::getSize() {
-    return _pattern_count * sizeof(TexPattern);
+    return _trieSize;
 }
 
 bool TexHyph::load( LVStreamRef stream )
 {
+    // Compiled dictionary: use it in place
+    char magic[8];
+    lvsize_t bytesRead = 0;
+    stream->SetPos(0);
+    if ( stream->Read( magic, sizeof(magic), &bytesRead ) == LVERR_OK && bytesRead == sizeof(magic)
+            && memcmp( magic, TEX_HYPH_TRIE_MAGIC, sizeof(magic) ) == 0 ) {
+        lvsize_t size = stream->GetSize();
+        if ( size > 0xFFFFFFF )
+            return false;
+        _trieBuffer = stream->GetReadBuffer( 0, size );
+        if ( _trieBuffer.isNull() || !setTrie( _trieBuffer->getReadOnly(), (lUInt32)size ) ) {
+            _trieBuffer.Clear();
+            return false;
+        }
+        return true;
+    }
+    stream->SetPos(0);
+
+    LVPtrVector<TexPattern> patterns;
     int w = isCorrectHyphFile(stream.get());
     int patternCount = 0;
     if (w) {
@@ -796,7 +991,7 @@ bool TexHyph::load( LVStreamRef stream )
                     delete pattern;
                 }
                 else {
-                    addPattern( pattern );
+                    patterns.add( pattern );
                     patternCount++;
                 }
             }
@@ -834,7 +1029,7 @@ bool TexHyph::load( LVStreamRef stream )
                     delete pattern;
                 }
                 else {
-                    addPattern( pattern );
+                    patterns.add( pattern );
                     patternCount++;
                 }
                 p += sz + sz + 1;
@@ -842,7 +1037,8 @@ bool TexHyph::load( LVStreamRef stream )
         }
         // Note: support for diacritics/modifiers with checkForModifiers() not implemented
 
-        return patternCount>0;
+        _pattern_count = patternCount;
+        return patternCount>0 && compile( patterns );
     } else {
         // tex xml format as for FBReader
         lString32Collection data;
@@ -868,14 +1064,15 @@ bool TexHyph::load( LVStreamRef stream )
                 delete pattern;
             }
             else {
-                addPattern( pattern );
+                patterns.add( pattern );
                 patternCount++;
                 // Check for and remember diacritics found in patterns, so we don't ignore
                 // them when present in word to hyphenate
                 checkForModifiers( data[i] );
             }
         }
-        return patternCount>0;
+        _pattern_count = patternCount;
+        return patternCount>0 && compile( patterns );
     }
 }
 
@@ -890,22 +1087,40 @@ bool TexHyph::load( lString32 fileName )
 
 bool TexHyph::match( const lChar32 * str, char * mask )
 {
+    // Walk the trie along str: each node reached that ends a pattern
+    // word gives the values of a pattern matching at str
     bool found = false;
-    TexPattern * res = table[ TexPattern::hash( str ) ];
-    if ( res ) {
-        found = res->match( str, mask ) || found;
-    }
-    res = table[ TexPattern::hash3( str ) ];
-    if ( res ) {
-        found = res->match( str, mask ) || found;
-    }
-    res = table[ TexPattern::hash2( str ) ];
-    if ( res ) {
-        found = res->match( str, mask ) || found;
-    }
-    res = table[ TexPattern::hash1( str ) ];
-    if ( res ) {
-        found = res->match( str, mask ) || found;
+    lUInt32 node = 0;
+    for ( ; *str; str++ ) {
+        const TexHyphTrieNode & n = _trieNodes[node];
+        lUInt32 a = n.firstEdge;
+        lUInt32 b = a + n.edgeCount;
+        if ( b > _trieEdgeCount )
+            break; // corrupted
+        while ( a < b ) {
+            lUInt32 c = (a + b) / 2;
+            if ( _trieEdgeChars[c] < *str )
+                a = c + 1;
+            else
+                b = c;
+        }
+        if ( a >= n.firstEdge + n.edgeCount || _trieEdgeChars[a] != *str )
+            break;
+        node = _trieEdgeTargets[a];
+        if ( node >= _trieNodeCount )
+            break; // corrupted
+        lUInt32 value = _trieNodes[node].value;
+        if ( value && value <= _trieValuesSize ) {
+#if DUMP_PATTERNS==1
+            CRLog::debug("Pattern matched: %s on %s", _trieValues + value - 1, mask);
+#endif
+            char * m = mask;
+            for ( const char * p = _trieValues + value - 1; *p && *m; p++, m++ ) {
+                if ( *m < *p )
+                    *m = *p;
+            }
+            found = true;
+        }
     }
     return found;
 }
@@ -984,10 +1199,41 @@ bool TexHyph::hyphenate( const lChar32 * str, int len, const lUInt16 * widths, l
 
     // Find matches from dict patterns, at any position in word.
     // Places where hyphenation is allowed are put into 'mask'.
-    memset( mask, '0', wlen+3 );	// 0x30!
+    // As it only depends on the word, reuse the mask of words seen before.
     bool found = false;
-    for ( int i=0; i<=wlen; i++ ) {
-        found = match( word + i, mask + i ) || found;
+    bool known = false;
+    bool remember = w <= MAX_REAL_WORD + 2;
+    lUInt32 hash = 0;
+    if ( remember ) {
+        hash = lString32::getHash( word, word + w );
+        LVLock lock( _word_masks_mutex );
+        if ( !_word_masks )
+            _word_masks = (TexHyphWordMask *)calloc( WORD_MASKS_CACHE_SIZE, sizeof(TexHyphWordMask) );
+        if ( _word_masks ) {
+            TexHyphWordMask * item = _word_masks + ( hash & (WORD_MASKS_CACHE_SIZE - 1) );
+            if ( item->len == w && item->hash == hash && !memcmp( item->word, word, w * sizeof(lChar32) ) ) {
+                known = true;
+                found = item->found;
+                memcpy( mask, item->mask, wlen+3 );
+            }
+        }
+    }
+    if ( !known ) {
+        memset( mask, '0', wlen+3 );	// 0x30!
+        for ( int i=0; i<=wlen; i++ ) {
+            found = match( word + i, mask + i ) || found;
+        }
+        if ( remember ) {
+            LVLock lock( _word_masks_mutex );
+            if ( _word_masks ) {
+                TexHyphWordMask * item = _word_masks + ( hash & (WORD_MASKS_CACHE_SIZE - 1) );
+                item->hash = hash;
+                item->len = (lUInt8)w;
+                item->found = found;
+                memcpy( item->word, word, w * sizeof(lChar32) );
+                memcpy( item->mask, mask, wlen+3 );
+            }
+        }
     }
     if ( !found )
         return false;
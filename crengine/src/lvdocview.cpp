@@ -189,6 +189,10 @@ LVDocView::LVDocView(int bitsPerPixel, bool noDefaultDocument) :
 			, m_rotateAngle(CR_ROTATE_ANGLE_0)
 #endif
 			, m_section_bounds_valid(false), m_section_bounds_externally_updated(false)
+#if CR_ENABLE_PAGE_IMAGE_CACHE==1
+			, m_imageCache(this), m_imageCacheLastPos(-1), m_imageCacheDirection(1)
+#endif
+			, m_pageDrawBands(0)
 			, m_doc_format(doc_format_none),
 			m_callback(NULL), m_swapDone(false), m_drawBufferBits(
 					GRAY_BACKBUFFER_BITS) {
@@ -231,6 +235,10 @@ LVDocView::LVDocView(int bitsPerPixel, bool noDefaultDocument) :
 }
 
 LVDocView::~LVDocView() {
+#if CR_ENABLE_PAGE_IMAGE_CACHE==1
+	// don't let render threads draw a view being destroyed
+	m_imageCache.stop();
+#endif
 	Clear();
 }
 
@@ -628,99 +636,448 @@ void LVDocView::checkPos() {
 }
 
 #if CR_ENABLE_PAGE_IMAGE_CACHE==1
+
+#define PAGE_IMAGE_CACHE_DEFAULT_PAGES   4
+#define PAGE_IMAGE_CACHE_DEFAULT_BYTES   0x3000000 // 48.0 MiB
+#define PAGE_IMAGE_CACHE_DEFAULT_THREADS 1
+
+class LVDocViewImageCache::Worker : public LVThread {
+	LVDocViewImageCache * _cache;
+public:
+	Worker( LVDocViewImageCache * cache ) : _cache(cache)
+	{
+	}
+	virtual void run()
+	{
+		_cache->run();
+	}
+};
+
+LVDocViewImageCache::LVDocViewImageCache( LVDocView * view )
+: _view(view), _useCounter(0), _totalSize(0)
+, _maxPages(PAGE_IMAGE_CACHE_DEFAULT_PAGES)
+, _maxBytes(PAGE_IMAGE_CACHE_DEFAULT_BYTES)
+, _threadCount(PAGE_IMAGE_CACHE_DEFAULT_THREADS)
+, _stopped(false)
+{
+}
+
+LVDocViewImageCache::~LVDocViewImageCache()
+{
+	stop();
+	clear();
+}
+
+int LVDocViewImageCache::find( int offset, int page )
+{
+	for ( int i=0; i<_items.length(); i++ ) {
+		if ( _items[i]->matches( offset, page ) )
+			return i;
+	}
+	return -1;
+}
+
+void LVDocViewImageCache::drop( int index )
+{
+	Item * item = _items.remove( index );
+	_totalSize -= item->_size;
+	if ( item->_rendering )
+		item->_stale = true; // deleted by the worker when done
+	else
+		delete item;
+}
+
+void LVDocViewImageCache::evict( Item * keep )
+{
+	while ( _items.length() > _maxPages || _totalSize > _maxBytes ) {
+		// least recently used page, queued pages being cancelled
+		int oldest = -1;
+		for ( int i=0; i<_items.length(); i++ ) {
+			Item * item = _items[i];
+			if ( item == keep || item->_rendering )
+				continue;
+			if ( oldest < 0 || item->_lastUse < _items[oldest]->_lastUse )
+				oldest = i;
+		}
+		if ( oldest < 0 )
+			break;
+		if ( _items[oldest]->_ready )
+			_stats.evicted++;
+		else
+			_stats.cancelled++;
+		drop( oldest );
+	}
+}
+
+LVDocViewImageCache::Item * LVDocViewImageCache::nextJob()
+{
+	// most recently requested page first
+	Item * job = NULL;
+	for ( int i=0; i<_items.length(); i++ ) {
+		Item * item = _items[i];
+		if ( item->_ready || item->_rendering )
+			continue;
+		if ( !job || item->_lastUse > job->_lastUse )
+			job = item;
+	}
+	if ( job )
+		job->_rendering = true;
+	return job;
+}
+
+void LVDocViewImageCache::render( Item * item )
+{
+	_view->Draw( *item->_drawbuf, item->_offset, item->_page, true );
+}
+
+void LVDocViewImageCache::finish( Item * item )
+{
+	item->_rendering = false;
+	_stats.rendered++;
+	if ( item->_stale )
+		delete item;
+	else
+		item->_ready = true;
+	_cond.notifyAll();
+}
+
+bool LVDocViewImageCache::hasQueuedJob()
+{
+	for ( int i=0; i<_items.length(); i++ ) {
+		if ( !_items[i]->_ready && !_items[i]->_rendering )
+			return true;
+	}
+	return false;
+}
+
+void LVDocViewImageCache::run()
+{
+	_mutex.lock();
+	while ( !_stopped ) {
+		if ( !hasQueuedJob() ) {
+			_cond.wait( _mutex );
+			continue;
+		}
+		_mutex.unlock();
+		// A job is only taken with the view mutex held: a thread waiting in
+		// get() for a page being rendered can't be holding it then, and
+		// other pages are rendered by get() itself
+		LVLock viewLock( _view->getMutex() );
+		_mutex.lock();
+		Item * item = _stopped ? NULL : nextJob();
+		if ( !item )
+			continue;
+		_mutex.unlock();
+		render( item );
+		_mutex.lock();
+		finish( item );
+	}
+	_mutex.unlock();
+}
+
+bool LVDocViewImageCache::hasWorker() const
+{
+#if (CR_USE_THREADS==1)
+	return _threadCount > 0;
+#else
+	return false;
+#endif
+}
+
+void LVDocViewImageCache::startWorkers()
+{
+	for ( int i=0; i<_threadCount; i++ ) {
+		Worker * worker = new Worker( this );
+		_workers.add( worker );
+		worker->start();
+	}
+}
+
+void LVDocViewImageCache::stopWorkers()
+{
+	{
+		LVLock lock( _mutex );
+		_stopped = true;
+		for ( int i=_items.length()-1; i>=0; i-- ) {
+			if ( !_items[i]->_ready && !_items[i]->_rendering ) {
+				_stats.cancelled++;
+				drop( i );
+			}
+		}
+		_cond.notifyAll();
+	}
+	for ( int i=0; i<_workers.length(); i++ )
+		_workers[i]->join();
+	_workers.clear();
+}
+
+void LVDocViewImageCache::stop()
+{
+	stopWorkers();
+}
+
+void LVDocViewImageCache::setLimits( int maxPages, lUInt32 maxBytes, int threadCount )
+{
+	if ( maxPages < 1 )
+		maxPages = 1;
+	if ( threadCount < 0 )
+		threadCount = 0;
+	if ( threadCount > 1 )
+		threadCount = 1; // would wait for each other on the view mutex
+	if ( threadCount != _threadCount ) {
+		stopWorkers();
+		_threadCount = threadCount;
+		_stopped = false; // workers restarted on next request
+	}
+	LVLock lock( _mutex );
+	_maxPages = maxPages;
+	_maxBytes = maxBytes;
+	evict( NULL );
+}
+
+void LVDocViewImageCache::set( int offset, int page, LVRef<LVDrawBuf> drawbuf )
+{
+	_mutex.lock();
+	int index = find( offset, page );
+	if ( index >= 0 ) {
+		_items[index]->_lastUse = ++_useCounter;
+		_mutex.unlock();
+		return;
+	}
+	Item * item = new Item();
+	item->_drawbuf = drawbuf;
+	item->_offset = offset;
+	item->_page = page;
+	item->_size = drawbuf->GetRowSize() * drawbuf->GetHeight();
+	item->_lastUse = ++_useCounter;
+	item->_ready = false;
+	item->_rendering = false;
+	item->_stale = false;
+	_items.add( item );
+	_totalSize += item->_size;
+	evict( item );
+#if (CR_USE_THREADS==1)
+	if ( _threadCount > 0 && !_stopped ) {
+		if ( _workers.empty() )
+			startWorkers();
+		_cond.notifyAll();
+		_mutex.unlock();
+		return;
+	}
+#endif
+	// no worker threads: render now
+	item->_rendering = true;
+	_mutex.unlock();
+	render( item );
+	_mutex.lock();
+	finish( item );
+	_mutex.unlock();
+}
+
+LVDocImageRef LVDocViewImageCache::get( int offset, int page, bool updateStats )
+{
+	_mutex.lock();
+	int index = find( offset, page );
+	if ( index < 0 ) {
+		if ( updateStats )
+			_stats.misses++;
+		_mutex.unlock();
+		return LVDocImageRef( NULL );
+	}
+	_items[index]->_lastUse = ++_useCounter;
+	if ( !_items[index]->_ready ) {
+		lUInt64 start = GetCurrentTimeMillis();
+		while ( index >= 0 && !_items[index]->_ready ) {
+			Item * item = _items[index];
+			if ( !item->_rendering ) {
+				// Render it here rather than wait for the worker, which
+				// may need the view mutex this thread holds
+				item->_rendering = true;
+				_mutex.unlock();
+				render( item );
+				_mutex.lock();
+				finish( item );
+			} else {
+				_cond.wait( _mutex );
+			}
+			index = find( offset, page ); // may have been dropped meanwhile
+		}
+		if ( updateStats ) {
+			_stats.waits++;
+			_stats.waitTimeMs += GetCurrentTimeMillis() - start;
+		}
+		if ( index < 0 ) {
+			_mutex.unlock();
+			return LVDocImageRef( NULL );
+		}
+	} else if ( updateStats ) {
+		_stats.hits++;
+	}
+	// a ready page image is not drawn to anymore, just released under the mutex
+	LVDocImageRef ref( new LVDocImageHolder( _items[index]->_drawbuf, _mutex ) );
+	_mutex.unlock();
+	return ref;
+}
+
+bool LVDocViewImageCache::has( int offset, int page )
+{
+	LVLock lock( _mutex );
+	int index = find( offset, page );
+	if ( index < 0 )
+		return false;
+	// still wanted: not to be evicted for the pages queued after it
+	_items[index]->_lastUse = ++_useCounter;
+	return true;
+}
+
+bool LVDocViewImageCache::isReady( int offset, int page )
+{
+	LVLock lock( _mutex );
+	int index = find( offset, page );
+	return index >= 0 && _items[index]->_ready;
+}
+
+void LVDocViewImageCache::clear()
+{
+	LVLock lock( _mutex );
+	for ( int i=_items.length()-1; i>=0; i-- ) {
+		if ( !_items[i]->_ready && !_items[i]->_rendering )
+			_stats.cancelled++;
+		drop( i );
+	}
+	_cond.notifyAll();
+}
+
+LVDocViewImageCacheStats LVDocViewImageCache::getStats()
+{
+	LVLock lock( _mutex );
+	return _stats;
+}
+
+void LVDocViewImageCache::resetStats()
+{
+	LVLock lock( _mutex );
+	_stats = LVDocViewImageCacheStats();
+}
+
 /// returns true if current page image is ready
 bool LVDocView::IsDrawed()
 {
 	return isPageImageReady( 0 );
 }
 
-/// returns true if page image is available (0=current, -1=prev, 1=next)
-bool LVDocView::isPageImageReady( int delta )
+/// get cache key of page image (0=current, -1=prev, 1=next; any page delta in page mode)
+bool LVDocView::getPageImageKey( int delta, int & offset, int & page )
 {
-	if ( !m_is_rendered || !_posIsSet )
-	return false;
-	LVDocImageRef ref;
+	offset = -1;
+	page = -1;
 	if ( isPageMode() ) {
-		int p = _page;
-		if ( delta<0 )
-		p--;
-		else if ( delta>0 )
-		p++;
-		//CRLog::trace("getPageImage: checking cache for page [%d] (delta=%d)", offset, delta);
-		ref = m_imageCache.get( -1, p );
+		page = _page + delta;
+		if ( page<0 || page>=m_pages.length() )
+			return false;
 	} else {
-		int offset = _pos;
+		offset = _pos;
 		if ( delta<0 )
-		offset = getPrevPageOffset();
+			offset = getPrevPageOffset();
 		else if ( delta>0 )
-		offset = getNextPageOffset();
-		//CRLog::trace("getPageImage: checking cache for page [%d] (delta=%d)", offset, delta);
-		ref = m_imageCache.get( offset, -1 );
+			offset = getNextPageOffset();
 	}
-	return ( !ref.isNull() );
+	return true;
+}
+
+/// returns true if page image is available (0=current, -1=prev, 1=next)
+bool LVDocView::isPageImageReady( int delta )
+{
+	if ( !m_is_rendered || !_posIsSet )
+		return false;
+	int offset, p;
+	if ( !getPageImageKey( delta, offset, p ) )
+		return false;
+	return m_imageCache.isReady( offset, p );
 }
 
 /// get page image
 LVDocImageRef LVDocView::getPageImage( int delta )
 {
 	checkPos();
-	// find existing object in cache
 	LVDocImageRef ref;
-	int p = -1;
-	int offset = -1;
-	if ( isPageMode() ) {
-		p = _page;
-		if ( delta<0 )
-		p--;
-		else if ( delta>0 )
-		p++;
-		if ( p<0 || p>=m_pages.length() )
+	int p, offset;
+	if ( !getPageImageKey( delta, offset, p ) )
 		return ref;
-		ref = m_imageCache.get( -1, p );
-		if ( !ref.isNull() ) {
-			//CRLog::trace("getPageImage: + page [%d] found in cache", offset);
-			return ref;
-		}
-	} else {
-		offset = _pos;
-		if ( delta<0 )
-		offset = getPrevPageOffset();
-		else if ( delta>0 )
-		offset = getNextPageOffset();
-		//CRLog::trace("getPageImage: checking cache for page [%d] (delta=%d)", offset, delta);
-		ref = m_imageCache.get( offset, -1 );
-		if ( !ref.isNull() ) {
-			//CRLog::trace("getPageImage: + page [%d] found in cache", offset);
-			return ref;
-		}
+	if ( delta==0 ) {
+		// queue neighbour pages before the current one, which being
+		// requested last will be rendered first
+		cachePageImages();
 	}
+	// find existing object in cache
+	ref = m_imageCache.get( offset, p );
 	while ( ref.isNull() ) {
 		//CRLog::trace("getPageImage: - page [%d] not found, force rendering", offset);
 		cachePageImage( delta );
-		ref = m_imageCache.get( offset, p );
+		ref = m_imageCache.get( offset, p, false );
 	}
 	//CRLog::trace("getPageImage: page [%d] is ready", offset);
 	return ref;
 }
 
-class LVDrawThread : public LVThread {
-	LVDocView * _view;
-	int _offset;
-	int _page;
-	LVRef<LVDrawBuf> _drawbuf;
-public:
-	LVDrawThread( LVDocView * view, int offset, int page, LVRef<LVDrawBuf> drawbuf )
-	: _view(view), _offset(offset), _page(page), _drawbuf(drawbuf)
-	{
-		start();
+/// cache page image (render in background if necessary)
+void LVDocView::cachePageImage( int delta )
+{
+	int offset, p;
+	if ( !getPageImageKey( delta, offset, p ) )
+		return;
+	//CRLog::trace("cachePageImage: request to cache page [%d] (delta=%d)", offset, delta);
+	if ( m_imageCache.has(offset, p) ) {
+		//CRLog::trace("cachePageImage: Page [%d] is found in cache", offset);
+		return;
 	}
-	virtual void run()
-	{
-		//CRLog::trace("LVDrawThread::run() offset==%d", _offset);
-		_view->Draw( *_drawbuf, _offset, _page, true );
-		//_drawbuf->Rotate( _view->GetRotateAngle() );
+	//CRLog::trace("cachePageImage: starting new render task for page [%d]", offset);
+	LVDrawBuf * buf = NULL;
+	if ( m_bitsPerPixel==-1 ) {
+#if (COLOR_BACKBUFFER==1)
+        buf = new LVColorDrawBuf( m_dx, m_dy, DEF_COLOR_BUFFER_BPP );
+#else
+		buf = new LVGrayDrawBuf( m_dx, m_dy, m_drawBufferBits );
+#endif
+	} else {
+        if ( m_bitsPerPixel==32 || m_bitsPerPixel==16 ) {
+            buf = new LVColorDrawBuf( m_dx, m_dy, m_bitsPerPixel );
+		} else {
+			buf = new LVGrayDrawBuf( m_dx, m_dy, m_bitsPerPixel );
+		}
 	}
-};
+	m_imageCache.set( offset, p, LVRef<LVDrawBuf>( buf ) );
+	//CRLog::trace("cachePageImage: caching page [%d] is finished", offset);
+}
+
+/// queue rendering of pages around current one, mostly in last page turn direction
+void LVDocView::cachePageImages()
+{
+	// rendering them here would delay the current page
+	if ( !m_imageCache.hasWorker() )
+		return;
+	int pos = isPageMode() ? _page : _pos;
+	if ( m_imageCacheLastPos >= 0 && pos != m_imageCacheLastPos )
+		m_imageCacheDirection = pos > m_imageCacheLastPos ? 1 : -1;
+	m_imageCacheLastPos = pos;
+	// besides current page, keep one page behind, and fill the rest ahead
+	// (only adjacent pages are known in scroll mode)
+	int ahead = m_imageCache.getMaxPages() - 2;
+	if ( ahead < 0 )
+		return;
+	if ( !isPageMode() && ahead > 1 )
+		ahead = 1;
+	cachePageImage( -m_imageCacheDirection );
+	// nearest page queued last, to be rendered first
+	for ( int i=ahead; i>=1; i-- )
+		cachePageImage( i * m_imageCacheDirection );
+}
+
+/// set number of cached page images, their memory budget, and number of render threads
+void LVDocView::setPageImageCacheParams( int maxPages, lUInt32 maxBytes, int threadCount )
+{
+	m_imageCache.setLimits( maxPages, maxBytes, threadCount );
+}
 #endif
 
 /// draw current page to specified buffer
@@ -753,53 +1110,6 @@ void LVDocView::Draw(LVDrawBuf & drawbuf, bool autoResize) {
 	}
 }
 
-#if CR_ENABLE_PAGE_IMAGE_CACHE==1
-/// cache page image (render in background if necessary)
-void LVDocView::cachePageImage( int delta )
-{
-	int offset = -1;
-	int p = -1;
-	if ( isPageMode() ) {
-		p = _page;
-		if ( delta<0 )
-		p--;
-		else if ( delta>0 )
-		p++;
-		if ( p<0 || p>=m_pages.length() )
-		return;
-	} else {
-		offset = _pos;
-		if ( delta<0 )
-		offset = getPrevPageOffset();
-		else if ( delta>0 )
-		offset = getNextPageOffset();
-	}
-	//CRLog::trace("cachePageImage: request to cache page [%d] (delta=%d)", offset, delta);
-	if ( m_imageCache.has(offset, p) ) {
-		//CRLog::trace("cachePageImage: Page [%d] is found in cache", offset);
-		return;
-	}
-	//CRLog::trace("cachePageImage: starting new render task for page [%d]", offset);
-	LVDrawBuf * buf = NULL;
-	if ( m_bitsPerPixel==-1 ) {
-#if (COLOR_BACKBUFFER==1)
-        buf = new LVColorDrawBuf( m_dx, m_dy, DEF_COLOR_BUFFER_BPP );
-#else
-		buf = new LVGrayDrawBuf( m_dx, m_dy, m_drawBufferBits );
-#endif
-	} else {
-        if ( m_bitsPerPixel==32 || m_bitsPerPixel==16 ) {
-            buf = new LVColorDrawBuf( m_dx, m_dy, m_bitsPerPixel );
-		} else {
-			buf = new LVGrayDrawBuf( m_dx, m_dy, m_bitsPerPixel );
-		}
-	}
-	LVRef<LVDrawBuf> drawbuf( buf );
-	LVRef<LVThread> thread( new LVDrawThread( this, offset, p, drawbuf ) );
-	m_imageCache.set( offset, p, drawbuf, thread );
-	//CRLog::trace("cachePageImage: caching page [%d] is finished", offset);
-}
-#endif
 
 #if 0 // unused
 
@@ -836,7 +1146,8 @@ LVTocItem * LVDocView::getToc() {
 	// called when it is really needed: after next full rendering)
 	if (!m_doc->isTocFromCacheValid() || !m_doc->getToc()->hasValidPageNumbers(getVisiblePageNumberCount())) {
 		updatePageNumbers(m_doc->getToc());
-		m_doc->setCacheFileStale(true); // have cache saved with the updated TOC
+		if (!m_doc->getPartialRerenderingsCount()) // (no cache saved with partial rerenderings)
+			m_doc->setCacheFileStale(true); // have cache saved with the updated TOC
 		m_doc->setTocFromCacheValid();  // consider it valid now that page numbers are updated
 	}
 	return m_doc->getToc();
@@ -1999,8 +2310,41 @@ void LVDocView::drawPageHeader(LVDrawBuf * drawbuf, const lvRect & headerRc,
 	drawbuf->SetTextColor(getTextColor());
 }
 
+/// set number of horizontal bands pages are drawn in, each by its own thread (0 or 1: no threads)
+void LVDocView::setPageDrawBands(int bands) {
+#if (CR_THREAD_SAFE==1)
+	if (bands < 2)
+		bands = 0;
+	LVLock lock(getMutex());
+	if (bands == m_pageDrawBands)
+		return;
+	m_pageDrawBands = bands;
+	// the calling thread draws a band too
+	m_drawBandPool = bands ? new LVDrawBandPool(bands - 1) : NULL;
+#else
+	CR_UNUSED(bands);
+#endif
+}
+
 void LVDocView::drawPageTo(LVDrawBuf * drawbuf, LVRendPageInfo & page,
 		lvRect * pageRect, int pageCount, int basePage, bool hasTwoVisiblePages, bool isRightPage, bool isLastPage) {
+#if (CR_THREAD_SAFE==1)
+	if (!m_drawBandPool.isNull()) {
+		// The document can only be walked by this thread: record what is drawn,
+		// then draw it on drawbuf in bands, by the pool threads
+		LVRecordingDrawBuf recorder(drawbuf, m_pageDrawBands);
+		if (recorder.canDrawBands()) {
+			drawPageContentTo(&recorder, page, pageRect, pageCount, basePage, hasTwoVisiblePages, isRightPage, isLastPage);
+			recorder.drawBands(m_drawBandPool.get());
+			return;
+		}
+	}
+#endif
+	drawPageContentTo(drawbuf, page, pageRect, pageCount, basePage, hasTwoVisiblePages, isRightPage, isLastPage);
+}
+
+void LVDocView::drawPageContentTo(LVDrawBuf * drawbuf, LVRendPageInfo & page,
+		lvRect * pageRect, int pageCount, int basePage, bool hasTwoVisiblePages, bool isRightPage, bool isLastPage) {
 	int start = page.start;
 	int height = page.height;
 	int headerHeight = getPageHeaderHeight();
@@ -2984,10 +3328,12 @@ LVRef<ldomXRange> LVDocView::getPageDocumentRange(int pageIndex) {
     // on a line in "logical order" instead of "visual order", which
     // is needed with bidi text to not miss some text on the first
     // or last line of the page.
+    // When no xpointer is found, we can skip to the next final block edge,
+    // as with getBookmark(): only a found one may be out of page.
     ldomXPointer start;
     ldomXPointer end;
     int start_h;
-    for (start_h=0; start_h < height; start_h++) {
+    for (start_h=0; start_h < height; ) {
         start = m_doc->createXPointer(lvPoint(0, start_y + start_h), PT_DIR_SCAN_FORWARD_LOGICAL_FIRST);
         // printf("  start (%d=%d): %s\n", start_h, start_y + start_h, UnicodeToLocal(start.toString()).c_str());
         if (!start.isNull()) {
@@ -2996,10 +3342,16 @@ LVRef<ldomXRange> LVDocView::getPageDocumentRange(int pageIndex) {
             // printf("start pt.y %d start_y %d end_y %d\n", pt.y, start_y, end_y);
             if (pt.y >= start_y && pt.y <= end_y)
                 break; // we found our start of page xpointer
+            start_h++;
+        }
+        else {
+            start_h = m_doc->getFinalBlockScanY(start_y + start_h, true) - start_y;
         }
     }
+    if (start_h > height)
+        start_h = height;
     int end_h;
-    for (end_h=height; end_h >= start_h; end_h--) {
+    for (end_h=height; end_h >= start_h; ) {
         end = m_doc->createXPointer(lvPoint(GetWidth(), start_y + end_h), PT_DIR_SCAN_BACKWARD_LOGICAL_LAST);
             // (x=GetWidth() might be redundant with PT_DIR_SCAN_BACKWARD_LOGICAL_LAST, but it might help skiping floats)
         // printf("  end (%d=%d): %s\n", end_h, start_y + end_h, UnicodeToLocal(end.toString()).c_str());
@@ -3009,6 +3361,10 @@ LVRef<ldomXRange> LVDocView::getPageDocumentRange(int pageIndex) {
             // printf("end pt.y %d start_y %d end_y %d\n", pt.y, start_y, end_y);
             if (pt.y >= start_y && pt.y <= end_y)
                 break; // we found our end of page xpointer
+            end_h--;
+        }
+        else {
+            end_h = m_doc->getFinalBlockScanY(start_y + end_h, false) - start_y;
         }
     }
     if (start.isNull() || end.isNull())
@@ -3155,6 +3511,18 @@ void LVDocView::Render(int dx, int dy, LVRendPageList * pages) {
 			m_section_bounds_valid = false;
 			fontMan->gc();
 		}
+		if ( m_props->getBoolDef(PROP_RENDER_PROGRESSIVE, false) ) {
+			if ( m_doc->isProgressiveRenderingEnabled() && m_doc->isRerenderingDelayed(true) ) {
+				// Only render now the part of the document at the current position:
+				// the others will be when drawn, or by continueProgressiveRendering()
+				CRTimerUtil now(0);
+				m_doc->renderPendingFragments(_posBookmark.getNode(), now);
+				m_section_bounds_valid = false;
+			} else {
+				// Fully rendered (or loaded from cache): next rerenderings can be progressive
+				m_doc->enableProgressiveRendering(true);
+			}
+		}
 		m_is_rendered = true;
 		//CRLog::debug("Making TOC...");
 		//makeToc();
@@ -3371,6 +3739,17 @@ bool LVDocView::getCursorRect(ldomXPointer ptr, lvRect & rc,
 	return false;
 }
 
+/// set props identifying file content, used as cache file key
+static void setFileKeyProps(CRPropRef props, LVStreamRef stream) {
+	if (isFileFingerprintUsedAsCacheKey()) {
+		props->setHex(DOC_PROP_FILE_CRC32, 0);
+		props->setInt64(DOC_PROP_FILE_FINGERPRINT, (lInt64)stream->getFingerprint());
+	} else {
+		props->setHex(DOC_PROP_FILE_CRC32, stream->getcrc32());
+		props->setInt64(DOC_PROP_FILE_FINGERPRINT, 0);
+	}
+}
+
 /// follow link, returns true if navigation was successful
 bool LVDocView::goLink(lString32 link, bool savePos) {
 	CRLog::debug("goLink(%s)", LCSTR(link));
@@ -3461,7 +3840,7 @@ bool LVDocView::goLink(lString32 link, bool savePos) {
 			m_doc_props->setString(DOC_PROP_CODE_BASE, LVExtractPath(filename));
 			m_doc_props->setString(DOC_PROP_FILE_SIZE, lString32::itoa(
 					(int) stream->GetSize()));
-            m_doc_props->setHex(DOC_PROP_FILE_CRC32, stream->getcrc32());
+            setFileKeyProps(m_doc_props, stream);
 			// TODO: load document from stream properly
 			if (!LoadDocument(stream)) {
                 createDefaultDocument(cs32("Load error"), lString32(
@@ -4174,6 +4553,7 @@ static void FileToArcProps(CRPropRef props) {
     props->setString(DOC_PROP_FILE_PATH, lString32::empty_str);
     props->setString(DOC_PROP_FILE_SIZE, lString32::empty_str);
 	props->setHex(DOC_PROP_FILE_CRC32, 0);
+	props->setInt64(DOC_PROP_FILE_FINGERPRINT, 0);
 }
 
 /// load document from file
@@ -4226,7 +4606,7 @@ bool LVDocView::LoadDocument(const lChar32 * fname, bool metadataOnly) {
 				(int) stream->GetSize()));
 		m_doc_props->setString(DOC_PROP_FILE_NAME, arcItemPathName);
 		if (!metadataOnly)
-			m_doc_props->setHex(DOC_PROP_FILE_CRC32, stream->getcrc32());
+			setFileKeyProps(m_doc_props, stream);
 		// loading document
 		if (LoadDocument(stream, metadataOnly)) {
 			m_filename = lString32(fname);
@@ -4273,7 +4653,7 @@ bool LVDocView::LoadDocument(const lChar32 * fname, bool metadataOnly) {
 	m_doc_props->setString(DOC_PROP_FILE_SIZE, lString32::itoa(
 			(int) stream->GetSize()));
 	if (!metadataOnly)
-		m_doc_props->setHex(DOC_PROP_FILE_CRC32, stream->getcrc32());
+		setFileKeyProps(m_doc_props, stream);
 
 	if (LoadDocument(stream, metadataOnly)) {
 		m_filename = lString32(fname);
@@ -4805,7 +5185,7 @@ bool LVDocView::LoadDocument(LVStreamRef stream, bool metadataOnly) {
 						m_doc_props->setString(DOC_PROP_CODE_BASE, LVExtractPath(fn, false));
 					m_doc_props->setString(DOC_PROP_FILE_SIZE, lString32::itoa((int)m_stream->GetSize()));
 					if (!metadataOnly)
-						m_doc_props->setHex(DOC_PROP_FILE_CRC32, m_stream->getcrc32());
+						setFileKeyProps(m_doc_props, m_stream);
 					found = true;
 				}
 			}
@@ -4962,6 +5342,9 @@ void LVDocView::createEmptyDocument() {
             PROP_EMBEDDED_FONTS, true));
     m_doc->setDocFlag(DOC_FLAG_NONLINEAR_PAGEBREAK, m_props->getBoolDef(
             PROP_NONLINEAR_PAGEBREAK, false));
+    m_doc->setTextSearchIndexEnabled(m_props->getBoolDef(PROP_TEXT_SEARCH_INDEX, false));
+    m_doc->setLayoutProfilesLimits(m_props->getIntDef(PROP_LAYOUT_PROFILES_MAX_COUNT, 0),
+            m_props->getIntDef(PROP_LAYOUT_PROFILES_MAX_SIZE, DEF_LAYOUT_PROFILES_MAX_SIZE));
     m_doc->setSpaceWidthScalePercent(m_props->getIntDef(PROP_FORMAT_SPACE_WIDTH_SCALE_PERCENT, DEF_SPACE_WIDTH_SCALE_PERCENT));
     m_doc->setMinSpaceCondensingPercent(m_props->getIntDef(PROP_FORMAT_MIN_SPACE_CONDENSING_PERCENT, DEF_MIN_SPACE_CONDENSING_PERCENT));
     m_doc->setUnusedSpaceThresholdPercent(m_props->getIntDef(PROP_FORMAT_UNUSED_SPACE_THRESHOLD_PERCENT, DEF_UNUSED_SPACE_THRESHOLD_PERCENT));
@@ -5041,10 +5424,11 @@ bool LVDocView::ParseDocument() {
 		lString32 fn =
 				m_doc_props->getStringDef(DOC_PROP_FILE_NAME, "untitled");
 		fn = LVExtractFilename(fn);
-		lUInt32 crc = 0;
-        m_stream->getcrc32(crc);
-		CRLog::debug("Check whether document %s crc %08x exists in cache",
-				UnicodeToUtf8(fn).c_str(), crc);
+		// (don't compute it here: it is already known when caching is used)
+		lUInt32 crc = (lUInt32)m_doc_props->getIntDef(DOC_PROP_FILE_CRC32, 0);
+		lUInt64 fingerprint = (lUInt64)m_doc_props->getInt64Def(DOC_PROP_FILE_FINGERPRINT, 0);
+		CRLog::debug("Check whether document %s crc %08x fingerprint %016llx exists in cache",
+				UnicodeToUtf8(fn).c_str(), crc, (unsigned long long)fingerprint);
 
 		// set stylesheet
         updateDocStyleSheet();
@@ -5343,6 +5727,48 @@ ContinuousOperationResult LVDocView::updateCache()
     return swapToCache(infinite);
 }
 
+/// wait for data saved to cache file to be written to disk, with timeout option
+ContinuousOperationResult LVDocView::waitCacheWrites(CRTimerUtil & maxTime)
+{
+    if ( !m_doc )
+        return CR_DONE;
+    return m_doc->waitCacheWrites(maxTime);
+}
+
+/// save unsaved data to cache file, and wait for it to be on disk (e.g. before the app is suspended)
+ContinuousOperationResult LVDocView::syncCache()
+{
+    if ( !m_doc )
+        return CR_DONE;
+    CRTimerUtil infinite;
+    if ( m_doc->updateMap(infinite) == CR_ERROR )
+        return CR_ERROR;
+    return m_doc->waitCacheWrites(infinite);
+}
+
+/// with progressive rendering, render the parts of the document not yet rendered, with timeout option
+ContinuousOperationResult LVDocView::continueProgressiveRendering(CRTimerUtil & maxTime)
+{
+    LVLock lock(getMutex());
+    if ( !m_doc || !m_is_rendered || !m_doc->getPendingFragmentsCount() )
+        return CR_DONE;
+    ContinuousOperationResult res = m_doc->renderPendingFragments(_posBookmark.getNode(), maxTime);
+    // Pages before the current one may have changed: stay at the current position
+    m_section_bounds_valid = false;
+    clearImageCache();
+    _posIsSet = false;
+    if ( res == CR_DONE ) {
+        CRLog::info("Progressive rendering done: %d pages", m_pages.length());
+        // Have TOC and page map page numbers updated when next needed
+        m_doc->getToc()->invalidatePageNumbers();
+        m_doc->getPageMap()->invalidatePageInfo();
+        updateBookMarksRanges();
+        if ( m_callback )
+            m_callback->OnPageNumbersFinal();
+    }
+    return res;
+}
+
 /// save document to cache file, with timeout option
 ContinuousOperationResult LVDocView::swapToCache(CRTimerUtil & maxTime)
 {
@@ -5471,7 +5897,7 @@ ldomXPointer LVDocView::getBookmark( bool precise ) {
 			// Let's do the same in that case: get the previous text node
 			// position
 			if (precise) {
-				for (int y = _pos; y >= 0; y--) {
+				for (int y = _pos; y >= 0; y = m_doc->getFinalBlockScanY(y, false)) {
 					ptr = m_doc->createXPointer(lvPoint(0, y), PT_DIR_SCAN_BACKWARD_LOGICAL_FIRST);
 					if (!ptr.isNull())
 						break;
@@ -7146,6 +7572,15 @@ CRPropRef LVDocView::propsApply(CRPropRef props) {
             if (m_doc) // not when noDefaultDocument=true
                 getDocument()->setDocFlag(DOC_FLAG_NONLINEAR_PAGEBREAK, value);
             REQUEST_RENDER("propsApply nonlinear")
+        } else if (name == PROP_TEXT_SEARCH_INDEX) {
+            bool value = props->getBoolDef(PROP_TEXT_SEARCH_INDEX, false);
+            if (m_doc) // not when noDefaultDocument=true
+                getDocument()->setTextSearchIndexEnabled(value); // (built on next search if needed)
+        } else if (name == PROP_LAYOUT_PROFILES_MAX_COUNT || name == PROP_LAYOUT_PROFILES_MAX_SIZE) {
+            m_props->setString(name.c_str(), value); // both limits needed
+            if (m_doc) // not when noDefaultDocument=true
+                getDocument()->setLayoutProfilesLimits(m_props->getIntDef(PROP_LAYOUT_PROFILES_MAX_COUNT, 0),
+                        m_props->getIntDef(PROP_LAYOUT_PROFILES_MAX_SIZE, DEF_LAYOUT_PROFILES_MAX_SIZE));
         } else if (name == PROP_FOOTNOTES) {
             bool value = props->getBoolDef(PROP_FOOTNOTES, true);
             if (m_doc) // not when noDefaultDocument=true
@@ -7165,6 +7600,17 @@ CRPropRef LVDocView::propsApply(CRPropRef props) {
                 if (getDocument()->setDOMVersionRequested(value)) {
                     REQUEST_RENDER("propsApply requested dom version")
                 }
+        } else if (name == PROP_RENDER_PROGRESSIVE) {
+            bool value = props->getBoolDef(PROP_RENDER_PROGRESSIVE, false);
+            if (m_doc) { // not when noDefaultDocument=true
+                if (!value) {
+                    // Pages from partial rerenderings would stay: have a full rendering done
+                    if (getDocument()->enableProgressiveRendering(false))
+                        REQUEST_RENDER("propsApply progressive rendering")
+                } else if (m_is_rendered) {
+                    getDocument()->enableProgressiveRendering(true);
+                }
+            }
         } else if (name == PROP_RENDER_BLOCK_RENDERING_FLAGS) {
             lUInt32 value = (lUInt32)props->getIntDef(PROP_RENDER_BLOCK_RENDERING_FLAGS, DEF_RENDER_BLOCK_RENDERING_FLAGS);
             if (m_doc) // not when noDefaultDocument=true
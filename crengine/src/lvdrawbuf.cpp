@@ -18,6 +18,13 @@
 #include <stdio.h>
 #include <string.h>
 #include "../include/lvdrawbuf.h"
+#include "../include/crlocks.h"
+#include "../include/lvptrvec.h"
+
+#ifndef IMAGE_BITMAP_CACHE_SIZE
+/// max total size of decoded and scaled images kept for next draws
+#define IMAGE_BITMAP_CACHE_SIZE 0x1000000
+#endif
 
 #define GUARD_BYTE 0xa5
 #define CHECK_GUARD_BYTE \
@@ -251,6 +258,280 @@ lUInt32 Dither1BitColor( lUInt32 color, lUInt32 x, lUInt32 y )
     return (cl >> 7) & 1;
 }
 
+// Row kernels for glyph blending, gray conversion and ordered dithering.
+// Like qimagescale, the instruction set is chosen at build time: with GCC or Clang,
+// they handle 16 pixels at a time using generic vector types, which get compiled
+// to SSE2 on x86 and to NEON on ARM. Remaining pixels (and other compilers) go
+// through the scalar code, and both give the exact same results.
+// Define CR_DRAWBUF_NO_SIMD to only use the scalar code.
+#if !defined(CR_DRAWBUF_NO_SIMD) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 9)) \
+        && (defined(__SSE2__) || defined(__ARM_NEON))
+#define CR_DRAWBUF_SIMD 1
+#else
+#define CR_DRAWBUF_SIMD 0
+#endif
+
+#if (CR_DRAWBUF_SIMD==1)
+typedef lUInt8  cr_u8x16  __attribute__((vector_size(16)));
+typedef lUInt16 cr_u16x16 __attribute__((vector_size(32)));
+typedef lUInt32 cr_u32x16 __attribute__((vector_size(64)));
+typedef lUInt8  cr_u8x4   __attribute__((vector_size(4)));
+typedef lUInt32 cr_u32x4  __attribute__((vector_size(16)));
+typedef lInt32  cr_i32x4  __attribute__((vector_size(16)));
+
+// Per lane select: m ? a : b (m lanes are all ones or all zeros, as given by comparisons)
+#define CR_VSEL(T, m, a, b) ( ((T)(m) & (a)) | (~(T)(m) & (b)) )
+
+static inline bool isZeroBlock16( const lUInt8 * __restrict p )
+{
+    lUInt64 w[2];
+    memcpy( w, p, 16 );
+    return !(w[0] | w[1]);
+}
+#endif
+
+/// Blend a row of glyph opacities with color onto an 8-bit gray row
+static void blendGlyphRowGray8( lUInt8 * __restrict dst, const lUInt8 * __restrict src, int n, lUInt8 color, lUInt8 bopacity )
+{
+    int i = 0;
+#if (CR_DRAWBUF_SIMD==1)
+    const cr_u16x16 vcolor = (cr_u16x16){} + (lUInt16)color;
+    for ( ; i + 16 <= n; i += 16 ) {
+        if ( isZeroBlock16(src + i) )
+            continue;
+        cr_u8x16 o8, d8;
+        memcpy( &o8, src + i, 16 );
+        memcpy( &d8, dst + i, 16 );
+        const cr_u16x16 o = __builtin_convertvector( o8, cr_u16x16 );
+        const cr_u16x16 d = __builtin_convertvector( d8, cr_u16x16 );
+        const cr_u16x16 opacity = (o * (lUInt16)bopacity) >> 8;
+        cr_u16x16 r = (d * ((lUInt16)0xFF - opacity) + vcolor * opacity) >> 8;
+        r = CR_VSEL( cr_u16x16, opacity == 0, d, r );
+        if ( bopacity == 0xFF )
+            r = CR_VSEL( cr_u16x16, o == 0xFF, vcolor, r );
+        d8 = __builtin_convertvector( r, cr_u8x16 );
+        memcpy( dst + i, &d8, 16 );
+    }
+#endif
+    for ( ; i < n; i++ ) {
+        lUInt8 opacity = src[i]; // glyph opacity
+        if ( opacity == 0 ) {
+            // Background pixel, NOP
+        }
+        else if (opacity == 0xFF && bopacity == 0xFF) { // fully opaque pixel and color
+            dst[i] = color;
+        }
+        else {
+            opacity = (opacity*bopacity)>>8;
+            const lUInt8 alpha = opacity ^ 0xFF;
+            ApplyAlphaGray8( dst[i], color, alpha, opacity );
+        }
+    }
+}
+
+/// Blend a row of glyph opacities with color onto a RGB565 row
+static void blendGlyphRowRGB565( lUInt16 * __restrict dst, const lUInt8 * __restrict src, int n, lUInt16 color, lUInt8 bopacity )
+{
+    int i = 0;
+#if (CR_DRAWBUF_SIMD==1)
+    // Channels are blended separately: ((d<<s)*alpha + (c<<s)*opacity)>>8 masked back
+    // in place is the same as ((d*alpha + c*opacity)>>8)<<s
+    const lUInt16 cr = color >> 11;
+    const lUInt16 cg = (color >> 5) & 0x3F;
+    const lUInt16 cb = color & 0x1F;
+    for ( ; i + 16 <= n; i += 16 ) {
+        if ( isZeroBlock16(src + i) )
+            continue;
+        cr_u8x16 o8;
+        cr_u16x16 d;
+        memcpy( &o8, src + i, 16 );
+        memcpy( &d, dst + i, 32 );
+        const cr_u16x16 o = __builtin_convertvector( o8, cr_u16x16 );
+        const cr_u16x16 opacity = (o * (lUInt16)bopacity) >> 8;
+        const cr_u16x16 alpha = opacity ^ (lUInt16)0xFF;
+        const cr_u16x16 r = (((d >> 11) * alpha + cr * opacity) >> 8) << 11;
+        const cr_u16x16 g = ((((d >> 5) & (lUInt16)0x3F) * alpha + cg * opacity) >> 8) << 5;
+        const cr_u16x16 b = ((d & (lUInt16)0x1F) * alpha + cb * opacity) >> 8;
+        cr_u16x16 res = r | g | b;
+        if ( bopacity == 0xFF )
+            res = CR_VSEL( cr_u16x16, o == 0xFF, (cr_u16x16){} + color, res );
+        res = CR_VSEL( cr_u16x16, o == 0, d, res );
+        memcpy( dst + i, &res, 32 );
+    }
+#endif
+    for ( ; i < n; i++ ) {
+        // Note: former code was considering pixel opacity >= 0xF0 as fully opaque (0xFF),
+        // not sure why (it would save on the blending computation by 5% to 15%).
+        lUInt8 opacity = src[i]; // glyph pixel opacity
+        if ( opacity == 0 ) {
+            // Background pixel, NOP
+        }
+        else if (opacity == 0xFF && bopacity == 0xFF) { // fully opaque pixel and color
+            dst[i] = color;
+        }
+        else {
+            opacity = (opacity*bopacity)>>8;
+            const lUInt8 alpha = opacity ^ 0xFF;
+            const lUInt32 r = (((dst[i] & 0xF800) * alpha + (color & 0xF800) * opacity) >> 8) & 0xF800;
+            const lUInt32 g = (((dst[i] & 0x07E0) * alpha + (color & 0x07E0) * opacity) >> 8) & 0x07E0;
+            const lUInt32 b = (((dst[i] & 0x001F) * alpha + (color & 0x001F) * opacity) >> 8) & 0x001F;
+            dst[i] = (lUInt16)(r | g | b);
+        }
+    }
+}
+
+/// Blend a row of glyph opacities with color (alpha byte cleared) onto a 32-bit row
+static void blendGlyphRowARGB( lUInt32 * __restrict dst, const lUInt8 * __restrict src, int n, lUInt32 color, lUInt8 bopacity )
+{
+    int i = 0;
+#if (CR_DRAWBUF_SIMD==1)
+    for ( ; i + 16 <= n; i += 16 ) {
+        if ( isZeroBlock16(src + i) )
+            continue;
+        cr_u8x16 o8;
+        cr_u32x16 d;
+        memcpy( &o8, src + i, 16 );
+        memcpy( &d, dst + i, 64 );
+        const cr_u32x16 o = __builtin_convertvector( o8, cr_u32x16 );
+        const cr_u32x16 opacity = (o * (lUInt32)bopacity) >> 8;
+        const cr_u32x16 alpha = opacity ^ (lUInt32)0xFF;
+        const cr_u32x16 n1 = (((d & (lUInt32)0xFF00FF) * alpha + (color & 0xFF00FF) * opacity) >> 8) & (lUInt32)0xFF00FF;
+        const cr_u32x16 n2 = (((d & (lUInt32)0x00FF00) * alpha + (color & 0x00FF00) * opacity) >> 8) & (lUInt32)0x00FF00;
+        cr_u32x16 res = n1 | n2;
+        if ( bopacity == 0xFF )
+            res = CR_VSEL( cr_u32x16, o == 0xFF, (cr_u32x16){} + color, res );
+        res = CR_VSEL( cr_u32x16, o == 0, d, res );
+        memcpy( dst + i, &res, 64 );
+    }
+#endif
+    for ( ; i < n; i++ ) {
+        // Note: former code was considering pixel opacity >= 0xF0 as fully opaque (0xFF),
+        // not sure why (it would save on the blending computation by 5% to 15%).
+        lUInt8 opacity = src[i]; // glyph pixel opacity
+        if ( opacity == 0 ) {
+            // Background pixel, NOP
+        }
+        else if (opacity == 0xFF && bopacity == 0xFF) { // fully opaque pixel and color
+            dst[i] = color;
+        }
+        else {
+            opacity = (opacity*bopacity)>>8;
+            const lUInt8 alpha = opacity ^ 0xFF;
+            const lUInt32 n1 = (((dst[i] & 0xFF00FF) * alpha + (color & 0xFF00FF) * opacity) >> 8) & 0xFF00FF;
+            const lUInt32 n2 = (((dst[i] & 0x00FF00) * alpha + (color & 0x00FF00) * opacity) >> 8) & 0x00FF00;
+            dst[i] = n1 | n2;
+        }
+    }
+}
+
+/// true if no pixel of the row has any transparency
+static bool isOpaqueRow( const lUInt32 * __restrict src, int n )
+{
+    int i = 0;
+    lUInt32 acc = 0;
+#if (CR_DRAWBUF_SIMD==1)
+    cr_u32x16 vacc = {};
+    for ( ; i + 16 <= n; i += 16 ) {
+        cr_u32x16 s;
+        memcpy( &s, src + i, 64 );
+        vacc |= s;
+    }
+    for ( int k = 0; k < 16; k++ )
+        acc |= vacc[k];
+#endif
+    for ( ; i < n; i++ )
+        acc |= src[i];
+    return (acc & 0xFF000000) == 0;
+}
+
+/// Convert a row of colors to gray: dst = ((rgbToGray(src ^ colorxor) >> shift) & mask) ^ outxor
+/// (left as a plain loop: compilers vectorize it better than the explicit kernels would)
+static void grayRow( lUInt8 * __restrict dst, const lUInt32 * __restrict src, int n, lUInt32 colorxor, int shift, lUInt8 mask, lUInt8 outxor )
+{
+    for ( int i = 0; i < n; i++ )
+        dst[i] = (lUInt8)(((rgbToGray(src[i] ^ colorxor) >> shift) & mask) ^ outxor);
+}
+
+/// Ordered dithering of a row of colors (src ^ colorxor), one output byte per pixel
+/// (^ outxor), x and y being the position of the first pixel in the dithering pattern:
+/// bpp 1 and 2 give Dither1BitColor()/Dither2BitColor() values, bpp 3 and 4
+/// DitherNBitColor() ones, and bpp 8 dither_o8x8() of rgbToGray()
+static void ditherRow( lUInt8 * __restrict dst, const lUInt32 * __restrict src, int n, int x, int y, int bpp, lUInt32 colorxor, lUInt8 outxor )
+{
+    int i = 0;
+#if (CR_DRAWBUF_SIMD==1)
+    if ( n >= 4 ) {
+        // The pattern is 8 pixels wide: blocks of 4 alternate between its two halves
+        cr_i32x4 thr[2];
+        for ( int k = 0; k < 8; k++ ) {
+            const int pos = ((x + k) & 7) | ((y & 7) << 3);
+            thr[k >> 2][k & 3] = bpp == 8 ? threshold_map_o8x8[pos] : dither_2bpp_8x8[pos] - 1;
+        }
+        const int bits = bpp == 3 ? 3 : 4;
+        const lInt32 white = (1 << bits) - 1;
+        const lInt32 nmask = white << (8 - bits);
+        const int nshift = bits - 2;
+        for ( ; i + 4 <= n; i += 4 ) {
+            const cr_i32x4 t = thr[(i >> 2) & 1];
+            cr_u32x4 s;
+            memcpy( &s, src + i, 16 );
+            s ^= colorxor;
+            const cr_i32x4 r = (cr_i32x4)((s >> 16) & (lUInt32)0xFF);
+            const cr_i32x4 g = (cr_i32x4)((s >> 8) & (lUInt32)0xFF);
+            const cr_i32x4 b = (cr_i32x4)(s & (lUInt32)0xFF);
+            cr_i32x4 res;
+            if ( bpp == 8 ) {
+                const cr_i32x4 gray = (r + g + g + b) >> 2;
+                const cr_i32x4 v = gray * 961 + 128; // DIV255(v * ((15U << 6) + 1U))
+                cr_i32x4 q = ((v >> 8) + v) >> 8;
+                const cr_i32x4 l = q >> 6;
+                q -= l << 6;
+                res = (l - (cr_i32x4)(q >= t)) * 17; // (q >= t) lanes are -1 when true
+                res = CR_VSEL( cr_i32x4, res > 0xFF, (cr_i32x4){} + 0xFF, res );
+            } else if ( bpp >= 3 ) {
+                const cr_i32x4 cl = (r + g + g + b) >> 2;
+                cr_i32x4 v = ((cl << nshift) + t - 32) >> nshift;
+                v = CR_VSEL( cr_i32x4, v > 255, (cr_i32x4){} + 255, v );
+                v = CR_VSEL( cr_i32x4, v < 0, (cr_i32x4){}, v );
+                res = v & nmask;
+                res = CR_VSEL( cr_i32x4, cl >= 255 - white, (cr_i32x4){} + nmask, res );
+                res = CR_VSEL( cr_i32x4, cl < white, (cr_i32x4){}, res );
+            } else {
+                const cr_i32x4 cl = ((r + g + b) * (256/3)) >> 8;
+                const cr_i32x4 v = cl + t - 32;
+                const lInt32 top = bpp == 2 ? 3 : 1;
+                res = bpp == 2 ? (v >> 6) & 3 : (v >> 7) & 1;
+                res = CR_VSEL( cr_i32x4, v >= 250, (cr_i32x4){} + top, res );
+                res = CR_VSEL( cr_i32x4, v < 5, (cr_i32x4){}, res );
+                res = CR_VSEL( cr_i32x4, cl >= (bpp == 2 ? 250 : 240), (cr_i32x4){} + top, res );
+                res = CR_VSEL( cr_i32x4, cl < (bpp == 2 ? 5 : 16), (cr_i32x4){}, res );
+            }
+            cr_u8x4 d8 = __builtin_convertvector( res, cr_u8x4 );
+            d8 ^= outxor;
+            memcpy( dst + i, &d8, 4 );
+        }
+    }
+#endif
+    for ( ; i < n; i++ ) {
+        lUInt32 dcl;
+        switch ( bpp ) {
+        case 1:
+            dcl = Dither1BitColor( src[i] ^ colorxor, x + i, y );
+            break;
+        case 2:
+            dcl = Dither2BitColor( src[i] ^ colorxor, x + i, y );
+            break;
+        case 8:
+            dcl = dither_o8x8( x + i, y, rgbToGray( src[i] ^ colorxor ) );
+            break;
+        default:
+            dcl = DitherNBitColor( src[i] ^ colorxor, x + i, y, bpp );
+            break;
+        }
+        dst[i] = (lUInt8)(dcl ^ outxor);
+    }
+}
+
 static lUInt8 revByteBits1( lUInt8 b )
 {
     return ( (b&1)<<7 )
@@ -454,6 +735,7 @@ private:
     bool dither;
     bool invert;
     bool smoothscale;
+    bool wantsmooth;
     lUInt8 * __restrict decoded;
     bool isNinePatch;
 public:
@@ -502,7 +784,7 @@ public:
         return map;
     }
     LVImageScaledDrawCallback(LVBaseDrawBuf * dstbuf, LVImageSourceRef img, int x, int y, int width, int height, bool dith, bool inv, bool smooth )
-    : src(img), dst(dstbuf), dst_x(x), dst_y(y), dst_dx(width), dst_dy(height), xmap(0), ymap(0), dither(dith), invert(inv), smoothscale(smooth), decoded(0)
+    : src(img), dst(dstbuf), dst_x(x), dst_y(y), dst_dx(width), dst_dy(height), xmap(0), ymap(0), dither(dith), invert(inv), smoothscale(smooth), wantsmooth(smooth), decoded(0)
     {
         src_dx = img->GetWidth();
         src_dy = img->GetHeight();
@@ -547,6 +829,37 @@ public:
         height = dst_dy;
         return true;
     }
+    virtual bool OnScaledDecode( LVImageSource *, int width, int height )
+    {
+        // Nine-patch frames are expressed in the image's own pixels: keep those full size
+        if ( isNinePatch || width < dst_dx || height < dst_dy )
+            return false;
+        // The decoder will shrink the image for us: redo our own scaling setup for what's left
+        if (xmap) {
+            delete[] xmap;
+            xmap = 0;
+        }
+        if (ymap) {
+            delete[] ymap;
+            ymap = 0;
+        }
+        if (decoded) {
+            delete[] decoded;
+            decoded = 0;
+        }
+        src_dx = width;
+        src_dy = height;
+        smoothscale = wantsmooth && (src_dx != dst_dx || src_dy != dst_dy);
+        if (smoothscale) {
+            decoded = new lUInt8[src_dy * (src_dx * 4)];
+        } else {
+            if ( src_dx != dst_dx )
+                xmap = GenMap( src_dx, dst_dx );
+            if ( src_dy != dst_dy )
+                ymap = GenMap( src_dy, dst_dy );
+        }
+        return true;
+    }
     virtual ~LVImageScaledDrawCallback()
     {
         if (xmap)
@@ -605,11 +918,16 @@ public:
 //        }
         lvRect clip;
         dst->GetClipRect( &clip );
+        const int bpp = dst->GetBitsPerPixel();
+        // When the visible part of an unscaled line is fully opaque, gray buffers
+        // don't need any blending: convert it with the row kernels in one go
+        const int vis_x0 = clip.left > dst_x ? clip.left - dst_x : 0;
+        const int vis_x1 = clip.right - dst_x < dst_dx ? clip.right - dst_x : dst_dx;
+        const bool opaqueRow = bpp <= 8 && !xmap && vis_x0 < vis_x1 && isOpaqueRow( data + vis_x0, vis_x1 - vis_x0 );
         for ( ;yy<yy2; yy++ )
         {
             if ( yy+dst_y<clip.top || yy+dst_y>=clip.bottom )
                 continue;
-            const int bpp = dst->GetBitsPerPixel();
             if ( bpp >= 24 )
             {
                 lUInt32 * __restrict row = (lUInt32 *)dst->GetScanLine( yy + dst_y );
@@ -690,6 +1008,21 @@ public:
             {
                 lUInt8 * __restrict row = (lUInt8 *)dst->GetScanLine( yy + dst_y );
                 row += dst_x;
+                if ( opaqueRow ) {
+                    const int n = vis_x1 - vis_x0;
+                    if ( dither && bpp < 8 ) {
+#if (GRAY_INVERSE==1)
+                        ditherRow( row + vis_x0, data + vis_x0, n, vis_x0, yy, bpp, 0xFFFFFF, gray_invert );
+#else
+                        ditherRow( row + vis_x0, data + vis_x0, n, vis_x0, yy, bpp, 0, gray_invert );
+#endif
+                    } else if ( dither && bpp == 8 ) {
+                        ditherRow( row + vis_x0, data + vis_x0, n, vis_x0, yy, 8, 0, gray_invert );
+                    } else {
+                        grayRow( row + vis_x0, data + vis_x0, n, 0, 0, (lUInt8)(((1<<bpp)-1)<<(8-bpp)), gray_invert );
+                    }
+                    continue;
+                }
                 for (int x=0; x<dst_dx; x++)
                 {
                     const int xx = x + dst_x;
@@ -747,6 +1080,29 @@ public:
                 //fprintf( stderr, "." );
                 lUInt8 * __restrict row = (lUInt8 *)dst->GetScanLine( yy+dst_y );
                 //row += dst_x;
+                if ( opaqueRow ) {
+                    lUInt8 dcls[256];
+                    for ( int x0 = vis_x0; x0 < vis_x1; x0 += 256 ) {
+                        const int n = vis_x1 - x0 < 256 ? vis_x1 - x0 : 256;
+                        if ( dither ) {
+#if (GRAY_INVERSE==1)
+                            ditherRow( dcls, data + x0, n, x0, yy, 2, rgba_invert, 3 );
+#else
+                            ditherRow( dcls, data + x0, n, x0, yy, 2, rgba_invert, 0 );
+#endif
+                        } else {
+                            grayRow( dcls, data + x0, n, rgba_invert, 6, 3, 0 );
+                        }
+                        for ( int i = 0; i < n; i++ ) {
+                            const int xx = x0 + i + dst_x;
+                            const int byteindex = (xx >> 2);
+                            const int bitindex = (3-(xx & 3))<<1;
+                            const lUInt8 mask = 0xC0 >> (6 - bitindex);
+                            row[ byteindex ] = (lUInt8)((row[ byteindex ] & (~mask)) | (dcls[i] << bitindex));
+                        }
+                    }
+                    continue;
+                }
                 for (int x=0; x<dst_dx; x++)
                 {
                     const int xx = x + dst_x;
@@ -797,6 +1153,29 @@ public:
                 //fprintf( stderr, "." );
                 lUInt8 * __restrict row = (lUInt8 *)dst->GetScanLine( yy+dst_y );
                 //row += dst_x;
+                if ( opaqueRow ) {
+                    lUInt8 dcls[256];
+                    for ( int x0 = vis_x0; x0 < vis_x1; x0 += 256 ) {
+                        const int n = vis_x1 - x0 < 256 ? vis_x1 - x0 : 256;
+                        if ( dither ) {
+#if (GRAY_INVERSE==1)
+                            ditherRow( dcls, data + x0, n, x0, yy, 1, rgba_invert, 1 );
+#else
+                            ditherRow( dcls, data + x0, n, x0, yy, 1, rgba_invert, 0 );
+#endif
+                        } else {
+                            grayRow( dcls, data + x0, n, rgba_invert, 7, 1, 0 );
+                        }
+                        for ( int i = 0; i < n; i++ ) {
+                            const int xx = x0 + i + dst_x;
+                            const int byteindex = (xx >> 3);
+                            const int bitindex = ((xx & 7));
+                            const lUInt8 mask = 0x80 >> (bitindex);
+                            row[ byteindex ] = (lUInt8)((row[ byteindex ] & (~mask)) | (dcls[i] << (7-bitindex)));
+                        }
+                    }
+                    continue;
+                }
                 for (int x=0; x<dst_dx; x++)
                 {
                     const int xx = x + dst_x;
@@ -880,6 +1259,195 @@ public:
 };
 
 
+// Decoded and scaled image, as the 32 bpp lines LVImageScaledDrawCallback
+// plots: drawing it again only costs dithering and blending it into the
+// target buffer. Each draw gets a new image source from the document, so
+// images are identified by the content fingerprint of their source stream.
+struct LVImageBitmapKey {
+    lUInt64 fingerprint;
+    int src_dx;
+    int src_dy;
+    int dx;
+    int dy;
+    bool smooth;
+    bool stretch;
+    bool operator == ( const LVImageBitmapKey & v ) const
+    {
+        return fingerprint == v.fingerprint && src_dx == v.src_dx && src_dy == v.src_dy
+            && dx == v.dx && dy == v.dy && smooth == v.smooth && stretch == v.stretch;
+    }
+};
+
+class LVImageBitmap : public LVRefCounter
+{
+public:
+    LVImageBitmapKey key;
+    lUInt32 * pixels;
+    int size() const { return key.dx * key.dy * 4; }
+    LVImageBitmap( const LVImageBitmapKey & k ) : key(k)
+    {
+        pixels = (lUInt32 *)malloc( size() );
+    }
+    ~LVImageBitmap()
+    {
+        free( pixels );
+    }
+};
+typedef LVFastRef<LVImageBitmap> LVImageBitmapRef;
+
+/// image source decoding a cached bitmap
+class LVImageBitmapSource : public LVImageSource
+{
+    LVImageBitmapRef _bitmap;
+public:
+    LVImageBitmapSource( const LVImageBitmapRef & bitmap ) : _bitmap(bitmap) { }
+    virtual ldomDocument * GetSourceDocument() { return NULL; }
+    virtual ldomNode * GetSourceNode() { return NULL; }
+    virtual LVStream * GetSourceStream() { return NULL; }
+    virtual void   Compact() { }
+    virtual int    GetWidth() const { return _bitmap->key.dx; }
+    virtual int    GetHeight() const { return _bitmap->key.dy; }
+    virtual bool   Decode( LVImageDecoderCallback * callback )
+    {
+        const int dx = _bitmap->key.dx;
+        const int dy = _bitmap->key.dy;
+        callback->OnStartDecode( this );
+        for ( int y=0; y<dy; y++ ) {
+            if ( !callback->OnLineDecoded( this, y, _bitmap->pixels + y * dx ) )
+                break;
+        }
+        callback->OnEndDecode( this, false );
+        return true;
+    }
+};
+
+/// Decoded images, least recently used first, protected by IMAGE_BITMAP_CACHE_GUARD
+class LVImageBitmapCache
+{
+    struct Item {
+        LVImageBitmapRef bitmap;
+        Item( LVImageBitmapRef b ) : bitmap(b) { }
+    };
+    LVPtrVector<Item> _items;
+    int _size;
+    int _maxSize;
+    void evict( int maxSize )
+    {
+        while ( _size > maxSize && _items.length() ) {
+            Item * item = _items.remove( 0 );
+            _size -= item->bitmap->size();
+            delete item;
+        }
+    }
+public:
+    LVImageBitmapCache() : _size(0), _maxSize(IMAGE_BITMAP_CACHE_SIZE) { }
+    int getMaxSize() const { return _maxSize; }
+    /// returns cached bitmap, and makes it most recently used
+    LVImageBitmapRef get( const LVImageBitmapKey & key )
+    {
+        for ( int i=_items.length()-1; i>=0; i-- ) {
+            if ( _items[i]->bitmap->key == key ) {
+                if ( i < _items.length()-1 )
+                    _items.add( _items.remove( i ) );
+                return _items[_items.length()-1]->bitmap;
+            }
+        }
+        return LVImageBitmapRef();
+    }
+    /// adds bitmap, or returns the one decoded meanwhile by another thread
+    LVImageBitmapRef put( LVImageBitmapRef bitmap )
+    {
+        LVImageBitmapRef existing = get( bitmap->key );
+        if ( !existing.isNull() )
+            return existing;
+        evict( _maxSize - bitmap->size() );
+        _items.add( new Item( bitmap ) );
+        _size += bitmap->size();
+        return bitmap;
+    }
+    void setMaxSize( int maxSize )
+    {
+        _maxSize = maxSize;
+        evict( _maxSize );
+    }
+    void clear()
+    {
+        evict( 0 );
+    }
+};
+
+static LVImageBitmapCache _imageBitmapCache;
+
+// LVGetCachedScaledImage(), also telling if the returned source is a decoded bitmap
+// (which, unlike document images, can be decoded by several threads at once)
+static LVImageSourceRef getCachedScaledImage( LVImageSourceRef img, int width, int height, bool smooth, bool stretch, bool * isBitmap )
+{
+    if ( isBitmap )
+        *isBitmap = false;
+    if ( img.isNull() || width <= 0 || height <= 0 )
+        return img;
+    LVImageSourceRef src = img;
+    if ( stretch && ( width != img->GetWidth() || height != img->GetHeight() ) )
+        src = LVCreateStretchFilledTransform( img, width, height, IMG_TRANSFORM_STRETCH, IMG_TRANSFORM_STRETCH, 0, 0, smooth );
+    LVStream * stream = img->GetSourceStream();
+    if ( !stream || img->GetNinePatchInfo() )
+        return src;
+    LVImageBitmapKey key;
+    key.src_dx = img->GetWidth();
+    key.src_dy = img->GetHeight();
+    key.dx = width;
+    key.dy = height;
+    key.smooth = smooth;
+    key.stretch = stretch;
+    if ( key.src_dx <= 0 || key.src_dy <= 0 || (lInt64)width * height * 4 > _imageBitmapCache.getMaxSize() / 2 )
+        return src;
+    if ( stream->getFingerprint( key.fingerprint ) != LVERR_OK )
+        return src;
+    LVImageBitmapRef cached;
+    {
+        IMAGE_BITMAP_CACHE_GUARD
+        cached = _imageBitmapCache.get( key );
+    }
+    if ( !cached.isNull() ) {
+        if ( isBitmap )
+            *isBitmap = true;
+        return LVImageSourceRef( new LVImageBitmapSource( cached ) );
+    }
+    // Plot it on a transparent 32 bpp buffer, where it's stored unchanged
+    // (only fully transparent pixels lose their color, which isn't used)
+    LVImageBitmapRef bitmap( new LVImageBitmap( key ) );
+    if ( !bitmap->pixels )
+        return src;
+    LVColorDrawBuf buf( width, height, (lUInt8 *)bitmap->pixels, 32 );
+    buf.Clear( 0xFF000000 );
+    LVImageScaledDrawCallback drawcb( &buf, src, 0, 0, width, height, false, false, smooth );
+    if ( src->Decode( &drawcb ) ) {
+        IMAGE_BITMAP_CACHE_GUARD
+        bitmap = _imageBitmapCache.put( bitmap );
+    }
+    if ( isBitmap )
+        *isBitmap = true;
+    return LVImageSourceRef( new LVImageBitmapSource( bitmap ) );
+}
+
+LVImageSourceRef LVGetCachedScaledImage( LVImageSourceRef img, int width, int height, bool smooth, bool stretch )
+{
+    return getCachedScaledImage( img, width, height, smooth, stretch, NULL );
+}
+
+void LVSetImageBitmapCacheSize( int maxSize )
+{
+    IMAGE_BITMAP_CACHE_GUARD
+    _imageBitmapCache.setMaxSize( maxSize );
+}
+
+void LVClearImageBitmapCache()
+{
+    IMAGE_BITMAP_CACHE_GUARD
+    _imageBitmapCache.clear();
+}
+
+
 int LVBaseDrawBuf::GetWidth() const
 {
     return _dx;
@@ -900,6 +1468,7 @@ void LVGrayDrawBuf::Draw( LVImageSourceRef img, int x, int y, int width, int hei
     //fprintf( stderr, "LVGrayDrawBuf::Draw( img(%d, %d), %d, %d, %d, %d\n", img->GetWidth(), img->GetHeight(), x, y, width, height );
     if ( width<=0 || height<=0 )
         return;
+    img = LVGetCachedScaledImage( img, width, height, _smoothImages );
     LVImageScaledDrawCallback drawcb( this, img, x, y, width, height, _ditherImages, _invertImages, _smoothImages );
     img->Decode( &drawcb );
 
@@ -1216,6 +1785,15 @@ LVGrayDrawBuf::~LVGrayDrawBuf()
     	free( _data );
     }
 }
+
+LVBaseDrawBuf * LVGrayDrawBuf::createView()
+{
+    if ( !_data )
+        return NULL;
+    LVGrayDrawBuf * view = new LVGrayDrawBuf( _dx, _dy, _bpp, _data );
+    view->copySettings( *this );
+    return view;
+}
 void LVGrayDrawBuf::DrawLine(int x0, int y0, int x1, int y1, lUInt32 color0, int length1, int length2, int direction)
 {
     if (x0<_clip.left)
@@ -1332,25 +1910,7 @@ void LVGrayDrawBuf::Draw( int x, int y, const lUInt8 * bitmap, int width, int he
             return;
         while (height--)
         {
-            const lUInt8 * __restrict src = bitmap;
-            lUInt8 * __restrict dst = dstline;
-            size_t px_count = width;
-            while (px_count--)
-            {
-                lUInt8 opacity = *(src++); // glyph opacity
-                if ( opacity == 0 ) {
-                    // Background pixel, NOP
-                }
-                else if (opacity == 0xFF && bopacity == 0xFF) { // fully opaque pixel and color
-                    *dst = color;
-                }
-                else {
-                    opacity = (opacity*bopacity)>>8;
-                    const lUInt8 alpha = opacity ^ 0xFF;
-                    ApplyAlphaGray8( *dst, color, alpha, opacity );
-                }
-                dst++;
-            }
+            blendGlyphRowGray8( dstline, bitmap, width, color, bopacity );
             /* next line, accounting for clipping in src and padding in dst */
             bitmap += bmp_width;
             dstline += _rowsize;
@@ -1531,6 +2091,19 @@ void LVGrayDrawBuf::DrawColorGlyph( int x, int y, const lUInt8 * bitmap, int wid
     CHECK_GUARD_BYTE;
 }
 
+void LVBaseDrawBuf::copySettings( const LVBaseDrawBuf & buf )
+{
+    SetClipRect( &buf._clip );
+    _drawExtraInfo = buf._drawExtraInfo;
+    _backgroundColor = buf._backgroundColor;
+    _textColor = buf._textColor;
+    _hidePartialGlyphs = buf._hidePartialGlyphs;
+    _invertImages = buf._invertImages;
+    _invertColors = buf._invertColors;
+    _ditherImages = buf._ditherImages;
+    _smoothImages = buf._smoothImages;
+}
+
 void LVBaseDrawBuf::SetClipRect( const lvRect * clipRect )
 {
     if (clipRect)
@@ -1637,6 +2210,7 @@ int  LVColorDrawBuf::GetBitsPerPixel() const
 void LVColorDrawBuf::Draw( LVImageSourceRef img, int x, int y, int width, int height, bool dither )
 {
     //fprintf( stderr, "LVColorDrawBuf::Draw( img(%d, %d), %d, %d, %d, %d\n", img->GetWidth(), img->GetHeight(), x, y, width, height );
+    img = LVGetCachedScaledImage( img, width, height, _smoothImages );
     LVImageScaledDrawCallback drawcb( this, img, x, y, width, height, dither, _invertImages, _smoothImages );
     img->Decode( &drawcb );
     _drawnImagesCount++;
@@ -2102,31 +2676,7 @@ void LVColorDrawBuf::Draw( int x, int y, const lUInt8 * bitmap, int width, int h
 
         while (height--)
         {
-            const lUInt8 * __restrict src = bitmap;
-            lUInt16 * __restrict dst = ((lUInt16*)GetScanLine(y++)) + x;
-
-            size_t px_count = width;
-            while (px_count--)
-            {
-                // Note: former code was considering pixel opacity >= 0xF0 as fully opaque (0xFF),
-                // not sure why (it would save on the blending computation by 5% to 15%).
-                lUInt8 opacity = *(src++); // glyph pixel opacity
-                if ( opacity == 0 ) {
-                    // Background pixel, NOP
-                }
-                else if (opacity == 0xFF && bopacity == 0xFF) { // fully opaque pixel and color
-                    *dst = bmpcl16;
-                }
-                else {
-                    opacity = (opacity*bopacity)>>8;
-                    const lUInt8 alpha = opacity ^ 0xFF;
-                    const lUInt32 r = ((((*dst) & 0xF800) * alpha + (bmpcl16 & 0xF800) * opacity) >> 8) & 0xF800;
-                    const lUInt32 g = ((((*dst) & 0x07E0) * alpha + (bmpcl16 & 0x07E0) * opacity) >> 8) & 0x07E0;
-                    const lUInt32 b = ((((*dst) & 0x001F) * alpha + (bmpcl16 & 0x001F) * opacity) >> 8) & 0x001F;
-                    *dst = (lUInt16)(r | g | b);
-                }
-                dst++;
-            }
+            blendGlyphRowRGB565( ((lUInt16*)GetScanLine(y++)) + x, bitmap, width, bmpcl16, bopacity );
             /* new src line, to account for clipping */
             bitmap += bmp_width;
         }
@@ -2138,31 +2688,7 @@ void LVColorDrawBuf::Draw( int x, int y, const lUInt8 * bitmap, int width, int h
 
         while (height--)
         {
-            const lUInt8 * __restrict src = bitmap;
-            lUInt32 * __restrict dst = ((lUInt32*)GetScanLine(y++)) + x;
-
-            size_t px_count = width;
-            while (px_count--)
-            {
-                // Note: former code was considering pixel opacity >= 0xF0 as fully opaque (0xFF),
-                // not sure why (it would save on the blending computation by 5% to 15%).
-                lUInt8 opacity = *(src++); // glyph pixel opacity
-                if ( opacity == 0 ) {
-                    // Background pixel, NOP
-                }
-                else if (opacity == 0xFF && bopacity == 0xFF) { // fully opaque pixel and color
-                    *dst = bmpcl32;
-                }
-                else {
-                    opacity = (opacity*bopacity)>>8;
-                    const lUInt8 alpha = opacity ^ 0xFF;
-                    const lUInt32 n1 = ((((*dst) & 0xFF00FF) * alpha + (bmpcl32 & 0xFF00FF) * opacity) >> 8) & 0xFF00FF;
-                    const lUInt32 n2 = ((((*dst) & 0x00FF00) * alpha + (bmpcl32 & 0x00FF00) * opacity) >> 8) & 0x00FF00;
-                    *dst = n1 | n2;
-                }
-
-                dst++;
-            }
+            blendGlyphRowARGB( ((lUInt32*)GetScanLine(y++)) + x, bitmap, width, bmpcl32, bopacity );
             bitmap += bmp_width;
         }
     }
@@ -3318,6 +3844,15 @@ LVColorDrawBuf::~LVColorDrawBuf()
 #endif
 }
 
+LVBaseDrawBuf * LVColorDrawBuf::createView()
+{
+    if ( !_data )
+        return NULL;
+    LVColorDrawBuf * view = new LVColorDrawBuf( _dx, _dy, _data, _bpp );
+    view->copySettings( *this );
+    return view;
+}
+
 #if 0
 
 /// convert to 1-bit bitmap
@@ -3328,3 +3863,359 @@ void LVColorDrawBuf::ConvertToBitmap(bool flgDither)
 }
 
 #endif
+
+#if (CR_THREAD_SAFE==1)
+
+//=======================================================================
+// LVDrawBandPool, LVRecordingDrawBuf: drawing in horizontal bands
+//=======================================================================
+
+class LVDrawBandJob
+{
+public:
+    /// draws band (called by several threads at once, for different bands)
+    virtual void drawBand( int index ) = 0;
+    virtual ~LVDrawBandJob() { }
+};
+
+class LVDrawBandPool::Worker : public LVThread
+{
+    LVDrawBandPool * _pool;
+public:
+    Worker( LVDrawBandPool * pool ) : _pool(pool) { }
+    virtual void run() { _pool->work(); }
+};
+
+LVDrawBandPool::LVDrawBandPool( int threads )
+    : _job(NULL), _count(0), _next(0), _done(0), _stopped(false)
+{
+    for ( int i=0; i<threads; i++ ) {
+        Worker * worker = new Worker( this );
+        _workers.add( worker );
+        worker->start();
+    }
+}
+
+LVDrawBandPool::~LVDrawBandPool()
+{
+    {
+        LVLock lock( _mutex );
+        _stopped = true;
+        _cond.notifyAll();
+    }
+    for ( int i=0; i<_workers.length(); i++ )
+        _workers[i]->join();
+    _workers.clear();
+}
+
+void LVDrawBandPool::work()
+{
+    _mutex.lock();
+    for (;;) {
+        while ( !_stopped && !(_job && _next < _count) )
+            _cond.wait( _mutex );
+        if ( _stopped )
+            break;
+        LVDrawBandJob * job = _job;
+        int index = _next++;
+        _mutex.unlock();
+        job->drawBand( index );
+        _mutex.lock();
+        if ( ++_done == _count )
+            _cond.notifyAll();
+    }
+    _mutex.unlock();
+}
+
+void LVDrawBandPool::run( LVDrawBandJob * job, int count )
+{
+    LVLock runLock( _runMutex );
+    _mutex.lock();
+    _job = job;
+    _count = count;
+    _next = 0;
+    _done = 0;
+    _cond.notifyAll();
+    // draw the bands no worker has taken yet
+    while ( _next < _count ) {
+        int index = _next++;
+        _mutex.unlock();
+        job->drawBand( index );
+        _mutex.lock();
+        _done++;
+    }
+    while ( _done < _count )
+        _cond.wait( _mutex );
+    _job = NULL;
+    _mutex.unlock();
+}
+
+/// draws recorded operations [start, end) (none of them serial) in bands
+class LVRecordingDrawBandJob : public LVDrawBandJob
+{
+    LVRecordingDrawBuf * _rec;
+    int _start;
+    int _end;
+public:
+    LVRecordingDrawBandJob( LVRecordingDrawBuf * rec, int start, int end ) : _rec(rec), _start(start), _end(end) { }
+    virtual void drawBand( int index )
+    {
+        LVBaseDrawBuf * view = _rec->_views[index];
+        const int bands = _rec->_views.length();
+        const int top = _rec->_dy * index / bands;
+        const int bottom = _rec->_dy * (index + 1) / bands;
+        for ( int i=_start; i<_end; i++ ) {
+            const LVRecordingDrawBuf::Op & op = _rec->_ops[i];
+            lvRect clip = op.clip;
+            if ( clip.top < top )
+                clip.top = top;
+            if ( clip.bottom > bottom )
+                clip.bottom = bottom;
+            if ( clip.top >= clip.bottom || clip.left >= clip.right )
+                continue;
+            view->SetClipRect( &clip );
+            view->SetTextColor( op.textColor );
+            view->SetBackgroundColor( op.backgroundColor );
+            _rec->drawOp( view, op );
+        }
+    }
+};
+
+LVRecordingDrawBuf::LVRecordingDrawBuf( LVDrawBuf * target, int bands )
+    : _target(target), _bpp(target->GetBitsPerPixel()), _bitmaps(NULL), _bitmapsSize(0), _bitmapsLength(0)
+{
+    _dx = target->GetWidth();
+    _dy = target->GetHeight();
+    for ( int i=0; i<bands; i++ ) {
+        LVBaseDrawBuf * view = target->createView();
+        if ( !view )
+            break;
+        _views.add( view );
+    }
+    if ( _views.length() ) {
+        copySettings( *_views[0] );
+    }
+    else {
+        lvRect clip;
+        target->GetClipRect( &clip );
+        SetClipRect( &clip );
+        _drawExtraInfo = target->GetDrawExtraInfo();
+        _backgroundColor = target->GetBackgroundColor();
+        _textColor = target->GetTextColor();
+        _invertImages = target->getInvertImages();
+        _invertColors = target->getInvertColors();
+        _smoothImages = target->getSmoothScalingImages();
+    }
+}
+
+LVRecordingDrawBuf::~LVRecordingDrawBuf()
+{
+    free( _bitmaps );
+}
+
+LVRecordingDrawBuf::Op & LVRecordingDrawBuf::addOp( OpType type, bool serial )
+{
+    _ops.add( Op() );
+    Op & op = _ops[_ops.length() - 1];
+    op.type = type;
+    op.serial = serial;
+    op.hidePartialGlyphs = _hidePartialGlyphs;
+    op.clip = _clip;
+    op.textColor = _textColor;
+    op.backgroundColor = _backgroundColor;
+    return op;
+}
+
+int LVRecordingDrawBuf::addBitmap( const lUInt8 * bitmap, int width, int height, int pitch )
+{
+    const int size = width * height;
+    if ( _bitmapsLength + size > _bitmapsSize ) {
+        int newSize = _bitmapsSize ? _bitmapsSize * 2 : 0x10000;
+        while ( newSize < _bitmapsLength + size )
+            newSize *= 2;
+        _bitmaps = cr_realloc( _bitmaps, newSize );
+        _bitmapsSize = newSize;
+    }
+    const int offset = _bitmapsLength;
+    for ( int y=0; y<height; y++ )
+        memcpy( _bitmaps + offset + y * width, bitmap + y * pitch, width );
+    _bitmapsLength += size;
+    return offset;
+}
+
+void LVRecordingDrawBuf::drawOp( LVDrawBuf * buf, const Op & op ) const
+{
+    switch ( op.type ) {
+    case OP_CLEAR:
+        buf->Clear( op.color );
+        break;
+    case OP_INVERT:
+        buf->Invert();
+        break;
+    case OP_FILL_RECT:
+        buf->FillRect( op.x0, op.y0, op.x1, op.y1, op.color );
+        break;
+    case OP_INVERT_RECT:
+        buf->InvertRect( op.x0, op.y0, op.x1, op.y1 );
+        break;
+    case OP_DRAW_LINE:
+        buf->DrawLine( op.x0, op.y0, op.x1, op.y1, op.color, op.length1, op.length2, op.direction );
+        break;
+    case OP_DRAW_BITMAP:
+        buf->Draw( op.x0, op.y0, _bitmaps + op.bitmap, op.x1, op.y1, op.hasPalette ? &op.color : NULL );
+        break;
+    case OP_DRAW_COLOR_GLYPH:
+        buf->DrawColorGlyph( op.x0, op.y0, _bitmaps + op.bitmap, op.x1, op.y1, op.pitch, op.hasPalette ? &op.color : NULL );
+        break;
+    case OP_DRAW_IMAGE:
+        buf->Draw( op.img, op.x0, op.y0, op.x1, op.y1, op.dither );
+        break;
+    }
+}
+
+void LVRecordingDrawBuf::drawBands( LVDrawBandPool * pool )
+{
+    // Only LVBaseDrawBuf subclasses create views
+    LVBaseDrawBuf * target = (LVBaseDrawBuf *)_target;
+    for ( int i=0; i<_views.length(); i++ )
+        _views[i]->copySettings( *this );
+    target->copySettings( *this );
+    int start = 0;
+    for ( int i=0; i<=_ops.length(); i++ ) {
+        if ( i < _ops.length() && !_ops[i].serial )
+            continue;
+        if ( i > start ) {
+            LVRecordingDrawBandJob job( this, start, i );
+            if ( pool ) {
+                pool->run( &job, _views.length() );
+            }
+            else {
+                for ( int band=0; band<_views.length(); band++ )
+                    job.drawBand( band );
+            }
+        }
+        if ( i < _ops.length() ) {
+            const Op & op = _ops[i];
+            target->SetClipRect( &op.clip );
+            target->SetTextColor( op.textColor );
+            target->SetBackgroundColor( op.backgroundColor );
+            target->setHidePartialGlyphs( op.hidePartialGlyphs );
+            drawOp( target, op );
+        }
+        start = i + 1;
+    }
+    // Leave the target as if drawn directly
+    target->copySettings( *this );
+    target->_drawnImagesCount += _drawnImagesCount;
+    target->_drawnImagesSurface += _drawnImagesSurface;
+    _drawnImagesCount = 0;
+    _drawnImagesSurface = 0;
+    _ops.clear();
+    _bitmapsLength = 0;
+}
+
+void LVRecordingDrawBuf::Invert()
+{
+    addOp( OP_INVERT, true );
+}
+
+void LVRecordingDrawBuf::Clear( lUInt32 color )
+{
+    // Clears the whole buffer, whatever the clip
+    addOp( OP_CLEAR, true ).color = color;
+}
+
+void LVRecordingDrawBuf::FillRect( int x0, int y0, int x1, int y1, lUInt32 color )
+{
+    if ( x0 >= _clip.right || y0 >= _clip.bottom || x1 <= _clip.left || y1 <= _clip.top )
+        return;
+    Op & op = addOp( OP_FILL_RECT, false );
+    op.x0 = x0;
+    op.y0 = y0;
+    op.x1 = x1;
+    op.y1 = y1;
+    op.color = color;
+}
+
+void LVRecordingDrawBuf::InvertRect( int x0, int y0, int x1, int y1 )
+{
+    if ( x0 >= _clip.right || y0 >= _clip.bottom || x1 <= _clip.left || y1 <= _clip.top )
+        return;
+    Op & op = addOp( OP_INVERT_RECT, false );
+    op.x0 = x0;
+    op.y0 = y0;
+    op.x1 = x1;
+    op.y1 = y1;
+}
+
+void LVRecordingDrawBuf::DrawLine( int x0, int y0, int x1, int y1, lUInt32 color0, int length1, int length2, int direction )
+{
+    if ( x0 >= _clip.right || y0 >= _clip.bottom || x1 <= _clip.left || y1 <= _clip.top )
+        return;
+    // 1 and 2 bpp LVGrayDrawBuf::DrawLine() sets a byte per pixel, past the rows it's given
+    Op & op = addOp( OP_DRAW_LINE, _bpp <= 2 );
+    op.x0 = x0;
+    op.y0 = y0;
+    op.x1 = x1;
+    op.y1 = y1;
+    op.color = color0;
+    op.length1 = length1;
+    op.length2 = length2;
+    op.direction = direction;
+}
+
+void LVRecordingDrawBuf::Draw( int x, int y, const lUInt8 * bitmap, int width, int height, const lUInt32 * __restrict palette )
+{
+    if ( width <= 0 || height <= 0 )
+        return;
+    // With hidePartialGlyphs, glyphs partially out of the clip are drawn whole or not at all
+    if ( !_hidePartialGlyphs && ( x >= _clip.right || y >= _clip.bottom || x + width <= _clip.left || y + height <= _clip.top ) )
+        return;
+    Op & op = addOp( OP_DRAW_BITMAP, _hidePartialGlyphs );
+    op.x0 = x;
+    op.y0 = y;
+    op.x1 = width;
+    op.y1 = height;
+    op.hasPalette = palette != NULL;
+    op.color = palette ? palette[0] : 0;
+    op.bitmap = addBitmap( bitmap, width, height, width );
+}
+
+void LVRecordingDrawBuf::DrawColorGlyph( int x, int y, const lUInt8 * bitmap, int width, int height, int pitch, const lUInt32 * __restrict palette )
+{
+    if ( width <= 0 || height <= 0 )
+        return;
+    if ( !_hidePartialGlyphs && ( x >= _clip.right || y >= _clip.bottom || x + width <= _clip.left || y + height <= _clip.top ) )
+        return;
+    Op & op = addOp( OP_DRAW_COLOR_GLYPH, _hidePartialGlyphs );
+    op.x0 = x;
+    op.y0 = y;
+    op.x1 = width;
+    op.y1 = height;
+    op.pitch = width * 4;
+    op.hasPalette = palette != NULL;
+    op.color = palette ? palette[0] : 0;
+    op.bitmap = addBitmap( bitmap, width * 4, height, pitch );
+}
+
+void LVRecordingDrawBuf::Draw( LVImageSourceRef img, int x, int y, int width, int height, bool dither )
+{
+    // Images decoded from a document are drawn by the calling thread, unless
+    // their decoded and scaled bitmap is cached, to be plotted by bands
+    bool isBitmap = false;
+    LVImageSourceRef src = getCachedScaledImage( img, width, height, _smoothImages, false, &isBitmap );
+    Op & op = addOp( OP_DRAW_IMAGE, !isBitmap );
+    op.img = isBitmap ? src : img;
+    op.x0 = x;
+    op.y0 = y;
+    op.x1 = width;
+    op.y1 = height;
+    op.dither = dither;
+    if ( isBitmap ) {
+        // (a serial one is counted by the target)
+        _drawnImagesCount++;
+        _drawnImagesSurface += width*height;
+    }
+}
+
+#endif // CR_THREAD_SAFE==1
@@ -459,7 +459,6 @@ bool LVEmbeddedFontList::deserialize(SerialBuf & buf) {
  * Max width of -/./,/!/? to use for visial alignment by width
  */
 int LVFont::getVisualAligmentWidth() {
-    FONT_GUARD
     if ( _visual_alignment_width==-1 ) {
         lChar32 chars[] = { getHyphChar(), ',', '.', '!', '?', ':', ';',
                     (lChar32)U'，', (lChar32)U'。', (lChar32)U'！', 0 };
@@ -1027,7 +1026,6 @@ private:
 public:
     lUInt16 get( lChar32 ch )
     {
-        FONT_GLYPH_CACHE_GUARD
         int inx = (ch>>9) & 0x1ff;
         if (inx >= COUNT) return CACHED_UNSIGNED_METRIC_NOT_SET;
         lUInt16 * ptr = ptrs[inx];
@@ -1037,7 +1035,6 @@ public:
     }
     void put( lChar32 ch, lUInt16 m )
     {
-        FONT_GLYPH_CACHE_GUARD
         int inx = (ch>>9) & 0x1ff;
         if (inx >= COUNT) return;
         lUInt16 * ptr = ptrs[inx];
@@ -1050,7 +1047,6 @@ public:
     }
     void clear()
     {
-        FONT_GLYPH_CACHE_GUARD
         for ( int i=0; i<360; i++ ) {
             if ( ptrs[i] )
                 delete [] ptrs[i];
@@ -1086,7 +1082,6 @@ class LVFreeTypeFace;
 
 static LVFontGlyphCacheItem * newItem( LVFontLocalGlyphCache * local_cache, lChar32 ch, FT_GlyphSlot slot ) // , bool drawMonochrome
 {
-    FONT_LOCAL_GLYPH_CACHE_GUARD
     FT_Bitmap*  bitmap = &slot->bitmap;
     int w = bitmap->width;
     int h = bitmap->rows;
@@ -1154,7 +1149,6 @@ static LVFontGlyphCacheItem * newItem( LVFontLocalGlyphCache * local_cache, lCha
 #if USE_HARFBUZZ==1
 static LVFontGlyphCacheItem * newItem(LVFontLocalGlyphCache *local_cache, lUInt32 index, FT_GlyphSlot slot )
 {
-    FONT_LOCAL_GLYPH_CACHE_GUARD
     FT_Bitmap*  bitmap = &slot->bitmap;
     int w = bitmap->width;
     int h = bitmap->rows;
@@ -1217,191 +1211,326 @@ static inline void drawGlyphItem(LVDrawBuf * buf, int x, int y,
 //   font it comes from
 // - the LVFontGlobalGlyphCache LVFreeTypeFontManager->_globalCache of
 //   the global and unique FontManager.
-// The first one is used for quick iteration to find the glyph in a
-// known font/size instance.
+// The first one is a hash table used to find the glyph in a known
+// font/size instance: lookups only mark the item as recently used,
+// and don't touch the global cache.
 // The global one is used to limit the number of cached glyphs, globally
 // across all fonts.
 // When adding the glyph to the local cache, the local cache adds it
 // to the global cache. When that happens, the global cache checks
-// its max_size, and remove any LRU item, by deleting it from itself,
-// and asking the relevant local cache to remove it too.
+// its max_size, and removes items not recently used (CLOCK algorithm),
+// by deleting them from itself, and asking the relevant local cache to
+// remove them too.
 
-void LVFontLocalGlyphCache::clear()
+static inline lUInt32 glyphCacheHash( lUInt32 key )
 {
-    FONT_LOCAL_GLYPH_CACHE_GUARD
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    LVHashTable<GlyphCacheItemData, struct LVFontGlyphCacheItem*>::iterator it = hashTable.forwardIterator();
-    LVHashTable<GlyphCacheItemData, struct LVFontGlyphCacheItem*>::pair* pair;
-    while ((pair = it.next()))
-    {
-        global_cache->remove(pair->value);
-        LVFontGlyphCacheItem::freeItem(pair->value);
-    }
-    hashTable.clear();
-#else
-    while ( head ) {
-        LVFontGlyphCacheItem * ptr = head;
-        remove( ptr );
-        global_cache->remove( ptr );
-        LVFontGlyphCacheItem::freeItem( ptr );
-    }
-#endif
+    return key * 2654435761U;
 }
 
-LVFontGlyphCacheItem * LVFontLocalGlyphCache::getByChar(lChar32 ch)
+LVFontGlyphCacheItem * LVFontLocalGlyphCache::find( lUInt32 key )
 {
-    FONT_LOCAL_GLYPH_CACHE_GUARD
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    LVFontGlyphCacheItem *ptr = 0;
-    GlyphCacheItemData data;
-    data.ch = ch;
-    if (hashTable.get(data, ptr))
-        return ptr;
-#else
-    LVFontGlyphCacheItem * ptr = head;
-    for ( ; ptr; ptr = ptr->next_local ) {
-        if ( ptr->data.ch == ch ) {
-            global_cache->refresh( ptr );
-            return ptr;
+    if ( !count )
+        return NULL;
+    int mask = table_size - 1;
+    for ( int i = glyphCacheHash(key) & mask; table[i]; i = (i + 1) & mask ) {
+        LVFontGlyphCacheItem * item = table[i];
+        if ( (lUInt32)item->data.ch == key ) {
+            item->referenced.set(true);
+            return item;
         }
     }
-#endif
     return NULL;
 }
 
-#if USE_HARFBUZZ==1
-LVFontGlyphCacheItem * LVFontLocalGlyphCache::getByIndex(lUInt32 index)
+void LVFontLocalGlyphCache::resize( int newSize )
 {
-    FONT_LOCAL_GLYPH_CACHE_GUARD
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    LVFontGlyphCacheItem *ptr = 0;
-    GlyphCacheItemData data;
-    data.gindex = index;
-    if (hashTable.get(data, ptr))
-        return ptr;
-#else
-    LVFontGlyphCacheItem *ptr = head;
-    for (; ptr; ptr = ptr->next_local) {
-        if (ptr->data.gindex == index) {
-            global_cache->refresh( ptr );
-            return ptr;
+    LVFontGlyphCacheItem ** oldTable = table;
+    int oldSize = table_size;
+    table = (LVFontGlyphCacheItem **)calloc( newSize, sizeof(LVFontGlyphCacheItem *) );
+    table_size = newSize;
+    int mask = newSize - 1;
+    for ( int j = 0; j < oldSize; j++ ) {
+        LVFontGlyphCacheItem * item = oldTable[j];
+        if ( !item )
+            continue;
+        int i = glyphCacheHash(item->data.ch) & mask;
+        while ( table[i] )
+            i = (i + 1) & mask;
+        table[i] = item;
+    }
+    free( oldTable );
+}
+
+void LVFontLocalGlyphCache::clear()
+{
+    for ( int i = 0; i < table_size && count > 0; i++ ) {
+        if ( table[i] ) {
+            LVFontGlyphCacheItem * item = table[i];
+            table[i] = NULL;
+            count--;
+            global_cache->remove( item );
         }
     }
-#endif
-    return NULL;
 }
-#endif
 
 void LVFontLocalGlyphCache::put( LVFontGlyphCacheItem * item )
 {
-    FONT_LOCAL_GLYPH_CACHE_GUARD
+    // may evict some of our own items
     global_cache->put( item );
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    hashTable.set(item->data, item);
-#else
-    item->next_local = head;
-    if ( head )
-        head->prev_local = item;
-    if ( !tail )
-        tail = item;
-    head = item;
-#endif
+    // keep load factor under 1/2 for short probe sequences
+    if ( (count + 1) * 2 > table_size )
+        resize( table_size ? table_size * 2 : 64 );
+    int mask = table_size - 1;
+    int i = glyphCacheHash(item->data.ch) & mask;
+    while ( table[i] )
+        i = (i + 1) & mask;
+    table[i] = item;
+    count++;
 }
 
-/// remove from list, but don't delete
 void LVFontLocalGlyphCache::remove( LVFontGlyphCacheItem * item )
 {
-    FONT_LOCAL_GLYPH_CACHE_GUARD
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    hashTable.remove(item->data);
-#else
-    if ( item==head )
-        head = item->next_local;
-    if ( item==tail )
-        tail = item->prev_local;
-    if ( !head || !tail )
+    if ( !count )
         return;
-    if ( item->prev_local )
-        item->prev_local->next_local = item->next_local;
-    if ( item->next_local )
-        item->next_local->prev_local = item->prev_local;
-    item->next_local = NULL;
-    item->prev_local = NULL;
-#endif
+    int mask = table_size - 1;
+    int i = glyphCacheHash(item->data.ch) & mask;
+    while ( table[i] != item ) {
+        if ( !table[i] )
+            return; // not there
+        i = (i + 1) & mask;
+    }
+    table[i] = NULL;
+    count--;
+    // move back following items of the probe sequence into the hole
+    for ( int j = (i + 1) & mask; table[j]; j = (j + 1) & mask ) {
+        int k = glyphCacheHash(table[j]->data.ch) & mask;
+        bool reachable = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+        if ( reachable )
+            continue; // still found from its home slot
+        table[i] = table[j];
+        table[j] = NULL;
+        i = j;
+    }
 }
 
-#if USE_GLYPHCACHE_HASHTABLE != 1
-void LVFontGlobalGlyphCache::refresh( LVFontGlyphCacheItem * item )
+// Glyph items are allocated from slabs of chunks of the same size class,
+// to avoid one malloc per glyph. A slab is listed in its size class
+// while having some free chunks, and released when all its chunks are
+// free (except the last one of a class, kept for the next allocation).
+#define GLYPH_SLAB_SIZE 0x2000 // 8 KiB
+#define GLYPH_SLAB_MIN_CHUNKS 4
+
+struct LVFontGlyphSlab
 {
-    FONT_GLYPH_CACHE_GUARD
-    if ( tail!=item ) {
-        //move to head
-        removeNoLock( item );
-        putNoLock( item );
+    LVFontGlyphSlab * prev; // in size class list
+    LVFontGlyphSlab * next;
+    void * free_chunks;     // single linked list of free chunks
+    int used;
+    int size_class;
+    bool listed;
+    alignas(16) lUInt8 data[1];
+};
+
+static const int glyph_slab_class_sizes[GLYPH_SLAB_CLASS_COUNT] = {
+    64, 128, 192, 256, 320, 384, 448, 512, 576, 640, 704, 768, 832, 896, 960, 1024,
+    1536, 2048, 3072, 4096
+};
+
+static int glyphSlabClass( int sz )
+{
+    if ( sz <= 1024 )
+        return (sz - 1) >> 6;
+    for ( int i = 16; i < GLYPH_SLAB_CLASS_COUNT; i++ ) {
+        if ( sz <= glyph_slab_class_sizes[i] )
+            return i;
     }
+    return -1;
 }
-#endif
 
-void LVFontGlobalGlyphCache::put( LVFontGlyphCacheItem * item )
+LVFontGlobalGlyphCache::LVFontGlobalGlyphCache( int maxSize )
+    : items(NULL), count(0), capacity(0), hand(0), size(0), max_size(maxSize)
+{
+    memset( slabs, 0, sizeof(slabs) );
+}
+
+LVFontGlobalGlyphCache::~LVFontGlobalGlyphCache()
+{
+    clear();
+    free( items );
+}
+
+LVFontGlyphCacheItem * LVFontGlobalGlyphCache::alloc( int sz )
 {
     FONT_GLYPH_CACHE_GUARD
-    putNoLock(item);
+    return allocNoLock( sz );
 }
 
-void LVFontGlobalGlyphCache::putNoLock( LVFontGlyphCacheItem * item )
+LVFontGlyphCacheItem * LVFontGlobalGlyphCache::allocNoLock( int sz )
 {
+    int cls = glyphSlabClass( sz );
+    if ( cls < 0 ) {
+        LVFontGlyphCacheItem * item = (LVFontGlyphCacheItem *)malloc( sz );
+        if ( item )
+            item->slab = NULL;
+        return item;
+    }
+    LVFontGlyphSlab * slab = slabs[cls];
+    if ( !slab ) {
+        int chunkSize = glyph_slab_class_sizes[cls];
+        int chunks = GLYPH_SLAB_SIZE / chunkSize;
+        if ( chunks < GLYPH_SLAB_MIN_CHUNKS )
+            chunks = GLYPH_SLAB_MIN_CHUNKS;
+        slab = (LVFontGlyphSlab *)malloc( offsetof(LVFontGlyphSlab, data) + chunks * chunkSize );
+        if ( !slab )
+            return NULL;
+        slab->prev = NULL;
+        slab->next = NULL;
+        slab->used = 0;
+        slab->size_class = cls;
+        slab->listed = true;
+        slab->free_chunks = NULL;
+        for ( int i = chunks - 1; i >= 0; i-- ) {
+            void * chunk = slab->data + i * chunkSize;
+            *(void **)chunk = slab->free_chunks;
+            slab->free_chunks = chunk;
+        }
+        slabs[cls] = slab;
+    }
+    LVFontGlyphCacheItem * item = (LVFontGlyphCacheItem *)slab->free_chunks;
+    slab->free_chunks = *(void **)item;
+    slab->used++;
+    if ( !slab->free_chunks ) {
+        // full: unlist
+        slabs[cls] = slab->next;
+        if ( slab->next )
+            slab->next->prev = NULL;
+        slab->next = NULL;
+        slab->listed = false;
+    }
+    item->slab = slab;
+    return item;
+}
+
+void LVFontGlobalGlyphCache::freeNoLock( LVFontGlyphCacheItem * item )
+{
+    LVFontGlyphSlab * slab = item->slab;
+    if ( !slab ) {
+        free( item );
+        return;
+    }
+    *(void **)item = slab->free_chunks;
+    slab->free_chunks = item;
+    slab->used--;
+    int cls = slab->size_class;
+    if ( !slab->listed ) {
+        slab->prev = NULL;
+        slab->next = slabs[cls];
+        if ( slab->next )
+            slab->next->prev = slab;
+        slabs[cls] = slab;
+        slab->listed = true;
+    }
+    if ( slab->used == 0 && (slab->prev || slab->next) ) {
+        // empty, and not the last one of its class
+        if ( slab->prev )
+            slab->prev->next = slab->next;
+        else
+            slabs[cls] = slab->next;
+        if ( slab->next )
+            slab->next->prev = slab->prev;
+        free( slab );
+    }
+}
+
+void LVFontGlobalGlyphCache::freeEmptySlabsNoLock()
+{
+    for ( int cls = 0; cls < GLYPH_SLAB_CLASS_COUNT; cls++ ) {
+        LVFontGlyphSlab * slab = slabs[cls];
+        if ( slab && slab->used == 0 && !slab->next ) {
+            slabs[cls] = NULL;
+            free( slab );
+        }
+    }
+}
+
+void LVFontGlobalGlyphCache::put( LVFontGlyphCacheItem * item )
+{
+    FONT_GLYPH_CACHE_GUARD
     int sz = item->getSize();
-    // remove extra items from tail
-    while ( sz + size > max_size ) {
-        LVFontGlyphCacheItem * removed_item = tail;
-        if ( !removed_item )
-            break;
-        removeNoLock( removed_item );
-        removed_item->local_cache->remove( removed_item );
-        LVFontGlyphCacheItem::freeItem( removed_item );
-    }
-    // add new item to head
-    item->next_global = head;
-    if ( head )
-        head->prev_global = item;
-    head = item;
-    if ( !tail )
-        tail = item;
+    evictNoLock( sz );
+    if ( count >= capacity ) {
+        capacity = capacity ? capacity * 2 : 256;
+        items = (LVFontGlyphCacheItem **)realloc( items, capacity * sizeof(LVFontGlyphCacheItem *) );
+    }
+    item->clock_index = count;
+    items[count++] = item;
     size += sz;
 }
 
+void LVFontGlobalGlyphCache::evictNoLock( int sz )
+{
+    // Give referenced items a second chance, and stop after going
+    // twice around without finding anything that can be removed
+    int scanned = 0;
+    while ( count > 0 && size + sz > max_size && scanned < 2 * count ) {
+        if ( hand >= count )
+            hand = 0;
+        LVFontGlyphCacheItem * item = items[hand];
+        if ( item->referenced.get() ) {
+            item->referenced.set(false);
+            hand++;
+            scanned++;
+            continue;
+        }
+        // keep glyphs of fonts being used by other threads
+        LVFontLocalGlyphCache * local_cache = item->local_cache;
+        if ( !local_cache->tryLock() ) {
+            hand++;
+            scanned++;
+            continue;
+        }
+        removeNoLock( item ); // the last item takes its place, at hand
+        local_cache->remove( item );
+        local_cache->unlock();
+        freeNoLock( item );
+    }
+}
+
 void LVFontGlobalGlyphCache::remove( LVFontGlyphCacheItem * item )
 {
     FONT_GLYPH_CACHE_GUARD
-    removeNoLock(item);
+    removeNoLock( item );
+    freeNoLock( item );
 }
 
 void LVFontGlobalGlyphCache::removeNoLock( LVFontGlyphCacheItem * item )
 {
-    size -= item->getSize();
-    if ( item==head )
-        head = item->next_global;
-    if ( item==tail )
-        tail = item->prev_global;
-    if ( !head || !tail )
+    int index = item->clock_index;
+    if ( index < 0 || index >= count || items[index] != item )
         return;
-    if ( item->prev_global )
-        item->prev_global->next_global = item->next_global;
-    if ( item->next_global )
-        item->next_global->prev_global = item->prev_global;
-    item->next_global = NULL;
-    item->prev_global = NULL;
+    size -= item->getSize();
+    LVFontGlyphCacheItem * last = items[--count];
+    items[index] = last;
+    last->clock_index = index;
+    item->clock_index = -1;
 }
 
 void LVFontGlobalGlyphCache::clear()
 {
     FONT_GLYPH_CACHE_GUARD
-    while ( head ) {
-        LVFontGlyphCacheItem * ptr = head;
-        remove( ptr );
-        ptr->local_cache->remove( ptr );
-        LVFontGlyphCacheItem::freeItem( ptr );
-    }
+    for ( int i = count - 1; i >= 0; i-- ) {
+        LVFontGlyphCacheItem * item = items[i];
+        // keep glyphs of fonts being used by other threads
+        LVFontLocalGlyphCache * local_cache = item->local_cache;
+        if ( local_cache->tryLock() ) {
+            removeNoLock( item );
+            local_cache->remove( item );
+            local_cache->unlock();
+            freeNoLock( item );
+        }
+    }
+    hand = 0;
+    freeEmptySlabsNoLock();
 }
 
 lString8 familyName( FT_Face face )
@@ -1521,12 +1650,238 @@ inline lUInt32 getHash( const struct LVCharTriplet& triplet )
                         + (((lUInt64)triplet.nextChar)<<32) );
     return hash;
 }
+
+// For use with Harfbuzz full: cache of shaping results, shared by measureText()
+// and DrawTextString(), as the same text runs are shaped again on each re-format
+// and when drawing.
+// Runs are keyed on their text and what else is given to HarfBuzz for shaping
+// (hints, language, def_char if filtering chars): as the cache belongs to the
+// font instance, the face, size and features are implied (and any change to
+// them clears the cache).
+#define HB_SHAPED_RUN_HINTS_MASK   (LFNT_HINT_DIRECTION_KNOWN|LFNT_HINT_DIRECTION_IS_RTL|LFNT_HINT_BEGINS_PARAGRAPH|LFNT_HINT_ENDS_PARAGRAPH)
+#define HB_SHAPED_RUN_FILTERED     0x0100 // no fallback font: chars filtered with def_char
+#define HB_SHAPED_RUN_LATIN_SCRIPT 0x0200 // script not guessed from text, latin used (when drawing)
+
+struct LVHBShapedRun
+{
+    LVHBShapedRun * next_in_bucket;
+    LVHBShapedRun * prev; // LRU list, most recently used first
+    LVHBShapedRun * next;
+    lUInt32 hash;
+    lUInt32 key_flags;
+    hb_language_t language;
+    lChar32 def_char;
+    int len;
+    int size;
+    // shaping result
+    hb_direction_t direction;
+    hb_script_t script;
+    bool script_was_invalid; // before HB_SHAPED_RUN_LATIN_SCRIPT
+    int glyph_count;
+    hb_glyph_info_t * glyph_info;     // (in visual order when RTL)
+    hb_glyph_position_t * glyph_pos;
+    lChar32 * text;
+    bool matches( lUInt32 h, const lChar32 * t, int l, lUInt32 flags, hb_language_t lang, lChar32 dc ) const {
+        return hash == h && len == l && key_flags == flags && language == lang && def_char == dc
+                    && !memcmp( text, t, l * sizeof(lChar32) );
+    }
+};
+
+// Shaping cache statistics, for all font instances
+static struct {
+    lvref_counter_t hits;
+    lvref_counter_t misses;
+    lvref_counter_t evictions;
+    lvref_counter_t items;
+    lvref_counter_t size;
+} hb_shaping_cache_counters;
+
+class LVHBShapingCache
+{
+    LVHBShapedRun ** buckets;
+    int bucket_count; // power of 2
+    int count;
+    int size;
+    int max_size;
+    LVHBShapedRun * head;
+    LVHBShapedRun * tail;
+    LVHBShapedRun * uncached; // last run too large to be cached
+    LVHBShapedRun buffer_run; // last run left in the HarfBuzz buffer, when out of memory
+    void unlink( LVHBShapedRun * run ) {
+        if ( run->prev ) run->prev->next = run->next; else head = run->next;
+        if ( run->next ) run->next->prev = run->prev; else tail = run->prev;
+        run->prev = run->next = NULL;
+    }
+    void linkFirst( LVHBShapedRun * run ) {
+        run->prev = NULL;
+        run->next = head;
+        if ( head ) head->prev = run; else tail = run;
+        head = run;
+    }
+    void remove( LVHBShapedRun * run ) {
+        LVHBShapedRun ** p = &buckets[run->hash & (bucket_count - 1)];
+        while ( *p != run )
+            p = &(*p)->next_in_bucket;
+        *p = run->next_in_bucket;
+        unlink( run );
+        count--;
+        size -= run->size;
+        hb_shaping_cache_counters.items--;
+        hb_shaping_cache_counters.size -= run->size;
+        free( run );
+    }
+    bool resize( int newCount ) {
+        LVHBShapedRun ** newBuckets = (LVHBShapedRun **)calloc( newCount, sizeof(LVHBShapedRun *) );
+        if ( !newBuckets )
+            return false;
+        for ( int i = 0; i < bucket_count; i++ ) {
+            LVHBShapedRun * run = buckets[i];
+            while ( run ) {
+                LVHBShapedRun * next = run->next_in_bucket;
+                run->next_in_bucket = newBuckets[run->hash & (newCount - 1)];
+                newBuckets[run->hash & (newCount - 1)] = run;
+                run = next;
+            }
+        }
+        free( buckets );
+        buckets = newBuckets;
+        bucket_count = newCount;
+        return true;
+    }
+public:
+    static lUInt32 hashRun( const lChar32 * text, int len, lUInt32 key_flags, hb_language_t language, lChar32 def_char ) {
+        lUInt32 h = 2166136261U; // FNV-1a
+        for ( int i = 0; i < len; i++ )
+            h = (h ^ (lUInt32)text[i]) * 16777619U;
+        h = (h ^ key_flags) * 16777619U;
+        h = (h ^ (lUInt32)(size_t)language) * 16777619U;
+        h = (h ^ (lUInt32)def_char) * 16777619U;
+        return h;
+    }
+    LVHBShapingCache( int maxSize )
+        : buckets(NULL), bucket_count(0), count(0), size(0), max_size(maxSize)
+        , head(NULL), tail(NULL), uncached(NULL)
+    {
+    }
+    ~LVHBShapingCache() {
+        clear();
+        free( buckets );
+    }
+    LVHBShapedRun * find( lUInt32 hash, const lChar32 * text, int len, lUInt32 key_flags, hb_language_t language, lChar32 def_char ) {
+        if ( !count )
+            return NULL;
+        for ( LVHBShapedRun * run = buckets[hash & (bucket_count - 1)]; run; run = run->next_in_bucket ) {
+            if ( run->matches( hash, text, len, key_flags, language, def_char ) ) {
+                if ( run != head ) {
+                    unlink( run );
+                    linkFirst( run );
+                }
+                return run;
+            }
+        }
+        return NULL;
+    }
+    /// store shaping result from buffer; returned run is valid until next add() or clear()
+    LVHBShapedRun * add( lUInt32 hash, const lChar32 * text, int len, lUInt32 key_flags, hb_language_t language, lChar32 def_char,
+                         hb_buffer_t * buffer, bool script_was_invalid ) {
+        int glyph_count = hb_buffer_get_length( buffer );
+        int sz = sizeof(LVHBShapedRun) + glyph_count * (sizeof(hb_glyph_info_t) + sizeof(hb_glyph_position_t)) + len * sizeof(lChar32);
+        if ( uncached ) {
+            free( uncached );
+            uncached = NULL;
+        }
+        LVHBShapedRun * run = (LVHBShapedRun *)malloc( sz );
+        if ( !run ) {
+            // Out of memory: don't cache it, point to the results in the
+            // buffer, which stay there until the next shaping
+            run = &buffer_run;
+        }
+        run->next_in_bucket = run->prev = run->next = NULL;
+        run->hash = hash;
+        run->key_flags = key_flags;
+        run->language = language;
+        run->def_char = def_char;
+        run->len = len;
+        run->size = sz;
+        run->direction = hb_buffer_get_direction( buffer );
+        run->script = hb_buffer_get_script( buffer );
+        run->script_was_invalid = script_was_invalid;
+        run->glyph_count = glyph_count;
+        if ( run == &buffer_run ) {
+            run->glyph_info = hb_buffer_get_glyph_infos( buffer, NULL );
+            run->glyph_pos = hb_buffer_get_glyph_positions( buffer, NULL );
+            run->text = (lChar32 *)text;
+            return run;
+        }
+        run->glyph_info = (hb_glyph_info_t *)(run + 1);
+        run->glyph_pos = (hb_glyph_position_t *)(run->glyph_info + glyph_count);
+        run->text = (lChar32 *)(run->glyph_pos + glyph_count);
+        memcpy( run->glyph_info, hb_buffer_get_glyph_infos( buffer, NULL ), glyph_count * sizeof(hb_glyph_info_t) );
+        memcpy( run->glyph_pos, hb_buffer_get_glyph_positions( buffer, NULL ), glyph_count * sizeof(hb_glyph_position_t) );
+        memcpy( run->text, text, len * sizeof(lChar32) );
+        if ( sz > max_size / 8 ) {
+            // don't let a single long run flush the cache
+            uncached = run;
+            return run;
+        }
+        while ( tail && size + sz > max_size ) {
+            remove( tail );
+            hb_shaping_cache_counters.evictions++;
+        }
+        if ( (count + 1) > bucket_count && !resize( bucket_count ? bucket_count * 2 : 64 ) && !bucket_count ) {
+            uncached = run;
+            return run;
+        }
+        LVHBShapedRun ** bucket = &buckets[hash & (bucket_count - 1)];
+        run->next_in_bucket = *bucket;
+        *bucket = run;
+        linkFirst( run );
+        count++;
+        size += sz;
+        hb_shaping_cache_counters.items++;
+        hb_shaping_cache_counters.size += sz;
+        return run;
+    }
+    void clear() {
+        while ( tail )
+            remove( tail );
+        if ( uncached ) {
+            free( uncached );
+            uncached = NULL;
+        }
+    }
+};
+
+static void reverseHBGlyphs( hb_glyph_info_t * info, hb_glyph_position_t * pos, int start, int end )
+{
+    for ( int a = start, b = end - 1; a < b; a++, b-- ) {
+        hb_glyph_info_t ti = info[a]; info[a] = info[b]; info[b] = ti;
+        hb_glyph_position_t tp = pos[a]; pos[a] = pos[b]; pos[b] = tp;
+    }
+}
+
+// Same as hb_buffer_reverse_clusters(), on a copy of shaping results
+static void reverseHBClusters( hb_glyph_info_t * info, hb_glyph_position_t * pos, int count )
+{
+    if ( count <= 0 )
+        return;
+    reverseHBGlyphs( info, pos, 0, count );
+    int start = 0;
+    for ( int i = 1; i < count; i++ ) {
+        if ( info[i].cluster != info[start].cluster ) {
+            reverseHBGlyphs( info, pos, start, i );
+            start = i;
+        }
+    }
+    reverseHBGlyphs( info, pos, start, count );
+}
 #endif
 
 class LVFreeTypeFace : public LVFont
 {
 protected:
-    LVMutex &     _mutex;
+    LVMutex &     _mutex; // font manager lock, for FT_Library operations
+    LVMutex       _faceMutex; // this font instance lock
     lString8      _fileName;
     lString8      _faceName;
     css_font_family_t _fontFamily;
@@ -1568,6 +1923,9 @@ protected:
     LVArray<hb_feature_t> _hb_features;
     // For use with KERNING_MODE_HARFBUZZ:
     LVFontLocalGlyphCache _glyph_cache2;
+    LVHBShapingCache _hb_shaping_cache;
+    LVArray<hb_glyph_info_t> _hb_glyph_info; // shaping results reordered for measureText() when RTL
+    LVArray<hb_glyph_position_t> _hb_glyph_pos;
     // For use with KERNING_MODE_HARFBUZZ_LIGHT:
     LVHashTable<struct LVCharTriplet, struct LVCharPosInfo> _width_cache2;
 #endif
@@ -1667,6 +2025,7 @@ public:
     }
 
     int getXHeight() {
+        LVLock lock(_faceMutex);
         int x_height = 0;
         int glyph_index = getCharIndex( 'x', 0 );
         if ( glyph_index ) {
@@ -1689,6 +2048,7 @@ public:
     }
 
     int getCapHeight() {
+        LVLock lock(_faceMutex);
         int cap_height = 0;
         int glyph_index = getCharIndex( 'H', 0 );
         if ( glyph_index ) {
@@ -1789,13 +2149,14 @@ public:
         : _mutex(mutex), _fontFamily(css_ff_sans_serif), _library(library), _face(NULL), _face_size(0)
         , _size(0), _hyphen_width(0), _baseline(0), _weight(400), _italic(0)
         , _underline_offset(0), _underline_thickness(0), _extra_metric(NULL)
-        , _glyph_cache(globalCache), _drawMonochrome(false)
+        , _glyph_cache(globalCache, &_faceMutex), _drawMonochrome(false)
         , _hintingMode(HINTING_MODE_AUTOHINT), _kerningMode(KERNING_MODE_DISABLED)
         , _fallbackFontIsSet(false), _nextFallbackFontIsSet(false)
         , _synth_weight(0), _synth_weight_strength(0), _synth_weight_half_strength(0)
         , _features(0)
         #if USE_HARFBUZZ==1
-        , _glyph_cache2(globalCache)
+        , _glyph_cache2(globalCache, &_faceMutex)
+        , _hb_shaping_cache(HB_SHAPING_CACHE_SIZE)
         , _width_cache2(1024)
         #endif
     {
@@ -1818,12 +2179,14 @@ public:
     }
 
     void clearCache() {
+        LVLock lock(_faceMutex);
         _glyph_cache.clear();
         _wcache.clear();
         _lsbcache.clear();
         _rsbcache.clear();
         #if USE_HARFBUZZ==1
         _glyph_cache2.clear();
+        _hb_shaping_cache.clear();
         _width_cache2.clear();
         #endif
     }
@@ -1856,7 +2219,7 @@ public:
     }
 
     virtual int getHyphenWidth() {
-        FONT_GUARD
+        LVLock lock(_faceMutex);
         if ( !_hyphen_width ) {
             _hyphen_width = getCharWidth( getHyphChar() );
         }
@@ -2003,21 +2366,30 @@ public:
     #endif
 
     virtual void setFeatures( int features ) {
+        LVLock lock(_faceMutex);
         _features = features;
         _hash = 0; // Force lvstyles.cpp calcHash(font_ref_t) to recompute the hash
+        #if USE_HARFBUZZ==1
+        _hb_shaping_cache.clear();
+        #endif
     }
     virtual int getFeatures() const {
         return _features;
     }
     void setVariations( const LVFontVariations& variations ) {
+        LVLock lock(_faceMutex);
         _variations = variations;
         _hash = 0; // force calcHash(font_ref_t) to recompute
+        #if USE_HARFBUZZ==1
+        _hb_shaping_cache.clear();
+        #endif
     }
     virtual lUInt32 getVariationHash() const {
         return _variations.hash();
     }
 
     virtual void setKerningMode( kerning_mode_t kerningMode ) {
+        LVLock lock(_faceMutex);
         _kerningMode = kerningMode;
         _DecimalListItemFont.Clear(); // depends on kerning mode
         _hash = 0; // Force lvstyles.cpp calcHash(font_ref_t) to recompute the hash
@@ -2032,6 +2404,7 @@ public:
     virtual kerning_mode_t getKerningMode() const { return _kerningMode; }
 
     virtual void setHintingMode(hinting_mode_t mode) {
+        LVLock lock(_faceMutex);
         if (_hintingMode == mode)
             return;
         _hintingMode = mode;
@@ -2069,6 +2442,7 @@ public:
     /// get/set bitmap mode (true=bitmap, false=antialiased)
     virtual void setBitmapMode( bool drawBitmap )
     {
+        LVLock lock(_faceMutex);
         if ( _drawMonochrome == drawBitmap )
             return;
         _drawMonochrome = drawBitmap;
@@ -2078,6 +2452,7 @@ public:
 
     // Synthetic thin/bold on a font that does not come with a corresponding variant.
     void setSynthWeight(int synth_weight) {
+        LVLock lock(_faceMutex);
         if (_weight == synth_weight) {
             _synth_weight = 0;
             _synth_weight_half_strength = 0;
@@ -2140,9 +2515,13 @@ public:
     // Used when an embedded font (registered by RegisterDocumentFont()) is intantiated
     bool loadFromBuffer(LVByteArrayRef buf, int index, int size, css_font_family_t fontFamily,
                                             bool monochrome, bool italicize, int weight=-1, int face_size=-1 ) {
-        FONT_GUARD;
+        LVLock lock(_faceMutex);
         Clear();
-        FT_Error error = FT_New_Memory_Face( _library, buf->get(), buf->length(), index, &_face ); /* create face object */
+        FT_Error error;
+        {
+            LVLock libraryLock(_mutex); // FT_Library is shared by all faces
+            error = FT_New_Memory_Face( _library, buf->get(), buf->length(), index, &_face );
+        } /* create face object */
         if (error != FT_Err_Ok) {
             ft_error_trace(__func__, "FT_New_Memory_Face", error);
             return false;
@@ -2153,10 +2532,14 @@ public:
     // Load font from file path
     bool loadFromFile( const char * fname, int index, int size, css_font_family_t fontFamily,
                                            bool monochrome, bool italicize, int weight=-1, int face_size=-1 ) {
-        FONT_GUARD;
+        LVLock lock(_faceMutex);
         Clear();
         _fileName = fname;
-        FT_Error error = FT_New_Face( _library, _fileName.c_str(), index, &_face ); /* create face object */
+        FT_Error error;
+        {
+            LVLock libraryLock(_mutex); // FT_Library is shared by all faces
+            error = FT_New_Face( _library, _fileName.c_str(), index, &_face );
+        } /* create face object */
         if (error != FT_Err_Ok) {
             ft_error_trace(__func__, "FT_New_Face", error);
             return false;
@@ -2465,7 +2848,7 @@ public:
         \return true if glyh was found
     */
     virtual bool getGlyphInfo( lUInt32 code, glyph_info_t * glyph, lChar32 def_char=0, bool code_is_glyph_index=false, bool is_fallback=false ) {
-        //FONT_GUARD
+        LVLock lock(_faceMutex);
         FT_UInt glyph_index;
         if ( code_is_glyph_index ) {
             // Accept 0 and give info about the notdef/tofu char
@@ -2640,6 +3023,7 @@ public:
 #endif
 
     virtual bool collectGlyphSVGPath(SVGGlyphsCollector * svg_collector, lUInt32 code, bool code_is_glyph_index=false, bool is_fallback=false) {
+        LVLock lock(_faceMutex);
 
         // All the points/distances/metrics we get with Harfbuzz and Freetype here are in *64 units,
         // so update our scale and current values fed into svg_collector
@@ -2817,6 +3201,7 @@ public:
     }
 
     virtual bool getGlyphExtraMetric( glyph_extra_metric_t metric, lUInt32 code, int & value, bool scaled_to_px, lChar32 def_char=0, bool is_fallback=false ) {
+        LVLock lock(_faceMutex);
         int glyph_index = getCharIndex( code, 0 );
         if ( glyph_index==0 ) {
             LVFontRef fallback = is_fallback ? getNextFallbackFont() : getFallbackFont();
@@ -2878,6 +3263,116 @@ public:
         \param hints: hint flags (direction, begin/end of paragraph, for Harfbuzz - unrelated to font hinting)
         \return number of characters before max_width reached
     */
+#if USE_HARFBUZZ==1
+    /// shape text with HarfBuzz (KERNING_MODE_HARFBUZZ), or get the cached result of the same
+    /// shaping; the returned run is valid until next call (don't release the font instance lock)
+    LVHBShapedRun * shapeText( const lChar32 * text, int len, lUInt32 hints, TextLangCfg * lang_cfg,
+                               bool has_fallback_font, lChar32 def_char, bool fix_invalid_script )
+    {
+        lUInt32 key_flags = hints & HB_SHAPED_RUN_HINTS_MASK;
+        if ( has_fallback_font )
+            def_char = 0; // not used
+        else
+            key_flags |= HB_SHAPED_RUN_FILTERED;
+        hb_language_t language = lang_cfg ? lang_cfg->getHBLanguage() : NULL;
+        lUInt32 hash = LVHBShapingCache::hashRun(text, len, key_flags, language, def_char);
+        LVHBShapedRun * run = _hb_shaping_cache.find(hash, text, len, key_flags, language, def_char);
+        if ( fix_invalid_script && (!run || run->script_was_invalid) ) {
+            // Shaped with latin script when drawing (see below)
+            lUInt32 latin_hash = LVHBShapingCache::hashRun(text, len, key_flags | HB_SHAPED_RUN_LATIN_SCRIPT, language, def_char);
+            run = _hb_shaping_cache.find(latin_hash, text, len, key_flags | HB_SHAPED_RUN_LATIN_SCRIPT, language, def_char);
+        }
+        if ( run ) {
+            hb_shaping_cache_counters.hits++;
+            return run;
+        }
+        hb_shaping_cache_counters.misses++;
+
+        hb_buffer_clear_contents(_hb_buffer);
+
+        // hb_buffer_set_replacement_codepoint(_hb_buffer, def_char);
+        // /\ This would just set the codepoint to use when parsing
+        // invalid utf8/16/32. As we provide codepoints, Harfbuzz
+        // won't use it. This does NOT set the codepoint/glyph that
+        // would be used when a glyph does not exist in that for that
+        // codepoint. There is currently no way to specify that, and
+        // it's always the .notdef/tofu glyph that is measured/drawn.
+
+        // Fill HarfBuzz buffer
+        // No need to call filterChar() on the input: HarfBuzz seems to do
+        // the right thing with symbol fonts, and we'd better not replace
+        // bullets & al unicode chars with generic equivalents, as they
+        // may be found in the fallback font.
+        // So, we don't, unless the current font has no fallback font,
+        // in which case we need to get a replacement, in the worst case
+        // def_char (?), because the glyph for 0/.notdef (tofu) has so
+        // many different looks among fonts that it would mess the text.
+        // We'll then get the '?' glyph of the fallback font only.
+        // Note: not sure if Harfbuzz is able to be fine by using other
+        // glyphs when the main codepoint does not exist by itself in
+        // the font... in which case we'll mess things up.
+        // todo: (if needed) might need a pre-pass in the fallback case:
+        // full shaping without filterChar(), and if any .notdef
+        // codepoint, re-shape with filterChar()...
+        if ( has_fallback_font ) { // It has a fallback font, add chars as-is
+            for (int i = 0; i < len; i++) {
+                hb_buffer_add(_hb_buffer, (hb_codepoint_t)(text[i]), i);
+            }
+        }
+        else { // No fallback font, check codepoint presence or get replacement char
+            for (int i = 0; i < len; i++) {
+                hb_buffer_add(_hb_buffer, (hb_codepoint_t)filterChar(text[i], def_char), i);
+            }
+        }
+        // Note: hb_buffer_add_codepoints(_hb_buffer, (hb_codepoint_t*)text, len, 0, len)
+        // would do the same kind of loop we did above, so no speedup gain using it; and we
+        // get to be sure of the cluster initial value we set to each of our added chars.
+        hb_buffer_set_content_type(_hb_buffer, HB_BUFFER_CONTENT_TYPE_UNICODE);
+
+        // If we are provided with direction and hints, let harfbuzz know
+        if ( hints ) {
+            if ( hints & LFNT_HINT_DIRECTION_KNOWN ) {
+                // Trust direction decided by fribidi: if we made a word containing just '(',
+                // harfbuzz wouldn't be able to determine its direction and would render
+                // it LTR - while it could be in some RTL text and needs to be mirrored.
+                if ( hints & LFNT_HINT_DIRECTION_IS_RTL )
+                    hb_buffer_set_direction(_hb_buffer, HB_DIRECTION_RTL);
+                else
+                    hb_buffer_set_direction(_hb_buffer, HB_DIRECTION_LTR);
+            }
+            int hb_flags = HB_BUFFER_FLAG_DEFAULT; // (hb_buffer_flags_t won't let us do |= )
+            if ( hints & LFNT_HINT_BEGINS_PARAGRAPH )
+                hb_flags |= HB_BUFFER_FLAG_BOT;
+            if ( hints & LFNT_HINT_ENDS_PARAGRAPH )
+                hb_flags |= HB_BUFFER_FLAG_EOT;
+            hb_buffer_set_flags(_hb_buffer, (hb_buffer_flags_t)hb_flags); // NOLINT(clang-analyzer-optin.core.EnumCastOutOfRange)
+        }
+        if ( lang_cfg ) {
+            hb_buffer_set_language(_hb_buffer, language);
+        }
+        // Let HB guess what's not been set (script, direction, language)
+        hb_buffer_guess_segment_properties(_hb_buffer);
+        bool script_was_invalid = hb_buffer_get_script(_hb_buffer) == HB_SCRIPT_INVALID;
+        // When drawing: in case HB couldn't guess a script from the unicode chars we added
+        // to its buffer, (which can happen when we give it a single CJK punctuation which
+        // would be considered as script COMMON, or a sequence of digits and punctuations),
+        // make sure we have HB aware of some valid script, so that at least the 'locl'
+        // feature works and is able to provide glyphs for the requested hb_language.
+        if ( fix_invalid_script && script_was_invalid ) {
+            // Provide "latn", which has the best chance to be known by the font and have
+            // its OpenType features working.
+            hb_buffer_set_script(_hb_buffer, HB_SCRIPT_LATIN);
+            key_flags |= HB_SHAPED_RUN_LATIN_SCRIPT;
+            hash = LVHBShapingCache::hashRun(text, len, key_flags, language, def_char);
+        }
+
+        // Shape
+        hb_shape(_hb_font, _hb_buffer, _hb_features.ptr(), (unsigned int)_hb_features.length());
+
+        return _hb_shaping_cache.add(hash, text, len, key_flags, language, def_char, _hb_buffer, script_was_invalid);
+    }
+#endif
+
     virtual lUInt16 measureText(
                         const lChar32 * text,
                         int len,
@@ -2891,7 +3386,7 @@ public:
                         lUInt32 hints=0
                      )
     {
-        FONT_GUARD
+        LVLock lock(_faceMutex);
         if ( len <= 0 || _face==NULL )
             return 0;
         if ( letter_spacing < 0 ) {
@@ -2931,77 +3426,19 @@ public:
             int glyph_count;
             hb_glyph_info_t* glyph_info = 0;
             hb_glyph_position_t* glyph_pos = 0;
-            hb_buffer_clear_contents(_hb_buffer);
-
-            // hb_buffer_set_replacement_codepoint(_hb_buffer, def_char);
-            // /\ This would just set the codepoint to use when parsing
-            // invalid utf8/16/32. As we provide codepoints, Harfbuzz
-            // won't use it. This does NOT set the codepoint/glyph that
-            // would be used when a glyph does not exist in that for that
-            // codepoint. There is currently no way to specify that, and
-            // it's always the .notdef/tofu glyph that is measured/drawn.
-
-            // Fill HarfBuzz buffer
-            // No need to call filterChar() on the input: HarfBuzz seems to do
-            // the right thing with symbol fonts, and we'd better not replace
-            // bullets & al unicode chars with generic equivalents, as they
-            // may be found in the fallback font.
-            // So, we don't, unless the current font has no fallback font,
-            // in which case we need to get a replacement, in the worst case
-            // def_char (?), because the glyph for 0/.notdef (tofu) has so
-            // many different looks among fonts that it would mess the text.
-            // We'll then get the '?' glyph of the fallback font only.
-            // Note: not sure if Harfbuzz is able to be fine by using other
-            // glyphs when the main codepoint does not exist by itself in
-            // the font... in which case we'll mess things up.
-            // todo: (if needed) might need a pre-pass in the fallback case:
-            // full shaping without filterChar(), and if any .notdef
-            // codepoint, re-shape with filterChar()...
+
+            // Shape (or get the cached shaping of this same text), see
+            // shapeText() for how the text is given to HarfBuzz
             bool is_fallback_font = hints & LFNT_HINT_IS_FALLBACK_FONT;
             LVFontRef fallback = is_fallback_font ? getNextFallbackFont() : getFallbackFont();
             bool has_fallback_font = !fallback.isNull();
-            if ( has_fallback_font ) { // It has a fallback font, add chars as-is
-                for (i = 0; i < len; i++) {
-                    hb_buffer_add(_hb_buffer, (hb_codepoint_t)(text[i]), i);
-                }
-            }
-            else { // No fallback font, check codepoint presence or get replacement char
-                for (i = 0; i < len; i++) {
-                    hb_buffer_add(_hb_buffer, (hb_codepoint_t)filterChar(text[i], def_char), i);
-                }
-            }
-            // Note: hb_buffer_add_codepoints(_hb_buffer, (hb_codepoint_t*)text, len, 0, len)
-            // would do the same kind of loop we did above, so no speedup gain using it; and we
-            // get to be sure of the cluster initial value we set to each of our added chars.
-            hb_buffer_set_content_type(_hb_buffer, HB_BUFFER_CONTENT_TYPE_UNICODE);
-
-            // If we are provided with direction and hints, let harfbuzz know
-            if ( hints ) {
-                if ( hints & LFNT_HINT_DIRECTION_KNOWN ) {
-                    if ( hints & LFNT_HINT_DIRECTION_IS_RTL )
-                        hb_buffer_set_direction(_hb_buffer, HB_DIRECTION_RTL);
-                    else
-                        hb_buffer_set_direction(_hb_buffer, HB_DIRECTION_LTR);
-                }
-                int hb_flags = HB_BUFFER_FLAG_DEFAULT; // (hb_buffer_flags_t won't let us do |= )
-                if ( hints & LFNT_HINT_BEGINS_PARAGRAPH )
-                    hb_flags |= HB_BUFFER_FLAG_BOT;
-                if ( hints & LFNT_HINT_ENDS_PARAGRAPH )
-                    hb_flags |= HB_BUFFER_FLAG_EOT;
-                hb_buffer_set_flags(_hb_buffer, (hb_buffer_flags_t)hb_flags); // NOLINT(clang-analyzer-optin.core.EnumCastOutOfRange)
-            }
-            if ( lang_cfg ) {
-                hb_buffer_set_language(_hb_buffer, lang_cfg->getHBLanguage());
-            }
-            // Let HB guess what's not been set (script, direction, language)
-            hb_buffer_guess_segment_properties(_hb_buffer);
+            LVHBShapedRun * run = shapeText(text, len, hints, lang_cfg, has_fallback_font, def_char, false);
 
             // Some additional care might need to be taken, see:
             //   https://www.w3.org/TR/css-text-3/#letter-spacing-property
             if ( letter_spacing > 0 ) {
                 // Don't apply letter-spacing if the script is cursive
-                hb_script_t script = hb_buffer_get_script(_hb_buffer);
-                if ( isHBScriptCursive(script) )
+                if ( isHBScriptCursive(run->script) )
                     letter_spacing = 0;
             }
             // todo: if letter_spacing, ligatures should be disabled (-liga, -clig)
@@ -3009,14 +3446,15 @@ public:
             // todo: it should be applied half-before/half-after each grapheme
             // cf in *some* minikin repositories: libs/minikin/Layout.cpp
 
-            // Shape
-            hb_shape(_hb_font, _hb_buffer, _hb_features.ptr(), (unsigned int)_hb_features.length());
+            glyph_count = run->glyph_count;
+            glyph_info = run->glyph_info;
+            glyph_pos = run->glyph_pos;
 
             // Harfbuzz has guessed and set a direction even if we did not provide one.
             #ifdef DEBUG_MEASURE_TEXT
             bool is_rtl = false;
             #endif
-            if ( hb_buffer_get_direction(_hb_buffer) == HB_DIRECTION_RTL ) {
+            if ( run->direction == HB_DIRECTION_RTL ) {
                 #ifdef DEBUG_MEASURE_TEXT
                 is_rtl = true;
                 #endif
@@ -3031,13 +3469,17 @@ public:
                 // looks more natural (like it happens when LTR).
                 // But hb_buffer_reverse_clusters() is required to have the clusters
                 // ordered as our text indices, so we can map them back to our text.
-                hb_buffer_reverse_clusters(_hb_buffer);
+                // We do the same on a copy, as the cached run is kept in visual
+                // order for DrawTextString().
+                _hb_glyph_info.reset();
+                _hb_glyph_info.append(glyph_info, glyph_count);
+                _hb_glyph_pos.reset();
+                _hb_glyph_pos.append(glyph_pos, glyph_count);
+                glyph_info = _hb_glyph_info.ptr();
+                glyph_pos = _hb_glyph_pos.ptr();
+                reverseHBClusters(glyph_info, glyph_pos, glyph_count);
             }
 
-            glyph_count = hb_buffer_get_length(_hb_buffer);
-            glyph_info = hb_buffer_get_glyph_infos(_hb_buffer, 0);
-            glyph_pos = hb_buffer_get_glyph_positions(_hb_buffer, 0);
-
             #ifdef DEBUG_MEASURE_TEXT
                 printf("MTHB >>> measureText %x len %d is_rtl=%d [%s]\n", text, len, is_rtl, _faceName.c_str());
                 for (i = 0; i < glyph_count; i++) {
@@ -3476,8 +3918,9 @@ public:
         \return width of specified string
     */
     virtual lUInt32 getTextWidth( const lChar32 * text, int len, TextLangCfg * lang_cfg=NULL) {
-        static lUInt16 widths[MAX_LINE_CHARS+1];
-        static lUInt8 flags[MAX_LINE_CHARS+1];
+        LVLock lock(_faceMutex);
+        static CR_THREAD_LOCAL lUInt16 widths[MAX_LINE_CHARS+1];
+        static CR_THREAD_LOCAL lUInt8 flags[MAX_LINE_CHARS+1];
         if ( len>MAX_LINE_CHARS )
             len = MAX_LINE_CHARS;
         if ( len<=0 )
@@ -3508,7 +3951,7 @@ public:
         \return glyph pointer if glyph was found, NULL otherwise
     */
     virtual LVFontGlyphCacheItem * getGlyph(lUInt32 ch, lChar32 def_char=0, bool is_fallback=false) {
-        //FONT_GUARD
+        LVLock lock(_faceMutex);
         FT_UInt ch_glyph_index = getCharIndex( ch, 0 );
         if ( ch_glyph_index==0 ) {
             LVFontRef fallback = is_fallback ? getNextFallbackFont() : getFallbackFont();
@@ -3603,7 +4046,7 @@ public:
 
 #if USE_HARFBUZZ==1
     LVFontGlyphCacheItem * getGlyphByIndex(lUInt32 index) {
-        //FONT_GUARD
+        LVLock lock(_faceMutex);
         LVFontGlyphCacheItem *item = _glyph_cache2.getByIndex(index);
         if (!item) {
             // glyph not found in cache, rendering...
@@ -3684,6 +4127,7 @@ public:
     }
 
     LVFontGlyphCacheItem * getGlyphByIndexSubpixel(lUInt32 index, int phase_step, int phase_count) {
+        LVLock lock(_faceMutex);
         if (phase_count <= 1 || _drawMonochrome )
             return NULL;
         // Phase zero has no outline translation, so reuse the normal bitmap.
@@ -3805,6 +4249,7 @@ public:
     /// returns char glyph advance width
     virtual int getCharWidth( lChar32 ch, lChar32 def_char='?' )
     {
+        LVLock lock(_faceMutex);
         int w = _wcache.get(ch);
         if ( w == CACHED_UNSIGNED_METRIC_NOT_SET ) {
             glyph_info_t glyph;
@@ -3822,6 +4267,7 @@ public:
     /// returns char glyph left side bearing
     virtual int getLeftSideBearing( lChar32 ch, bool negative_only=false, bool italic_only=false )
     {
+        LVLock lock(_faceMutex);
         if ( italic_only && !getItalic() )
             return 0;
         int b = _lsbcache.get(ch);
@@ -3843,6 +4289,7 @@ public:
     /// returns char glyph right side bearing
     virtual int getRightSideBearing( lChar32 ch, bool negative_only=false, bool italic_only=false )
     {
+        LVLock lock(_faceMutex);
         if ( italic_only && !getItalic() )
             return 0;
         int b = _rsbcache.get(ch);
@@ -3874,6 +4321,7 @@ public:
 
     virtual int getExtraMetric(font_extra_metric_t metric, bool scaled_to_px)
     {
+        LVLock lock(_faceMutex);
         if ( _extra_metric == NULL ) {
             _extra_metric = (int *)malloc(sizeof(int)*FONT_METRIC_MAX);
             for (int i=0; i<FONT_METRIC_MAX; i++) {
@@ -4275,7 +4723,7 @@ public:
                        int target_w=-1, int target_h=-1,
                        SVGGlyphsCollector * svg_collector=NULL)
     {
-        FONT_GUARD
+        LVLock lock(_faceMutex);
         if ( len <= 0 || _face==NULL )
             return 0;
         if ( letter_spacing < 0 ) {
@@ -4307,76 +4755,27 @@ public:
             int glyph_count;
             hb_glyph_info_t *glyph_info = 0;
             hb_glyph_position_t *glyph_pos = 0;
-            hb_buffer_clear_contents(_hb_buffer);
-            // Fill HarfBuzz buffer
+            // Shape (or get the cached shaping of this same text)
             bool is_fallback_font = flags & LFNT_HINT_IS_FALLBACK_FONT;
             LVFontRef fallback = is_fallback_font ? getNextFallbackFont() : getFallbackFont();
             bool has_fallback_font = !fallback.isNull();
-            if ( has_fallback_font ) { // It has a fallback font, add chars as-is
-                for (i = 0; i < len; i++) {
-                    hb_buffer_add(_hb_buffer, (hb_codepoint_t)(text[i]), i);
-                }
-            }
-            else { // No fallback font, check codepoint presence or get replacement char
-                for (i = 0; i < len; i++) {
-                    hb_buffer_add(_hb_buffer, (hb_codepoint_t)filterChar(text[i], def_char), i);
-                }
-            }
-            hb_buffer_set_content_type(_hb_buffer, HB_BUFFER_CONTENT_TYPE_UNICODE);
-
-            // If we are provided with direction and hints, let harfbuzz know
-            if ( flags ) {
-                if ( flags & LFNT_HINT_DIRECTION_KNOWN ) {
-                    // Trust direction decided by fribidi: if we made a word containing just '(',
-                    // harfbuzz wouldn't be able to determine its direction and would render
-                    // it LTR - while it could be in some RTL text and needs to be mirrored.
-                    if ( flags & LFNT_HINT_DIRECTION_IS_RTL )
-                        hb_buffer_set_direction(_hb_buffer, HB_DIRECTION_RTL);
-                    else
-                        hb_buffer_set_direction(_hb_buffer, HB_DIRECTION_LTR);
-                }
-                int hb_flags = HB_BUFFER_FLAG_DEFAULT; // (hb_buffer_flags_t won't let us do |= )
-                if ( flags & LFNT_HINT_BEGINS_PARAGRAPH )
-                    hb_flags |= HB_BUFFER_FLAG_BOT;
-                if ( flags & LFNT_HINT_ENDS_PARAGRAPH )
-                    hb_flags |= HB_BUFFER_FLAG_EOT;
-                hb_buffer_set_flags(_hb_buffer, (hb_buffer_flags_t)hb_flags); // NOLINT(clang-analyzer-optin.core.EnumCastOutOfRange)
-            }
-            if ( lang_cfg ) {
-                hb_buffer_set_language(_hb_buffer, lang_cfg->getHBLanguage());
-            }
-            // Let HB guess what's not been set (script, direction, language)
-            hb_buffer_guess_segment_properties(_hb_buffer);
-            // In case HB couldn't guess a script from the unicode chars we added to its buffer,
-            // (which can happen when we give it a single CJK punctuation which would be considered
-            // as script COMMON, or a sequence of digits and punctuations), make sure we have HB aware
-            // of some valid script, so that at least the 'locl' feature works and is able to provide
-            // glyphs for the requested hb_language.
-            if ( hb_buffer_get_script(_hb_buffer) == HB_SCRIPT_INVALID ) {
-                // Provide "latn", which has the best chance to be known by the font and have
-                // its OpenType features working.
-                hb_buffer_set_script(_hb_buffer, HB_SCRIPT_LATIN);
-            }
+            LVHBShapedRun * run = shapeText(text, len, flags, lang_cfg, has_fallback_font, def_char, true);
 
             // See measureText() for details
             if ( letter_spacing > 0 ) {
                 // Don't apply letter-spacing if the script is cursive
-                hb_script_t script = hb_buffer_get_script(_hb_buffer);
-                if ( isHBScriptCursive(script) )
+                if ( isHBScriptCursive(run->script) )
                     letter_spacing = 0;
             }
 
-            // Shape
-            hb_shape(_hb_font, _hb_buffer, _hb_features.ptr(), (unsigned int)_hb_features.length());
-
             // If direction is RTL, hb_shape() has reversed the order of the glyphs, so
             // they are in visual order and ready to be iterated and drawn. So,
             // we do not revert them, unlike in measureText().
-            bool is_rtl = hb_buffer_get_direction(_hb_buffer) == HB_DIRECTION_RTL;
+            bool is_rtl = run->direction == HB_DIRECTION_RTL;
 
-            glyph_count = hb_buffer_get_length(_hb_buffer);
-            glyph_info = hb_buffer_get_glyph_infos(_hb_buffer, 0);
-            glyph_pos = hb_buffer_get_glyph_positions(_hb_buffer, 0);
+            glyph_count = run->glyph_count;
+            glyph_info = run->glyph_info;
+            glyph_pos = run->glyph_pos;
 
             #ifdef DEBUG_DRAW_TEXT
                 printf("DTHB >>> drawTextString %x len %d is_rtl=%d [%s]\n", text, len, is_rtl, _faceName.c_str());
@@ -4543,7 +4942,7 @@ public:
                     bool cluster_has_advance = false;
                     for (i = hg; i < hg2; i++) {
                         if ( svg_collector ) {
-                            bool can_adjust_from_previous = (i == hg) && !isHBScriptCursive(hb_buffer_get_script(_hb_buffer));
+                            bool can_adjust_from_previous = (i == hg) && !isHBScriptCursive(run->script);
                             svg_collector->collectGlyph(this, glyph_info[i].codepoint, true, text[glyph_info[i].cluster],
                                                         glyph_pos[i].x_offset,  -glyph_pos[i].y_offset,
                                                         glyph_pos[i].x_advance, -glyph_pos[i].y_advance,
@@ -5017,6 +5416,7 @@ public:
 
     void DrawStretchedGlyph(LVDrawBuf * buf, int glyph_index, int x, int y, int w, int h, lUInt32 * palette=NULL)
     {
+        LVLock lock(_faceMutex);
         // This is used for drawing stretched MathML operators,
         // and we do it the "cheap" way by just scaling the glyph
         // (which will have the edges of glyphs like '[' or '{'
@@ -5163,7 +5563,8 @@ public:
 
     virtual void Clear()
     {
-        LVLock lock(_mutex);
+        LVLock lock(_faceMutex);
+        LVLock libraryLock(_mutex);
         clearCache();
         #if USE_HARFBUZZ==1
         if (_hb_font) {
@@ -5475,6 +5876,7 @@ class LVFontBoldTransform : public LVFontProxy
 {
     int _hShift;
     int _vShift;
+    LVMutex _mutex; // this font instance lock
     LVFontLocalGlyphCache _glyph_cache;
 public:
     /// returns font weight
@@ -5486,7 +5888,7 @@ public:
     }
 
     LVFontBoldTransform( LVFontRef baseFont, LVFontGlobalGlyphCache * globalCache )
-        : LVFontProxy(baseFont), _glyph_cache(globalCache)
+        : LVFontProxy(baseFont), _glyph_cache(globalCache, &_mutex)
     {
         int size = _font->getSize();
         _hShift = size <= 36 ? 1 : 2;
@@ -5555,8 +5957,8 @@ public:
         \return width of specified string
     */
     virtual lUInt32 getTextWidth( const lChar32 * text, int len, TextLangCfg * lang_cfg=NULL) {
-        static lUInt16 widths[MAX_LINE_CHARS+1];
-        static lUInt8 flags[MAX_LINE_CHARS+1];
+        static CR_THREAD_LOCAL lUInt16 widths[MAX_LINE_CHARS+1];
+        static CR_THREAD_LOCAL lUInt8 flags[MAX_LINE_CHARS+1];
         if ( len>MAX_LINE_CHARS )
             len = MAX_LINE_CHARS;
         if ( len<=0 )
@@ -5579,7 +5981,7 @@ public:
         \return glyph pointer if glyph was found, NULL otherwise
     */
     virtual LVFontGlyphCacheItem * getGlyph(lUInt32 ch, lChar32 def_char=0, bool is_fallback=false) {
-
+        LVLock lock(_mutex);
         LVFontGlyphCacheItem * item = _glyph_cache.getByChar( ch );
         if ( item )
             return item;
@@ -5752,6 +6154,7 @@ public:
                        int target_w, int target_h,
                        SVGGlyphsCollector * svg_collector)
     {
+        LVLock lock(_mutex);
         if ( len <= 0 )
             return 0;
         if ( letter_spacing < 0 ) {
@@ -6356,6 +6759,242 @@ public:
     }
 };
 
+/// On-disk index of the faces found in font files by RegisterFont(), so
+/// that font files don't need to be opened with FreeType (and HarfBuzz)
+/// at each startup. Entries are keyed by file path, and are only valid
+/// for the file size and modification time recorded when scanned: a new
+/// or modified font file is scanned again. The whole index is discarded
+/// when its version, or the set of inspected face capabilities, changes.
+#define FONT_REGISTRY_INDEX_MAGIC "CR3 FONT REGISTRY INDEX\n"
+#define FONT_REGISTRY_INDEX_VERSION 2
+#define FONT_REGISTRY_INDEX_MAX_SIZE 0x4000000 // 64 MiB, sanity limit when loading
+class LVFontRegistryIndex {
+    struct Entry {
+        lString8 file_path;
+        lUInt64  size;
+        lUInt64  mtime;
+        bool     used;   // looked up or scanned in this session
+        LVPtrVector<LVFontFace, true> faces; // empty if the file has no usable face
+        Entry() : size(0), mtime(0), used(false) {}
+    };
+    lString8 _fileName;
+    LVPtrVector<Entry, true> _entries;
+    LVHashTable<lString8, Entry*> _map;
+    bool _dirty;
+
+    static lUInt32 getFeatureFlags() {
+        lUInt32 flags = 0;
+        #if USE_HARFBUZZ==1
+        flags |= 1; // has_ot_math and has_small_caps are detected
+        #endif
+        return flags;
+    }
+    // Axis values are saved as their float bits, so that faces loaded from
+    // the index get exactly the values of a scan (and the same instance keys)
+    static void putFloat(SerialBuf & buf, float v) {
+        lUInt32 bits;
+        memcpy(&bits, &v, sizeof(bits));
+        buf << bits;
+    }
+    static float getFloat(SerialBuf & buf) {
+        lUInt32 bits = 0;
+        buf >> bits;
+        float v;
+        memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+    static void serializeFace(SerialBuf & buf, const LVFontFace & face) {
+        buf << (lInt32)face.face_index << face.is_italic << (lUInt8)face.css_family << face.typeface;
+        buf << face.has_emojis << face.has_ot_math << face.has_small_caps;
+        lUInt8 axes = (face._has_wght ? 1 : 0) | (face._has_opsz ? 2 : 0) | (face._has_ital ? 4 : 0)
+                    | (face._has_slnt ? 8 : 0) | (face._has_wdth ? 16 : 0);
+        buf << axes;
+        putFloat(buf, face._wght_min); putFloat(buf, face._wght_max);
+        putFloat(buf, face._opsz_min); putFloat(buf, face._opsz_max);
+        putFloat(buf, face._ital_min); putFloat(buf, face._ital_max);
+        putFloat(buf, face._slnt_min); putFloat(buf, face._slnt_max);
+        putFloat(buf, face._wdth_min); putFloat(buf, face._wdth_max);
+    }
+    static void deserializeFace(SerialBuf & buf, LVFontFace & face) {
+        lInt32 index = 0;
+        lUInt8 family = 0;
+        lUInt8 axes = 0;
+        buf >> index >> face.is_italic >> family >> face.typeface;
+        buf >> face.has_emojis >> face.has_ot_math >> face.has_small_caps;
+        buf >> axes;
+        face.face_index = index;
+        face.css_family = (css_font_family_t)family;
+        face._has_wght = (axes & 1) != 0;
+        face._has_opsz = (axes & 2) != 0;
+        face._has_ital = (axes & 4) != 0;
+        face._has_slnt = (axes & 8) != 0;
+        face._has_wdth = (axes & 16) != 0;
+        face._wght_min = getFloat(buf); face._wght_max = getFloat(buf);
+        face._opsz_min = getFloat(buf); face._opsz_max = getFloat(buf);
+        face._ital_min = getFloat(buf); face._ital_max = getFloat(buf);
+        face._slnt_min = getFloat(buf); face._slnt_max = getFloat(buf);
+        face._wdth_min = getFloat(buf); face._wdth_max = getFloat(buf);
+    }
+public:
+    LVFontRegistryIndex() : _map(256), _dirty(false) {}
+
+    const lString8 & getFileName() const { return _fileName; }
+
+    void clear() {
+        _map.clear();
+        _entries.clear();
+        _dirty = false;
+    }
+
+    /// Sets index file name and loads it. Returns false if the file
+    /// doesn't exist or can't be used (the index is then empty).
+    bool open(const lString8 & fileName) {
+        clear();
+        _fileName = fileName;
+        if (fileName.empty())
+            return false;
+        LVStreamRef stream = LVOpenFileStream(fileName.c_str(), LVOM_READ);
+        if (stream.isNull())
+            return false;
+        lvsize_t sz = stream->GetSize();
+        if (sz < 8 || sz > FONT_REGISTRY_INDEX_MAX_SIZE)
+            return false;
+        SerialBuf buf((int)sz, false);
+        lvsize_t bytesRead = 0;
+        if (stream->Read(buf.buf(), sz, &bytesRead) != LVERR_OK || bytesRead != sz)
+            return false;
+        buf.setPos((int)sz - 4);
+        buf.checkCRC((int)sz - 4);
+        buf.setPos(0);
+        if (buf.error()) {
+            CRLog::warn("Font registry index %s is corrupted, ignored", fileName.c_str());
+            return false;
+        }
+        lUInt32 version = 0;
+        lUInt32 flags = 0;
+        lUInt32 count = 0;
+        if (!buf.checkMagic(FONT_REGISTRY_INDEX_MAGIC))
+            return false;
+        buf >> version >> flags >> count;
+        if (buf.error() || version != FONT_REGISTRY_INDEX_VERSION || flags != getFeatureFlags()) {
+            CRLog::info("Font registry index %s is outdated, fonts will be scanned again", fileName.c_str());
+            _dirty = true;
+            return false;
+        }
+        for (lUInt32 i = 0; i < count && !buf.error(); i++) {
+            Entry * entry = new Entry();
+            lUInt32 size_lo = 0, size_hi = 0, mtime_lo = 0, mtime_hi = 0, faceCount = 0;
+            buf >> entry->file_path >> size_lo >> size_hi >> mtime_lo >> mtime_hi >> faceCount;
+            entry->size = ((lUInt64)size_hi << 32) | size_lo;
+            entry->mtime = ((lUInt64)mtime_hi << 32) | mtime_lo;
+            for (lUInt32 j = 0; j < faceCount && !buf.error(); j++) {
+                LVFontFace * face = new LVFontFace();
+                deserializeFace(buf, *face);
+                face->file_path = entry->file_path;
+                entry->faces.add(face);
+            }
+            _entries.add(entry);
+            _map.set(entry->file_path, entry);
+        }
+        if (buf.error() || buf.pos() != (int)sz - 4) {
+            CRLog::warn("Font registry index %s is corrupted, ignored", fileName.c_str());
+            clear();
+            _dirty = true;
+            return false;
+        }
+        CRLog::debug("Font registry index %s: %d font files", fileName.c_str(), _entries.length());
+        return true;
+    }
+
+    /// Writes the index if it was changed. Entries not used in this session
+    /// are kept only while their font file still exists.
+    bool save() {
+        if (_fileName.empty() || !_dirty)
+            return true;
+        SerialBuf buf(0x10000, true);
+        buf.putMagic(FONT_REGISTRY_INDEX_MAGIC);
+        buf << (lUInt32)FONT_REGISTRY_INDEX_VERSION << getFeatureFlags();
+        int countPos = buf.pos();
+        buf << (lUInt32)0;
+        lUInt32 count = 0;
+        for (int i = 0; i < _entries.length(); i++) {
+            Entry * entry = _entries[i];
+            lUInt64 size, mtime;
+            if (!entry->used && !LVGetFileStat(entry->file_path, size, mtime))
+                continue;
+            buf << entry->file_path;
+            buf << (lUInt32)(entry->size & 0xFFFFFFFF) << (lUInt32)(entry->size >> 32);
+            buf << (lUInt32)(entry->mtime & 0xFFFFFFFF) << (lUInt32)(entry->mtime >> 32);
+            buf << (lUInt32)entry->faces.length();
+            for (int j = 0; j < entry->faces.length(); j++)
+                serializeFace(buf, *entry->faces[j]);
+            count++;
+        }
+        int endPos = buf.pos();
+        buf.setPos(countPos);
+        buf << count;
+        buf.setPos(endPos);
+        buf.putCRC(endPos);
+        if (buf.error())
+            return false;
+        lString8 tmpName = _fileName + ".tmp";
+        {
+            LVStreamRef stream = LVOpenFileStream(tmpName.c_str(), LVOM_WRITE);
+            if (stream.isNull()) {
+                CRLog::error("Cannot create font registry index %s", tmpName.c_str());
+                return false;
+            }
+            lvsize_t bytesWritten = 0;
+            if (stream->Write(buf.buf(), buf.pos(), &bytesWritten) != LVERR_OK || bytesWritten != (lvsize_t)buf.pos()) {
+                stream.Clear();
+                LVDeleteFile(tmpName);
+                CRLog::error("Cannot write font registry index %s", tmpName.c_str());
+                return false;
+            }
+        }
+        if (!LVRenameFile(tmpName, _fileName)) {
+            // rename doesn't replace existing file on some platforms
+            LVDeleteFile(_fileName);
+            if (!LVRenameFile(tmpName, _fileName)) {
+                LVDeleteFile(tmpName);
+                return false;
+            }
+        }
+        _dirty = false;
+        return true;
+    }
+
+    /// Returns faces stored for this font file, or NULL if the file was not
+    /// scanned yet or has been modified since
+    const LVPtrVector<LVFontFace, true> * find(const lString8 & file_path, lUInt64 size, lUInt64 mtime) {
+        Entry * entry = NULL;
+        if (!_map.get(file_path, entry))
+            return NULL;
+        if (entry->size != size || entry->mtime != mtime)
+            return NULL;
+        entry->used = true;
+        return &entry->faces;
+    }
+
+    /// Stores the result of a font file scan
+    void update(const lString8 & file_path, lUInt64 size, lUInt64 mtime, const LVArray<LVFontFace*> & faces) {
+        Entry * entry = NULL;
+        if (!_map.get(file_path, entry)) {
+            entry = new Entry();
+            entry->file_path = file_path;
+            _entries.add(entry);
+            _map.set(file_path, entry);
+        }
+        entry->size = size;
+        entry->mtime = mtime;
+        entry->used = true;
+        entry->faces.clear();
+        for (int i = 0; i < faces.length(); i++)
+            entry->faces.add(new LVFontFace(*faces[i]));
+        _dirty = true;
+    }
+};
+
 /// Result of a font selection.
 /// computed_variations holds the OpenType axis values to apply (variable fonts only).
 /// Synthesized bold/italic are NOT here; loadAndCache() re-derives them from
@@ -6630,12 +7269,14 @@ public:
     void clear() {
         _entries.clear();
     }
-    // Evict instances whose face_id is in the provided set.
+    // Evict instances whose face_id is in the provided set, moving them to
+    // evicted (to be destroyed out of the font manager lock, as gc() does).
     // Call before removeFonts() so the registry still holds the face IDs.
-    void evictFaces(const LVArray<lUInt32>& face_ids) {
+    void evictFaces(const LVArray<lUInt32>& face_ids, LVArray<LVFontRef>& evicted) {
         for (int i = _entries.length() - 1; i >= 0; i--)
             for (int j = 0; j < face_ids.length(); j++)
                 if (_entries[i].key.face_id == face_ids[j]) {
+                    evicted.add(_entries[i].font);
                     _entries.remove(i);
                     break;
                 }
@@ -6646,19 +7287,22 @@ public:
     }
     int length() const { return _entries.length(); }
 
-    /// Call f(font) for every live instance.  Used by mode-change methods
+    /// Add every live instance to fonts.  Used by mode-change methods
     /// (SetAntialiasMode, SetHintingMode, SetKerningMode, clearGlyphCache).
-    template<typename Fn>
-    void forEachFont(Fn f) {
+    void getFonts(LVArray<LVFontRef>& fonts) const {
         for (int i = 0; i < _entries.length(); i++)
             if (!_entries[i].font.isNull())
-                f(_entries[i].font);
+                fonts.add(_entries[i].font);
     }
 
-    void gc() {
+    /// Remove instances not used anymore, moving them to unused (so that
+    /// they can be destroyed out of the font manager lock).
+    void gc(LVArray<LVFontRef>& unused) {
         for (int i = _entries.length() - 1; i >= 0; i--) {
-            if (_entries[i].font.isNull() || _entries[i].font.getRefCount() == 1)
+            if (_entries[i].font.isNull() || _entries[i].font.getRefCount() == 1) {
+                unused.add(_entries[i].font);
                 _entries.remove(i);
+            }
         }
     }
 };
@@ -6669,6 +7313,7 @@ private:
     lString8    _fallbackFontFacesString;  // comma separated list of fallback fonts
     lString8Collection _fallbackFontFaces; // splitted from previous
     LVFontRegistry      _registry;         // physical face registry
+    LVFontRegistryIndex _registry_index;   // on-disk cache of RegisterFont() font file scans
     LVFontSelector      _font_selector;    // font matching/selection (see LVFontSelector)
     LVFontInstanceCache _instance_cache;   // exact-match instance cache
     lString8 _preferred_family;            // primary reading font - step-2 fallback for any generic family
@@ -6680,6 +7325,23 @@ private:
     FILE * _log;
     #endif
     LVMutex   _lock;
+
+    // Font instances take FONT_MAN_GUARD while locked, to get their fallback
+    // fonts, so the font manager never locks an instance while holding it:
+    // instances are loaded and set up (GetFont()), changed (forEachFont())
+    // and destroyed (gc()) out of it.
+
+    /// call f(font) for every live font instance, out of the font manager lock
+    template<typename Fn>
+    void forEachFont(Fn f) {
+        LVArray<LVFontRef> fonts;
+        {
+            FONT_MAN_GUARD
+            _instance_cache.getFonts(fonts);
+        }
+        for (int i = 0; i < fonts.length(); i++)
+            f(fonts[i]);
+    }
 public:
 
     /// get hash of installed fonts and fallback font
@@ -6709,8 +7371,10 @@ public:
 
     /// set fallback fonts
     virtual bool SetFallbackFontFaces( lString8 facesString ) {
-        FONT_MAN_GUARD
-        if ( facesString != _fallbackFontFacesString ) {
+        {
+            FONT_MAN_GUARD
+            if ( facesString == _fallbackFontFacesString )
+                return !_fallbackFontFacesString.empty();
             // Multiple fallback font names can be provided, separated by '|'
             lString8Collection faces = lString8Collection(facesString, lString8("|"));
             bool has_valid_face = false;
@@ -6744,16 +7408,16 @@ public:
                 return false;
             }
             _fallbackFontFacesString = facesString;
-            // Somehow, with Fedra Serif (only!), changing the fallback font does
-            // not prevent glyphs from previous fallback font to be re-used...
-            // So let's clear glyphs caches too.
-            // Also reset the per-instance cached fallback font reference so every
-            // live instance re-resolves it against the new fallback on next use.
-            _instance_cache.forEachFont([](LVFontRef& f) { f->setFallbackFont(LVFontRef()); });
-            gc();
-            clearGlyphCache();
         }
-        return !_fallbackFontFacesString.empty();
+        // Somehow, with Fedra Serif (only!), changing the fallback font does
+        // not prevent glyphs from previous fallback font to be re-used...
+        // So let's clear glyphs caches too.
+        // Also reset the per-instance cached fallback font reference so every
+        // live instance re-resolves it against the new fallback on next use.
+        forEachFont([](LVFontRef& f) { f->setFallbackFont(LVFontRef()); });
+        gc();
+        clearGlyphCache();
+        return true;
     }
 
     virtual void SetPrimaryFont( lString8 face ) {
@@ -6774,9 +7438,13 @@ public:
 
     /// returns fallback font for specified size
     virtual LVFontRef GetFallbackFont(int size) {
-        FONT_MAN_GUARD
-        if ( _fallbackFontFaces.length() == 0 )
-            return LVFontRef();
+        lString8 face;
+        {
+            FONT_MAN_GUARD
+            if ( _fallbackFontFaces.length() == 0 )
+                return LVFontRef();
+            face = _fallbackFontFaces[0];
+        }
         // reduce number of possible distinct sizes for fallback font
         if ( size>40 )
             size &= 0xFFF8;
@@ -6785,42 +7453,46 @@ public:
         else if ( size>16 )
             size &= 0xFFFE;
         // GetFont() uses the selector + instance cache - no need for findFallback().
-        return GetFont(size, 400, false, css_ff_sans_serif, _fallbackFontFaces[0], 0, -1);
+        return GetFont(size, 400, false, css_ff_sans_serif, face, 0, -1);
     }
 
     /// returns fallback font for specified size, weight and italic
     virtual LVFontRef GetFallbackFont(int size, int weight=400, bool italic=false, lString8 forFaceName=lString8::empty_str) {
-        FONT_MAN_GUARD
-        if ( _fallbackFontFaces.length() == 0 )
-            return LVFontRef();
-        /* No real need to limit the number of instances (we prefer accuracy)
-        // reduce number of possible distinct sizes for fallback font
-        if ( size>40 )
-            size &= 0xFFF8;
-        else if ( size>28 )
-            size &= 0xFFFC;
-        else if ( size>16 )
-            size &= 0xFFFE;
-        */
-        // If forFaceName not provided, returns first font among _fallbackFontFaces.
-        // If forFaceName provided, returns the one just after it, if forFaceName is
-        // among _fallbackFontFaces. If it is not, return the first one.
-        int idx = 0;
-        if ( !forFaceName.empty() ) {
-            for ( int i=0; i < _fallbackFontFaces.length(); i++ ) {
-                if ( forFaceName == _fallbackFontFaces[i] ) {
-                    idx = i + 1;
-                    if ( idx >= _fallbackFontFaces.length() ) // forFaceName was last fallback font
-                        return LVFontRef();
-                    break;
+        lString8 face;
+        {
+            FONT_MAN_GUARD
+            if ( _fallbackFontFaces.length() == 0 )
+                return LVFontRef();
+            /* No real need to limit the number of instances (we prefer accuracy)
+            // reduce number of possible distinct sizes for fallback font
+            if ( size>40 )
+                size &= 0xFFF8;
+            else if ( size>28 )
+                size &= 0xFFFC;
+            else if ( size>16 )
+                size &= 0xFFFE;
+            */
+            // If forFaceName not provided, returns first font among _fallbackFontFaces.
+            // If forFaceName provided, returns the one just after it, if forFaceName is
+            // among _fallbackFontFaces. If it is not, return the first one.
+            int idx = 0;
+            if ( !forFaceName.empty() ) {
+                for ( int i=0; i < _fallbackFontFaces.length(); i++ ) {
+                    if ( forFaceName == _fallbackFontFaces[i] ) {
+                        idx = i + 1;
+                        if ( idx >= _fallbackFontFaces.length() ) // forFaceName was last fallback font
+                            return LVFontRef();
+                        break;
+                    }
                 }
             }
+            face = _fallbackFontFaces[idx];
         }
         // We don't use/extend findFallback(), which was made to work
         // assuming the fallback font is a standalone regular font
         // without any bold/italic sibling.
         // GetFont() works just as fine when we need specified weigh and italic.
-        return GetFont(size, weight, italic, css_ff_sans_serif, _fallbackFontFaces[idx], 0, -1);
+        return GetFont(size, weight, italic, css_ff_sans_serif, face, 0, -1);
     }
 
     bool isBitmapModeForSize( int size )
@@ -6847,8 +7519,7 @@ public:
         _antialiasMode = mode;
         gc();
         clearGlyphCache();
-        FONT_MAN_GUARD
-        _instance_cache.forEachFont([this](LVFontRef& f) {
+        forEachFont([this](LVFontRef& f) {
             f->setBitmapMode(isBitmapModeForSize(f->getHeight()));
         });
     }
@@ -6857,12 +7528,14 @@ public:
     virtual void SetHintingMode(hinting_mode_t mode) {
         if (_hintingMode == mode)
             return;
-        FONT_MAN_GUARD
         CRLog::debug("Hinting mode is changed: %d", (int)mode);
-        _hintingMode = mode;
+        {
+            FONT_MAN_GUARD
+            _hintingMode = mode;
+        }
         gc();
         clearGlyphCache();
-        _instance_cache.forEachFont([mode](LVFontRef& f) {
+        forEachFont([mode](LVFontRef& f) {
             f->setHintingMode(mode);
         });
     }
@@ -6875,11 +7548,13 @@ public:
     /// set antialiasing mode
     virtual void SetKerningMode( kerning_mode_t mode )
     {
-        FONT_MAN_GUARD
-        _kerningMode = mode;
+        {
+            FONT_MAN_GUARD
+            _kerningMode = mode;
+        }
         gc();
         clearGlyphCache();
-        _instance_cache.forEachFont([mode](LVFontRef& f) {
+        forEachFont([mode](LVFontRef& f) {
             f->setKerningMode(mode);
         });
     }
@@ -6893,8 +7568,10 @@ public:
             strength = 0;
         if (fractionalGlyphPositioningStrength == strength)
             return;
-        FONT_MAN_GUARD
-        fractionalGlyphPositioningStrength = strength;
+        {
+            FONT_MAN_GUARD
+            fractionalGlyphPositioningStrength = strength;
+        }
         CRLog::debug("Fractional glyph positioning strength is %d", strength);
         gc();
         clearGlyphCache();
@@ -6903,8 +7580,10 @@ public:
     /// set monospace size scale percent
     virtual void SetMonospaceSizeScale( int scale )
     {
-        FONT_MAN_GUARD
-        _monospaceSizeScale = scale;
+        {
+            FONT_MAN_GUARD
+            _monospaceSizeScale = scale;
+        }
         gc();
         clearGlyphCache();
         // We would need to loop thru each instance and somehow invalidate
@@ -6920,27 +7599,52 @@ public:
 
     virtual void SetFallbackFontSizesAdjusted( bool adjusted )
     {
-        FONT_MAN_GUARD
-        _fallbackFontSizesAdjusted = adjusted;
-        _instance_cache.forEachFont([](LVFontRef& f) { f->setFallbackFont(LVFontRef()); });
+        {
+            FONT_MAN_GUARD
+            _fallbackFontSizesAdjusted = adjusted;
+        }
+        forEachFont([](LVFontRef& f) { f->setFallbackFont(LVFontRef()); });
         gc();
     }
 
     /// clear glyph cache
     virtual void clearGlyphCache()
     {
-        FONT_MAN_GUARD
-        _globalCache.clear();
+        {
+            FONT_MAN_GUARD
+            _globalCache.clear();
+        }
         #if USE_HARFBUZZ==1
         // Clear per-font glyph caches (e.g. after a gamma change).
-        _instance_cache.forEachFont([](LVFontRef& f) {
+        forEachFont([](LVFontRef& f) {
             f->clearCache();
         });
         #endif
     }
 
+    #if USE_HARFBUZZ==1
+    /// get HarfBuzz shaping cache statistics
+    virtual void getShapingCacheStats( LVFontShapingCacheStats & stats )
+    {
+        stats.hits = hb_shaping_cache_counters.hits;
+        stats.misses = hb_shaping_cache_counters.misses;
+        stats.evictions = hb_shaping_cache_counters.evictions;
+        stats.items = hb_shaping_cache_counters.items;
+        stats.size = hb_shaping_cache_counters.size;
+    }
+
+    /// reset HarfBuzz shaping cache hits, misses and evictions counters
+    virtual void resetShapingCacheStats()
+    {
+        hb_shaping_cache_counters.hits = 0;
+        hb_shaping_cache_counters.misses = 0;
+        hb_shaping_cache_counters.evictions = 0;
+    }
+    #endif
+
     virtual int GetFontCount()
     {
+        FONT_MAN_GUARD
         return _registry.familyCount();
     }
 
@@ -7150,11 +7854,12 @@ public:
 
     virtual ~LVFreeTypeFontManager()
     {
-        FONT_MAN_GUARD
         // Release all cached font instances before touching the glyph cache or
         // library: LVFreeTypeFace destructors call FT_Done_Face and flush their
         // local glyph cache, both of which require these to still be alive.
         _instance_cache.clearAll();
+        FONT_MAN_GUARD
+        _registry_index.save();
         _globalCache.clear();
         if ( _library )
             FT_Done_FreeType( _library );
@@ -7192,8 +7897,12 @@ public:
 
     virtual void gc() // garbage collector
     {
-        FONT_MAN_GUARD
-        _instance_cache.gc();
+        LVArray<LVFontRef> unused;
+        {
+            FONT_MAN_GUARD
+            _instance_cache.gc(unused);
+        }
+        // unused instances are destroyed here
     }
 
     /// returns available typefaces (global fonts only - excludes document-embedded fonts)
@@ -7818,6 +8527,12 @@ public:
                                     (features & LFNT_OT_FEATURES_P_C2SC) != 0));
         }
 
+        FONT_MAN_GUARD
+        // Another thread may have loaded the same instance meanwhile: keep
+        // the first one (ours is released after the guard).
+        LVFontRef cached = _instance_cache.get(key);
+        if (!cached.isNull())
+            return cached;
         _instance_cache.put(key, ref);
         return ref;
     }
@@ -7826,44 +8541,54 @@ public:
                                 int features, int documentId, bool useBias=false,
                                 const LVFontVariations* variations=NULL, int docFragmentIdx = -1)
     {
-        FONT_MAN_GUARD
-
-        // 1. Select face + synthesis via LVFontSelector.
-        LVFontVariations requested = variations ? *variations : LVFontVariations();
-        lString8 preferred;
-        if (useBias) {
-            preferred = _preferred_by_css_family[(int)css_family];
-            if (preferred.empty())
-                preferred = _preferred_family;
-        }
-        LVFontMatch m = _font_selector.select(weight, italic, css_family, typeface,
-                                         requested, _registry, documentId, preferred, docFragmentIdx);
-        if (!m.valid()) {
-            CRLog::error("GetFont: no match for typeface='%s' w=%d italic=%d family=%d",
-                         typeface.c_str(), weight, (int)italic, (int)css_family);
-            return LVFontRef(NULL);
-        }
-
-        // 2. Build instance cache key.
-        int face_size = size;
-        if (m.face->css_family == css_ff_monospace && GetMonospaceSizeScale() != 100)
-            face_size = size * GetMonospaceSizeScale() / 100;
-
+        LVFontFace face;
+        int face_size;
+        LVFontVariations computed_variations;
         LVFontInstanceKey key;
-        key.face_id          = m.face->id();
-        key.size             = size;
-        key.face_size        = face_size;
-        key.features         = features;
-        key.requested_weight = weight;
-        key.requested_italic = italic;
-        key.computed_variations_hash = m.computed_variations.hash();
-
-        // 3. Return cached instance if available; otherwise load and cache.
-        LVFontRef cached = _instance_cache.get(key);
-        if (!cached.isNull()) return cached;
-
-        return loadAndCache(*m.face, size, face_size, weight, italic,
-                            features, m.computed_variations, key);
+        {
+            FONT_MAN_GUARD
+
+            // 1. Select face + synthesis via LVFontSelector.
+            LVFontVariations requested = variations ? *variations : LVFontVariations();
+            lString8 preferred;
+            if (useBias) {
+                preferred = _preferred_by_css_family[(int)css_family];
+                if (preferred.empty())
+                    preferred = _preferred_family;
+            }
+            LVFontMatch m = _font_selector.select(weight, italic, css_family, typeface,
+                                             requested, _registry, documentId, preferred, docFragmentIdx);
+            if (!m.valid()) {
+                CRLog::error("GetFont: no match for typeface='%s' w=%d italic=%d family=%d",
+                             typeface.c_str(), weight, (int)italic, (int)css_family);
+                return LVFontRef(NULL);
+            }
+
+            // 2. Build instance cache key.
+            face_size = size;
+            if (m.face->css_family == css_ff_monospace && GetMonospaceSizeScale() != 100)
+                face_size = size * GetMonospaceSizeScale() / 100;
+
+            key.face_id          = m.face->id();
+            key.size             = size;
+            key.face_size        = face_size;
+            key.features         = features;
+            key.requested_weight = weight;
+            key.requested_italic = italic;
+            key.computed_variations_hash = m.computed_variations.hash();
+
+            // 3. Return cached instance if available; otherwise load and cache.
+            LVFontRef cached = _instance_cache.get(key);
+            if (!cached.isNull()) return cached;
+
+            // (copied, as the registry may change while loading)
+            face = *m.face;
+            computed_variations = m.computed_variations;
+        }
+        // Loaded out of the font manager lock, as the new instance is locked
+        // while loaded and set up.
+        return loadAndCache(face, size, face_size, weight, italic,
+                            features, computed_variations, key);
     }
 
     bool checkCharSet( FT_Face face )
@@ -8067,20 +8792,26 @@ public:
 
     /// unregisters all document fonts
     virtual void UnregisterDocumentFonts(int documentId) {
-        LVArray<lUInt32> face_ids;
-        for (int i = 0; i < _registry.familyCount(); i++) {
-            const LVFontFamily* fam = _registry.familyAt(i);
-            for (int j = 0; j < fam->faceCount(); j++) {
-                const LVFontFace& face = fam->faceAt(j);
-                if (face.documentId == documentId)
-                    face_ids.add(face.id());
+        LVArray<LVFontRef> evicted;
+        {
+            FONT_MAN_GUARD
+            LVArray<lUInt32> face_ids;
+            for (int i = 0; i < _registry.familyCount(); i++) {
+                const LVFontFamily* fam = _registry.familyAt(i);
+                for (int j = 0; j < fam->faceCount(); j++) {
+                    const LVFontFace& face = fam->faceAt(j);
+                    if (face.documentId == documentId)
+                        face_ids.add(face.id());
+                }
             }
+            _instance_cache.evictFaces(face_ids, evicted);
+            _registry.removeFonts(documentId);
         }
-        _instance_cache.evictFaces(face_ids);
-        _registry.removeFonts(documentId);
+        // evicted instances no other thread uses are destroyed here
     }
 
     virtual bool RegisterExternalFont(int documentId, lString32 name, lString8 family_name, int weight, bool italic, int docFragmentIdx = -1) {
+        FONT_MAN_GUARD
         if (name.startsWithNoCase(lString32("res://")))
             name = name.substr(6);
         else if (name.startsWithNoCase(lString32("file://")))
@@ -8186,26 +8917,23 @@ public:
         return res;
     }
 
-    // RegisterFont (and the 2 similar functions above) adds to the cache
-    // definitions for all the fonts in their font file.
-    // Font instances will be created as need from the LVFontDef name or buf.
-    // (The similar functions do most of the same work, and some code
-    // could be factorized between them.)
-    virtual bool RegisterFont( lString8 name )
+    virtual bool SetFontRegistryIndexFile( lString8 fileName )
     {
         FONT_MAN_GUARD
-        #ifdef LOAD_TTF_FONTS_ONLY
-        if ( name.pos( cs8(".ttf") ) < 0 && name.pos( cs8(".TTF") ) < 0 )
-            return false; // load ttf fonts only
-        #endif
-        //CRLog::trace("RegisterFont(%s)", name.c_str());
-        #if (DEBUG_FONT_MAN==1)
-            if ( _log ) {
-                fprintf(_log, "RegisterFont( %s )\n", name.c_str());
-            }
-        #endif
+        _registry_index.save(); // previous one, if any
+        return _registry_index.open(fileName);
+    }
 
-        bool res = false;
+    virtual bool SaveFontRegistryIndex()
+    {
+        FONT_MAN_GUARD
+        return _registry_index.save();
+    }
+
+    /// Opens the faces of a font file with FreeType, and appends the usable
+    /// ones to faces (to be deleted by the caller).
+    void scanFontFile( const lString8 & name, LVArray<LVFontFace*> & faces )
+    {
         int index = 0;
         FT_Face face = NULL;
 
@@ -8243,22 +8971,21 @@ public:
             if (face->face_flags & FT_FACE_FLAG_FIXED_WIDTH) fontFamily = css_ff_monospace;
             int weight = getFontWeight(face);
             bool italicFlag = ( face->style_flags & FT_STYLE_FLAG_ITALIC ) ? true : false;
-            LVFontFace def;
-            def.file_path  = name;
-            def.face_index = index;
-            def.is_italic  = italicFlag;
-            def.css_family = fontFamily;
-            def.typeface   = familyName;
-            inspectFTFace(face, def, weight);
+            LVFontFace * def = new LVFontFace();
+            def->file_path  = name;
+            def->face_index = index;
+            def->is_italic  = italicFlag;
+            def->css_family = fontFamily;
+            def->typeface   = familyName;
+            inspectFTFace(face, *def, weight);
             #if (DEBUG_FONT_MAN==1)
                 if ( _log )
                     fprintf(_log, "registering font: (file=%s[%d], weight=%d, italic=%d, family=%d, typeface=%s)\n",
-                        def.file_path.c_str(), def.face_index, weight,
-                        def.is_italic?1:0, (int)def.css_family, def.typeface.c_str());
+                        def->file_path.c_str(), def->face_index, weight,
+                        def->is_italic?1:0, (int)def->css_family, def->typeface.c_str());
             #endif
             if ( face ) { FT_Done_Face( face ); face = NULL; }
-            if (!tryRegisterFace(def)) return false;
-            res = true;
+            faces.add(def);
             if ( index>=num_faces-1 ) break;
 #if 0 // removed during font manager refactor
             css_font_family_t fontFamily = css_ff_sans_serif;
@@ -8325,6 +9052,55 @@ public:
                 break;
 #endif // 0 // removed during font manager refactor
         }
+    }
+
+    // RegisterFont (and the 2 similar functions above) adds to the cache
+    // definitions for all the fonts in their font file.
+    // Font instances will be created as need from the LVFontDef name or buf.
+    // (The similar functions do most of the same work, and some code
+    // could be factorized between them.)
+    // When a font registry index file is set, the faces found in a font file
+    // are remembered there, and the file is not opened again as long as its
+    // size and modification time are unchanged.
+    virtual bool RegisterFont( lString8 name )
+    {
+        FONT_MAN_GUARD
+        #ifdef LOAD_TTF_FONTS_ONLY
+        if ( name.pos( cs8(".ttf") ) < 0 && name.pos( cs8(".TTF") ) < 0 )
+            return false; // load ttf fonts only
+        #endif
+        //CRLog::trace("RegisterFont(%s)", name.c_str());
+        #if (DEBUG_FONT_MAN==1)
+            if ( _log ) {
+                fprintf(_log, "RegisterFont( %s )\n", name.c_str());
+            }
+        #endif
+
+        lUInt64 size = 0;
+        lUInt64 mtime = 0;
+        bool indexed = !_registry_index.getFileName().empty() && LVGetFileStat(name, size, mtime);
+        if ( indexed ) {
+            const LVPtrVector<LVFontFace, true> * cached = _registry_index.find(name, size, mtime);
+            if ( cached ) {
+                bool res = false;
+                for ( int i = 0; i < cached->length(); i++ ) {
+                    if (!tryRegisterFace(*cached->get(i))) return false;
+                    res = true;
+                }
+                return res;
+            }
+        }
+
+        LVArray<LVFontFace*> faces;
+        scanFontFile(name, faces);
+        if ( indexed )
+            _registry_index.update(name, size, mtime, faces);
+        bool res = faces.length() > 0;
+        for ( int i = 0; i < faces.length(); i++ ) {
+            if ( res && !tryRegisterFace(*faces[i]) )
+                res = false;
+            delete faces[i];
+        }
         return res;
     }
 
@@ -8718,6 +9494,9 @@ bool InitFontManager( lString8 path )
         return true;
         //delete fontMan;
     }
+#if (CR_THREAD_SAFE==1)
+    CRSetupEngineConcurrency();
+#endif
 #if (USE_WIN32_FONTS==1)
     fontMan = new LVWin32FontManager;
 #elif (USE_FREETYPE==1)
@@ -9008,8 +9787,8 @@ lUInt16 LBitmapFont::measureText(
 
 lUInt32 LBitmapFont::getTextWidth( const lChar32 * text, int len, TextLangCfg * lang_cfg )
 {
-    static lUInt16 widths[MAX_LINE_CHARS+1];
-    static lUInt8 flags[MAX_LINE_CHARS+1];
+    static CR_THREAD_LOCAL lUInt16 widths[MAX_LINE_CHARS+1];
+    static CR_THREAD_LOCAL lUInt8 flags[MAX_LINE_CHARS+1];
     if ( len>MAX_LINE_CHARS )
         len = MAX_LINE_CHARS;
     if ( len<=0 )
@@ -9464,8 +10243,8 @@ int LVWin32DrawFont::getCharWidth( lChar32 ch, lChar32 def_char )
 lUInt32 LVWin32DrawFont::getTextWidth( const lChar32 * text, int len, TextLangCfg * lang_cfg=NULL )
 {
     //
-    static lUInt16 widths[MAX_LINE_CHARS+1];
-    static lUInt8 flags[MAX_LINE_CHARS+1];
+    static CR_THREAD_LOCAL lUInt16 widths[MAX_LINE_CHARS+1];
+    static CR_THREAD_LOCAL lUInt8 flags[MAX_LINE_CHARS+1];
     if ( len>MAX_LINE_CHARS )
         len = MAX_LINE_CHARS;
     if ( len<=0 )
@@ -9832,8 +10611,8 @@ bool LVWin32Font::getGlyphInfo( lUInt16 code, glyph_info_t * glyph, lChar32 def_
 lUInt32 LVWin32Font::getTextWidth( const lChar32 * text, int len, TextLangCfg * lang_cfg=NULL )
 {
     //
-    static lUInt16 widths[MAX_LINE_CHARS+1];
-    static lUInt8 flags[MAX_LINE_CHARS+1];
+    static CR_THREAD_LOCAL lUInt16 widths[MAX_LINE_CHARS+1];
+    static CR_THREAD_LOCAL lUInt8 flags[MAX_LINE_CHARS+1];
     if ( len>MAX_LINE_CHARS )
         len = MAX_LINE_CHARS;
     if ( len<=0 )
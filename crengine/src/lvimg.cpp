@@ -70,7 +70,11 @@ typedef boolean wxjpeg_boolean;
 #endif
 #endif
 
+#if (CR_THREAD_SAFE==1)
+static std::atomic<lUInt32> NEXT_CACHEABLE_OBJECT_ID(1);
+#else
 static lUInt32 NEXT_CACHEABLE_OBJECT_ID = 1;
+#endif
 CacheableObject::CacheableObject() : _callback(NULL), _cache(NULL)
 {
 	_objectId = ++NEXT_CACHEABLE_OBJECT_ID;
@@ -200,6 +204,119 @@ public:
     }
 };
 
+/// max factor a PNG image is box-filtered by while decoding (keeps the sums in 32 bits)
+#define PNG_MAX_SHRINK_FACTOR 32
+
+/// biggest factor (up to max_factor, a power of 2 if pow2) an image can be shrunk by
+/// while decoding, staying at least the size the callback will draw it at
+static inline int getDecodeShrinkFactor( LVImageDecoderCallback * callback, int width, int height, int max_factor, bool pow2 )
+{
+    int target_w, target_h;
+    if ( !callback || !callback->GetTargetSize(target_w, target_h) || target_w <= 0 || target_h <= 0 )
+        return 1;
+    int factor = 1;
+    for (;;) {
+        const int next = pow2 ? factor * 2 : factor + 1;
+        if ( next > max_factor )
+            break;
+        if ( (width + next - 1) / next < target_w || (height + next - 1) / next < target_h )
+            break;
+        factor = next;
+    }
+    return factor;
+}
+
+/// Shrinks decoded lines by averaging factor x factor boxes before passing them to
+/// another callback, as they come: only one row of sums is kept, whatever the image height.
+/// With alpha, colors are weighted by opacity, so that transparent pixels don't darken edges.
+class LVBoxShrinkDecoderCallback : public LVImageDecoderCallback
+{
+    LVImageDecoderCallback * _callback;
+    int _src_dx;
+    int _src_dy;
+    int _factor;
+    bool _alpha;
+    int _dst_dx;
+    int _dst_dy;
+    lUInt32 * _sums; // 4 per destination pixel: b, g, r (times opacity if _alpha) and opacity
+    lUInt32 * _row;
+    bool emitRow( LVImageSource * obj, int y, int rows ) {
+        lUInt32 * __restrict sums = _sums;
+        for ( int x = 0; x < _dst_dx; x++, sums += 4 ) {
+            const int cols = x < _dst_dx - 1 ? _factor : _src_dx - x * _factor;
+            const lUInt32 count = cols * rows;
+            const lUInt32 opacity = sums[3];
+            if ( !_alpha ) {
+                const lUInt32 b = (sums[0] + count / 2) / count;
+                const lUInt32 g = (sums[1] + count / 2) / count;
+                const lUInt32 r = (sums[2] + count / 2) / count;
+                _row[x] = (r << 16) | (g << 8) | b;
+            } else if ( opacity == 0 ) {
+                _row[x] = 0xFF000000; // fully transparent
+            } else {
+                const lUInt32 b = (sums[0] + opacity / 2) / opacity;
+                const lUInt32 g = (sums[1] + opacity / 2) / opacity;
+                const lUInt32 r = (sums[2] + opacity / 2) / opacity;
+                const lUInt32 a = 0xFF - (opacity + count / 2) / count; // back to inverted alpha
+                _row[x] = (a << 24) | (r << 16) | (g << 8) | b;
+            }
+        }
+        memset( _sums, 0, _dst_dx * 4 * sizeof(lUInt32) );
+        return _callback->OnLineDecoded( obj, y, _row );
+    }
+public:
+    LVBoxShrinkDecoderCallback( LVImageDecoderCallback * callback, int src_dx, int src_dy, int factor, bool alpha )
+        : _callback(callback), _src_dx(src_dx), _src_dy(src_dy), _factor(factor), _alpha(alpha)
+    {
+        _dst_dx = (src_dx + factor - 1) / factor;
+        _dst_dy = (src_dy + factor - 1) / factor;
+        _sums = (lUInt32 *)calloc( _dst_dx * 4, sizeof(lUInt32) );
+        _row = (lUInt32 *)malloc( _dst_dx * sizeof(lUInt32) );
+    }
+    virtual ~LVBoxShrinkDecoderCallback() {
+        free( _sums );
+        free( _row );
+    }
+    int getWidth() const { return _dst_dx; }
+    int getHeight() const { return _dst_dy; }
+    virtual void OnStartDecode( LVImageSource * obj ) {
+        _callback->OnStartDecode( obj );
+    }
+    virtual bool OnLineDecoded( LVImageSource * obj, int y, lUInt32 * __restrict data ) {
+        lUInt32 * __restrict sums = _sums;
+        for ( int x = 0; x < _src_dx; sums += 4 ) {
+            lUInt32 b = 0, g = 0, r = 0, o = 0;
+            const int end = x + _factor < _src_dx ? x + _factor : _src_dx;
+            if ( !_alpha ) {
+                for ( ; x < end; x++ ) {
+                    const lUInt32 cl = data[x];
+                    b += cl & 0xFF;
+                    g += (cl >> 8) & 0xFF;
+                    r += (cl >> 16) & 0xFF;
+                }
+            }
+            for ( ; x < end; x++ ) {
+                const lUInt32 cl = data[x];
+                const lUInt32 opacity = 0xFF - (cl >> 24); // lvimg alpha is inverted
+                b += (cl & 0xFF) * opacity;
+                g += ((cl >> 8) & 0xFF) * opacity;
+                r += ((cl >> 16) & 0xFF) * opacity;
+                o += opacity;
+            }
+            sums[0] += b;
+            sums[1] += g;
+            sums[2] += r;
+            sums[3] += o;
+        }
+        const int rows = y % _factor + 1;
+        if ( rows == _factor || y == _src_dy - 1 )
+            return emitRow( obj, y / _factor, rows );
+        return true;
+    }
+    virtual void OnEndDecode( LVImageSource * obj, bool errors ) {
+        _callback->OnEndDecode( obj, errors );
+    }
+};
 
 static void fixNegative(int & n) {
 	if (n < 0)
@@ -788,6 +905,17 @@ public:
 
             if ( callback )
             {
+                // When drawn smaller, have libjpeg shrink the image with DCT scaling
+                // while decoding: it is faster and needs far less memory than
+                // decoding at full size and scaling afterwards
+                const int factor = getDecodeShrinkFactor( callback, _width, _height, 8, true );
+                if ( factor > 1 ) {
+                    cinfo.scale_num = 1;
+                    cinfo.scale_denom = factor;
+                    jpeg_calc_output_dimensions(&cinfo);
+                    if ( !callback->OnScaledDecode(this, cinfo.output_width, cinfo.output_height) )
+                        cinfo.scale_denom = 1;
+                }
                 callback->OnStartDecode(this);
                 /* Step 4: set parameters for decompression */
 
@@ -903,6 +1031,21 @@ bool LVPngImageSource::Decode( LVImageDecoderCallback * callback )
 
     if ( callback )
     {
+        // When drawn smaller, box-filter lines as they are decoded, so that we
+        // never need to hold much more than the shrunk image
+        LVImageDecoderCallback * sink = callback;
+        LVBoxShrinkDecoderCallback * shrinker = NULL;
+        const int factor = getDecodeShrinkFactor( callback, width, height, PNG_MAX_SHRINK_FACTOR, false );
+        if ( factor > 1 ) {
+            const bool alpha = (color_type & PNG_COLOR_MASK_ALPHA) || png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS);
+            shrinker = new LVBoxShrinkDecoderCallback( callback, width, height, factor, alpha );
+            if ( callback->OnScaledDecode(this, shrinker->getWidth(), shrinker->getHeight()) ) {
+                sink = shrinker;
+            } else {
+                delete shrinker;
+                shrinker = NULL;
+            }
+        }
         callback->OnStartDecode(this);
 
         //int png_transforms = PNG_TRANSFORM_STRIP_16 | PNG_TRANSFORM_INVERT_ALPHA;
@@ -956,33 +1099,45 @@ bool LVPngImageSource::Decode( LVImageDecoderCallback * callback )
         png_read_update_info(png_ptr, info_ptr);  // update after set
 
         size_t rowbytes = png_get_rowbytes(png_ptr, info_ptr);
-        size_t image_size = height * rowbytes;
-        unsigned char * storage = NULL;
-        unsigned char * __restrict image = NULL;
-        png_bytep * __restrict row_pointers = NULL;
-
-        // NOTE: Stash *both* the array of row pointers *and* the image data in a single allocation.
-        //       This implies some alignment trickery to ensure both pointers are aligned as malloc would.
-        //       c.f., the comments for LVFontGlyphCacheItem in lvfntman.h
-        // To that effect, compute the size of the array of row pointers, and align it on a 16-byte boundary.
-        size_t image_offset = ALIGN((height * sizeof(*row_pointers)), 16);
-        // And we can now alloc the whole thing...
-        storage = (unsigned char *) malloc(image_offset + image_size);
-        // ...and update both pointers to point to the right storage location.
-        image = storage + image_offset; // Still aligned properly, thanks to the above trickery.
-        row_pointers = (png_bytep * __restrict) storage;
-
-        for (size_t y = 0; y < height; y++) {
-            row_pointers[y] = image + y * rowbytes;
-        }
-        png_read_image(png_ptr, row_pointers);
-        for (size_t y = 0; y < height; y++) {
-            callback->OnLineDecoded( this, y, reinterpret_cast<lUInt32 *>(row_pointers[y]) );
+        if ( interlace_type == PNG_INTERLACE_NONE ) {
+            // Rows come out complete one at a time: no need to keep the whole image around
+            png_bytep row = (png_bytep) malloc(rowbytes);
+            for (size_t y = 0; y < height; y++) {
+                png_read_row(png_ptr, row, NULL);
+                sink->OnLineDecoded( this, y, reinterpret_cast<lUInt32 *>(row) );
+            }
+            free(row);
+        } else {
+            // Interlaced images are only complete after the last pass
+            size_t image_size = height * rowbytes;
+            unsigned char * storage = NULL;
+            unsigned char * __restrict image = NULL;
+            png_bytep * __restrict row_pointers = NULL;
+
+            // NOTE: Stash *both* the array of row pointers *and* the image data in a single allocation.
+            //       This implies some alignment trickery to ensure both pointers are aligned as malloc would.
+            //       c.f., the comments for LVFontGlyphCacheItem in lvfntman.h
+            // To that effect, compute the size of the array of row pointers, and align it on a 16-byte boundary.
+            size_t image_offset = ALIGN((height * sizeof(*row_pointers)), 16);
+            // And we can now alloc the whole thing...
+            storage = (unsigned char *) malloc(image_offset + image_size);
+            // ...and update both pointers to point to the right storage location.
+            image = storage + image_offset; // Still aligned properly, thanks to the above trickery.
+            row_pointers = (png_bytep * __restrict) storage;
+
+            for (size_t y = 0; y < height; y++) {
+                row_pointers[y] = image + y * rowbytes;
+            }
+            png_read_image(png_ptr, row_pointers);
+            for (size_t y = 0; y < height; y++) {
+                sink->OnLineDecoded( this, y, reinterpret_cast<lUInt32 *>(row_pointers[y]) );
+            }
+            free(storage);
         }
 
         png_read_end(png_ptr, info_ptr);
         callback->OnEndDecode(this, false);
-        free(storage);
+        delete shrinker;
     }
     png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
 
@@ -1743,6 +1898,44 @@ bool LVWebpImageSource::Decode( LVImageDecoderCallback * callback )
     buf[sz] = 0;
     bool ret = false;
     if ( callback ) {
+        // A still image drawn smaller can be scaled by libwebp while decoding,
+        // straight to the target size and without a full size canvas
+        WebPBitstreamFeatures features;
+        int target_w, target_h;
+        if ( WebPGetFeatures(buf, sz, &features) == VP8_STATUS_OK && !features.has_animation
+                && callback->GetTargetSize(target_w, target_h) && target_w > 0 && target_h > 0
+                && target_w <= features.width && target_h <= features.height
+                && (target_w < features.width || target_h < features.height) ) {
+            WebPDecoderConfig config;
+            if ( WebPInitDecoderConfig(&config) ) {
+                config.options.use_scaling = 1;
+                config.options.scaled_width = target_w;
+                config.options.scaled_height = target_h;
+                config.output.colorspace = MODE_BGRA;
+                if ( WebPDecode(buf, sz, &config) == VP8_STATUS_OK ) {
+                    _width = features.width;
+                    _height = features.height;
+                    if ( callback->OnScaledDecode(this, target_w, target_h) ) {
+                        callback->OnStartDecode(this);
+                        lUInt32 * __restrict row = new lUInt32 [ target_w ];
+                        for (int y=0; y<target_h; y++) {
+                            const lUInt32 * __restrict src = (const lUInt32 *)(config.output.u.RGBA.rgba + y * config.output.u.RGBA.stride);
+                            for (int x=0; x<target_w; x++) {
+                                // lvimg expects BGRA with inverted alpha,
+                                row[x] = src[x] ^ 0xFF000000;
+                            }
+                            callback->OnLineDecoded( this, y, row );
+                        }
+                        delete[] row;
+                        callback->OnEndDecode(this, false);
+                        ret = true;
+                    }
+                    WebPFreeDecBuffer(&config.output);
+                }
+            }
+        }
+    }
+    if ( callback && !ret ) {
         // Using the simpler option:
         //   lUInt8 * img = WebPDecodeBGRA(buf, sz, &_width, &_height);
         // would give a blank canvas with an animated webp.
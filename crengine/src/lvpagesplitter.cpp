@@ -1506,8 +1506,8 @@ void LVRendPageList::replacePages(int old_y, int old_h, LVRendPageList * pages,
         }
         else if ( pi->start + pi->height > old_y + old_h ) {
             // part of this page after: truncate it
-            pi->start = old_y + old_h;
-            pi->height = pi->start + pi->height - pi->start;
+            pi->height = pi->start + pi->height - (old_y + old_h);
+            pi->start = old_y + old_h + next_pages_shift_y;
             pi->index += added_count - remove_count;
             // printf("%d (%d +%d) truncated\n", pi->index, pi->start, pi->height);
         }
@@ -20,6 +20,11 @@
 #include "../include/fb2def.h"
 #include "../include/lvrend.h"
 #include "../include/renderutil.h"
+#include "../include/lvthread.h"
+
+#if (CR_THREAD_SAFE==1)
+#include <thread>
+#endif
 
 // Note about box model/sizing in crengine:
 // https://quirksmode.org/css/user-interface/boxsizing.html says:
@@ -4660,7 +4665,11 @@ void renderFinalBlock( ldomNode * enode, LFormattedText * txform, RenderRectAcce
     }
     else if ( enode->isEffectiveText() ) {
         // text nodes
-        lString32 txt = enode->getEffectiveText();
+        // Text is decoded into a reused buffer (AddSourceLine() makes its
+        // own copy with LTEXT_FLAG_OWNTEXT), saving an allocation per node
+        static CR_THREAD_LOCAL lString32 txt_buf;
+        lString32 & txt = txt_buf;
+        enode->getEffectiveText( txt );
         if ( !txt.empty() ) {
             #ifdef DEBUG_DUMP_ENABLED
                 for (int i=0; i<enode->getNodeLevel(); i++)
@@ -5713,6 +5722,338 @@ int renderBlockElementLegacy( LVRendPageContext & context, ldomNode * enode, int
 }
 
 
+#if (CR_THREAD_SAFE==1)
+
+//=======================================================================
+// FinalBlockFormatPool: formatting of final blocks ahead of the layout
+// used by renderBlockElementEnhanced() when rendering the whole document
+//=======================================================================
+// Formatting (measuring, bidi, line breaking, hyphenation) the text of
+// final blocks is what takes most of the rendering time. When laying
+// out a final block in the main flow, its next sibling final blocks with
+// the same style are quite probably going to be laid out with the same
+// widths and parameters: we add their source text (which needs the DOM,
+// and so must be done on the rendering thread) with these guessed
+// parameters, and have worker threads format them while the layout goes
+// on. When the layout reaches one of these blocks, the prepared
+// LFormattedText is used only if its actual parameters are the ones
+// guessed, and if there are no outer floats, so that we get exactly what
+// formatting it then would have given. Otherwise, it is formatted as usual.
+// Workers only get final blocks made of plain text (no image, inline-box,
+// float, ::first-line, or properties that lvtextfm would need to fetch
+// from the DOM while formatting), as the DOM is not thread safe.
+// The rendering thread does not wait for blocks not yet picked by a
+// worker, and formats them itself.
+
+#define FINAL_BLOCK_FORMAT_MAX_THREADS 4  // max worker threads formatting final blocks
+#define FINAL_BLOCK_FORMAT_AHEAD      32  // max final blocks prepared ahead of the layout
+
+// RenderRectAccessor flags read when adding a final block source text
+#define FINAL_BLOCK_FORMAT_RECT_FLAGS ( RENDER_RECT_FLAG_DIRECTION_MASK \
+                                      | RENDER_RECT_FLAG_NO_INTERLINE_SCALE_UP \
+                                      | RENDER_RECT_FLAG_DO_MATH_TRANSFORM )
+
+// LTEXT flags of source text that lvtextfm may look up in the DOM
+#define FINAL_BLOCK_FORMAT_DOM_LTEXT_FLAGS ( LTEXT_SRC_IS_OBJECT | LTEXT_FLAG_NOWRAP \
+                                           | LTEXT_IS_FIRST_LINE_CLONE | LTEXT_HAS_EXTRA )
+
+// What the source text and formatting of a final block depend on, other than
+// its DOM content and document settings (which don't change while rendering)
+struct FinalBlockFormatParams {
+    int width;            // final block width (for text-indent in %)
+    int inner_width;      // width given to LFormattedText::Format()
+    int rect_flags;       // FINAL_BLOCK_FORMAT_RECT_FLAGS, including direction
+    int lang_node_idx;
+    int list_prop_node_idx;
+    int usable_left_overflow;
+    int usable_right_overflow;
+    bool no_clear_own_floats;
+    bool no_clear_own_initial_letter;
+
+    FinalBlockFormatParams( RenderRectAccessor & fmt, int innerWidth, const BlockFloatFootprint & footprint ) :
+        width(fmt.getWidth()),
+        inner_width(innerWidth),
+        rect_flags(fmt.getFlags() & FINAL_BLOCK_FORMAT_RECT_FLAGS),
+        lang_node_idx(fmt.getLangNodeIndex()),
+        list_prop_node_idx(fmt.getListPropNodeIndex()),
+        usable_left_overflow(fmt.getUsableLeftOverflow()),
+        usable_right_overflow(fmt.getUsableRightOverflow()),
+        no_clear_own_floats(footprint.no_clear_own_floats),
+        no_clear_own_initial_letter(footprint.no_clear_own_initial_letter)
+        { }
+    bool operator == ( const FinalBlockFormatParams & other ) const {
+        return width == other.width
+            && inner_width == other.inner_width
+            && rect_flags == other.rect_flags
+            && lang_node_idx == other.lang_node_idx
+            && list_prop_node_idx == other.list_prop_node_idx
+            && usable_left_overflow == other.usable_left_overflow
+            && usable_right_overflow == other.usable_right_overflow
+            && no_clear_own_floats == other.no_clear_own_floats
+            && no_clear_own_initial_letter == other.no_clear_own_initial_letter;
+    }
+};
+
+class FinalBlockFormatPool {
+    class Worker : public LVThread {
+        FinalBlockFormatPool * _pool;
+    public:
+        Worker( FinalBlockFormatPool * pool ) : _pool(pool) { }
+        virtual void run() { _pool->run(); }
+    };
+    enum JobState { JOB_QUEUED, JOB_RUNNING, JOB_DONE };
+    struct Job {
+        ldomNode * node;
+        FinalBlockFormatParams params;
+        LFormattedTextRef text;
+        BlockFloatFootprint footprint; // empty, with the guessed flags
+        int page_height;
+        bool hanging_punctuation;
+        int height;
+        JobState state;
+        bool abandoned;
+        Job( ldomNode * n, const FinalBlockFormatParams & p ) : node(n), params(p),
+            page_height(0), hanging_punctuation(false), height(0), state(JOB_QUEUED), abandoned(false)
+        {
+            footprint.no_clear_own_floats = p.no_clear_own_floats;
+            footprint.no_clear_own_initial_letter = p.no_clear_own_initial_letter;
+        }
+        void format() {
+            // Same as done by ldomNode::renderFinalBlock()
+            height = text->Format( (lUInt16)params.inner_width, (lUInt16)page_height,
+                                   params.rect_flags & RENDER_RECT_FLAG_DIRECTION_MASK,
+                                   params.usable_left_overflow, params.usable_right_overflow,
+                                   hanging_punctuation, &footprint );
+        }
+    };
+    LVPtrVector<Worker> _workers;
+    LVPtrVector<Job> _jobs; // in document order
+    LVMutex _mutex;
+    LVCondition _cond;      // signaled when a job is queued or done
+    bool _stopped;
+    // Position of the last final node laid out among its siblings, and of the
+    // last sibling after it that has been prepared (getNodeIndex() walks
+    // the parent children: we avoid it when going on with the same parent)
+    ldomNode * _lastParent;
+    int _lastNodeIndex;
+    int _lastPreparedIndex;
+
+    void run() {
+        _mutex.lock();
+        for (;;) {
+            Job * job = NULL;
+            while ( !_stopped && !(job = getQueuedJob()) )
+                _cond.wait(_mutex);
+            if ( _stopped )
+                break;
+            job->state = JOB_RUNNING;
+            _mutex.unlock();
+            job->format();
+            _mutex.lock();
+            job->state = JOB_DONE;
+            _cond.notifyAll();
+        }
+        _mutex.unlock();
+    }
+    Job * getQueuedJob() {
+        for ( int i=0; i<_jobs.length(); i++ ) {
+            if ( _jobs[i]->state == JOB_QUEUED )
+                return _jobs[i];
+        }
+        return NULL;
+    }
+    // Drop job at index (to be called with _mutex locked): it is deleted
+    // now if no worker is formatting it, or when done otherwise
+    void abandonJob( int index ) {
+        Job * job = _jobs[index];
+        if ( job->state == JOB_RUNNING ) {
+            job->abandoned = true;
+            return;
+        }
+        _jobs.remove(index);
+        delete job;
+    }
+    int findJob( ldomNode * node ) {
+        for ( int i=0; i<_jobs.length(); i++ ) {
+            if ( _jobs[i]->node == node && !_jobs[i]->abandoned )
+                return i;
+        }
+        return -1;
+    }
+    // Adds final node source text into a new LFormattedText, as done by
+    // ldomNode::renderFinalBlock(), but with the guessed rect fields.
+    // Returns NULL if it has to be formatted by the rendering thread.
+    Job * prepareJob( ldomNode * node, const FinalBlockFormatParams & guessed ) {
+        RenderRectAccessor fmt( node );
+        int direction = guessed.rect_flags & RENDER_RECT_FLAG_DIRECTION_MASK;
+        fmt.setWidth( guessed.width );
+        RENDER_RECT_SET_DIRECTION( fmt, direction );
+        fmt.setLangNodeIndex( guessed.lang_node_idx );
+        fmt.setUsableLeftOverflow( guessed.usable_left_overflow );
+        fmt.setUsableRightOverflow( guessed.usable_right_overflow );
+        BlockFloatFootprint footprint( NULL, 0, 0, guessed.no_clear_own_floats, guessed.no_clear_own_initial_letter );
+        Job * job = new Job( node, FinalBlockFormatParams( fmt, guessed.inner_width, footprint ) );
+        ldomDocument * doc = node->getDocument();
+        job->text = doc->createFormattedText();
+        direction = RENDER_RECT_GET_DIRECTION(fmt);
+        lUInt32 flags = styleToTextFmtFlags( true, node->getStyle(), 0, direction );
+        int lang_node_idx = job->params.lang_node_idx;
+        TextLangCfg * lang_cfg = TextLangMan::getTextLangCfg( lang_node_idx>0 ? doc->getTinyNode(lang_node_idx) : NULL );
+        renderFinalBlock( node, job->text.get(), &fmt, flags, 0, -1, lang_cfg );
+        fmt.discardChanges(); // guessed values are not to be saved
+        formatted_text_fragment_t * buffer = job->text->GetBuffer();
+        bool plain = buffer->srctextlen > 0;
+        for ( int i=0; i<buffer->srctextlen && plain; i++ ) {
+            if ( buffer->srctext[i].flags & FINAL_BLOCK_FORMAT_DOM_LTEXT_FLAGS )
+                plain = false;
+        }
+        if ( !plain ) {
+            delete job;
+            return NULL;
+        }
+        // Full rendering in progress (see ldomNode::renderFinalBlock())
+        job->text->requestLightFormatting();
+        job->page_height = doc->getPageHeight();
+        job->hanging_punctuation = doc->getHangingPunctiationEnabled();
+        return job;
+    }
+    FinalBlockFormatPool( int threads ) : _stopped(false), _lastParent(NULL), _lastNodeIndex(-1), _lastPreparedIndex(-1) {
+        for ( int i=0; i<threads; i++ ) {
+            Worker * worker = new Worker(this);
+            _workers.add(worker);
+            worker->start();
+        }
+    }
+public:
+    /// returns a new pool, or NULL if there is no other CPU to format final blocks on
+    static FinalBlockFormatPool * create() {
+        int threads = (int)std::thread::hardware_concurrency() - 1;
+        if ( threads > FINAL_BLOCK_FORMAT_MAX_THREADS )
+            threads = FINAL_BLOCK_FORMAT_MAX_THREADS;
+        if ( threads <= 0 )
+            return NULL;
+        return new FinalBlockFormatPool( threads );
+    }
+    ~FinalBlockFormatPool() {
+        {
+            LVLock lock(_mutex);
+            _stopped = true;
+            _cond.notifyAll();
+        }
+        for ( int i=0; i<_workers.length(); i++ )
+            _workers[i]->join();
+        _workers.clear();
+        _jobs.clear();
+    }
+    /// have the final blocks following node (which is being laid out with
+    /// these params) among its siblings formatted ahead, if they have its style
+    void prepareNextSiblings( ldomNode * node, const FinalBlockFormatParams & params, lInt32 flow_lang_node_idx ) {
+        ldomNode * parent = node->getParentNode();
+        if ( !parent )
+            return;
+        int count = parent->getChildCount();
+        int index = -1;
+        if ( parent == _lastParent ) {
+            for ( int i=_lastNodeIndex+1; i<count; i++ ) {
+                if ( parent->getChildNode(i) == node ) {
+                    index = i;
+                    break;
+                }
+            }
+        }
+        if ( index < 0 ) {
+            index = node->getNodeIndex();
+            _lastPreparedIndex = -1;
+        }
+        _lastParent = parent;
+        _lastNodeIndex = index;
+        int start = index + 1;
+        if ( _lastPreparedIndex >= start )
+            start = _lastPreparedIndex + 1;
+        css_style_rec_t * style = node->getStyle().get();
+        for ( int i=start; i<count; i++ ) {
+            {
+                LVLock lock(_mutex);
+                // Forget about the ones done and abandoned
+                for ( int j=_jobs.length()-1; j>=0; j-- ) {
+                    if ( _jobs[j]->abandoned && _jobs[j]->state == JOB_DONE )
+                        abandonJob(j);
+                }
+                if ( _jobs.length() >= FINAL_BLOCK_FORMAT_AHEAD )
+                    break;
+            }
+            ldomNode * child = parent->getChildNode(i);
+            if ( !child->isElement() )
+                continue;
+            lvdom_element_render_method rm = child->getRendMethod();
+            if ( rm == erm_invisible )
+                continue;
+            // Stop at the first sibling that is not a final block with the
+            // same style: the layout of the next ones is less predictable
+            if ( rm != erm_final || child->getStyle().get() != style )
+                break;
+            _lastPreparedIndex = i;
+            FinalBlockFormatParams guessed = params;
+            // (Layout sets it as its own for a final node with a lang attribute)
+            if ( child->hasEffectiveAttribute( attr_lang ) && !child->getEffectiveAttributeValue( attr_lang ).empty() )
+                guessed.lang_node_idx = child->getDataIndex();
+            else
+                guessed.lang_node_idx = flow_lang_node_idx;
+            Job * job = prepareJob( child, guessed );
+            if ( job ) {
+                LVLock lock(_mutex);
+                _jobs.add(job);
+                _cond.notifyAll();
+            }
+        }
+    }
+    /// get node formatted text as ldomNode::renderFinalBlock() would make it with these
+    /// params and footprint (which has been stored), if it has been prepared with them
+    bool takeFormatted( ldomNode * node, const FinalBlockFormatParams & params, BlockFloatFootprint & footprint,
+                        LFormattedTextRef & frmtext, int & height ) {
+        Job * job = NULL;
+        {
+            LVLock lock(_mutex);
+            int index = findJob(node);
+            if ( index < 0 )
+                return false;
+            // Final blocks before it have not been laid out as guessed
+            for ( int i=index-1; i>=0; i-- ) {
+                if ( !_jobs[i]->abandoned )
+                    abandonJob(i);
+            }
+            index = findJob(node);
+            job = _jobs[index];
+            LFormattedTextRef cached;
+            if ( !(job->params == params) || footprint.floats_cnt > 0 || footprint.initial_letter_active
+                    || node->getDocument()->getRendBlockCache().get( node, cached ) ) {
+                abandonJob(index);
+                return false;
+            }
+            if ( job->state == JOB_QUEUED ) {
+                // No worker has picked it yet: format it ourselves
+                job->state = JOB_RUNNING;
+                _mutex.unlock();
+                job->format();
+                _mutex.lock();
+                job->state = JOB_DONE;
+            }
+            while ( job->state != JOB_DONE )
+                _cond.wait(_mutex);
+            _jobs.remove(index);
+        }
+        // Same as done by ldomNode::renderFinalBlock()
+        footprint.store( node );
+        node->getDocument()->getRendBlockCache().set( node, job->text );
+        frmtext = job->text;
+        height = job->height;
+        delete job;
+        return true;
+    }
+};
+
+#endif // CR_THREAD_SAFE==1
+
 //=======================================================================
 // FlowState: block formatting context manager
 // used by renderBlockElementEnhanced()
@@ -5870,6 +6211,7 @@ private:
     int  baseline_y;   // baseline y relative to formatting context top (computed when rendering inline-block/table)
     bool baseline_set; // (set to true on first baseline met)
     bool is_main_flow;
+    bool followed_by_page_break; // top node rendered alone, but followed by a forced page break
     int  top_clear_level; // level to attach floats for final clearance when leaving the flow
     bool avoid_pb_inside; // To carry this fact from upper elements to inner children
     bool avoid_pb_inside_just_toggled_on;  // for specific processing of boundaries
@@ -5893,6 +6235,10 @@ private:
     int  vm_max_negative_margin;
     int  vm_back_usable_as_margin; // previously moved vertical space where next margin could be accounted in
 
+#if (CR_THREAD_SAFE==1)
+    FinalBlockFormatPool * final_block_format_pool; // set when rendering the whole document
+#endif
+
 public:
     FlowState( LVRendPageContext & ctx, int width, int usable_left_overflow, int usable_right_overflow,
                             int rendflags, int dir=REND_DIRECTION_UNSET, lInt32 langNodeIdx=0 ):
@@ -5911,6 +6257,7 @@ public:
         baseline_req(REQ_BASELINE_NOT_NEEDED),
         baseline_y(0),
         baseline_set(false),
+        followed_by_page_break(false),
         avoid_pb_inside(false),
         avoid_pb_inside_just_toggled_on(false),
         avoid_pb_inside_just_toggled_off(false),
@@ -5930,6 +6277,9 @@ public:
         vm_max_positive_margin(0),
         vm_max_negative_margin(0),
         vm_back_usable_as_margin(0)
+#if (CR_THREAD_SAFE==1)
+        , final_block_format_pool(NULL)
+#endif
         {
             is_main_flow = context.getPageList() != NULL;
             if ( context.wantsLines() ) {
@@ -5963,6 +6313,14 @@ public:
     bool isMainFlow() {
         return is_main_flow;
     }
+#if (CR_THREAD_SAFE==1)
+    FinalBlockFormatPool * getFinalBlockFormatPool() {
+        return final_block_format_pool;
+    }
+    void setFinalBlockFormatPool( FinalBlockFormatPool * pool ) {
+        final_block_format_pool = pool;
+    }
+#endif
     int getDirection() {
         return direction;
     }
@@ -6020,6 +6378,12 @@ public:
     void setRequestedBaselineType(int baseline_req_type) {
         baseline_req = baseline_req_type;
     }
+    void setFollowedByPageBreak(bool followed) {
+        followed_by_page_break = followed;
+    }
+    bool isFollowedByPageBreak() {
+        return followed_by_page_break;
+    }
     int getBaselineAbsoluteY(ldomNode * node=NULL) {
         // Quotes from https://www.w3.org/TR/CSS21/visudet.html#propdef-vertical-align
         // Note that our table rendering code has not been updated to use FlowState,
@@ -8641,6 +9005,10 @@ void renderBlockElementEnhanced( FlowState * flow, ldomNode * enode, int x, int
         // (This must be true also with inline-block boxes, but not tested/verified.)
         no_margin_collapse = true;
     }
+    // A fragment of the document rendered alone (partial rerendering) that is followed
+    // by a forced page break: its bottom margins would be dropped by that page break
+    // when rendering the whole document, so don't push them.
+    bool drop_bottom_margin = flow->getCurrentLevel() == 0 && flow->isFollowedByPageBreak();
 
     // Ensure page breaks following the rules from:
     //   https://www.w3.org/TR/CSS2/page.html#allowed-page-breaks
@@ -9071,7 +9439,7 @@ void renderBlockElementEnhanced( FlowState * flow, ldomNode * enode, int x, int
                     }
                 }
 
-                if ( no_margin_collapse ) {
+                if ( no_margin_collapse && !drop_bottom_margin ) {
                     // Push any earlier margin so it does not get collapsed with this one,
                     // and we get the resulting margin in the height given by leaveBlockLevel().
                     flow->pushVerticalMargin();
@@ -9188,7 +9556,7 @@ void renderBlockElementEnhanced( FlowState * flow, ldomNode * enode, int x, int
                 }
 
                 flow->addVerticalMargin( enode, margin_bottom, break_after );
-                if ( no_margin_collapse ) {
+                if ( no_margin_collapse && !drop_bottom_margin ) {
                     // Push our margin so it does not get collapsed with some later one
                     flow->pushVerticalMargin();
                 }
@@ -9364,7 +9732,19 @@ void renderBlockElementEnhanced( FlowState * flow, ldomNode * enode, int x, int
                     // (No need to account for margin-top, as we pushed vertical margin
                     // just above if there were floats.)
 
-                int final_h = enode->renderFinalBlock( txform, &fmt, inner_width, &float_footprint );
+                int final_h;
+#if (CR_THREAD_SAFE==1)
+                FinalBlockFormatPool * format_pool = flow->getFinalBlockFormatPool();
+                if ( format_pool ) {
+                    FinalBlockFormatParams format_params( fmt, inner_width, float_footprint );
+                    // Have next siblings formatted ahead, guessing they will be laid out like this one
+                    format_pool->prepareNextSiblings( enode, format_params, flow->getLangNodeIndex() );
+                    if ( !format_pool->takeFormatted( enode, format_params, float_footprint, txform, final_h ) )
+                        final_h = enode->renderFinalBlock( txform, &fmt, inner_width, &float_footprint );
+                }
+                else
+#endif
+                final_h = enode->renderFinalBlock( txform, &fmt, inner_width, &float_footprint );
                 int final_min_y = float_footprint.getFinalMinY();
                 int final_max_y = float_footprint.getFinalMaxY();
 
@@ -9644,7 +10024,7 @@ void renderBlockElementEnhanced( FlowState * flow, ldomNode * enode, int x, int
                 }
 
                 flow->addVerticalMargin( enode, margin_bottom, break_after );
-                if ( no_margin_collapse ) {
+                if ( no_margin_collapse && !drop_bottom_margin ) {
                     // Push our margin so it does not get collapsed with some later one
                     flow->pushVerticalMargin();
                 }
@@ -9671,7 +10051,8 @@ void renderBlockElementEnhanced( FlowState * flow, ldomNode * enode, int x, int
 
 // Entry points for rendering the root node, a table cell or a float
 int renderBlockElement(LVRendPageContext & context, ldomNode * enode, int x, int y, int width,
-            int usable_left_overflow, int usable_right_overflow, int direction, int * baseline, lUInt32 rend_flags )
+            int usable_left_overflow, int usable_right_overflow, int direction, int * baseline, lUInt32 rend_flags,
+            bool followed_by_page_break )
 {
     if ( BLOCK_RENDERING(rend_flags, ENHANCED) ) {
         // Create a flow state (aka "block formatting context") for the rendering
@@ -9685,6 +10066,16 @@ int renderBlockElement(LVRendPageContext & context, ldomNode * enode, int x, int
         if (baseline != NULL) {
             flow.setRequestedBaselineType(*baseline);
         }
+        flow.setFollowedByPageBreak(followed_by_page_break);
+#if (CR_THREAD_SAFE==1)
+        // When rendering the whole document, have final blocks formatted
+        // ahead by worker threads (see FinalBlockFormatPool)
+        LVAutoPtr<FinalBlockFormatPool> format_pool;
+        if ( flow.isMainFlow() && enode == enode->getDocument()->getRootNode() ) {
+            format_pool = FinalBlockFormatPool::create();
+            flow.setFinalBlockFormatPool( format_pool.get() );
+        }
+#endif
         renderBlockElementEnhanced( &flow, enode, x, width, rend_flags );
         if (baseline != NULL) {
             // (We pass the top node, so it can find the first table row
@@ -10305,10 +10696,9 @@ void DrawBackgroundImage(ldomNode *enode,LVDrawBuf & drawbuf,int x0,int y0,int d
             // Honor the same "Image Scaling" (smooth vs nearest-neighbor) setting
             // used for normal <img> elements, so background-image scaling looks
             // consistent with the rest of the page.
-            if ( img_w != native_img_w || img_h != native_img_h ) {
-                img = LVCreateStretchFilledTransform(img, img_w, img_h, IMG_TRANSFORM_STRETCH, IMG_TRANSFORM_STRETCH, 0, 0,
-                                                      drawbuf.getSmoothScalingImages());
-            }
+            // The decoded and resized image is cached, as the same background is
+            // usually drawn again on next pages.
+            img = LVGetCachedScaledImage(img, img_w, img_h, drawbuf.getSmoothScalingImages(), true);
 
             // We can use some crengine facilities for background repetition and position,
             // which has the advantage that img will be decoded once even if tiling it many
@@ -10644,7 +11034,7 @@ void DrawDocument( LVDrawBuf & drawbuf, ldomNode * enode, int x0, int y0, int dx
             }
         }
 
-        if ( enode->getNodeId()==el_DocFragment && enode->getDocument()->isPartialRerenderingEnabled() ) {
+        if ( enode->getDocument()->isRerenderingFragment(enode) ) {
             // Check if rerendering needed, and do it if it is
             if ( enode->getDocument()->partialRender(enode) ) {
                 // Re-rendered, recheck if it is part of the viewport
@@ -12240,9 +12630,10 @@ void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direct
     int indent = 0;         // text-indent: used on first text, and set again on <BR/>
     bool nowrap = false;    // from upper node's white-space
     bool isStartNode = true; // we are starting measurement on that node
+    bool discardState = true; // nobody goes on with the above parameters after us
     // Start measurements and recursions:
     getRenderedWidths(node, maxWidth, minWidth, direction, ignoreMargin, rendFlags,
-        curMaxWidth, curWordWidth, collapseNextSpace, lastSpaceWidth, indent, nowrap, NULL, false, isStartNode);
+        curMaxWidth, curWordWidth, collapseNextSpace, lastSpaceWidth, indent, nowrap, NULL, false, isStartNode, discardState);
     // We took more care with including side bearings into minWidth when considering
     // single words, than into maxWidth: so trust minWidth if larger than maxWidth.
     if ( maxWidth < minWidth)
@@ -12251,7 +12642,7 @@ void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direct
 
 void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direction, bool ignoreMargin, int rendFlags,
     int &curMaxWidth, int &curWordWidth, bool &collapseNextSpace, int &lastSpaceWidth,
-    int indent, bool nowrap, TextLangCfg * lang_cfg, bool processNodeAsText, bool isStartNode)
+    int indent, bool nowrap, TextLangCfg * lang_cfg, bool processNodeAsText, bool isStartNode, bool discardState)
 {
     // This does mostly what renderBlockElement, renderFinalBlock and lvtextfm.cpp
     // do, but only with widths and horizontal margin/border/padding and indent
@@ -12474,7 +12865,19 @@ void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direct
             }
         }
 
-        if ( use_style_width ) {
+        // Our content widths only depend on our subtree: reuse them if already measured
+        // for the current rendering (ie. a table measured by each enclosing table or
+        // float, and again by renderTable() for its cells). Not if our caller goes on
+        // with the curMaxWidth... we leave (ie. a float in a final block), as we would
+        // not update them, nor with an inside list marker (its width depends on siblings).
+        bool memoize = discardState && !use_style_width && !is_img && !list_marker_width;
+        bool memoized = memoize && node->getDocument()->getRenderedWidths(node, direction, rendFlags, _maxWidth, _minWidth);
+        if ( memoized ) {
+            #ifdef DEBUG_GETRENDEREDWIDTHS
+                printf("GRW: memoized min %d max %d\n", _minWidth, _maxWidth);
+            #endif
+        }
+        else if ( use_style_width ) {
             _maxWidth = lengthToPx( node, style_width, 0 );
             _minWidth = _maxWidth;
         }
@@ -12615,7 +13018,8 @@ void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direct
                                 bool _collapseNextSpace = true;
                                 int _lastSpaceWidth = 0;
                                 getRenderedWidths(child, _maxw, _minw, direction, false, rendFlags,
-                                    _curMaxWidth, _curWordWidth, _collapseNextSpace, _lastSpaceWidth, indent, nowrap_in, lang_cfg);
+                                    _curMaxWidth, _curWordWidth, _collapseNextSpace, _lastSpaceWidth, indent, nowrap_in, lang_cfg,
+                                    false, false, true);
                                 int cspan = StrToIntPercent( child->getAttributeValue(attr_colspan).c_str() );
                                 if ( !cspan ) { // 0 if no attribute
                                     // also check obsolete rbspan attribute for <ruby> tables
@@ -12646,7 +13050,8 @@ void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direct
                             bool _collapseNextSpace = true;
                             int _lastSpaceWidth = 0;
                             getRenderedWidths(n, _maxw, _minw, direction, false, rendFlags,
-                                _curMaxWidth, _curWordWidth, _collapseNextSpace, _lastSpaceWidth, indent, nowrap_in, lang_cfg);
+                                _curMaxWidth, _curWordWidth, _collapseNextSpace, _lastSpaceWidth, indent, nowrap_in, lang_cfg,
+                                false, false, true);
                             if ( _minw > caption_min_width )
                                 caption_min_width = _minw;
                             if ( _maxw > caption_max_width )
@@ -12804,13 +13209,16 @@ void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direct
                     continue;
                 }
                 getRenderedWidths(child, _maxw, _minw, direction, false, rendFlags,
-                    curMaxWidth, curWordWidth, collapseNextSpace, lastSpaceWidth, indent, nowrap_in, lang_cfg);
+                    curMaxWidth, curWordWidth, collapseNextSpace, lastSpaceWidth, indent, nowrap_in, lang_cfg,
+                    false, false, discardState);
                 if (_maxw > _maxWidth)
                     _maxWidth = _maxw;
                 if (_minw > _minWidth)
                     _minWidth = _minw;
             }
         }
+        if ( memoize && !memoized )
+            node->getDocument()->setRenderedWidths(node, direction, rendFlags, _maxWidth, _minWidth);
 
         // For all the previous cases, if ensuring width, ensure min-width and max-width, but at
         // this point only. Now if box-sizing:content-box, later if border-box (after we've computed paddings)
@@ -13016,13 +13424,14 @@ void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direct
             minWidth = _minWidth;
     }
     else { // text or pseudoElem
-        lString32 text;
+        // Text nodes are decoded into this buffer, reused for all the nodes measured
+        static CR_THREAD_LOCAL lString32 text;
         int start = 0;
         int len = 0;
         ldomNode * parent;
         bool is_first_letter_pseudo = false;
         if ( node->isEffectiveText() ) {
-            text = node->getEffectiveText();
+            node->getEffectiveText( text );
             len = text.length();
             parent = node->getParentNode();
             // Check if this text node has a preceding FirstLetter pseudoElem
@@ -13054,7 +13463,7 @@ void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direct
             ldomNode * textNode = node->getEffectiveFirstLetterTextNode();
             if ( !textNode )
                 return;
-            text = textNode->getText();
+            textNode->getText( text );
             len = firstLetterEnd; // Only measure the first N characters
             parent = node; // this pseudoElem node carries the font and style of the text
             is_first_letter_pseudo = true;
@@ -13127,8 +13536,8 @@ void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direct
             printf("GRW text:  (dumb text size=%d)\n", font->getTextWidth(txt, len));
         #endif
         #define MAX_TEXT_CHUNK_SIZE 4096
-        static lUInt16 widths[MAX_TEXT_CHUNK_SIZE+1];
-        static lUInt8 flags[MAX_TEXT_CHUNK_SIZE+1];
+        static CR_THREAD_LOCAL lUInt16 widths[MAX_TEXT_CHUNK_SIZE+1];
+        static CR_THREAD_LOCAL lUInt8 flags[MAX_TEXT_CHUNK_SIZE+1];
 
         // todo: use fribidi and split measurement at fribidi level change,
         // and beware left/right side bearing adjustments...
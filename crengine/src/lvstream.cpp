@@ -29,6 +29,7 @@
 #include "../include/lvstream.h"
 #include "../include/lvptrvec.h"
 #include "../include/crtxtenc.h"
+#include "../include/lvthread.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,6 +40,7 @@
 #if (USE_ZLIB==1)
 #include <zlib.h>
 #endif
+#include <xxhash.h>
 
 #if (USE_UNRAR==1)
 #include <rar.hpp>
@@ -142,6 +144,62 @@ lverror_t LVNamedStream::getcrc32( lUInt32 & dst )
         return LVERR_FAIL;
     }
 }
+/// calculate fast content fingerprint for stream, if possible
+lverror_t LVNamedStream::getFingerprint( lUInt64 & dst )
+{
+    if ( _fingerprint==0 ) {
+        lverror_t res = LVStream::getFingerprint( dst );
+        if ( res!=LVERR_OK )
+            return res;
+        _fingerprint = dst;
+    }
+    dst = _fingerprint;
+    return LVERR_OK;
+}
+
+struct LVFileFingerprint
+{
+    lUInt64 size;
+    lUInt64 mtime;
+    lUInt64 fingerprint;
+    LVFileFingerprint() : size(0), mtime(0), fingerprint(0) { }
+};
+
+#define FILE_FINGERPRINT_CACHE_MAX_SIZE 1000
+
+static LVHashTable<lString32, LVFileFingerprint> _fileFingerprints(64);
+static LVMutex _fileFingerprintsMutex;
+
+/// fingerprint of file stream, remembered by file path, size and modification time
+lverror_t LVNamedStream::getFileFingerprint( lUInt64 & dst )
+{
+    if ( _fingerprint!=0 || m_fname.empty() )
+        return LVNamedStream::getFingerprint( dst );
+    LVFileFingerprint item;
+    lUInt64 size = 0;
+    lUInt64 mtime = 0;
+    if ( !LVGetFileStat( UnicodeToUtf8(m_fname), size, mtime ) || size!=(lUInt64)GetSize() )
+        return LVNamedStream::getFingerprint( dst );
+    {
+        LVLock lock( _fileFingerprintsMutex );
+        if ( _fileFingerprints.get( m_fname, item ) && item.size==size && item.mtime==mtime ) {
+            _fingerprint = dst = item.fingerprint;
+            return LVERR_OK;
+        }
+    }
+    lverror_t res = LVNamedStream::getFingerprint( dst );
+    if ( res==LVERR_OK ) {
+        item.size = size;
+        item.mtime = mtime;
+        item.fingerprint = dst;
+        LVLock lock( _fileFingerprintsMutex );
+        if ( _fileFingerprints.length() >= FILE_FINGERPRINT_CACHE_MAX_SIZE )
+            _fileFingerprints.clear();
+        _fileFingerprints.set( m_fname, item );
+    }
+    return res;
+}
+
 /// returns stream/container name, may be NULL if unknown
 const lChar32 * LVNamedStream::GetName()
 {
@@ -294,6 +352,63 @@ LVStreamBufferRef LVStream::GetWriteBuffer( lvpos_t pos, lvpos_t size )
 
 #define CRC_BUF_SIZE 16384
 
+// Content fingerprint: streams not larger than FINGERPRINT_FULL_HASH_MAX_SIZE
+// are hashed whole. For bigger ones, only head, tail and FINGERPRINT_SAMPLE_COUNT
+// evenly spaced blocks are read, with the size as hash seed: a change in the
+// content that doesn't touch any sampled byte nor the size is not detected.
+#define FINGERPRINT_FULL_HASH_MAX_SIZE 0x100000
+#define FINGERPRINT_EDGE_SIZE 0x10000
+#define FINGERPRINT_SAMPLE_COUNT 16
+#define FINGERPRINT_SAMPLE_SIZE 0x1000
+
+/// calculate fast content fingerprint for stream, if possible
+lverror_t LVStream::getFingerprint( lUInt64 & dst )
+{
+    dst = 0;
+    if ( GetMode() != LVOM_READ && GetMode() != LVOM_APPEND )
+        return LVERR_NOTIMPL; // not supported
+    lvsize_t size = GetSize();
+    if ( size == LV_INVALID_SIZE )
+        return LVERR_FAIL;
+    lvpos_t pos[FINGERPRINT_SAMPLE_COUNT + 2];
+    lvsize_t len[FINGERPRINT_SAMPLE_COUNT + 2];
+    int count = 0;
+    lvsize_t total = 0;
+    if ( size <= FINGERPRINT_FULL_HASH_MAX_SIZE ) {
+        pos[0] = 0;
+        len[0] = size;
+        count = 1;
+    } else {
+        pos[count] = 0;
+        len[count++] = FINGERPRINT_EDGE_SIZE;
+        lvsize_t space = size - 2 * FINGERPRINT_EDGE_SIZE - FINGERPRINT_SAMPLE_SIZE;
+        for ( int i = 1; i <= FINGERPRINT_SAMPLE_COUNT; i++ ) {
+            pos[count] = FINGERPRINT_EDGE_SIZE + (lvpos_t)((lUInt64)space * i / (FINGERPRINT_SAMPLE_COUNT + 1));
+            len[count++] = FINGERPRINT_SAMPLE_SIZE;
+        }
+        pos[count] = size - FINGERPRINT_EDGE_SIZE;
+        len[count++] = FINGERPRINT_EDGE_SIZE;
+    }
+    for ( int i = 0; i < count; i++ )
+        total += len[i];
+    LVArray<lUInt8> buf( (int)total + 1, 0 );
+    lvpos_t savepos = GetPos();
+    lvsize_t offset = 0;
+    for ( int i = 0; i < count; i++ ) {
+        lvsize_t bytesRead = 0;
+        if ( SetPos( pos[i] ) != pos[i] || Read( buf.get() + offset, len[i], &bytesRead ) != LVERR_OK || bytesRead != len[i] ) {
+            SetPos( savepos );
+            return LVERR_FAIL;
+        }
+        offset += len[i];
+    }
+    SetPos( savepos );
+    dst = XXH64( buf.get(), total, (XXH64_hash_t)size );
+    if ( dst == 0 )
+        dst = 1; // 0 is for error
+    return LVERR_OK;
+}
+
 /// calculate crc32 code for stream, if possible
 lverror_t LVStream::getcrc32( lUInt32 & dst )
 {
@@ -379,6 +494,11 @@ private:
 
 
 public:
+    /// fingerprint is remembered by file path, size and modification time
+    virtual lverror_t getFingerprint( lUInt64 & dst )
+    {
+        return getFileFingerprint( dst );
+    }
 
     /// Get read buffer (optimal for )
     virtual LVStreamBufferRef GetReadBuffer( lvpos_t pos, lvpos_t size )
@@ -883,6 +1003,11 @@ class LVFileStream : public LVNamedStream
 private:
     FILE * m_file;
 public:
+    /// fingerprint is remembered by file path, size and modification time
+    virtual lverror_t getFingerprint( lUInt64 & dst )
+    {
+        return getFileFingerprint( dst );
+    }
 
 
     virtual lverror_t Seek( lvoffset_t offset, lvseek_origin_t origin, lvpos_t * pNewPos )
@@ -1027,6 +1152,11 @@ protected:
     lvsize_t               m_size;
     lvpos_t                m_pos;
 public:
+    /// fingerprint is remembered by file path, size and modification time
+    virtual lverror_t getFingerprint( lUInt64 & dst )
+    {
+        return getFileFingerprint( dst );
+    }
     /// flushes unsaved data from buffers to file, with optional flush of OS buffers
     virtual lverror_t Flush( bool sync )
     {
@@ -1928,6 +2058,12 @@ public:
         return m_stream->getcrc32( dst );
     }
 
+    /// fastly return already known fingerprint
+    virtual lverror_t getFingerprint( lUInt64 & dst )
+    {
+        return m_stream->getFingerprint( dst );
+    }
+
     virtual bool Eof()
     {
         return m_pos >= m_size;
@@ -2208,12 +2344,21 @@ struct Zip64ExtInfo
 
 #define ARC_INBUF_SIZE  (8 * 1024)
 #define ARC_OUTBUF_SIZE (16 * 1024)
+#define ARC_WINDOW_SIZE (32 * 1024) // deflate history window
 
 #if (USE_ZLIB==1)
 
 class LVZipDecodeStream : public LVNamedStream
 {
 private:
+    /// Inflate state at a deflate block boundary, allowing to resume
+    /// decoding from there instead of from the start of the member
+    struct Checkpoint {
+        lvpos_t out;    // decoded position
+        lvpos_t in;     // position of the first byte not fully consumed in packed data
+        int     bits;   // count of unconsumed bits in the byte before it
+        lUInt8  window[ARC_WINDOW_SIZE]; // decoded data preceding out
+    };
     LVStreamRef m_stream;
     lvsize_t    m_packsize;
     lvsize_t    m_unpacksize;
@@ -2226,10 +2371,21 @@ private:
     z_stream_s  m_zstream;
     lUInt8      m_inbuf[ARC_INBUF_SIZE];
     lUInt8      m_outbuf[ARC_OUTBUF_SIZE];
+    // large members: checkpoints recorded every ZIP_STREAM_CHECKPOINT_INTERVAL
+    // decoded bytes, so that a backward seek doesn't decode from the start
+    bool        m_useCheckpoints;
+    LVPtrVector<Checkpoint> m_checkpoints; // sorted by out
+    lUInt8 *    m_window;     // ring buffer with last decoded bytes, while a checkpoint is due
+    int         m_windowFill; // count of valid bytes in m_window
+    lvpos_t     m_windowEnd;  // decoded position following the last byte put into m_window
+    // small members: whole decoded content, once seeked back
+    lUInt8 *    m_cache;
 
     LVZipDecodeStream( LVStreamRef stream, lvsize_t packsize, lvsize_t unpacksize, lUInt32 crc )
         : m_stream(stream), m_packsize(packsize), m_unpacksize(unpacksize), m_zInitialized(false)
         , m_CRC(0), m_originalCRC(crc), m_pos(0), m_inpos(0), m_outpos(0)
+        , m_useCheckpoints(unpacksize > ZIP_STREAM_CACHE_MAX_SIZE && unpacksize > ZIP_STREAM_CHECKPOINT_INTERVAL)
+        , m_window(NULL), m_windowFill(0), m_windowEnd(0), m_cache(NULL)
     {
         rewind();
     }
@@ -2237,6 +2393,10 @@ private:
     ~LVZipDecodeStream()
     {
         zUninit();
+        if (m_window)
+            free(m_window);
+        if (m_cache)
+            free(m_cache);
     }
 
     /// Get stream open mode
@@ -2272,12 +2432,14 @@ private:
         return m_zstream.avail_in > 0;
     }
 
-    bool rewind()
+    /// init decoder to read packed data from inpos
+    bool zInit(lvpos_t inpos)
     {
         zUninit();
-        if (m_stream->Seek(0, LVSEEK_SET, NULL) != LVERR_OK)
+        if (m_stream->Seek(inpos, LVSEEK_SET, NULL) != LVERR_OK)
             return false;
-        m_CRC = m_outpos = m_inpos = 0;
+        m_CRC = m_outpos = 0;
+        m_inpos = inpos;
         memset(&m_zstream, 0, sizeof (m_zstream));
         m_zstream.next_in = m_inbuf;
         m_zstream.avail_in = 0;
@@ -2291,6 +2453,83 @@ private:
         m_zInitialized = true;
         return true;
     }
+
+    bool rewind()
+    {
+        m_windowFill = 0;
+        return zInit(0);
+    }
+
+    /// resume decoding from the last checkpoint before pos (or from start)
+    bool restoreCheckpoint(lvpos_t pos)
+    {
+        Checkpoint * cp = NULL;
+        for (int i = m_checkpoints.length() - 1; i >= 0; i--) {
+            if (m_checkpoints[i]->out <= pos) {
+                cp = m_checkpoints[i];
+                break;
+            }
+        }
+        if (!cp)
+            return rewind();
+        if (!zInit(cp->in - (cp->bits ? 1 : 0)))
+            return false;
+        if (cp->bits) {
+            lUInt8 b = 0;
+            lvsize_t count = 0;
+            if (m_stream->Read(&b, 1, &count) != LVERR_OK || count != 1)
+                return false;
+            m_inpos++;
+            inflatePrime(&m_zstream, cp->bits, b >> (8 - cp->bits));
+        }
+        inflateSetDictionary(&m_zstream, cp->window, ARC_WINDOW_SIZE);
+        m_zstream.total_out = m_outpos = cp->out;
+        if (m_window) {
+            memcpy(m_window, cp->window, ARC_WINDOW_SIZE);
+            m_windowFill = ARC_WINDOW_SIZE;
+            m_windowEnd = cp->out;
+        }
+        return true;
+    }
+
+    /// record a checkpoint if one is due, called after each inflate() with Z_BLOCK
+    void updateCheckpoints()
+    {
+        lvpos_t last = m_checkpoints.length() > 0 ? m_checkpoints[m_checkpoints.length() - 1]->out : 0;
+        lvpos_t next = last + ZIP_STREAM_CHECKPOINT_INTERVAL;
+        lvpos_t out = m_zstream.total_out;
+        if (out < last || out + ARC_WINDOW_SIZE < next)
+            return;
+        // keep last decoded bytes
+        if (!m_window)
+            m_window = (lUInt8*)malloc(ARC_WINDOW_SIZE);
+        if (m_windowEnd != m_outpos)
+            m_windowFill = 0; // not contiguous
+        int avail = getAvailBytes();
+        const lUInt8 * data = m_outbuf;
+        if (avail >= ARC_WINDOW_SIZE) {
+            data += avail - ARC_WINDOW_SIZE;
+            avail = ARC_WINDOW_SIZE;
+            m_windowFill = 0;
+        }
+        int keep = m_windowFill + avail > ARC_WINDOW_SIZE ? ARC_WINDOW_SIZE - avail : m_windowFill;
+        if (keep < m_windowFill)
+            memmove(m_window, m_window + m_windowFill - keep, keep);
+        memcpy(m_window + keep, data, avail);
+        m_windowFill = keep + avail;
+        m_windowEnd = out;
+        // at a block boundary, which is not the end of the last block?
+        if (out >= next && m_windowFill == ARC_WINDOW_SIZE
+                && (m_zstream.data_type & 128) && !(m_zstream.data_type & 64)) {
+            Checkpoint * cp = new Checkpoint();
+            cp->out = out;
+            cp->in = m_inpos - m_zstream.avail_in;
+            cp->bits = m_zstream.data_type & 7;
+            memcpy(cp->window, m_window, ARC_WINDOW_SIZE);
+            m_checkpoints.add(cp);
+        }
+    }
+
     // returns count of available decoded bytes in buffer
     inline int getAvailBytes()
     {
@@ -2306,7 +2545,12 @@ private:
         m_zstream.next_out = m_outbuf;
         m_zstream.avail_out = ARC_OUTBUF_SIZE;
 
-        int res = inflate(&m_zstream, m_inpos < m_packsize ? Z_NO_FLUSH : Z_FINISH);
+        int flush;
+        if (m_useCheckpoints)
+            flush = Z_BLOCK; // stop at block boundaries, where checkpoints can be made
+        else
+            flush = m_inpos < m_packsize ? Z_NO_FLUSH : Z_FINISH;
+        int res = inflate(&m_zstream, flush);
         switch (res) {
         case Z_BUF_ERROR:
         case Z_STREAM_END:
@@ -2325,19 +2569,51 @@ private:
         }
 #endif
 
+        if (m_useCheckpoints)
+            updateCheckpoints();
         return true;
     }
-    /// skip bytes from out stream
-    bool skip( int bytesToSkip )
+    /// decode until pos is in out buffer
+    bool skipTo( lvpos_t pos )
     {
-        for ( ; ; ) {
-            int avail = getAvailBytes();
-            if (avail >= bytesToSkip)
-                return true;
-            bytesToSkip -= avail;
+        while (pos > m_zstream.total_out) {
+            uLong total_in = m_zstream.total_in;
+            uLong total_out = m_zstream.total_out;
             if (!decodeNext())
                 return false;
+            if (total_in == m_zstream.total_in && total_out == m_zstream.total_out)
+                return false; // no progress: truncated data
+        }
+        return true;
+    }
+    /// decode the whole member into m_cache, and release decoder
+    bool decodeAll()
+    {
+        lUInt8 * data = (lUInt8*)malloc(m_unpacksize > 0 ? m_unpacksize : 1);
+        if (!data || !rewind()) {
+            free(data);
+            return false;
+        }
+        lvpos_t pos = 0;
+        while (pos < m_unpacksize) {
+            uLong total_in = m_zstream.total_in;
+            if (!decodeNext()) {
+                free(data);
+                return false;
+            }
+            lvsize_t avail = getAvailBytes();
+            if (avail > m_unpacksize - pos)
+                avail = m_unpacksize - pos;
+            if (avail == 0 && total_in == m_zstream.total_in) {
+                free(data);
+                return false; // no progress: truncated data
+            }
+            memcpy(data + pos, m_outbuf, avail);
+            pos += avail;
         }
+        zUninit();
+        m_cache = data;
+        return true;
     }
 public:
 
@@ -2348,6 +2624,13 @@ public:
         return LVERR_OK;
     }
 
+    /// make fingerprint from already known CRC and size, instead of unpacking samples
+    virtual lverror_t getFingerprint( lUInt64 & dst )
+    {
+        dst = ((lUInt64)m_unpacksize << 32) | m_originalCRC;
+        return LVERR_OK;
+    }
+
     virtual bool Eof()
     {
         return m_pos == m_unpacksize;
@@ -2368,7 +2651,7 @@ public:
     }
     virtual lverror_t Seek(lvoffset_t offset, lvseek_origin_t origin, lvpos_t* newPos)
     {
-        if (!m_zInitialized)
+        if (!m_zInitialized && !m_cache)
             return LVERR_FAIL;
 
         lvpos_t abspos;
@@ -2388,12 +2671,20 @@ public:
         if (abspos > m_unpacksize)
             return LVERR_FAIL;
 
-        if (abspos > m_zstream.total_out) {
-            if (!skip(abspos - m_zstream.total_out))
+        if (m_cache) {
+            // whole member already decoded
+        }
+        else if (abspos > m_zstream.total_out) {
+            if (!skipTo(abspos))
                 return LVERR_FAIL;
         }
         else if (abspos < m_outpos) {
-            if (!rewind() || !skip(abspos))
+            if (m_unpacksize <= ZIP_STREAM_CACHE_MAX_SIZE) {
+                // small member read again: keep it decoded
+                if (!decodeAll())
+                    return LVERR_FAIL;
+            }
+            else if (!restoreCheckpoint(abspos) || !skipTo(abspos))
                 return LVERR_FAIL;
         }
 
@@ -2409,12 +2700,20 @@ public:
     }
     virtual lverror_t Read(void* buf, lvsize_t count, lvsize_t* bytesRead)
     {
-        if (!m_zInitialized)
+        if (!m_zInitialized && !m_cache)
             return LVERR_FAIL;
 
         if ((m_pos + count) > m_unpacksize)
             count = m_unpacksize - m_pos;
 
+        if (m_cache) {
+            memcpy(buf, m_cache + m_pos, count);
+            m_pos += count;
+            if (bytesRead)
+                *bytesRead = count;
+            return LVERR_OK;
+        }
+
         lUInt8 * ptr = (lUInt8 *)buf;
         lUInt8 * end = ptr + count;
 
@@ -4158,6 +4457,31 @@ bool LVRenameFile(lString8 oldname, lString8 newname) {
 #endif
 }
 
+/// get file size and last modification time (seconds since epoch), returns false if file is not found
+bool LVGetFileStat(const lString8 & pathName, lUInt64 & size, lUInt64 & mtime) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(Utf8ToUnicode(pathName).c_str(), GetFileExInfoStandard, &data))
+        return false;
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        return false;
+    size = ((lUInt64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    lUInt64 ft = ((lUInt64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    // FILETIME is in 100ns units since 1601-01-01
+    mtime = ft / 10000000ULL - 11644473600ULL;
+    return true;
+#else
+    struct stat st;
+    if (stat(pathName.c_str(), &st) != 0)
+        return false;
+    if (!S_ISREG(st.st_mode))
+        return false;
+    size = (lUInt64)st.st_size;
+    mtime = (lUInt64)st.st_mtime;
+    return true;
+#endif
+}
+
 /// delete file, return true if file found and successfully deleted
 bool LVDeleteFile( lString8 filename ) {
     return LVDeleteFile(Utf8ToUnicode(filename));
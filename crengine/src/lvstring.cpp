@@ -3214,6 +3214,34 @@ lString32 Utf8ToUnicode( const char * s, int sz ) {
     return dst;
 }
 
+void Utf8DecodeChars( const lChar8 * s, int start, lChar32 * dst, int count ) {
+    // skip chars the way DecodeUtf8() reads them
+    for ( ; start > 0; start-- ) {
+        lUInt8 ch = *s++;
+        if ( (ch & 0xE0) == 0xC0 )
+            s++;
+        else if ( (ch & 0xF0) == 0xE0 )
+            s += 2;
+        else if ( (ch & 0xF8) == 0xF0 )
+            s += 3;
+    }
+    DecodeUtf8(s, dst, count);
+}
+
+void Utf8ToUnicode( const char * s, int sz, lString32 & dst ) {
+    int len = 0;
+    if (s && s[0] && sz > 0)
+        len = Utf8CharCount( s, sz );
+    if (!len) {
+        if (!dst.empty())
+            dst.reset(0);
+        return;
+    }
+    dst.reset(len);
+    dst.append(len, 0);
+    DecodeUtf8(s, dst.modify(), len);
+}
+
 
 lString8 UnicodeToUtf8(const lChar32 * s, int count)
 {
@@ -6380,6 +6380,39 @@ bool LVCssSelectorRule::quickClassCheck(const lUInt32 *classHashes, size_t size)
     return false;
 }
 
+// Bucket keys, hash of the required value with the kind of rule in low bits
+#define CSS_BUCKET_KEY_ID(hash)      (((lUInt32)(hash) << 2) | 1)
+#define CSS_BUCKET_KEY_CLASS(hash)   (((lUInt32)(hash) << 2) | 2)
+#define CSS_BUCKET_KEY_ATTR(attrid)  (((lUInt32)(attrid) << 2) | 3)
+
+lUInt32 LVCssSelectorRule::getBucketKey() const {
+    switch (_type) {
+    case cssrt_id:
+        return CSS_BUCKET_KEY_ID(_value.getHash());
+    case cssrt_class:
+        return CSS_BUCKET_KEY_CLASS(_valueHash);
+    case cssrt_attrset:
+    case cssrt_attreq:
+    case cssrt_attreq_i:
+    case cssrt_attrhas:
+    case cssrt_attrhas_i:
+    case cssrt_attrstarts_word:
+    case cssrt_attrstarts_word_i:
+    case cssrt_attrstarts:
+    case cssrt_attrstarts_i:
+    case cssrt_attrends:
+    case cssrt_attrends_i:
+    case cssrt_attrcontains:
+    case cssrt_attrcontains_i:
+        // all of them need the attribute to be present (but the inner text is not one)
+        if ( _attrid == attr_InnerText )
+            return 0;
+        return CSS_BUCKET_KEY_ATTR(_attrid);
+    default:
+        return 0;
+    }
+}
+
 static bool getOriginalFragmentAttributeValue(const ldomNode *node, lUInt16 attrid, lString32 &original_value) {
     // EPUB/CHM documents are merged into a single DOM, and ldomDocumentFragmentWriter
     // rewrites some attributes with a "_doc_fragment_N_ " prefix so they stay unique.
@@ -7119,6 +7152,14 @@ bool LVCssSelector::quickClassCheck(const lUInt32 *classHashes, size_t size) con
     return !_rules || _pseudo_elem || _rules->quickClassCheck(classHashes, size);
 }
 
+lUInt32 LVCssSelector::getBucketKey() const {
+    // Same limits as quickClassCheck(): only the first rule (from the right)
+    // is checked against the node itself before any other
+    if ( !_rules || _pseudo_elem )
+        return 0;
+    return _rules->getBucketKey();
+}
+
 bool parse_attr_value( const char * &str, char * buf, bool &parse_trailing_i, char stop_char=']' )
 {
     int pos = 0;
@@ -7774,6 +7815,7 @@ LVCssSelector::LVCssSelector( LVCssSelector & v )
 
 void LVStyleSheet::set(LVPtrVector<LVCssSelector> & v  )
 {
+    dropIndex();
     _selectors.clear();
     if ( !v.size() )
         return;
@@ -7790,6 +7832,9 @@ void LVStyleSheet::set(LVPtrVector<LVCssSelector> & v  )
 LVStyleSheet::LVStyleSheet( LVStyleSheet & sheet )
 :   _doc( sheet._doc )
 ,   _nested( sheet._nested )
+,   _index( NULL )
+,   _styled_nodes_count( 0 )
+,   _tested_selectors_count( 0 )
 ,   _fontFaceDecls( sheet._fontFaceDecls )
 ,   _trackFontFaceDecls( sheet._trackFontFaceDecls )
 {
@@ -7812,6 +7857,100 @@ static void for_each_split(const lChar32 *begin, F functor) {
         functor(begin, end);
 }
 
+// A selector in a bucket, with its position in its _selectors chain
+struct LVCssSelectorEntry {
+    LVCssSelector * selector;
+    int position;
+};
+
+// Walks a bucket, in chain order
+struct SelectorCursor {
+    const LVArray<LVCssSelectorEntry> * entries;
+    int index;
+    int chainRank;
+    bool end() const { return index >= entries->length(); }
+    LVCssSelector * next() { return (*entries)[index++].selector; }
+    // true if our next selector is to be applied before the one of other
+    // (the order the former walk of 2 whole chains would give)
+    bool before( const SelectorCursor & other ) const {
+        const LVCssSelectorEntry & a = (*entries)[index];
+        const LVCssSelectorEntry & b = (*other.entries)[other.index];
+        lUInt32 sa = a.selector->getSpecificity();
+        lUInt32 sb = b.selector->getSpecificity();
+        if ( sa != sb )
+            return sa < sb;
+        if ( chainRank != other.chainRank )
+            return chainRank < other.chainRank;
+        return a.position < b.position;
+    }
+};
+
+struct LVStyleSheet::SelectorIndex {
+    struct Chain {
+        LVArray<LVCssSelectorEntry> unbucketed; // checked against all nodes
+        LVPtrVector< LVArray<LVCssSelectorEntry> > buckets;
+        mutable LVHashTable<lUInt32, int> bucketByKey; // LVHashTable::get() is not const
+        Chain() : bucketByKey(16) { }
+        void add( LVCssSelector * selector, int position ) {
+            LVCssSelectorEntry entry = { selector, position };
+            lUInt32 key = selector->getBucketKey();
+            if ( !key ) {
+                unbucketed.add( entry );
+                return;
+            }
+            int n;
+            if ( !bucketByKey.get( key, n ) ) {
+                n = buckets.length();
+                buckets.add( new LVArray<LVCssSelectorEntry>() );
+                bucketByKey.set( key, n );
+            }
+            buckets[n]->add( entry );
+        }
+        void addCursors( LVArray<SelectorCursor> & cursors, const LVArray<lUInt32> & keys, int chainRank ) const {
+            int first = cursors.length();
+            SelectorCursor cursor = { &unbucketed, 0, chainRank };
+            if ( unbucketed.length() )
+                cursors.add( cursor );
+            for ( int i=0; i<keys.length(); i++ ) {
+                int n;
+                if ( !bucketByKey.get( keys[i], n ) )
+                    continue;
+                cursor.entries = buckets[n];
+                // a same bucket must be walked once (duplicate class names, hash collisions)
+                bool found = false;
+                for ( int k=first; k<cursors.length() && !found; k++ )
+                    found = cursors[k].entries == cursor.entries;
+                if ( !found )
+                    cursors.add( cursor );
+            }
+        }
+    };
+    LVPtrVector<Chain> chains; // same indexes as LVStyleSheet::_selectors, never NULL
+};
+
+const LVStyleSheet::SelectorIndex * LVStyleSheet::getIndex() const
+{
+    if ( !_index ) {
+        _index = new SelectorIndex();
+        for ( int i=0; i<_selectors.length(); i++ ) {
+            SelectorIndex::Chain * chain = new SelectorIndex::Chain();
+            int position = 0;
+            for ( LVCssSelector * p = _selectors[i]; p; p = p->getNext() )
+                chain->add( p, position++ );
+            _index->chains.add( chain );
+        }
+    }
+    return _index;
+}
+
+void LVStyleSheet::dropIndex()
+{
+    if ( _index ) {
+        delete _index;
+        _index = NULL;
+    }
+}
+
 void LVStyleSheet::apply( const ldomNode * node, css_style_rec_t * style ) const
 {
     if (!_selectors.length())
@@ -7884,46 +8023,59 @@ void LVStyleSheet::apply( const ldomNode * node, css_style_rec_t * style ) const
     // first checked agains all <p>).
     // To see which selectors apply to a <p>, we must iterate thru both chains,
     // checking and applying them in the order of specificity/parsed position.
-    LVCssSelector * selector_0 = _selectors[0];
-    LVCssSelector * selector_id = id>0 && id<_selectors.length() ? _selectors[id] : NULL;
-
+    // With publisher CSS made of thousands of ".calibre123" rules, most
+    // selectors sit in chain 0: so, each chain is indexed by the id, class
+    // or attribute name required by the first rule of its selectors, and we
+    // only walk the buckets matching this node (and the selectors requiring
+    // none of these), merged back in chain order.
+    const SelectorIndex * index = getIndex();
+    LVArray<SelectorCursor> cursors;
     LVArray<lUInt32> class_hash_array;
     const lString32 &v = node->getEffectiveAttributeValue(attr_class);
     for_each_split(v.c_str(), [&](const lChar32 *begin, const lChar32 *end) {
         class_hash_array.add(lString32::getHash(begin, end));
     });
+    LVArray<lUInt32> keys;
+    if ( node->getEffectiveNodeId() != el_pseudoElem ) {
+        // pseudoElem nodes only match selectors with a pseudo element, which are not bucketed
+        const ldomNode * enode = const_cast<ldomNode*>(node)->getEffectiveNode();
+        for ( int i=0; i<class_hash_array.length(); i++ )
+            keys.add( CSS_BUCKET_KEY_CLASS(class_hash_array[i]) );
+        int attrCount = enode->getAttrCount();
+        for ( int i=0; i<attrCount; i++ )
+            keys.add( CSS_BUCKET_KEY_ATTR(enode->getAttribute(i)->id) );
+        const lString32 & idValue = enode->getAttributeValue(attr_id);
+        if ( !idValue.empty() ) {
+            keys.add( CSS_BUCKET_KEY_ID(idValue.getHash()) );
+            lString32 original_val;
+            if ( getOriginalFragmentAttributeValue(enode, attr_id, original_val) )
+                keys.add( CSS_BUCKET_KEY_ID(original_val.getHash()) );
+        }
+    }
+    // On equal specificity, the element name chain goes first
+    if ( id>0 && id<index->chains.length() )
+        index->chains[id]->addCursors( cursors, keys, 0 );
+    index->chains[0]->addCursors( cursors, keys, 1 );
 
+    lUInt32 tested = 0;
     for (;;)
     {
-        if (selector_0!=NULL)
-        {
-            if (selector_id==NULL || selector_0->getSpecificity() < selector_id->getSpecificity() )
-            {
-                // step by sel_0
-                if (selector_0->quickClassCheck(class_hash_array.ptr(), class_hash_array.length()))
-                    selector_0->apply( node, style );
-                selector_0 = selector_0->getNext();
-            }
-            else
-            {
-                // step by sel_id
-                if (selector_id->quickClassCheck(class_hash_array.ptr(), class_hash_array.length()))
-                    selector_id->apply( node, style );
-                selector_id = selector_id->getNext();
-            }
-        }
-        else if (selector_id!=NULL)
-        {
-            // step by sel_id
-            if (selector_id->quickClassCheck(class_hash_array.ptr(), class_hash_array.length()))
-                selector_id->apply( node, style );
-            selector_id = selector_id->getNext();
+        int best = -1;
+        for ( int i=0; i<cursors.length(); i++ ) {
+            if ( cursors[i].end() )
+                continue;
+            if ( best<0 || cursors[i].before(cursors[best]) )
+                best = i;
         }
-        else
-        {
+        if ( best<0 )
             break; // end of chains
-        }
+        LVCssSelector * selector = cursors[best].next();
+        tested++;
+        if (selector->quickClassCheck(class_hash_array.ptr(), class_hash_array.length()))
+            selector->apply( node, style );
     }
+    _styled_nodes_count++;
+    _tested_selectors_count += tested;
 }
 
 lUInt32 LVCssSelectorRule::getHash() const
@@ -8089,6 +8241,7 @@ bool LVStyleSheet::parseAndAdvance( const char * &str, bool useragent_sheet, lSt
         {
             // Ok:
             // place rules to sheet
+            dropIndex();
             for (LVCssSelector * next, * p = selector; p; p = next) {
                 next = p->getNext();
                 insert_into_selectors(p, _selectors);
@@ -8176,6 +8329,7 @@ bool LVStyleSheet::gatherNodeMatchingRulesets(ldomNode * node, const char * str,
 }
 
 void LVStyleSheet::merge(const LVStyleSheet &other) {
+    dropIndex();
     int length = other._selectors.length();
     if (length > _selectors.length())
         _selectors.set(length - 1, nullptr);
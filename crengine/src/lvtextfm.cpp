@@ -416,10 +416,7 @@ public:
     int       m_length;
     int       m_size;
     bool      m_staticBufs;
-    static bool      m_staticBufs_inUse;
-    #if (USE_LIBUNIBREAK==1)
-    static bool      m_libunibreak_init_done;
-    #endif
+    static CR_THREAD_LOCAL bool      m_staticBufs_inUse;
     lChar32 * m_text;
     lUInt16 * m_flags;
     src_text_fragment_t * * m_srcs;
@@ -484,11 +481,12 @@ public:
     : m_pbuffer(pbuffer), m_length(0), m_size(0), m_staticBufs(true), m_y(0)
     {
         #if (USE_LIBUNIBREAK==1)
-        if (!m_libunibreak_init_done) {
-            m_libunibreak_init_done = true;
-            // Have libunibreak build up a few lookup tables for quicker computation
-            init_linebreak();
-        }
+        // Have libunibreak build up a few lookup tables for quicker computation.
+        // Done once by the initialization of this local static: formatters
+        // are also created by FinalBlockFormatPool workers, and threads
+        // coming at the same time wait for the tables to be complete.
+        static bool libunibreak_init_done = (init_linebreak(), true);
+        CR_UNUSED(libunibreak_init_done);
         #endif
         if (m_staticBufs_inUse)
             m_staticBufs = false;
@@ -1152,15 +1150,15 @@ public:
             m_staticBufs = false;
         } else {
             // static buffer space
-            static lChar32 m_static_text[STATIC_BUFS_SIZE];
-            static lUInt16 m_static_flags[STATIC_BUFS_SIZE];
-            static src_text_fragment_t * m_static_srcs[STATIC_BUFS_SIZE];
-            static lUInt16 m_static_charindex[STATIC_BUFS_SIZE];
-            static int m_static_widths[STATIC_BUFS_SIZE];
+            static CR_THREAD_LOCAL lChar32 m_static_text[STATIC_BUFS_SIZE];
+            static CR_THREAD_LOCAL lUInt16 m_static_flags[STATIC_BUFS_SIZE];
+            static CR_THREAD_LOCAL src_text_fragment_t * m_static_srcs[STATIC_BUFS_SIZE];
+            static CR_THREAD_LOCAL lUInt16 m_static_charindex[STATIC_BUFS_SIZE];
+            static CR_THREAD_LOCAL int m_static_widths[STATIC_BUFS_SIZE];
             #if (USE_FRIBIDI==1)
-                static FriBidiCharType m_static_bidi_ctypes[STATIC_BUFS_SIZE];
-                static FriBidiBracketType m_static_bidi_btypes[STATIC_BUFS_SIZE];
-                static FriBidiLevel m_static_bidi_levels[STATIC_BUFS_SIZE];
+                static CR_THREAD_LOCAL FriBidiCharType m_static_bidi_ctypes[STATIC_BUFS_SIZE];
+                static CR_THREAD_LOCAL FriBidiBracketType m_static_bidi_btypes[STATIC_BUFS_SIZE];
+                static CR_THREAD_LOCAL FriBidiLevel m_static_bidi_levels[STATIC_BUFS_SIZE];
             #endif
             m_text = m_static_text;
             m_flags = m_static_flags;
@@ -1999,8 +1997,8 @@ public:
         const lChar32 * str = srcline->t.text + word->t.start;
         // Avoid malloc by using static buffers. Returns false if word too long.
         #define MAX_MEASURED_WORD_SIZE 127
-        static lUInt16 widths[MAX_MEASURED_WORD_SIZE+1];
-        static lUInt8 flags[MAX_MEASURED_WORD_SIZE+1];
+        static CR_THREAD_LOCAL lUInt16 widths[MAX_MEASURED_WORD_SIZE+1];
+        static CR_THREAD_LOCAL lUInt8 flags[MAX_MEASURED_WORD_SIZE+1];
         if (word->t.len > MAX_MEASURED_WORD_SIZE)
             return false;
         lUInt32 hints = WORD_FLAGS_TO_FNT_FLAGS(word->flags);
@@ -2028,8 +2026,8 @@ public:
         int start = 0;
         int lastWidth = 0;
         #define MAX_TEXT_CHUNK_SIZE 4096
-        static lUInt16 widths[MAX_TEXT_CHUNK_SIZE+1];
-        static lUInt8 flags[MAX_TEXT_CHUNK_SIZE+1];
+        static CR_THREAD_LOCAL lUInt16 widths[MAX_TEXT_CHUNK_SIZE+1];
+        static CR_THREAD_LOCAL lUInt8 flags[MAX_TEXT_CHUNK_SIZE+1];
         int tabIndex = -1;
         #if (USE_FRIBIDI==1)
             FriBidiLevel lastBidiLevel = 0;
@@ -3469,11 +3467,11 @@ public:
                 printf("CRE WARNING: bidi processing line overflow (%d > %d)\n", end-start, MAX_LINE_SIZE);
                 end = start + MAX_LINE_SIZE;
             }
-            static lChar32 bidi_tmp_text[MAX_LINE_SIZE];
-            static lUInt16 bidi_tmp_flags[MAX_LINE_SIZE];
-            static src_text_fragment_t * bidi_tmp_srcs[MAX_LINE_SIZE];
-            static lUInt16 bidi_tmp_charindex[MAX_LINE_SIZE];
-            static int     bidi_tmp_widths[MAX_LINE_SIZE];
+            static CR_THREAD_LOCAL lChar32 bidi_tmp_text[MAX_LINE_SIZE];
+            static CR_THREAD_LOCAL lUInt16 bidi_tmp_flags[MAX_LINE_SIZE];
+            static CR_THREAD_LOCAL src_text_fragment_t * bidi_tmp_srcs[MAX_LINE_SIZE];
+            static CR_THREAD_LOCAL lUInt16 bidi_tmp_charindex[MAX_LINE_SIZE];
+            static CR_THREAD_LOCAL int     bidi_tmp_widths[MAX_LINE_SIZE];
             // Map of string indices which is reordered to reflect where each
             // glyph ends up. Note that fribidi will access it starting
             // from 0 (and not from 'start'): this would need us to allocate
@@ -3483,7 +3481,7 @@ public:
             // if some other part than [start:end] would be accessed, but
             // we know fribid doesn't - by contract as it shouldn't reorder
             // any other part except between start:end).
-            static FriBidiStrIndex bidi_indices_map[MAX_LINE_SIZE];
+            static CR_THREAD_LOCAL FriBidiStrIndex bidi_indices_map[MAX_LINE_SIZE];
             for (int i=start; i<end; i++) {
                 bidi_indices_map[i-start] = i;
             }
@@ -4661,7 +4659,6 @@ public:
                             word->width -= font->getHyphenWidth(); // TODO: strange fix - need some other solution
                         }
                         else if ( lastc=='.' || lastc==',' || lastc=='!' || lastc==':' || lastc==';' || lastc=='?') {
-                            FONT_GUARD
                             int w = font->getCharWidth(lastc);
                             TR("floating: %c w=%d", lastc, w);
                             if (frmline->width + w + wAlign + x >= maxWidth)
@@ -4672,7 +4669,6 @@ public:
                                   lastc==0x300d || lastc==0x300f ||   // 」 』 ideographic right bracket
                                   lastc==0xff01 || lastc==0xff0c ||   // ！ ， fullwidth ! and ,
                                   lastc==0xff1a || lastc==0xff1b ) {  // ： ； fullwidth : and ;
-                            FONT_GUARD
                             int w = font->getCharWidth(lastc);
                             if (frmline->width + w + wAlign + x >= maxWidth)
                                 word->width -= w;
@@ -4691,7 +4687,6 @@ public:
                             // (Chinese) add spaces between words in last line or single line
                             // (so they get visually aligned on a grid with the char on the
                             // previous justified lines)
-                            FONT_GUARD
                             int properwordcount = maxWidth/font->getSize() - 2;
                             int extraSpace = maxWidth - properwordcount*font->getSize() - wAlign;
                             int exccess = (frmline->width + x + word->width + extraSpace) - maxWidth;
@@ -4728,7 +4723,6 @@ public:
                         if ( first && font->getSize()!=0 && (maxWidth/font->getSize()-2)!=0 ) {
                             // proportionally enlarge text-indent when visualAlignment or
                             // floating punctuation is enabled
-                            FONT_GUARD
                             int cnt = ((x-wAlign/2)%font->getSize()==0) ? (x-wAlign/2)/font->getSize() : 0;
                                 // ugly way to caculate text-indent value, I can not get text-indent from here
                             int p = cnt*(cnt+1)/2;
@@ -5468,7 +5462,7 @@ public:
                     // flags on our upgraded (from lUInt8 to lUInt16) m_flags.
                     lUInt8 * flags = (lUInt8*) (m_flags + wstart);
                     // Fill static array with cumulative widths relative to word start
-                    static lUInt16 widths[MAX_WORD_SIZE];
+                    static CR_THREAD_LOCAL lUInt16 widths[MAX_WORD_SIZE];
                     int wordStart_w = wstart>0 ? m_widths[wstart-1] : 0;
                     for ( int i=0; i<len; i++ ) {
                         widths[i] = m_widths[wstart+i] - wordStart_w;
@@ -5880,10 +5874,7 @@ public:
     }
 };
 
-bool LVFormatter::m_staticBufs_inUse = false;
-#if (USE_LIBUNIBREAK==1)
-bool LVFormatter::m_libunibreak_init_done = false;
-#endif
+CR_THREAD_LOCAL bool LVFormatter::m_staticBufs_inUse = false;
 
 static void freeFrmLines( formatted_text_fragment_t * m_pbuffer )
 {
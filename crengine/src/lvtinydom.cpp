@@ -101,7 +101,7 @@ extern const int gDOMVersionCurrent = DOM_VERSION_CURRENT;
 
 /// change in case of incompatible changes in swap/cache file format to avoid using incompatible swap file
 // increment to force complete reload/reparsing of old file
-#define CACHE_FILE_FORMAT_VERSION "3.05.82k"
+#define CACHE_FILE_FORMAT_VERSION "3.05.83k"
 /// increment following value to force re-formatting of old book after load
 #define FORMATTING_VERSION_ID 0x0036
 
@@ -112,6 +112,50 @@ extern const int gDOMVersionCurrent = DOM_VERSION_CURRENT;
 #define DOC_DATA_COMPRESSION_LEVEL 1 // 0, 1, 3 (0=no compression)
 #endif
 
+#ifndef DOC_DATA_HIGH_COMPRESSION_LEVEL
+/// zlib compression level for rarely written blocks (TOC, page lists, maps...)
+#define DOC_DATA_HIGH_COMPRESSION_LEVEL 6
+#endif
+
+#ifndef DOC_DATA_ZSTD_FAST_COMPRESSION_LEVEL
+/// zstd compression level for hot rect/style storage chunks
+#define DOC_DATA_ZSTD_FAST_COMPRESSION_LEVEL 1
+#endif
+
+#ifndef DOC_DATA_ZSTD_HIGH_COMPRESSION_LEVEL
+/// zstd compression level for rarely written blocks (TOC, page lists, maps...)
+#define DOC_DATA_ZSTD_HIGH_COMPRESSION_LEVEL 9
+#endif
+
+#ifndef CACHE_FILE_PACK_DICT_SIZE
+/// max size of per block type compression dictionary (zlib window is 32K)
+#define CACHE_FILE_PACK_DICT_SIZE 0x8000
+#endif
+
+#ifndef CACHE_FILE_PACK_DICT_MIN_SIZE
+/// don't make dictionary from too small blocks
+#define CACHE_FILE_PACK_DICT_MIN_SIZE 0x1000
+#endif
+
+#ifndef CACHE_FILE_WRITER_MAX_THREADS
+/// max threads packing and writing cache file blocks (THREAD_SAFE builds)
+#define CACHE_FILE_WRITER_MAX_THREADS 4
+#endif
+
+#ifndef CACHE_FILE_WRITER_MAX_PENDING_SIZE
+/// max size of block data queued for writing before CacheFile::write() waits
+#define CACHE_FILE_WRITER_MAX_PENDING_SIZE 0x01000000 // 16M
+#endif
+
+#ifndef CACHE_FILE_MAP_READ
+/// read cache file blocks through a read-only mapping of the file, where mmap is available
+#if defined(_WIN32) || defined(_LINUX)
+#define CACHE_FILE_MAP_READ 1
+#else
+#define CACHE_FILE_MAP_READ 0
+#endif
+#endif
+
 #ifndef STREAM_AUTO_SYNC_SIZE
 #define STREAM_AUTO_SYNC_SIZE 300000
 #endif //STREAM_AUTO_SYNC_SIZE
@@ -154,6 +198,7 @@ extern const int gDOMVersionCurrent = DOM_VERSION_CURRENT;
 #define COMPRESS_TOC_DATA           true
 #define COMPRESS_PAGEMAP_DATA       true
 #define COMPRESS_STYLE_DATA         true
+#define COMPRESS_TEXT_SEARCH_INDEX  true
 
 //#define CACHE_FILE_SECTOR_SIZE 4096
 #define CACHE_FILE_SECTOR_SIZE 1024
@@ -221,7 +266,17 @@ enum CacheFileBlockType {
     CBT_STYLE_DATA,
     CBT_BLOB_INDEX, //16
     CBT_BLOB_DATA,
-    CBT_FONT_DATA  //18
+    CBT_FONT_DATA, //18
+    CBT_PACK_DICT, // compression dictionary, data index is block type it is used for
+    CBT_TEXT_SEARCH_INDEX, //20
+    CBT_LAYOUT_PROFILES, // index of layout profiles
+    CBT_LAYOUT_PROFILE // layout profile, data index is its slot
+};
+
+/// block compression methods, stored in CacheFileItem::_packMethod
+enum CacheFileBlockPackMethod {
+    CBP_DEFAULT = 0,   // compressed alone (or not compressed, if _uncompressedSize==0)
+    CBP_DICT = 1       // compressed with CBT_PACK_DICT dictionary of its block type
 };
 
 
@@ -235,6 +290,10 @@ enum CacheFileBlockType {
 #include "../include/chmfmt.h"
 #endif
 #include "../include/crtest.h"
+#include "../include/lvthread.h"
+#if (CR_THREAD_SAFE==1)
+#include <thread>
+#endif
 #include <stddef.h>
 #include <math.h>
 #if (USE_ZSTD == 1)
@@ -269,6 +328,16 @@ void compressCachedData(bool enable) {
 	_compressCachedData = enable;
 }
 
+// default is to use a CRC32 of the whole file (slow with big files, but
+// keeps existing cache files and DOC_PROP_FILE_CRC32 valid)
+static bool _useFileFingerprintAsCacheKey = false;
+void useFileFingerprintAsCacheKey(bool enable) {
+	_useFileFingerprintAsCacheKey = enable;
+}
+bool isFileFingerprintUsedAsCacheKey() {
+	return _useFileFingerprintAsCacheKey;
+}
+
 // default is to use the TEXT_CACHE_UNPACKED_SPACE & co defined above as is
 static float _storageMaxUncompressedSizeFactor = 1;
 void setStorageMaxUncompressedSizeFactor(float factor) {
@@ -282,10 +351,12 @@ void enableCacheFileContentsValidation(bool enable) {
 
 static int _nextDocumentIndex = 0;
 ldomDocument * ldomNode::_documentInstances[MAX_DOCUMENT_INSTANCE_COUNT] = {NULL,};
+static LVMutex _documentInstancesMutex; // documents may be created and deleted by different threads
 
 /// adds document to list, returns ID of allocated document, -1 if no space in instance array
 int ldomNode::registerDocument( ldomDocument * doc )
 {
+    LVLock lock( _documentInstancesMutex );
     for ( int i=0; i<MAX_DOCUMENT_INSTANCE_COUNT; i++ ) {
         if ( _nextDocumentIndex<0 || _nextDocumentIndex>=MAX_DOCUMENT_INSTANCE_COUNT )
             _nextDocumentIndex = 0;
@@ -302,6 +373,7 @@ int ldomNode::registerDocument( ldomDocument * doc )
 /// removes document from list
 void ldomNode::unregisterDocument( ldomDocument * doc )
 {
+    LVLock lock( _documentInstancesMutex );
     for ( int i=0; i<MAX_DOCUMENT_INSTANCE_COUNT; i++ ) {
         if ( _documentInstances[i]==doc ) {
             CRLog::info("ldomNode::unregisterDocument() - for index %d", i);
@@ -487,9 +559,9 @@ struct CacheFileItem
     lUInt64 _dataHash; // additional hash of data
     lUInt64 _packedHash; // additional hash of packed data
     lUInt32 _uncompressedSize;   // size of uncompressed block, if compression is applied, 0 if no compression
-    lUInt32 _padding;  // explicite padding (this struct would be implicitely padded from 44 bytes to 48 bytes)
-                       // so we can set this padding value to 0 (instead of some random data with implicite padding)
-                       // in order to get reproducible (same file checksum) cache files when this gets serialized
+    lUInt32 _packMethod; // compression method (CacheFileBlockPackMethod), also serves as explicit padding
+                         // (this struct would be implicitely padded from 44 bytes to 48 bytes), so that we get
+                         // reproducible (same file checksum) cache files when this gets serialized
     bool validate( int fsize )
     {
         if ( _magic!=CACHE_FILE_ITEM_MAGIC ) {
@@ -516,7 +588,7 @@ struct CacheFileItem
     , _dataHash(0)          // hash of data
     , _packedHash(0) // additional hash of packed data
     , _uncompressedSize(0)  // size of uncompressed block, if compression is applied, 0 if no compression
-    , _padding(0)           // (padding)
+    , _packMethod(CBP_DEFAULT) // compression method
     {
     }
 };
@@ -588,8 +660,180 @@ typedef struct {
 } zstd_decomp_ress_t;
 #endif
 
+/// compression dictionary of a block type
+struct CacheFilePackDict {
+    lUInt8 * data;
+    int size;
+    bool loaded; // already looked up in file
+    CacheFilePackDict() : data(NULL), size(0), loaded(false) { }
+    ~CacheFilePackDict() { if ( data ) free( data ); }
+};
+
+/// returns compression level to use for block type, and whether it benefits from a dictionary
+static int getBlockPackLevel( lUInt16 type, bool & useDict )
+{
+    switch ( type ) {
+    case CBT_TEXT_DATA:
+    case CBT_ELEM_DATA:
+    case CBT_ELEM_NODE:
+    case CBT_TEXT_NODE:
+        // small storage chunks, sharing a lot of structure with each other
+        useDict = true;
+#if (USE_ZSTD == 1)
+        return ZSTD_CLEVEL_DEFAULT;
+#else
+        return DOC_DATA_COMPRESSION_LEVEL;
+#endif
+    case CBT_LAYOUT_PROFILE:
+        // large, written each time we leave a layout: favor speed
+        useDict = false;
+#if (USE_ZSTD == 1)
+        return DOC_DATA_ZSTD_FAST_COMPRESSION_LEVEL;
+#else
+        return DOC_DATA_COMPRESSION_LEVEL;
+#endif
+    case CBT_RECT_DATA:
+    case CBT_ELEM_STYLE_DATA:
+        // hot chunks, unpacked again and again while rendering and drawing: favor speed
+        useDict = true;
+#if (USE_ZSTD == 1)
+        return DOC_DATA_ZSTD_FAST_COMPRESSION_LEVEL;
+#else
+        return DOC_DATA_COMPRESSION_LEVEL;
+#endif
+    default:
+        // written once per rendering, read once on loading: favor size
+        useDict = false;
+#if (USE_ZSTD == 1)
+        return DOC_DATA_ZSTD_HIGH_COMPRESSION_LEVEL;
+#else
+        return DOC_DATA_HIGH_COMPRESSION_LEVEL;
+#endif
+    }
+}
+
+// Read-only stream over a block of the mapped cache file: it keeps the
+// file mapped, and each stream has its own position
+class CacheFileBlockStream : public LVNamedStream
+{
+    LVStreamBufferRef _buf;
+    const lUInt8 * _data;
+    lvsize_t _size;
+    lvpos_t _pos;
+public:
+    CacheFileBlockStream( LVStreamBufferRef buf )
+        : _buf(buf), _data(buf->getReadOnly()), _size(buf->getSize()), _pos(0)
+    {
+        m_mode = LVOM_READ;
+    }
+    virtual bool Eof()
+    {
+        return _pos >= _size;
+    }
+    virtual lvsize_t GetSize()
+    {
+        return _size;
+    }
+    virtual lverror_t Seek( lvoffset_t offset, lvseek_origin_t origin, lvpos_t * newPos )
+    {
+        lvpos_t npos;
+        switch ( origin ) {
+        case LVSEEK_SET:
+            npos = offset;
+            break;
+        case LVSEEK_CUR:
+            npos = _pos + offset;
+            break;
+        case LVSEEK_END:
+            npos = _size + offset;
+            break;
+        default:
+            return LVERR_FAIL;
+        }
+        if ( npos > _size )
+            return LVERR_FAIL;
+        _pos = npos;
+        if ( newPos )
+            *newPos = npos;
+        return LVERR_OK;
+    }
+    virtual lverror_t Read( void * buf, lvsize_t count, lvsize_t * nBytesRead )
+    {
+        if ( count > _size - _pos )
+            count = _size - _pos;
+        memcpy( buf, _data + _pos, count );
+        _pos += count;
+        if ( nBytesRead )
+            *nBytesRead = count;
+        return LVERR_OK;
+    }
+    virtual lverror_t Write( const void *, lvsize_t, lvsize_t * )
+    {
+        return LVERR_NOTIMPL;
+    }
+    virtual lverror_t SetSize( lvsize_t )
+    {
+        return LVERR_NOTIMPL;
+    }
+};
+
 class CacheFile
 {
+#if (CR_THREAD_SAFE==1)
+    // Blocks given to write() are copied to a queue, and packed and written
+    // by writer threads, so that the document thread does not wait for
+    // compression and disk writes. Blocks still queued are read from the
+    // queue. A flush request is queued too: the index is written and the
+    // dirty flag cleared once all the blocks queued before it are written.
+    class Writer : public LVThread {
+        CacheFile * _file;
+    public:
+        Writer( CacheFile * file ) : _file(file) { }
+        virtual void run() { _file->runWriter(); }
+    };
+    enum WriteJobState { WRITE_JOB_QUEUED, WRITE_JOB_PACKING };
+    struct WriteJob {
+        lUInt16 type;
+        lUInt16 index;
+        lUInt8 * data; // copy of block data
+        int size;
+        lUInt32 hash;
+        int level; // compression level, -1 to write it unpacked
+        const CacheFilePackDict * dict;
+        bool flushIndex; // flush request, with no block
+        WriteJobState state;
+        bool cancelled; // removed or rewritten while being packed
+        WriteJob() : type(0), index(0), data(NULL), size(0), hash(0), level(-1), dict(NULL),
+            flushIndex(false), state(WRITE_JOB_QUEUED), cancelled(false) { }
+        ~WriteJob() { if ( data ) free( data ); }
+        void setData( const lUInt8 * buf, int sz, lUInt32 h ) {
+            data = cr_realloc( data, sz > 0 ? sz : 1 );
+            memcpy( data, buf, sz );
+            size = sz;
+            hash = h;
+        }
+    };
+    LVCondition _writeCond; // signaled when a job is queued or done
+    LVPtrVector<WriteJob> _writeQueue; // in write() call order
+    LVPtrVector<Writer> _writers; // started on first write()
+    int _writeQueueSize; // total size of queued block data
+    bool _writersStopped;
+    bool _writeError; // a queued block could not be written
+    // queues block for writing
+    bool queueBlock( lUInt16 type, lUInt16 index, const lUInt8 * buf, int size, bool compress );
+    // returns last queued version of block, NULL if none
+    WriteJob * findWriteJob( lUInt16 type, lUInt16 index );
+    // returns next job a writer can do, NULL if none
+    WriteJob * getWriteJob();
+    // drops queued versions of block
+    void cancelWriteJobs( lUInt16 type, lUInt16 index );
+    void startWriters();
+    void stopWriters();
+    void runWriter();
+    // waits (with mutex locked once) for queued jobs to be done
+    ContinuousOperationResult waitWriteQueue( CRTimerUtil & maxTime );
+#endif
+    LVMutex _mutex; // file, index and write queue
     int _sectorSize; // block position and size granularity
     int _size;
     bool _indexChanged;
@@ -600,16 +844,48 @@ class CacheFile
     LVPtrVector<CacheFileItem, true> _index; // full file block index
     LVPtrVector<CacheFileItem, false> _freeIndex; // free file block index
     LVHashTable<lUInt32, CacheFileItem*> _map; // hash map for fast search
+    // Blocks are read from a read-only mapping of the file when possible:
+    // no read copy, compressed ones are unpacked straight from it. Blocks
+    // written since the last flush may still be in the write cache of
+    // _stream, and are read from it.
+    enum {
+        BLOCK_VERIFIED = 1, // CRCs checked on read, since last written
+        BLOCK_WRITTEN = 2   // written since last flush, not to be read from mapping
+    };
+    LVHashTable<lUInt32, lUInt8> _blockState; // BLOCK_* flags, same keys as _map
+    LVStreamRef _mapStream; // read-only mapping of file
+    LVStreamBufferRef _mapBuffer; // whole mapped file
+    const lUInt8 * _mapData;
+    int _mapSize;
+    bool _mapFailed; // don't retry until next flush
+    // maps file for reading, returns false if not possible
+    bool mapFile();
+    // returns block data in mapped file, NULL if not mapped
+    const lUInt8 * getMappedData( CacheFileItem * block );
+    // blocks written before are in file now, and can be read from mapping
+    void setBlocksFlushed();
+    // checks block CRCs on first read
+    bool needVerify( CacheFileItem * block );
+    void setVerified( CacheFileItem * block );
 #if (USE_ZSTD == 1)
     zstd_comp_ress_t* _comp_ress;
     zstd_decomp_ress_t* _decomp_ress;
 #endif
+    CacheFilePackDict _packDicts[CBT_PACK_DICT]; // compression dictionaries by block type
     // searches for existing block
     CacheFileItem * findBlock( lUInt16 type, lUInt16 index );
     // alocates block at index, reuses existing one, if possible
     CacheFileItem * allocBlock( lUInt16 type, lUInt16 index, int size );
     // mark block as free, for later reusing
     void freeBlock( CacheFileItem * block );
+    // packs (if requested) and writes block to file, if changed
+    bool writeBlock( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int size, bool compress );
+    // writes block data, packed if uncompressedSize is not 0, to file
+    bool storeBlock( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int size, lUInt32 hash, lUInt32 uncompressedSize, lUInt32 packMethod );
+    // reads and allocates block in memory from file
+    bool readBlock( lUInt16 type, lUInt16 dataIndex, lUInt8 * &buf, int &size );
+    // writes header with dirty flag value, returns true if value is changed
+    bool writeDirtyFlag( bool dirty );
     // writes file header
     bool updateHeader();
     // writes index block
@@ -618,9 +894,14 @@ class CacheFile
     bool readIndex();
     // reads all blocks of index and checks CRCs
     bool validateContents();
+    // returns compression dictionary for block type: loads it from file, or makes it
+    // from seed (first compressed block of this type) if there's none yet
+    CacheFilePackDict * getPackDict( lUInt16 type, const lUInt8 * seed, int seedSize );
 public:
     // return current file size
-    int getSize() { return _size; }
+    int getSize() { LVLock lock(_mutex); return _size; }
+    // returns index entry of block, NULL if not found (for stats)
+    const CacheFileItem * getBlockInfo( lUInt16 type, lUInt16 index ) { LVLock lock(_mutex); return findBlock( type, index ); }
     // create uninitialized cache file, call open or create to initialize
     CacheFile(lUInt32 domVersion);
     // free resources
@@ -655,6 +936,12 @@ public:
     }
     /// reads block as a stream
     LVStreamRef readStream(lUInt16 type, lUInt16 index);
+    /// returns true if block exists
+    bool hasBlock( lUInt16 type, lUInt16 index );
+    /// removes block, its space will be reused
+    void remove( lUInt16 type, lUInt16 index );
+    /// waits for blocks queued by write() to be written to file
+    ContinuousOperationResult waitWrites( CRTimerUtil & maxTime );
 
 #if (USE_ZSTD == 1)
     bool allocCompRess(void);
@@ -662,10 +949,10 @@ public:
     bool allocDecompRess(void);
     bool freeDecompRess(void);
 #endif
-    /// pack data from buf to dstbuf
-    bool ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize );
-    /// unpack data from compbuf to dstbuf
-    bool ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &dstbuf, lUInt32 & dstsize );
+    /// pack data from buf to dstbuf, using dictionary if not NULL
+    bool ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize, int level, const CacheFilePackDict * dict );
+    /// unpack data from compbuf to dstbuf, using dictionary if not NULL
+    bool ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &dstbuf, lUInt32 & dstsize, const CacheFilePackDict * dict );
 
     /// sets dirty flag value, returns true if value is changed
     bool setDirtyFlag( bool dirty );
@@ -678,6 +965,7 @@ public:
         return (n + (_sectorSize-1)) & ~(_sectorSize-1);
     }
     void setAutoSyncSize(int sz) {
+        LVLock lock(_mutex);
         _stream->setAutoSyncSize(sz);
     }
     void setCachePath(const lString32 cachePath) {
@@ -691,7 +979,12 @@ public:
 
 // create uninitialized cache file, call open or create to initialize
 CacheFile::CacheFile(lUInt32 domVersion)
-: _sectorSize( CACHE_FILE_SECTOR_SIZE ), _size(0), _indexChanged(false), _dirty(true), _domVersion(domVersion), _cachePath(lString32::empty_str), _map(1024)
+:
+#if (CR_THREAD_SAFE==1)
+  _writeQueueSize(0), _writersStopped(false), _writeError(false),
+#endif
+  _sectorSize( CACHE_FILE_SECTOR_SIZE ), _size(0), _indexChanged(false), _dirty(true), _domVersion(domVersion), _cachePath(lString32::empty_str), _map(1024)
+  , _blockState(1024), _mapData(NULL), _mapSize(0), _mapFailed(false)
 #if (USE_ZSTD == 1)
     , _comp_ress(nullptr), _decomp_ress(nullptr)
 #endif
@@ -701,6 +994,10 @@ CacheFile::CacheFile(lUInt32 domVersion)
 // free resources
 CacheFile::~CacheFile()
 {
+#if (CR_THREAD_SAFE==1)
+    // queued blocks are written before writers exit
+    stopWriters();
+#endif
     if ( !_stream.isNull() ) {
         // don't flush -- leave file dirty
         //CRTimerUtil infinite;
@@ -714,6 +1011,18 @@ CacheFile::~CacheFile()
 
 /// sets dirty flag value, returns true if value is changed
 bool CacheFile::setDirtyFlag( bool dirty )
+{
+    LVLock lock(_mutex);
+#if (CR_THREAD_SAFE==1)
+    // a queued flush would clear it
+    CRTimerUtil infinite;
+    waitWriteQueue( infinite );
+#endif
+    return writeDirtyFlag( dirty );
+}
+
+// writes header with dirty flag value, returns true if value is changed
+bool CacheFile::writeDirtyFlag( bool dirty )
 {
     if ( _dirty==dirty )
         return false;
@@ -736,6 +1045,11 @@ bool CacheFile::setDirtyFlag( bool dirty )
 }
 
 bool CacheFile::setDOMVersion( lUInt32 domVersion ) {
+    LVLock lock(_mutex);
+#if (CR_THREAD_SAFE==1)
+    CRTimerUtil infinite;
+    waitWriteQueue( infinite );
+#endif
     if ( _domVersion == domVersion )
         return false;
     CRLog::info("CacheFile::setting DOM version value");
@@ -754,16 +1068,32 @@ bool CacheFile::setDOMVersion( lUInt32 domVersion ) {
 // flushes index
 bool CacheFile::flush( bool clearDirtyFlag, CRTimerUtil & maxTime )
 {
+    LVLock lock(_mutex);
+#if (CR_THREAD_SAFE==1)
+    // Writers write the index once the blocks queued before are written:
+    // errors writing them are reported by next calls, or by waitWrites()
+    CR_UNUSED(maxTime);
+    if ( clearDirtyFlag && ( _writeQueue.length() || _indexChanged || _dirty ) ) {
+        WriteJob * job = new WriteJob();
+        job->flushIndex = true;
+        _writeQueue.add( job );
+        startWriters();
+        _writeCond.notifyAll();
+    }
+    return !_writeError;
+#else
     if ( clearDirtyFlag ) {
         //setDirtyFlag(true);
         if ( !writeIndex() )
             return false;
-        setDirtyFlag(false);
+        writeDirtyFlag(false);
+        setBlocksFlushed();
     } else {
         _stream->Flush(false, maxTime);
         //CRLog::trace("CacheFile->flush() took %d ms ", (int)timer.elapsed());
     }
     return true;
+#endif
 }
 
 // reads all blocks of index and checks CRCs
@@ -883,7 +1213,7 @@ bool CacheFile::writeIndex()
             index[i]._dataSize = 0;
         }
     }
-    bool res = write(CBT_INDEX, 0, (const lUInt8*)index, sz, false);
+    bool res = writeBlock(CBT_INDEX, 0, (const lUInt8*)index, sz, false);
     delete[] index;
 
     indexItem = findBlock(CBT_INDEX, 0);
@@ -917,16 +1247,64 @@ void CacheFile::freeBlock( CacheFileItem * block )
 {
     lUInt32 key = ((lUInt32)block->_dataType)<<16 | block->_dataIndex;
     _map.remove(key);
+    _blockState.remove(key);
     block->_dataIndex = 0;
     block->_dataType = 0;
     block->_dataSize = 0;
     _freeIndex.add( block );
 }
 
+/// removes block, its space will be reused
+void CacheFile::remove( lUInt16 type, lUInt16 index )
+{
+    LVLock lock(_mutex);
+#if (CR_THREAD_SAFE==1)
+    cancelWriteJobs( type, index );
+#endif
+    CacheFileItem * block = findBlock( type, index );
+    if ( block ) {
+        freeBlock( block );
+        _indexChanged = true;
+    }
+}
+
 /// reads block as a stream
 LVStreamRef CacheFile::readStream(lUInt16 type, lUInt16 index)
 {
+    LVLock lock(_mutex);
     CacheFileItem * block = findBlock(type, index);
+#if (CR_THREAD_SAFE==1)
+    if ( findWriteJob( type, index ) )
+        block = NULL; // not yet written
+#endif
+    if ( block && block->_dataSize && !block->_uncompressedSize && getMappedData( block ) ) {
+        // view of the mapped file, which it keeps mapped
+        LVStreamBufferRef buf = _mapStream->GetReadBuffer( block->_blockFilePos, block->_dataSize );
+        if ( !buf.isNull() ) {
+            if ( needVerify( block ) ) {
+                if ( calcHash( buf->getReadOnly(), block->_dataSize ) != block->_dataHash ) {
+                    CRLog::error("CacheFile::readStream: CRC doesn't match for block %d:%d of size %d", type, index, (int)block->_dataSize);
+                    return LVStreamRef();
+                }
+                setVerified( block );
+            }
+            return LVStreamRef( new CacheFileBlockStream( buf ) );
+        }
+    }
+#if (CR_THREAD_SAFE==1)
+    // Writers move the file position: a fragment of the file stream
+    // could not be read later without the lock
+    lUInt8 * buf = NULL;
+    int size = 0;
+    if ( read(type, index, buf, size) ) {
+        LVStreamRef stream;
+        if ( size )
+            stream = LVCreateMemoryStream(buf, size, true);
+        free(buf);
+        return stream;
+    }
+    return LVStreamRef();
+#else
     if (block && block->_dataSize) {
 #if 0
         lUInt8 * buf = NULL;
@@ -938,6 +1316,18 @@ LVStreamRef CacheFile::readStream(lUInt16 type, lUInt16 index)
 #endif
     }
     return LVStreamRef();
+#endif
+}
+
+/// returns true if block exists
+bool CacheFile::hasBlock( lUInt16 type, lUInt16 index )
+{
+    LVLock lock(_mutex);
+#if (CR_THREAD_SAFE==1)
+    if ( findWriteJob( type, index ) )
+        return true;
+#endif
+    return findBlock( type, index ) != NULL;
 }
 
 // searches for existing block
@@ -1033,6 +1423,92 @@ bool CacheFile::validate( CacheFileItem * block )
 
 // reads and allocates block in memory
 bool CacheFile::read( lUInt16 type, lUInt16 dataIndex, lUInt8 * &buf, int &size )
+{
+    LVLock lock(_mutex);
+#if (CR_THREAD_SAFE==1)
+    WriteJob * job = findWriteJob( type, dataIndex );
+    if ( job ) {
+        // not yet written: its data is what would be read
+        size = job->size;
+        buf = (lUInt8 *)malloc( size > 0 ? size : 1 );
+        memcpy( buf, job->data, size );
+        return true;
+    }
+#endif
+    return readBlock( type, dataIndex, buf, size );
+}
+
+// maps file for reading, returns false if not possible
+bool CacheFile::mapFile()
+{
+    _mapBuffer.Clear();
+    _mapStream.Clear();
+    _mapData = NULL;
+    _mapSize = 0;
+#if (CACHE_FILE_MAP_READ==1)
+    if ( _cachePath.empty() )
+        return false;
+    LVStreamRef stream = LVMapFileStream( _cachePath.c_str(), LVOM_READ, 0 );
+    if ( stream.isNull() )
+        return false;
+    lvsize_t size = stream->GetSize();
+    LVStreamBufferRef buf = stream->GetReadBuffer( 0, size );
+    if ( buf.isNull() || !buf->getReadOnly() )
+        return false;
+    _mapStream = stream;
+    _mapBuffer = buf;
+    _mapData = buf->getReadOnly();
+    _mapSize = (int)size;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// returns block data in mapped file, NULL if not mapped
+const lUInt8 * CacheFile::getMappedData( CacheFileItem * block )
+{
+    lUInt32 key = ((lUInt32)block->_dataType)<<16 | block->_dataIndex;
+    if ( _blockState.get( key ) & BLOCK_WRITTEN )
+        return NULL;
+    if ( block->_blockFilePos + block->_dataSize > _mapSize ) {
+        // not mapped yet, or file has grown since
+        if ( _mapFailed )
+            return NULL;
+        if ( !mapFile() ) {
+            _mapFailed = true;
+            return NULL;
+        }
+        if ( block->_blockFilePos + block->_dataSize > _mapSize )
+            return NULL;
+    }
+    return _mapData + block->_blockFilePos;
+}
+
+// blocks written before are in file now, and can be read from mapping
+void CacheFile::setBlocksFlushed()
+{
+    LVHashTable<lUInt32, lUInt8>::pair * pair;
+    for ( LVHashTable<lUInt32, lUInt8>::iterator p = _blockState.forwardIterator(); (pair=p.next())!=NULL; )
+        pair->value &= ~BLOCK_WRITTEN;
+    _mapFailed = false;
+}
+
+// checks block CRCs on first read
+bool CacheFile::needVerify( CacheFileItem * block )
+{
+    lUInt32 key = ((lUInt32)block->_dataType)<<16 | block->_dataIndex;
+    return !(_blockState.get( key ) & BLOCK_VERIFIED);
+}
+
+void CacheFile::setVerified( CacheFileItem * block )
+{
+    lUInt32 key = ((lUInt32)block->_dataType)<<16 | block->_dataIndex;
+    _blockState.set( key, _blockState.get( key ) | BLOCK_VERIFIED );
+}
+
+// reads and allocates block in memory from file
+bool CacheFile::readBlock( lUInt16 type, lUInt16 dataIndex, lUInt8 * &buf, int &size )
 {
     buf = NULL;
     size = 0;
@@ -1041,33 +1517,53 @@ bool CacheFile::read( lUInt16 type, lUInt16 dataIndex, lUInt8 * &buf, int &size
         CRLog::error("CacheFile::read: Block %d:%d not found in file", type, dataIndex);
         return false;
     }
-    if ( (int)_stream->SetPos( block->_blockFilePos )!=block->_blockFilePos )
-        return false;
+    bool verify = needVerify( block );
+    bool compress = block->_uncompressedSize!=0;
 
-    // read block from file
+    // block data, in mapped file or read from file
     size = block->_dataSize;
-    buf = (lUInt8 *)malloc(size);
-    lvsize_t bytesRead = 0;
-    _stream->Read(buf, size, &bytesRead );
-    if ( (int)bytesRead!=size ) {
-        CRLog::error("CacheFile::read: Cannot read block %d:%d of size %d, bytesRead=%d", type, dataIndex, (int)size, (int)bytesRead);
-        free(buf);
-        buf = NULL;
-        size = 0;
-        return false;
+    lUInt8 * filebuf = NULL;
+    const lUInt8 * data = getMappedData( block );
+    if ( data && !compress ) {
+        // caller owns (and may modify) the returned buffer: one copy is needed
+        buf = (lUInt8 *)malloc(size);
+        memcpy( buf, data, size );
+    } else if ( !data ) {
+        if ( (int)_stream->SetPos( block->_blockFilePos )!=block->_blockFilePos ) {
+            size = 0;
+            return false;
+        }
+        filebuf = (lUInt8 *)malloc(size);
+        lvsize_t bytesRead = 0;
+        _stream->Read(filebuf, size, &bytesRead );
+        if ( (int)bytesRead!=size ) {
+            CRLog::error("CacheFile::read: Cannot read block %d:%d of size %d, bytesRead=%d", type, dataIndex, (int)size, (int)bytesRead);
+            free(filebuf);
+            size = 0;
+            return false;
+        }
+        data = filebuf;
+        if ( !compress )
+            buf = filebuf;
     }
 
-    bool compress = block->_uncompressedSize!=0;
-
     if ( compress ) {
         // block is compressed
 
         // check crc separately only for compressed data
-        lUInt32 packedhash = calcHash( buf, size );
-        if ( packedhash!=block->_packedHash ) {
+        if ( verify && calcHash( data, size )!=block->_packedHash ) {
             CRLog::error("CacheFile::read: packed data CRC doesn't match for block %d:%d of size %d", type, dataIndex, (int)size);
-            free(buf);
-            buf = NULL;
+            free(filebuf);
+            size = 0;
+            return false;
+        }
+
+        CacheFilePackDict * dict = NULL;
+        if ( block->_packMethod==CBP_DICT )
+            dict = getPackDict( type, NULL, 0 );
+        if ( block->_packMethod!=CBP_DEFAULT && !dict ) {
+            CRLog::error("CacheFile::read: no dictionary to uncompress block %d:%d (method %d)", type, dataIndex, (int)block->_packMethod);
+            free(filebuf);
             size = 0;
             return false;
         }
@@ -1075,27 +1571,30 @@ bool CacheFile::read( lUInt16 type, lUInt16 dataIndex, lUInt8 * &buf, int &size
         // uncompress block data
         lUInt8 * uncomp_buf = NULL;
         lUInt32 uncomp_size = 0;
-        if ( ldomUnpack(buf, size, uncomp_buf, uncomp_size) && uncomp_size==block->_uncompressedSize ) {
-            free( buf );
-            buf = uncomp_buf;
-            size = uncomp_size;
-        } else {
+        bool res = ldomUnpack(data, size, uncomp_buf, uncomp_size, dict) && uncomp_size==block->_uncompressedSize;
+        free(filebuf);
+        if ( !res ) {
             CRLog::error("CacheFile::read: error while uncompressing data for block %d:%d of size %d", type, dataIndex, (int)size);
-            free(buf);
-            buf = NULL;
+            if ( uncomp_buf )
+                free(uncomp_buf);
             size = 0;
             return false;
         }
+        buf = uncomp_buf;
+        size = uncomp_size;
     }
 
-    // check CRC
-    lUInt32 hash = calcHash( buf, size );
-    if (hash != block->_dataHash) {
-        CRLog::error("CacheFile::read: CRC doesn't match for block %d:%d of size %d", type, dataIndex, (int)size);
-        free(buf);
-        buf = NULL;
-        size = 0;
-        return false;
+    if ( verify ) {
+        // check CRC
+        lUInt32 hash = calcHash( buf, size );
+        if (hash != block->_dataHash) {
+            CRLog::error("CacheFile::read: CRC doesn't match for block %d:%d of size %d", type, dataIndex, (int)size);
+            free(buf);
+            buf = NULL;
+            size = 0;
+            return false;
+        }
+        setVerified( block );
     }
     // Success. Don't forget to free allocated block externally
     return true;
@@ -1103,6 +1602,20 @@ bool CacheFile::read( lUInt16 type, lUInt16 dataIndex, lUInt8 * &buf, int &size
 
 // writes block to file
 bool CacheFile::write( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int size, bool compress )
+{
+    LVLock lock(_mutex);
+#if (CR_THREAD_SAFE==1)
+    // Don't let the document get too far ahead of the writers
+    while ( _writeQueueSize > CACHE_FILE_WRITER_MAX_PENDING_SIZE && !_writeError )
+        _writeCond.wait(_mutex);
+    return queueBlock( type, dataIndex, buf, size, compress );
+#else
+    return writeBlock( type, dataIndex, buf, size, compress );
+#endif
+}
+
+// packs (if requested) and writes block to file, if changed
+bool CacheFile::writeBlock( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int size, bool compress )
 {
     // check whether data is changed
     lUInt32 newhash = calcHash( buf, size );
@@ -1120,28 +1633,40 @@ bool CacheFile::write( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int
         CRLog::trace("*    oldsz=%d oldhash=%08x", (int)existingblock->_uncompressedSize, (int)existingblock->_dataHash);
     CRLog::trace("* wr block t=%d[%d] sz=%d hash=%08x", type, dataIndex, size, newhash);
 #endif
-    setDirtyFlag(true);
 
     lUInt32 uncompressedSize = 0;
-    lUInt64 newpackedhash = newhash;
+    lUInt32 packMethod = CBP_DEFAULT;
+    lUInt8 * packed = NULL;
     if (!_compressCachedData)
         compress = false;
     if ( compress ) {
-        lUInt8 * dstbuf = NULL;
+        bool useDict = false;
+        int level = getBlockPackLevel( type, useDict );
+        CacheFilePackDict * dict = useDict ? getPackDict( type, buf, size ) : NULL;
         lUInt32 dstsize = 0;
-        if ( !ldomPack( buf, size, dstbuf, dstsize ) ) {
-            compress = false;
-        } else {
+        if ( ldomPack( buf, size, packed, dstsize, level, dict ) ) {
+            packMethod = dict ? CBP_DICT : CBP_DEFAULT;
             uncompressedSize = size;
             size = dstsize;
-            buf = dstbuf;
-            newpackedhash = calcHash( buf, size );
+            buf = packed;
 #if DEBUG_DOM_STORAGE==1
             //CRLog::trace("packed block %d:%d : %d to %d bytes (%d%%)", type, dataIndex, srcsize, dstsize, srcsize>0?(100*dstsize/srcsize):0 );
 #endif
         }
     }
+    bool res = storeBlock( type, dataIndex, buf, size, newhash, uncompressedSize, packMethod );
+    if ( packed )
+        free( packed );
+    return res;
+}
 
+// writes block data, packed if uncompressedSize is not 0, to file
+bool CacheFile::storeBlock( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int size, lUInt32 hash, lUInt32 uncompressedSize, lUInt32 packMethod )
+{
+    writeDirtyFlag(true);
+
+    lUInt64 newpackedhash = uncompressedSize ? calcHash( buf, size ) : hash;
+    CacheFileItem * existingblock = findBlock( type, dataIndex );
     CacheFileItem * block = NULL;
     if ( existingblock && existingblock->_dataSize>=size ) {
         // reuse existing block
@@ -1153,37 +1678,17 @@ bool CacheFile::write( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int
         block = allocBlock( type, dataIndex, size );
     }
     if ( !block )
-    {
-#if DOC_DATA_COMPRESSION_LEVEL!=0
-        if ( compress ) {
-            free( (void*)buf );
-        }
-#endif
         return false;
-    }
+    _blockState.set( ((lUInt32)type)<<16 | dataIndex, BLOCK_WRITTEN );
     if ( (int)_stream->SetPos( block->_blockFilePos )!=block->_blockFilePos )
-    {
-#if DOC_DATA_COMPRESSION_LEVEL!=0
-        if ( compress ) {
-            free( (void*)buf );
-        }
-#endif
         return false;
-    }
     // assert: size == block->_dataSize
     // actual writing of data
     block->_dataSize = size;
     lvsize_t bytesWritten = 0;
     _stream->Write(buf, size, &bytesWritten );
     if ( (int)bytesWritten!=size )
-    {
-#if DOC_DATA_COMPRESSION_LEVEL!=0
-        if ( compress ) {
-            free( (void*)buf );
-        }
-#endif
         return false;
-    }
 #if CACHE_FILE_WRITE_BLOCK_PADDING==1
     int paddingSize = block->_blockSize - size; //roundSector( size ) - size
     if ( paddingSize ) {
@@ -1205,13 +1710,11 @@ bool CacheFile::write( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int
 #endif
     //_stream->Flush(true);
     // update CRC
-    block->_dataHash = newhash;
+    block->_dataHash = hash;
     block->_packedHash = newpackedhash;
     block->_uncompressedSize = uncompressedSize;
+    block->_packMethod = packMethod;
 
-    if ( compress ) {
-        free( (void*)buf );
-    }
     _indexChanged = true;
 
     //CRLog::error("CacheFile::write: block %d:%d (pos %ds, size %ds) is written (crc=%08x)", type, dataIndex, (int)block->_blockFilePos/_sectorSize, (int)(size+_sectorSize-1)/_sectorSize, block->_dataCRC);
@@ -1219,6 +1722,37 @@ bool CacheFile::write( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int
     return true;
 }
 
+// returns compression dictionary for block type
+CacheFilePackDict * CacheFile::getPackDict( lUInt16 type, const lUInt8 * seed, int seedSize )
+{
+    if ( type >= CBT_PACK_DICT )
+        return NULL;
+    CacheFilePackDict * dict = &_packDicts[type];
+    if ( !dict->loaded ) {
+        dict->loaded = true;
+        if ( findBlock( CBT_PACK_DICT, type ) ) {
+            if ( !readBlock( CBT_PACK_DICT, type, dict->data, dict->size ) ) {
+                // keep it: blocks packed with it will fail to read, others are fine
+                CRLog::error("CacheFile::getPackDict: cannot read dictionary for block type %d", type);
+                return NULL;
+            }
+        }
+    }
+    if ( !dict->data && !findBlock( CBT_PACK_DICT, type ) && seed && seedSize >= CACHE_FILE_PACK_DICT_MIN_SIZE ) {
+        // The first block of a type is a good dictionary for the next ones, as
+        // they share the same structures (and, for text, the same vocabulary).
+        // Take its tail, which is what zlib references most cheaply.
+        // This block is never rewritten, as the blocks packed with it need it.
+        int sz = seedSize < CACHE_FILE_PACK_DICT_SIZE ? seedSize : CACHE_FILE_PACK_DICT_SIZE;
+        if ( !writeBlock( CBT_PACK_DICT, type, seed + seedSize - sz, sz, true ) )
+            return NULL;
+        dict->data = (lUInt8 *)malloc( sz );
+        memcpy( dict->data, seed + seedSize - sz, sz );
+        dict->size = sz;
+    }
+    return dict->data ? dict : NULL;
+}
+
 /// writes content of serial buffer
 bool CacheFile::write( lUInt16 type, lUInt16 index, SerialBuf & buf, bool compress )
 {
@@ -1263,6 +1797,8 @@ bool CacheFile::open( LVStreamRef stream )
         printf("CRE: failed reading index from cache file\n");
         return false;
     }
+    // Blocks CRCs are checked anyway on their first read, see needVerify():
+    // reading them all here makes opening a big document as slow as loading it
     if (_enableCacheFileContentsValidation && !validateContents() ) {
         CRLog::error("CacheFile::open : file contents validation failed");
         printf("CRE: failed validating cache file contents\n");
@@ -1308,46 +1844,54 @@ bool CacheFile::create( LVStreamRef stream )
 }
 
 #if (USE_ZSTD == 1)
-bool CacheFile::allocCompRess(void)
+// allocates compression resources, returns NULL on failure
+static zstd_comp_ress_t * newCompRess()
 {
-    // printf("CacheFile::allocCompRess\n");
-    _comp_ress = new zstd_comp_ress_t;
-    _comp_ress->buffOut = nullptr;
-    _comp_ress->cctx = nullptr;
-
-    _comp_ress->buffOutSize = ZSTD_CStreamOutSize();
-    _comp_ress->buffOut = malloc(_comp_ress->buffOutSize);
-    if (!_comp_ress->buffOut) {
-        return false;
-    }
-    _comp_ress->cctx = ZSTD_createCCtx();
-    if (_comp_ress->cctx == nullptr) {
-        return false;
+    zstd_comp_ress_t * ress = new zstd_comp_ress_t;
+    ress->buffOutSize = ZSTD_CStreamOutSize();
+    ress->buffOut = malloc(ress->buffOutSize);
+    ress->cctx = ZSTD_createCCtx();
+    if (!ress->buffOut || ress->cctx == nullptr) {
+        ZSTD_freeCCtx(ress->cctx);
+        free(ress->buffOut);
+        delete ress;
+        return nullptr;
     }
 
-    // Parameters are sticky
+    // Parameters are sticky (the compression level is set per block type by ldomPack)
     // NOTE: ZSTD_CLEVEL_DEFAULT is currently 3, sane range is 1-19
-    ZSTD_CCtx_setParameter(_comp_ress->cctx, ZSTD_c_compressionLevel, ZSTD_CLEVEL_DEFAULT);
+    ZSTD_CCtx_setParameter(ress->cctx, ZSTD_c_compressionLevel, ZSTD_CLEVEL_DEFAULT);
     // This would be redundant with CRe's own calcHash, AFAICT?
-    //ZSTD_CCtx_setParameter(_comp_ress->cctx, ZSTD_c_checksumFlag, 1);
+    //ZSTD_CCtx_setParameter(ress->cctx, ZSTD_c_checksumFlag, 1);
 
     // Threading? (Requires libzstd built w/ threading support)
     // NOTE: Since we always use ZSTD_e_end, which basically defers to ZSTD_compress2(), this will *not* make it async,
     //       it'll still block.
-    //ZSTD_CCtx_setParameter(_comp_ress->cctx, ZSTD_c_nbWorkers, 4);
+    //ZSTD_CCtx_setParameter(ress->cctx, ZSTD_c_nbWorkers, 4);
 
-    return true;
+    return ress;
+}
+
+static void deleteCompRess(zstd_comp_ress_t * ress)
+{
+    ZSTD_freeCCtx(ress->cctx);
+    free(ress->buffOut);
+    delete ress;
+}
+
+bool CacheFile::allocCompRess(void)
+{
+    // printf("CacheFile::allocCompRess\n");
+    _comp_ress = newCompRess();
+    return _comp_ress != nullptr;
 }
 
 bool CacheFile::freeCompRess(void)
 {
     // printf("CacheFile::freeCompRess\n");
+    LVLock lock(_mutex);
     if (_comp_ress) {
-        ZSTD_freeCCtx(_comp_ress->cctx);
-        _comp_ress->cctx = nullptr;
-        free(_comp_ress->buffOut);
-        _comp_ress->buffOut = nullptr;
-        delete _comp_ress;
+        deleteCompRess(_comp_ress);
         _comp_ress = nullptr;
 
         return true;
@@ -1356,8 +1900,10 @@ bool CacheFile::freeCompRess(void)
     return false;
 }
 
+static bool packBlock( zstd_comp_ress_t * ress, const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize, int level, const CacheFilePackDict * dict );
+
 /// pack data from buf to dstbuf
-bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize )
+bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize, int level, const CacheFilePackDict * dict )
 {
     // printf("ldomPack() <- %p (%zu)\n", buf, bufsize);
 
@@ -1368,12 +1914,16 @@ bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf,
             return false;
         }
     }
+    return packBlock( _comp_ress, buf, bufsize, dstbuf, dstsize, level, dict );
+}
 
+/// pack data from buf to dstbuf, with compression resources of the calling thread
+static bool packBlock( zstd_comp_ress_t * ress, const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize, int level, const CacheFilePackDict * dict )
+{
     // c.f., ZSTD's examples/streaming_compression.c
-    // NOTE: We could probably gain much by training zstd and using a dictionary, here ;).
-    size_t const buffOutSize = _comp_ress->buffOutSize;
-    void*  const buffOut = _comp_ress->buffOut;
-    ZSTD_CCtx* const cctx = _comp_ress->cctx;
+    size_t const buffOutSize = ress->buffOutSize;
+    void*  const buffOut = ress->buffOut;
+    ZSTD_CCtx* const cctx = ress->cctx;
 
     // Reset the context
     size_t const err = ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
@@ -1382,6 +1932,18 @@ bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf,
         return false;
     }
 
+    // Parameters are sticky, but the level depends on the block type
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+    // The dictionary is raw content (a previous block), referenced as a prefix:
+    // it is only valid for the next frame, so it is set again on each call
+    if (dict) {
+        size_t const perr = ZSTD_CCtx_refPrefix(cctx, dict->data, dict->size);
+        if (ZSTD_isError(perr)) {
+            CRLog::error("ZSTD_CCtx_refPrefix() error: %s", ZSTD_getErrorName(perr));
+            return false;
+        }
+    }
+
     // Tell the compressor just how much data we need to compress
     ZSTD_CCtx_setPledgedSrcSize(cctx, bufsize);
 
@@ -1457,7 +2019,7 @@ bool CacheFile::freeDecompRess(void)
 }
 
 /// unpack data from compbuf to dstbuf
-bool CacheFile::ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &dstbuf, lUInt32 & dstsize  )
+bool CacheFile::ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &dstbuf, lUInt32 & dstsize, const CacheFilePackDict * dict )
 {
     // printf("ldomUnpack() <- %p (%zu)\n", compbuf, compsize);
 
@@ -1480,6 +2042,13 @@ bool CacheFile::ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &d
         CRLog::error("ZSTD_DCtx_reset() error: %s", ZSTD_getErrorName(err));
         return false;
     }
+    if (dict) {
+        size_t const perr = ZSTD_DCtx_refPrefix(dctx, dict->data, dict->size);
+        if (ZSTD_isError(perr)) {
+            CRLog::error("ZSTD_DCtx_refPrefix() error: %s", ZSTD_getErrorName(perr));
+            return false;
+        }
+    }
 
     size_t uncompressed_size = 0;
     lUInt8 *uncompressed_buf = NULL;
@@ -1519,8 +2088,8 @@ bool CacheFile::ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &d
     return true;
 }
 #else
-/// pack data from buf to dstbuf
-bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize )
+/// pack data from buf to dstbuf (zlib needs no resources kept between blocks)
+static bool packBlock( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize, int level, const CacheFilePackDict * dict )
 {
     lUInt8 tmp[PACK_BUF_SIZE]; // 64K buffer for compressed data
     int ret;
@@ -1528,9 +2097,13 @@ bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf,
     z.zalloc = Z_NULL;
     z.zfree = Z_NULL;
     z.opaque = Z_NULL;
-    ret = deflateInit( &z, DOC_DATA_COMPRESSION_LEVEL );
+    ret = deflateInit( &z, level );
     if ( ret != Z_OK )
         return false;
+    if ( dict && deflateSetDictionary( &z, dict->data, dict->size ) != Z_OK ) {
+        deflateEnd(&z);
+        return false;
+    }
     z.avail_in = bufsize;
     z.next_in = (unsigned char *)buf;
     int compressed_size = 0;
@@ -1561,8 +2134,14 @@ bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf,
     return true;
 }
 
+/// pack data from buf to dstbuf
+bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize, int level, const CacheFilePackDict * dict )
+{
+    return packBlock( buf, bufsize, dstbuf, dstsize, level, dict );
+}
+
 /// unpack data from compbuf to dstbuf
-bool CacheFile::ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &dstbuf, lUInt32 & dstsize  )
+bool CacheFile::ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &dstbuf, lUInt32 & dstsize, const CacheFilePackDict * dict )
 {
     lUInt8 tmp[UNPACK_BUF_SIZE]; // 256K buffer for uncompressed data
     int ret;
@@ -1581,6 +2160,11 @@ bool CacheFile::ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &d
         z.avail_out = UNPACK_BUF_SIZE;
         z.next_out = tmp;
         ret = inflate( &z, Z_SYNC_FLUSH );
+        if (ret == Z_NEED_DICT && dict) { // stream header read, nothing output yet
+            ret = inflateSetDictionary( &z, dict->data, dict->size );
+            if (ret == Z_OK)
+                continue;
+        }
         if (ret != Z_OK && ret != Z_STREAM_END) { // some error occured while unpacking
             inflateEnd(&z);
             if (uncompressed_buf)
@@ -1605,6 +2189,228 @@ bool CacheFile::ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &d
 }
 #endif
 
+/// waits for blocks queued by write() to be written to file
+ContinuousOperationResult CacheFile::waitWrites( CRTimerUtil & maxTime )
+{
+    LVLock lock(_mutex);
+#if (CR_THREAD_SAFE==1)
+    return waitWriteQueue( maxTime );
+#else
+    CR_UNUSED(maxTime);
+    return CR_DONE;
+#endif
+}
+
+#if (CR_THREAD_SAFE==1)
+
+// waits (with mutex locked once) for queued jobs to be done
+ContinuousOperationResult CacheFile::waitWriteQueue( CRTimerUtil & maxTime )
+{
+    while ( _writeQueue.length() ) {
+        if ( maxTime.infinite() ) {
+            _writeCond.wait(_mutex);
+            continue;
+        }
+        int remaining = maxTime.interval() - (int)maxTime.elapsed();
+        if ( remaining <= 0 )
+            return CR_TIMEOUT;
+        _writeCond.wait(_mutex, remaining);
+    }
+    return _writeError ? CR_ERROR : CR_DONE;
+}
+
+// returns last queued version of block, NULL if none
+CacheFile::WriteJob * CacheFile::findWriteJob( lUInt16 type, lUInt16 index )
+{
+    // There is at most one not cancelled job for a block
+    for ( int i=_writeQueue.length()-1; i>=0; i-- ) {
+        WriteJob * job = _writeQueue[i];
+        if ( job->type==type && job->index==index && !job->flushIndex && !job->cancelled )
+            return job;
+    }
+    return NULL;
+}
+
+// drops queued versions of block
+void CacheFile::cancelWriteJobs( lUInt16 type, lUInt16 index )
+{
+    WriteJob * job = findWriteJob( type, index );
+    if ( !job )
+        return;
+    if ( job->state == WRITE_JOB_PACKING ) {
+        // deleted by its writer
+        job->cancelled = true;
+        return;
+    }
+    _writeQueueSize -= job->size;
+    _writeQueue.remove( job );
+    delete job;
+    _writeCond.notifyAll();
+}
+
+// queues block for writing
+bool CacheFile::queueBlock( lUInt16 type, lUInt16 index, const lUInt8 * buf, int size, bool compress )
+{
+    if ( _writeError )
+        return false;
+    // check whether data is changed, from what it will be when queued writes are done
+    lUInt32 hash = calcHash( buf, size );
+    WriteJob * job = findWriteJob( type, index );
+    if ( job ) {
+        if ( job->size==size && job->hash==hash )
+            return true;
+    } else {
+        CacheFileItem * existingblock = findBlock( type, index );
+        if (existingblock) {
+            bool sameSize = ((int)existingblock->_uncompressedSize==size) || (existingblock->_uncompressedSize==0 && (int)existingblock->_dataSize==size);
+            if (sameSize && existingblock->_dataHash == hash )
+                return true;
+        }
+    }
+    int level = -1;
+    const CacheFilePackDict * dict = NULL;
+    if ( compress && _compressCachedData ) {
+        bool useDict = false;
+        level = getBlockPackLevel( type, useDict );
+        // (the dictionary block itself is written now)
+        if ( useDict )
+            dict = getPackDict( type, buf, size );
+    }
+    if ( job && job->state == WRITE_JOB_PACKING ) {
+        // outdated when packed
+        job->cancelled = true;
+        job = NULL;
+    }
+    if ( !job ) {
+        job = new WriteJob();
+        job->type = type;
+        job->index = index;
+        _writeQueue.add( job );
+    } else {
+        // not picked yet by a writer: update it in place
+        _writeQueueSize -= job->size;
+    }
+    job->setData( buf, size, hash );
+    job->level = level;
+    job->dict = dict;
+    _writeQueueSize += size;
+    startWriters();
+    _writeCond.notifyAll();
+    return true;
+}
+
+// returns next job a writer can do, NULL if none
+CacheFile::WriteJob * CacheFile::getWriteJob()
+{
+    for ( int i=0; i<_writeQueue.length(); i++ ) {
+        WriteJob * job = _writeQueue[i];
+        if ( job->state != WRITE_JOB_QUEUED )
+            continue;
+        // a flush waits for all the blocks queued before it
+        if ( !job->flushIndex || i==0 )
+            return job;
+    }
+    return NULL;
+}
+
+void CacheFile::startWriters()
+{
+    if ( _writers.length() )
+        return;
+    int threads = (int)std::thread::hardware_concurrency() - 1;
+    if ( threads > CACHE_FILE_WRITER_MAX_THREADS )
+        threads = CACHE_FILE_WRITER_MAX_THREADS;
+    if ( threads < 1 )
+        threads = 1;
+    for ( int i=0; i<threads; i++ ) {
+        Writer * writer = new Writer(this);
+        _writers.add(writer);
+        writer->start();
+    }
+}
+
+void CacheFile::stopWriters()
+{
+    {
+        LVLock lock(_mutex);
+        _writersStopped = true;
+        _writeCond.notifyAll();
+    }
+    for ( int i=0; i<_writers.length(); i++ )
+        _writers[i]->join();
+    _writers.clear();
+}
+
+void CacheFile::runWriter()
+{
+#if (USE_ZSTD == 1)
+    zstd_comp_ress_t * ress = nullptr;
+#endif
+    _mutex.lock();
+    for (;;) {
+        WriteJob * job = NULL;
+        while ( !(job = getWriteJob()) && !_writersStopped ) {
+#if (USE_ZSTD == 1)
+            // release compression resources while idle, as saveChanges() does
+            if ( ress ) {
+                deleteCompRess( ress );
+                ress = nullptr;
+            }
+#endif
+            _writeCond.wait(_mutex);
+        }
+        if ( !job ) // stopped, and others are doing what's left
+            break;
+        if ( job->flushIndex ) {
+            if ( !writeIndex() ) {
+                CRLog::error("CacheFile: error while updating index");
+                _writeError = true;
+            } else {
+                writeDirtyFlag(false);
+                setBlocksFlushed();
+            }
+        } else {
+            lUInt8 * packed = NULL;
+            lUInt32 packedSize = 0;
+            if ( job->level >= 0 ) {
+                job->state = WRITE_JOB_PACKING;
+                _mutex.unlock();
+#if (USE_ZSTD == 1)
+                if ( !ress )
+                    ress = newCompRess();
+                if ( ress && !packBlock( ress, job->data, job->size, packed, packedSize, job->level, job->dict ) )
+                    packed = NULL;
+#else
+                if ( !packBlock( job->data, job->size, packed, packedSize, job->level, job->dict ) )
+                    packed = NULL;
+#endif
+                _mutex.lock();
+            }
+            if ( !job->cancelled ) {
+                bool res = packed ? storeBlock( job->type, job->index, packed, packedSize, job->hash, job->size, job->dict ? CBP_DICT : CBP_DEFAULT )
+                                  : storeBlock( job->type, job->index, job->data, job->size, job->hash, 0, CBP_DEFAULT );
+                if ( !res ) {
+                    CRLog::error("CacheFile: cannot write block %d:%d of size %d", job->type, job->index, job->size);
+                    _writeError = true;
+                }
+            }
+            if ( packed )
+                free( packed );
+            _writeQueueSize -= job->size;
+        }
+        _writeQueue.remove( job );
+        delete job;
+        _writeCond.notifyAll();
+    }
+    _mutex.unlock();
+#if (USE_ZSTD == 1)
+    if ( ress )
+        deleteCompRess( ress );
+#endif
+}
+
+#endif // CR_THREAD_SAFE==1
+
 // BLOB storage
 
 class ldomBlobItem {
@@ -2530,6 +3336,7 @@ bool tinyNodeCollection::openCacheFile()
     lString32 fname = getProps()->getStringDef( DOC_PROP_FILE_NAME, "noname" );
     //lUInt32 sz = (lUInt32)getProps()->getInt64Def(DOC_PROP_FILE_SIZE, 0);
     lUInt32 crc = (lUInt32)getProps()->getIntDef(DOC_PROP_FILE_CRC32, 0);
+    lUInt64 fingerprint = (lUInt64)getProps()->getInt64Def(DOC_PROP_FILE_FINGERPRINT, 0);
 
     if ( !ldomDocCache::enabled() ) {
         CRLog::error("Cannot open cached document: cache dir is not initialized");
@@ -2540,7 +3347,8 @@ bool tinyNodeCollection::openCacheFile()
     CRLog::info("ldomDocument::openCacheFile() - looking for cache file %s", UnicodeToUtf8(fname).c_str() );
 
     lString32 cache_path;
-    LVStreamRef map = ldomDocCache::openExisting( fname, crc, getPersistenceFlags(), cache_path );
+    LVStreamRef map = fingerprint ? ldomDocCache::openExisting( fname, fingerprint, getPersistenceFlags(), cache_path )
+                                  : ldomDocCache::openExisting( fname, crc, getPersistenceFlags(), cache_path );
     if ( map.isNull() ) {
         delete f;
         return false;
@@ -2580,6 +3388,7 @@ bool tinyNodeCollection::createCacheFile()
     lString32 fname = getProps()->getStringDef( DOC_PROP_FILE_NAME, "noname" );
     lUInt32 sz = (lUInt32)getProps()->getInt64Def(DOC_PROP_FILE_SIZE, 0);
     lUInt32 crc = (lUInt32)getProps()->getIntDef(DOC_PROP_FILE_CRC32, 0);
+    lUInt64 fingerprint = (lUInt64)getProps()->getInt64Def(DOC_PROP_FILE_FINGERPRINT, 0);
 
     if ( !ldomDocCache::enabled() ) {
         CRLog::error("Cannot swap: cache dir is not initialized");
@@ -2590,7 +3399,8 @@ bool tinyNodeCollection::createCacheFile()
     CRLog::info("ldomDocument::createCacheFile() - initialized swapping of document %s to cache file", UnicodeToUtf8(fname).c_str() );
 
     lString32 cache_path;
-    LVStreamRef map = ldomDocCache::createNew( fname, crc, getPersistenceFlags(), sz, cache_path );
+    LVStreamRef map = fingerprint ? ldomDocCache::createNew( fname, fingerprint, getPersistenceFlags(), sz, cache_path )
+                                  : ldomDocCache::createNew( fname, crc, getPersistenceFlags(), sz, cache_path );
     if ( map.isNull() ) {
         CRLog::error("Cannot swap: failed to allocate cache map");
         delete f;
@@ -2618,6 +3428,10 @@ lString32 tinyNodeCollection::getCacheFilePath() {
     return _cacheFile != NULL ? _cacheFile->getCachePath() : lString32::empty_str;
 }
 
+ContinuousOperationResult tinyNodeCollection::waitCacheWrites( CRTimerUtil & maxTime ) {
+    return _cacheFile != NULL ? _cacheFile->waitWrites( maxTime ) : CR_DONE;
+}
+
 void tinyNodeCollection::clearNodeStyle( lUInt32 dataIndex )
 {
     ldomNodeStyleInfo info;
@@ -3300,6 +4114,20 @@ lString8 ldomDataStorageManager::getText( lUInt32 address )
     return chunk->getText(address&0xFFFF);
 }
 
+/// set view to text by address, pinning its chunk
+void ldomDataStorageManager::getTextView( lUInt32 address, ldomTextView & view )
+{
+    ldomTextStorageChunk * chunk = getChunk(address);
+    int offset = (address&0xFFFF) << 4;
+    if ( chunk->_buf && offset < (int)chunk->_bufpos ) {
+        TextDataStorageItem * item = (TextDataStorageItem *)(chunk->_buf+offset);
+        view.set( chunk, item->text, item->length );
+    }
+    else {
+        view.reset();
+    }
+}
+
 /// get pointer to element data
 ElementDataStorageItem * ldomDataStorageManager::getElem( lUInt32 addr )
 {
@@ -3334,7 +4162,7 @@ void ldomDataStorageManager::compact( lUInt32 reservedSpace, const ldomTextStora
         for ( ldomTextStorageChunk * p = _recentChunk; p; p = p->_nextRecent ) {
 			if ( (p->_bufsize + sumsize < _maxUncompressedSize)
 					|| (p == _activeChunk && reservedSpace < 0xFFFFFFF)
-					|| (p == excludedChunk) ) {
+					|| (p == excludedChunk) || p->_pinCount ) {
 				// fits
 				sumsize += p->_bufsize;
 			} else {
@@ -3382,6 +4210,7 @@ ldomTextStorageChunk::ldomTextStorageChunk(ldomDataStorageManager * manager, lUI
 	, _index(index)      /// ? index of chunk in storage
 	, _type( manager->_type )
 	, _saved(true)
+	, _pinCount(0)
 {
     CR_UNUSED(compsize);
 }
@@ -3396,6 +4225,7 @@ ldomTextStorageChunk::ldomTextStorageChunk(lUInt32 preAllocSize, ldomDataStorage
 	, _index(index)      /// ? index of chunk in storage
 	, _type( manager->_type )
 	, _saved(false)
+	, _pinCount(0)
 {
     _buf = (lUInt8*)calloc(preAllocSize, sizeof(*_buf));
     _manager->_uncompressedSize += _bufsize;
@@ -3411,6 +4241,7 @@ ldomTextStorageChunk::ldomTextStorageChunk(ldomDataStorageManager * manager, lUI
 	, _index(index)      /// ? index of chunk in storage
 	, _type( manager->_type )
 	, _saved(false)
+	, _pinCount(0)
 {
 }
 
@@ -3946,6 +4777,15 @@ ldomDocument::ldomDocument()
 , _partial_rerendering_fake_node_style_hash(0)
 , _rendered_fragments(16)
 , _doc_pages(NULL)
+, _progressive_rendering(false)
+, _rerendering_fragments_parent(0)
+, _finalBlocksValid(false)
+, _textSearchIndexEnabled(false)
+, _textSearchIndex(NULL)
+, _layoutProfilesMaxCount(0)
+, _layoutProfilesMaxSize(0)
+, _layoutProfilesLoaded(false)
+, _layoutProfilesUseCounter(0)
 #endif
 , lists(100)
 , _parsingDocFragmentIdx(-1)
@@ -3998,6 +4838,15 @@ ldomDocument::ldomDocument( ldomDocument & doc )
 , _partial_rerendering_fake_node_style_hash(0)
 , _rendered_fragments(16)
 , _doc_pages(NULL)
+, _progressive_rendering(false)
+, _rerendering_fragments_parent(0)
+, _finalBlocksValid(false)
+, _textSearchIndexEnabled(false)
+, _textSearchIndex(NULL)
+, _layoutProfilesMaxCount(0)
+, _layoutProfilesMaxSize(0)
+, _layoutProfilesLoaded(false)
+, _layoutProfilesUseCounter(0)
 #endif
 , _container(doc._container)
 , lists(100)
@@ -4995,6 +5844,8 @@ ldomDocument::~ldomDocument()
     // keeping alive some font instances (eg. for initial-letter).
     // Drop them before unregistering document fonts.
     clearRendBlockCache();
+    clearRenderedWidths();
+    delete _textSearchIndex;
 #endif
     _def_font.Clear();
     _fonts.clear();
@@ -5316,65 +6167,995 @@ void ldomDocument::applyDocumentStyleSheet()
     }
 }
 
-bool ldomDocument::parseStyleSheet(lString32 codeBase, lString32 css)
-{
-    LVImportStylesheetParser parser(this);
-    return parser.Parse(codeBase, css, _stylesheet);
-}
-
-bool ldomDocument::parseStyleSheet(lString32 cssFile)
-{
-    LVImportStylesheetParser parser(this);
-    return parser.Parse(cssFile, _stylesheet);
+bool ldomDocument::parseStyleSheet(lString32 codeBase, lString32 css)
+{
+    LVImportStylesheetParser parser(this);
+    return parser.Parse(codeBase, css, _stylesheet);
+}
+
+bool ldomDocument::parseStyleSheet(lString32 cssFile)
+{
+    LVImportStylesheetParser parser(this);
+    return parser.Parse(cssFile, _stylesheet);
+}
+
+// Final blocks y index
+
+static const char * final_blocks_magic = "FinalBlk";
+
+// Collect rendered final blocks in document order, with their absolute vertical
+// extent (y0 is the absolute y of node's parent). Final nodes embedded in final
+// nodes (floatBox, inlineBox) are not collected: they are handled when looking
+// inside their container final node.
+static void collectFinalBlocks( ldomNode * node, int y0, LVArray<ldomFinalBlockPos> & blocks )
+{
+    if ( !node->isElement() )
+        return;
+    lvdom_element_render_method rm = node->getRendMethod();
+    if ( rm == erm_invisible || rm == erm_inline )
+        return;
+    RenderRectAccessor fmt( node );
+    int top = y0 + fmt.getY();
+    if ( rm == erm_final ) {
+        ldomFinalBlockPos pos;
+        pos.top = top;
+        pos.bottom = top + fmt.getHeight() + fmt.getBottomOverflow();
+        pos.dataIndex = node->getDataIndex();
+        blocks.add( pos );
+        return;
+    }
+    int count = node->getChildCount();
+    for ( int i=0; i<count; i++ )
+        collectFinalBlocks( node->getChildNode(i), top, blocks );
+}
+
+static int compare_final_block_edges( const void * a, const void * b )
+{
+    lInt32 ea = *(const lInt32 *)a;
+    lInt32 eb = *(const lInt32 *)b;
+    return ea < eb ? -1 : ( ea > eb ? 1 : 0 );
+}
+
+void ldomDocument::buildFinalBlockIndex()
+{
+    _finalBlocks.clear();
+    collectFinalBlocks( getRootNode(), 0, _finalBlocks );
+    updateFinalBlockIndexLookups();
+}
+
+void ldomDocument::updateFinalBlockIndexLookups()
+{
+    int count = _finalBlocks.length();
+    _finalBlocksEdges.clear();
+    if ( count > 0 ) {
+        // DOM order is not y order (floats, reordered table rows and negative
+        // margins may go back up): sort the edges
+        lInt32 * edges = _finalBlocksEdges.addSpace( count*2 );
+        for ( int i=0; i<count; i++ ) {
+            edges[i*2] = _finalBlocks[i].top;
+            edges[i*2+1] = _finalBlocks[i].bottom;
+        }
+        qsort( edges, count*2, sizeof(lInt32), compare_final_block_edges );
+        int n = 0;
+        for ( int i=0; i<count*2; i++ ) {
+            if ( n == 0 || edges[n-1] != edges[i] )
+                edges[n++] = edges[i];
+        }
+        _finalBlocksEdges.erase( n, count*2 - n );
+    }
+    _finalBlocksValid = true;
+}
+
+void ldomDocument::serializeFinalBlockIndex( SerialBuf & buf )
+{
+    if ( buf.error() )
+        return;
+    buf.putMagic( final_blocks_magic );
+    int pos = buf.pos();
+    buf << (lUInt32)_finalBlocks.length();
+    for ( int i=0; i<_finalBlocks.length(); i++ ) {
+        buf << _finalBlocks[i].top << _finalBlocks[i].bottom << _finalBlocks[i].dataIndex;
+    }
+    buf.putCRC( buf.pos() - pos );
+}
+
+// Reads the final blocks index stored after the pages, if any: cache files
+// from previous versions don't have it, and it will be built when needed.
+bool ldomDocument::deserializeFinalBlockIndex( SerialBuf & buf )
+{
+    _finalBlocksValid = false;
+    _finalBlocks.clear();
+    if ( buf.error() || buf.pos() >= buf.size() )
+        return false;
+    // Read from a view, so a failure doesn't flag the pages data as bad
+    SerialBuf view( buf.buf() + buf.pos(), buf.size() - buf.pos() );
+    if ( !view.checkMagic( final_blocks_magic ) )
+        return false;
+    int pos = view.pos();
+    lUInt32 count = 0;
+    view >> count;
+    if ( view.error() || count > (lUInt32)view.space() / 12 )
+        return false;
+    _finalBlocks.addSpace( count );
+    for ( lUInt32 i=0; i<count; i++ ) {
+        view >> _finalBlocks[i].top >> _finalBlocks[i].bottom >> _finalBlocks[i].dataIndex;
+    }
+    if ( !view.checkCRC( view.pos() - pos ) ) {
+        _finalBlocks.clear();
+        return false;
+    }
+    buf.setPos( buf.pos() + view.pos() );
+    updateFinalBlockIndexLookups();
+    return true;
+}
+
+// Returns true if the final blocks index can be used (building it if needed)
+bool ldomDocument::checkFinalBlockIndex()
+{
+    if ( !_rendered )
+        return false;
+    if ( !_finalBlocksValid )
+        buildFinalBlockIndex();
+    return true;
+}
+
+int ldomDocument::getFinalBlockScanY( int y, bool forward )
+{
+    // (In legacy rendering mode, elementFromPoint() checks boxes with their
+    // margins, which we don't have here: go on pixel by pixel.)
+    if ( !BLOCK_RENDERING(_renderBlockRenderingFlags, ENHANCED) || !checkFinalBlockIndex() )
+        return forward ? y + 1 : y - 1;
+    // When scanning, the final node elementFromPoint() gets to, and so the
+    // line found in it, only change when crossing the top or the bottom of
+    // a final block: jump to the closest y in the next section.
+    int count = _finalBlocksEdges.length();
+    int a = 0;
+    int b = count;
+    while ( a < b ) { // first edge > y
+        int m = (a + b) / 2;
+        if ( _finalBlocksEdges[m] > y )
+            b = m;
+        else
+            a = m + 1;
+    }
+    if ( forward )
+        return a < count ? _finalBlocksEdges[a] : getFullHeight() + 1;
+    // (a-1 is the last edge <= y, which starts y's section)
+    return a > 0 ? _finalBlocksEdges[a-1] - 1 : -1;
+}
+
+// getRenderedWidths() memo: one item per element, by element sequential index
+#define RENDERED_WIDTHS_CHUNK_ITEMS_SHIFT 10
+#define RENDERED_WIDTHS_CHUNK_ITEMS (1<<RENDERED_WIDTHS_CHUNK_ITEMS_SHIFT)
+#define RENDERED_WIDTHS_CHUNK_MASK (RENDERED_WIDTHS_CHUNK_ITEMS-1)
+
+bool ldomDocument::getRenderedWidths( ldomNode * node, int direction, int rendFlags, int & maxWidth, int & minWidth )
+{
+    int index = node->getDataIndex() >> 4; // element sequential index
+    int chunkIndex = index >> RENDERED_WIDTHS_CHUNK_ITEMS_SHIFT;
+    if ( chunkIndex >= _renderedWidths.length() || !_renderedWidths[chunkIndex] )
+        return false;
+    ldomRenderedWidths & w = _renderedWidths[chunkIndex][index & RENDERED_WIDTHS_CHUNK_MASK];
+    if ( !w.renderingHash || w.renderingHash != _doc_rendering_hash )
+        return false;
+    if ( w.direction != direction || w.rendFlags != rendFlags )
+        return false;
+    maxWidth = w.maxWidth;
+    minWidth = w.minWidth;
+    return true;
+}
+
+void ldomDocument::setRenderedWidths( ldomNode * node, int direction, int rendFlags, int maxWidth, int minWidth )
+{
+    if ( !_doc_rendering_hash )
+        return;
+    int index = node->getDataIndex() >> 4;
+    int chunkIndex = index >> RENDERED_WIDTHS_CHUNK_ITEMS_SHIFT;
+    while ( _renderedWidths.length() <= chunkIndex )
+        _renderedWidths.add( NULL );
+    if ( !_renderedWidths[chunkIndex] ) {
+        _renderedWidths[chunkIndex] = new ldomRenderedWidths[RENDERED_WIDTHS_CHUNK_ITEMS];
+        memset( _renderedWidths[chunkIndex], 0, sizeof(ldomRenderedWidths) * RENDERED_WIDTHS_CHUNK_ITEMS );
+    }
+    ldomRenderedWidths & w = _renderedWidths[chunkIndex][index & RENDERED_WIDTHS_CHUNK_MASK];
+    w.renderingHash = _doc_rendering_hash;
+    w.rendFlags = rendFlags;
+    w.direction = direction;
+    w.maxWidth = maxWidth;
+    w.minWidth = minWidth;
+}
+
+void ldomDocument::dropRenderedWidths( ldomNode * node )
+{
+    if ( _renderedWidths.empty() )
+        return;
+    // Widths of an element depend on its whole subtree: drop its parents' ones too
+    for ( ; node; node = node->getParentNode() ) {
+        if ( !node->isElement() )
+            continue;
+        int index = node->getDataIndex() >> 4;
+        int chunkIndex = index >> RENDERED_WIDTHS_CHUNK_ITEMS_SHIFT;
+        if ( chunkIndex < _renderedWidths.length() && _renderedWidths[chunkIndex] )
+            _renderedWidths[chunkIndex][index & RENDERED_WIDTHS_CHUNK_MASK].renderingHash = 0;
+    }
+}
+
+void ldomDocument::clearRenderedWidths()
+{
+    for ( int i=0; i<_renderedWidths.length(); i++ )
+        delete[] _renderedWidths[i];
+    _renderedWidths.clear();
+}
+
+// Full-text search index
+
+// text chars gathered in a group, and size of the trigram bit set of each group
+#define TEXT_SEARCH_INDEX_GROUP_CHARS 2048
+#define TEXT_SEARCH_INDEX_GROUP_BITS  4096 // power of 2, <= 65536
+#define TEXT_SEARCH_INDEX_GROUP_BYTES (TEXT_SEARCH_INDEX_GROUP_BITS/8)
+
+static const char * text_search_index_magic = "TxtIndex";
+
+static inline lUInt32 textSearchTrigramHash( lUInt32 c1, lUInt32 c2, lUInt32 c3 )
+{
+    lUInt32 h = ((c1 * 31 + c2) * 31 + c3) * 2654435761U;
+    return (h >> 16) & (TEXT_SEARCH_INDEX_GROUP_BITS - 1);
+}
+
+ldomTextSearchIndex::ldomTextSearchIndex()
+: _lastTextIndex(0)
+, _groupChars(0)
+, _modified(false)
+{
+}
+
+void ldomTextSearchIndex::addText( lUInt32 textIndex, const lChar8 * text, int len )
+{
+    int groupCount = _groupFirst.length();
+    if ( groupCount > 0 && textIndex < _groupFirst[groupCount-1] ) {
+        // Reused index of a removed node, in a group already closed: keep it
+        // as an always candidate (nodes before the first group already are)
+        if ( textIndex < _groupFirst[0] )
+            return;
+        int a = 0;
+        int b = _extra.length();
+        while ( a < b ) {
+            int m = (a + b) / 2;
+            if ( _extra[m] < textIndex )
+                a = m + 1;
+            else
+                b = m;
+        }
+        if ( a == _extra.length() || _extra[a] != textIndex ) {
+            _extra.insert( a, textIndex );
+            _modified = true;
+        }
+        return;
+    }
+    if ( groupCount == 0 || (_groupChars >= TEXT_SEARCH_INDEX_GROUP_CHARS && textIndex > _lastTextIndex) ) {
+        // start a new group (a node index not above the last one added is
+        // inside the last group: keep it there, to keep group ranges sorted)
+        _groupFirst.add( textIndex );
+        groupCount++;
+        int size = groupCount * TEXT_SEARCH_INDEX_GROUP_BYTES;
+        if ( _bits.size() < size )
+            _bits.reserve( size * 2 ); // (LVArray::reserve() doesn't grow exponentially)
+        memset( _bits.addSpace( TEXT_SEARCH_INDEX_GROUP_BYTES ), 0, TEXT_SEARCH_INDEX_GROUP_BYTES );
+        _groupChars = 0;
+    }
+    if ( textIndex > _lastTextIndex )
+        _lastTextIndex = textIndex;
+    _modified = true;
+    // Index what ldomNode::getText() returns, lowercased as findText() does
+    Utf8ToUnicode( text, len, _buf );
+    int n = _buf.length();
+    if ( n == 0 )
+        return;
+    lChar32 * p = _buf.modify();
+    lStr_lowercase( p, n );
+    lUInt8 * bits = _bits.get() + (groupCount-1) * TEXT_SEARCH_INDEX_GROUP_BYTES;
+    lUInt32 c1 = 0;
+    lUInt32 c2 = 0;
+    int count = 0;
+    for ( int i=0; i<n; i++ ) {
+        lUInt32 ch = p[i];
+        if ( ch == UNICODE_SOFT_HYPHEN_CODE ) // skipped by findText()
+            continue;
+        if ( ++count >= 3 ) {
+            lUInt32 h = textSearchTrigramHash( c1, c2, ch );
+            bits[h >> 3] |= (lUInt8)(1 << (h & 7));
+        }
+        c1 = c2;
+        c2 = ch;
+    }
+    _groupChars += count;
+}
+
+bool ldomTextSearchIndex::getCandidates( const lString32Collection & literals, LVArray<lUInt8> & candidates )
+{
+    LVArray<lUInt32> hashes;
+    for ( int k=0; k<literals.length(); k++ ) {
+        lString32 s = literals[k];
+        s.lowercase();
+        lUInt32 c1 = 0;
+        lUInt32 c2 = 0;
+        int count = 0;
+        for ( int i=0; i<s.length(); i++ ) {
+            lUInt32 ch = s[i];
+            if ( ch == UNICODE_SOFT_HYPHEN_CODE )
+                continue;
+            if ( ++count >= 3 )
+                hashes.add( textSearchTrigramHash( c1, c2, ch ) );
+            c1 = c2;
+            c2 = ch;
+        }
+    }
+    if ( hashes.empty() )
+        return false;
+    int groupCount = _groupFirst.length();
+    candidates.clear();
+    lUInt8 * flags = candidates.addSpace( groupCount );
+    for ( int g=0; g<groupCount; g++ ) {
+        const lUInt8 * bits = _bits.get() + g * TEXT_SEARCH_INDEX_GROUP_BYTES;
+        flags[g] = 1;
+        for ( int i=0; i<hashes.length(); i++ ) {
+            lUInt32 h = hashes[i];
+            if ( !(bits[h >> 3] & (1 << (h & 7))) ) {
+                flags[g] = 0;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+bool ldomTextSearchIndex::mayContain( const LVArray<lUInt8> & candidates, lUInt32 textIndex ) const
+{
+    int groupCount = _groupFirst.length();
+    if ( groupCount == 0 || candidates.length() != groupCount
+            || textIndex < _groupFirst[0] || textIndex > _lastTextIndex )
+        return true; // not indexed
+    int a = 0;
+    int b = _extra.length();
+    while ( a < b ) {
+        int m = (a + b) / 2;
+        if ( _extra[m] < textIndex )
+            a = m + 1;
+        else
+            b = m;
+    }
+    if ( a < _extra.length() && _extra[a] == textIndex )
+        return true;
+    // last group starting at or before textIndex
+    a = 0;
+    b = groupCount;
+    while ( a < b ) {
+        int m = (a + b) / 2;
+        if ( _groupFirst[m] > textIndex )
+            b = m;
+        else
+            a = m + 1;
+    }
+    return candidates[a-1] != 0;
+}
+
+void ldomTextSearchIndex::serialize( SerialBuf & buf )
+{
+    buf.putMagic( text_search_index_magic );
+    buf << (lUInt32)_groupFirst.length() << _lastTextIndex << (lUInt32)_groupChars << (lUInt32)_extra.length();
+    for ( int i=0; i<_extra.length(); i++ )
+        buf << _extra[i];
+    for ( int i=0; i<_groupFirst.length(); i++ )
+        buf << _groupFirst[i];
+    int size = _bits.length();
+    if ( !buf.check( size ) ) {
+        memcpy( buf.buf() + buf.pos(), _bits.get(), size );
+        buf.setPos( buf.pos() + size );
+    }
+}
+
+bool ldomTextSearchIndex::deserialize( SerialBuf & buf )
+{
+    if ( !buf.checkMagic( text_search_index_magic ) )
+        return false;
+    lUInt32 groupCount = 0;
+    lUInt32 groupChars = 0;
+    lUInt32 extraCount = 0;
+    buf >> groupCount >> _lastTextIndex >> groupChars >> extraCount;
+    if ( buf.error() || groupCount > 0x1000000 || extraCount > 0x1000000 )
+        return false;
+    _groupChars = (int)groupChars;
+    _extra.clear();
+    _extra.reserve( extraCount );
+    for ( lUInt32 i=0; i<extraCount && !buf.error(); i++ ) {
+        lUInt32 n = 0;
+        buf >> n;
+        _extra.add( n );
+    }
+    _groupFirst.clear();
+    _groupFirst.reserve( groupCount );
+    for ( lUInt32 i=0; i<groupCount && !buf.error(); i++ ) {
+        lUInt32 n = 0;
+        buf >> n;
+        _groupFirst.add( n );
+    }
+    int size = groupCount * TEXT_SEARCH_INDEX_GROUP_BYTES;
+    if ( buf.error() || buf.space() < size )
+        return false;
+    _bits.clear();
+    memcpy( _bits.addSpace( size ), buf.buf() + buf.pos(), size );
+    buf.setPos( buf.pos() + size );
+    return true;
+}
+
+void ldomDocument::setTextSearchIndexEnabled( bool enabled )
+{
+    _textSearchIndexEnabled = enabled;
+    if ( !enabled ) {
+        delete _textSearchIndex;
+        _textSearchIndex = NULL;
+    }
+    else if ( !_textSearchIndex && _textCount == 0 ) {
+        // not yet loaded: build it while parsing
+        _textSearchIndex = new ldomTextSearchIndex();
+    }
+}
+
+ldomTextSearchIndex * ldomDocument::getTextSearchIndex()
+{
+    if ( !_textSearchIndexEnabled )
+        return NULL;
+    if ( !_textSearchIndex ) {
+        // loaded from a cache file without it, or dropped: build it now
+        _textSearchIndex = new ldomTextSearchIndex();
+        for ( int i=1; i<=_textCount; i++ ) {
+            ldomNode * node = getTinyNode( i << 4 );
+            if ( node && node->getDataIndex() ) { // (0 for removed nodes)
+                ldomTextView view;
+                node->getTextView( view );
+                _textSearchIndex->addText( i, view.data(), view.length() );
+            }
+        }
+        setCacheFileStale( true );
+    }
+    return _textSearchIndex;
+}
+
+void ldomDocument::onTextNodeAdded( ldomNode * node, const lString8 & text )
+{
+    if ( _textSearchIndex )
+        _textSearchIndex->addText( node->getDataIndex() >> 4, text.c_str(), text.length() );
+}
+
+void ldomDocument::onTextNodeModified()
+{
+    if ( _textSearchIndex ) {
+        delete _textSearchIndex;
+        _textSearchIndex = NULL;
+        setCacheFileStale( true );
+    }
+}
+
+// Layout profiles
+
+static const char * layout_profiles_magic = "LayoutPs";
+static const char * layout_profile_magic = "LayoutPf";
+
+void ldomDocument::setLayoutProfilesLimits( int maxCount, int maxSize )
+{
+    // (profiles over the new limits are removed when a next one is saved)
+    _layoutProfilesMaxCount = maxCount > 0 && maxSize > 0 ? maxCount : 0;
+    _layoutProfilesMaxSize = maxSize > 0 ? maxSize : 0;
+}
+
+bool ldomDocument::loadLayoutProfilesIndex()
+{
+    if ( !_cacheFile )
+        return false;
+    if ( _layoutProfilesLoaded )
+        return true;
+    _layoutProfilesLoaded = true;
+    _layoutProfiles.clear();
+    _layoutProfilesUseCounter = 0;
+    if ( !_cacheFile->hasBlock( CBT_LAYOUT_PROFILES, 0 ) )
+        return true;
+    SerialBuf buf(0, true);
+    if ( _cacheFile->read( CBT_LAYOUT_PROFILES, buf ) ) {
+        lUInt32 count = 0;
+        buf.checkMagic( layout_profiles_magic );
+        buf >> _layoutProfilesUseCounter >> count;
+        for ( lUInt32 i=0; i<count && !buf.error(); i++ ) {
+            ldomLayoutProfileInfo item;
+            buf >> item.renderingHash >> item.size >> item.lastUsed >> item.slot;
+            _layoutProfiles.add( item );
+        }
+        buf.checkMagic( layout_profiles_magic );
+    }
+    if ( buf.error() ) {
+        CRLog::error("Error while reading layout profiles index");
+        for ( int i=0; i<_layoutProfiles.length(); i++ )
+            _cacheFile->remove( CBT_LAYOUT_PROFILE, (lUInt16)_layoutProfiles[i].slot );
+        _layoutProfiles.clear();
+    }
+    return true;
+}
+
+bool ldomDocument::saveLayoutProfilesIndex()
+{
+    SerialBuf buf(0, true);
+    buf.putMagic( layout_profiles_magic );
+    buf << _layoutProfilesUseCounter << (lUInt32)_layoutProfiles.length();
+    for ( int i=0; i<_layoutProfiles.length(); i++ ) {
+        ldomLayoutProfileInfo & item = _layoutProfiles[i];
+        buf << item.renderingHash << item.size << item.lastUsed << item.slot;
+    }
+    buf.putMagic( layout_profiles_magic );
+    if ( buf.error() || !_cacheFile->write( CBT_LAYOUT_PROFILES, buf, COMPRESS_MISC_DATA ) ) {
+        CRLog::error("Error while saving layout profiles index");
+        return false;
+    }
+    return true;
+}
+
+int ldomDocument::findLayoutProfile( lUInt32 renderingHash )
+{
+    for ( int i=0; i<_layoutProfiles.length(); i++ ) {
+        if ( _layoutProfiles[i].renderingHash == renderingHash )
+            return i;
+    }
+    return -1;
+}
+
+void ldomDocument::removeLayoutProfile( int index )
+{
+    CRLog::debug("Removing layout profile %x", _layoutProfiles[index].renderingHash);
+    _cacheFile->remove( CBT_LAYOUT_PROFILE, (lUInt16)_layoutProfiles[index].slot );
+    _layoutProfiles.remove( index );
+}
+
+// Saves the current layout (node rendering methods and rects, pages, TOC and
+// page map page numbers) as the profile of the current rendering settings.
+// The node styles are not saved: they are computed again when rendering
+// with these settings, before restoreLayoutProfile() checks the hash.
+bool ldomDocument::saveLayoutProfile()
+{
+    if ( !loadLayoutProfilesIndex() )
+        return false;
+    bool indexChanged = false;
+    while ( _layoutProfiles.length() > _layoutProfilesMaxCount ) {
+        // limits reduced or profiles disabled
+        removeLayoutProfile( 0 );
+        indexChanged = true;
+    }
+    if ( _layoutProfilesMaxCount <= 0 || !_rendered || _partial_rerenderings_count > 0 || !_pagesData.pos() ) {
+        // (no consistent layout after partial rerenderings)
+        if ( indexChanged )
+            saveLayoutProfilesIndex();
+        return false;
+    }
+    lUInt32 hash = _hdr.getRenderingHash();
+    int index = findLayoutProfile( hash );
+    if ( index >= 0 ) {
+        // Already saved, probably restored from it
+        _layoutProfiles[index].lastUsed = ++_layoutProfilesUseCounter;
+        return saveLayoutProfilesIndex();
+    }
+    CRTimerUtil timer;
+    int recSize = (int)sizeof(lvdomElementFormatRec);
+    lUInt32 elemCount = 0;
+    int count = ((_elemCount+TNC_PART_LEN-1) >> TNC_PART_SHIFT);
+    for ( int i=0; i<count; i++ ) {
+        int sz = TNC_PART_LEN;
+        if ( i*TNC_PART_LEN + sz > _elemCount+1 )
+            sz = _elemCount+1 - i*TNC_PART_LEN;
+        ldomNode * nodes = _elemList[i];
+        for ( int j=0; j<sz; j++ ) {
+            if ( nodes[j].isElement() )
+                elemCount++;
+        }
+    }
+    SerialBuf buf(0, true);
+    buf.putMagic( layout_profile_magic );
+    _hdr.serialize( buf );
+    buf << elemCount;
+    buf.check( elemCount * (recSize + 1) );
+    for ( int i=0; i<count && !buf.error(); i++ ) {
+        int sz = TNC_PART_LEN;
+        if ( i*TNC_PART_LEN + sz > _elemCount+1 )
+            sz = _elemCount+1 - i*TNC_PART_LEN;
+        ldomNode * nodes = _elemList[i];
+        for ( int j=0; j<sz; j++ ) {
+            if ( nodes[j].isElement() ) {
+                lvdomElementFormatRec rec;
+                _rectStorage.getRendRectData( nodes[j]._handle._dataIndex, &rec );
+                buf << (lUInt8)nodes[j].getRendMethod();
+                if ( buf.check( recSize ) )
+                    break;
+                memcpy( buf.buf() + buf.pos(), &rec, recSize );
+                buf.setPos( buf.pos() + recSize );
+            }
+        }
+    }
+    buf << (lUInt32)_pagesData.pos();
+    buf << _pagesData;
+    buf << _toc_from_cache_valid;
+    m_toc.serializePages( buf );
+    m_pagemap.serializePages( buf );
+    buf.putMagic( layout_profile_magic );
+    if ( buf.error() ) {
+        CRLog::error("Error while serializing layout profile");
+        return false;
+    }
+    if ( buf.pos() > _layoutProfilesMaxSize ) {
+        CRLog::info("Layout profile %x not saved: too large (%d bytes)", hash, buf.pos());
+        if ( indexChanged )
+            saveLayoutProfilesIndex();
+        return false;
+    }
+    // Evict least recently used profiles to make room for it
+    for (;;) {
+        lUInt32 totalSize = buf.pos();
+        int lru = -1;
+        for ( int i=0; i<_layoutProfiles.length(); i++ ) {
+            totalSize += _layoutProfiles[i].size;
+            if ( lru < 0 || _layoutProfiles[i].lastUsed < _layoutProfiles[lru].lastUsed )
+                lru = i;
+        }
+        if ( lru < 0 || ( _layoutProfiles.length() < _layoutProfilesMaxCount && totalSize <= (lUInt32)_layoutProfilesMaxSize ) )
+            break;
+        removeLayoutProfile( lru );
+    }
+    // First free slot
+    lUInt32 slot = 0;
+    for ( int i=0; i<_layoutProfiles.length(); i++ ) {
+        if ( _layoutProfiles[i].slot == slot ) {
+            slot++;
+            i = -1;
+        }
+    }
+    if ( !_cacheFile->write( CBT_LAYOUT_PROFILE, (lUInt16)slot, buf, true ) ) {
+        CRLog::error("Error while saving layout profile");
+        saveLayoutProfilesIndex();
+        return false;
+    }
+    ldomLayoutProfileInfo item;
+    item.renderingHash = hash;
+    item.size = buf.pos();
+    item.lastUsed = ++_layoutProfilesUseCounter;
+    item.slot = slot;
+    _layoutProfiles.add( item );
+    CRLog::info("Layout profile %x saved: %d elements, %d bytes, %d ms", hash, elemCount, buf.pos(), (int)timer.elapsed());
+    return saveLayoutProfilesIndex();
+}
+
+// Restores the layout saved for the current rendering settings, if any:
+// to be called with node styles and rendering methods initialized for them.
+bool ldomDocument::restoreLayoutProfile( LVRendPageList * pages )
+{
+    if ( _layoutProfilesMaxCount <= 0 || !loadLayoutProfilesIndex() )
+        return false;
+    lUInt32 hash = _hdr.getRenderingHash();
+    int index = findLayoutProfile( hash );
+    if ( index < 0 )
+        return false;
+    CRTimerUtil timer;
+    int recSize = (int)sizeof(lvdomElementFormatRec);
+    SerialBuf buf(0, true);
+    DocFileHeader hdr;
+    lUInt32 elemCount = 0;
+    int recordsPos = 0;
+    lUInt32 pagesSize = 0;
+    int pagesPos = 0;
+    bool tocValid = false;
+    if ( _cacheFile->read( CBT_LAYOUT_PROFILE, (lUInt16)_layoutProfiles[index].slot, buf ) ) {
+        buf.checkMagic( layout_profile_magic );
+        if ( !buf.error() && hdr.deserialize( buf ) && hdr.getRenderingHash() == hash ) {
+            buf >> elemCount;
+            recordsPos = buf.pos();
+            if ( buf.space() < (int)elemCount * (recSize + 1) )
+                buf.seterror();
+            else
+                buf.setPos( recordsPos + elemCount * (recSize + 1) );
+            buf >> pagesSize;
+            pagesPos = buf.pos();
+            if ( buf.space() < (int)pagesSize )
+                buf.seterror();
+            else
+                buf.setPos( pagesPos + pagesSize );
+            buf >> tocValid;
+        }
+        else {
+            buf.seterror();
+        }
+    }
+    else {
+        buf.seterror();
+    }
+    // Count elements, to be sure the records match the DOM
+    int count = ((_elemCount+TNC_PART_LEN-1) >> TNC_PART_SHIFT);
+    if ( !buf.error() ) {
+        lUInt32 n = 0;
+        for ( int i=0; i<count; i++ ) {
+            int sz = TNC_PART_LEN;
+            if ( i*TNC_PART_LEN + sz > _elemCount+1 )
+                sz = _elemCount+1 - i*TNC_PART_LEN;
+            ldomNode * nodes = _elemList[i];
+            for ( int j=0; j<sz; j++ ) {
+                if ( nodes[j].isElement() )
+                    n++;
+            }
+        }
+        if ( n != elemCount )
+            buf.seterror();
+    }
+    int tocPos = buf.pos();
+    if ( buf.error() ) {
+        CRLog::error("Error while reading layout profile %x", hash);
+        removeLayoutProfile( index );
+        saveLayoutProfilesIndex();
+        return false;
+    }
+    SerialBuf pagesbuf( buf.buf() + pagesPos, pagesSize );
+    pages->clear();
+    if ( !pages->deserialize( pagesbuf ) || !deserializeFinalBlockIndex( pagesbuf ) ) {
+        CRLog::error("Error while reading layout profile %x pages", hash);
+        pages->clear();
+        removeLayoutProfile( index );
+        saveLayoutProfilesIndex();
+        return false;
+    }
+    // From now on, we can't fail
+    buf.setPos( recordsPos );
+    for ( int i=0; i<count; i++ ) {
+        int sz = TNC_PART_LEN;
+        if ( i*TNC_PART_LEN + sz > _elemCount+1 )
+            sz = _elemCount+1 - i*TNC_PART_LEN;
+        ldomNode * nodes = _elemList[i];
+        for ( int j=0; j<sz; j++ ) {
+            if ( nodes[j].isElement() ) {
+                lUInt8 rendMethod = 0;
+                buf >> rendMethod;
+                nodes[j].setRendMethod( (lvdom_element_render_method)rendMethod );
+                lvdomElementFormatRec rec;
+                memcpy( (void*)&rec, buf.buf() + buf.pos(), recSize );
+                buf.setPos( buf.pos() + recSize );
+                _rectStorage.setRendRectData( nodes[j]._handle._dataIndex, &rec );
+            }
+        }
+    }
+    _pagesData.reset();
+    pagesbuf.setPos( pagesSize );
+    _pagesData << pagesbuf;
+    // TOC and page map may have been changed (ie. alternative TOC built) since
+    // the profile was saved: their page numbers will then be computed again
+    buf.setPos( tocPos );
+    _toc_from_cache_valid = tocValid;
+    if ( !m_toc.deserializePages( buf ) ) {
+        _toc_from_cache_valid = false;
+        m_toc.invalidatePageNumbers();
+    }
+    if ( !m_pagemap.deserializePages( buf ) )
+        m_pagemap.invalidatePageInfo();
+    _layoutProfiles[index].lastUsed = ++_layoutProfilesUseCounter;
+    saveLayoutProfilesIndex();
+    CRLog::info("Layout profile %x restored: %d pages, %d ms", hash, pages->length(), (int)timer.elapsed());
+    return true;
+}
+
+// Support for partial rerendering
+bool ldomDocument::canBePartiallyRerendered() {
+    // We only support documents with DocFragments (epub, chm), as we need a single set of concatenated
+    // siblings to be able to do individual partial rerenderings without too much complexity.
+    // FB2 unfortunately have 1 main <body> (containing <section>, that would each be interesting
+    // to render partially) and up to 2 other <body> for footnotes (where each <section> contains
+    // a single footnote). This DOM layout doesn't allow for easy rerendering.
+    // For other formats like HTML, we wouldn't know what elements to use as fragments.
+    // (Progressive rendering, which has all fragments rerendered before the frontend
+    // relies on the rendering again, handles such documents: see enableProgressiveRendering())
+    if ( !hasCacheFile() ) {
+        // If no cache file, we won't be able to render in background
+        // and reload from the cache file quickly.
+        return false;
+    }
+    return findRerenderingFragmentsParent( true ) != NULL;
+}
+
+// Returns the node whose children will be the fragments partially rerendered
+ldomNode * ldomDocument::findRerenderingFragmentsParent( bool docfragments_only ) {
+    ldomNode * node = getRootNode()->getChildNode(0);
+    if ( node ) {
+        // We need at least 2 <DocFragment> for partial rerenderings to have some benefit
+        if ( node->getChildCount() >= 2 && node->getChildNode(0)->getNodeId() == el_DocFragment ) {
+            if ( docfragments_only )
+                return node;
+            // Note: it may happen that the first DocFragment holds only a cover image, and
+            // a second the full book content, which makes partial rerendering quite useless,
+            // but this and similar ugly cases are hard to detect...
+        }
+    }
+    if ( docfragments_only )
+        return NULL;
+    // For progressive rendering, go down the block holding most of the content (FB2
+    // main <body>, HTML <body>, a TXT single <section>...), and keep the deepest one
+    // made of many blocks that can be fragments (ie. EPUB DocFragments, or FB2 <section>s,
+    // each starting on a new page: see isRerenderingFragmentsPathUsable()). The fragments
+    // will be its children, and the following siblings of it and its ancestors (FB2
+    // footnotes <body>).
+    ldomNode * parent = NULL;
+    node = getRootNode();
+    while ( node->getRendMethod() == erm_block ) {
+        int height = RenderRectAccessor( node ).getHeight();
+        ldomNode * main_child = NULL;
+        int main_height = 0;
+        int main_shown_before = 0; // height of the blocks before main_child
+        int shown_height = 0;
+        int nb_blocks = 0;
+        int cnt = node->getChildCount();
+        for ( int i=0; i<cnt; i++ ) {
+            ldomNode * child = node->getChildNode(i);
+            if ( !child->isElement() || child->getRendMethod() == erm_invisible )
+                continue;
+            if ( child->isFloatingBox() )
+                return parent; // floats may be laid out along many fragments
+            RenderRectAccessor fmt( child );
+            if ( fmt.getHeight() > main_height ) {
+                main_child = child;
+                main_height = fmt.getHeight();
+                main_shown_before = shown_height;
+            }
+            shown_height += fmt.getHeight();
+            nb_blocks++;
+        }
+        if ( nb_blocks >= 2 && isRerenderingFragmentsPathUsable( node ) )
+            parent = node;
+        // Fragments we partially rerender are positionned from the top of the
+        // document or from their previous sibling: we can only go down if
+        // nothing is shown before the main child
+        if ( main_child && main_height >= height * 3 / 4 && main_shown_before == 0 ) {
+            node = main_child;
+            continue;
+        }
+        break;
+    }
+    return parent;
+}
+
+// A fragment rendered alone gives the same pages as when fully rendered only
+// if a page break is forced before it
+static bool isRerenderingFragmentOnNewPage( ldomNode * node ) {
+    if ( !node->isElement() || node->getRendMethod() == erm_invisible )
+        return true; // (not laid out)
+    // The break may be set on its first block (ie. FB2 <section><title>), as long
+    // as nothing is shown above it
+    while ( node ) {
+        css_style_ref_t style = node->getStyle();
+        if ( style.isNull() )
+            return false;
+        if ( style->page_break_before >= css_pb_always ) // (or left, right...)
+            return true;
+        if ( node->getRendMethod() != erm_block )
+            return false;
+        if ( lengthToPx( node, style->margin[2], 0 ) != 0 || lengthToPx( node, style->padding[2], 0 ) != 0
+                || measureBorder( node, 0 ) != 0 )
+            return false;
+        ldomNode * first = NULL;
+        int cnt = node->getChildCount();
+        for ( int i=0; i<cnt && !first; i++ ) {
+            ldomNode * child = node->getChildNode(i);
+            if ( child->isElement() && child->getRendMethod() != erm_invisible )
+                first = child;
+        }
+        node = first;
+    }
+    return false;
+}
+
+// Fragments are rendered with the page width, at x=0 (and the first one at the top
+// of the document): this is fine only if their parent and its ancestors have no
+// horizontal margin, no border, no padding and no specified width.
+// Each one is laid out from the bottom of the previous one: this is fine only if
+// they all start on a new page (except the first one).
+bool ldomDocument::isRerenderingFragmentsPathUsable( ldomNode * parent ) {
+    bool is_first = true;
+    int cnt = parent->getChildCount();
+    for ( int i=0; i<cnt; i++ ) {
+        ldomNode * child = parent->getChildNode(i);
+        if ( !child->isElement() || child->getRendMethod() == erm_invisible )
+            continue;
+        if ( !is_first && !isRerenderingFragmentOnNewPage( child ) )
+            return false;
+        is_first = false;
+    }
+    for ( ldomNode * node = parent; node->getParentNode(); node = node->getParentNode() ) {
+        ldomNode * grand_parent = node->getParentNode();
+        cnt = grand_parent->getChildCount();
+        for ( int i=node->getNodeIndex()+1; i<cnt; i++ ) {
+            if ( !isRerenderingFragmentOnNewPage( grand_parent->getChildNode(i) ) )
+                return false;
+        }
+    }
+    for ( ldomNode * node = parent; node; node = node->getParentNode() ) {
+        if ( node->getRendMethod() != erm_block )
+            return false;
+        css_style_ref_t style = node->getStyle();
+        if ( style.isNull() )
+            return false;
+        if ( style->width.type != css_val_unspecified || style->min_width.type != css_val_unspecified
+                || style->max_width.type != css_val_unspecified )
+            return false;
+        for ( int i=0; i<4; i++ ) {
+            if ( lengthToPx( node, style->padding[i], _page_width ) != 0 || measureBorder( node, i ) != 0 )
+                return false;
+            if ( i < 2 && lengthToPx( node, style->margin[i], _page_width ) != 0 )
+                return false;
+        }
+    }
+    return true;
+}
+
+// Init the styles of the parent node of the fragments and of its ancestors, so each
+// fragment we will partially render can inherit updated styles from them.
+// With progressive rendering, init all the styles once (as a full rendering does), so
+// we can check all fragments still start on a new page, and they only need to be laid out.
+void ldomDocument::initRerenderingFragmentsPathStyles() {
+    _stylesheet.push();
+    if ( _progressive_rendering ) {
+        TextLangMan::resetCounters();
+        applyDocumentStyleSheet(); // (FB2 or HTML document stylesheet)
+        getRootNode()->initNodeStyleRecursive( NULL );
+    }
+    else {
+        LVArray<ldomNode*> path;
+        for ( ldomNode * node = getTinyNode(_rerendering_fragments_parent); node; node = node->getParentNode() )
+            path.add( node );
+        for ( int i=path.length()-1; i>=0; i-- )
+            path[i]->initNodeStyle();
+    }
+    _styleSheetCache.clear();
+    _stylesheet.pop();
 }
 
-// Support for partial rerendering
-bool ldomDocument::canBePartiallyRerendered() {
-    // We only support documents with DocFragments (epub, chm), as we need a single set of concatenated
-    // siblings to be able to do individual partial rerenderings without too much complexity.
-    // FB2 unfortunately have 1 main <body> (containing <section>, that would each be interesting
-    // to render partially) and up to 2 other <body> for footnotes (where each <section> contains
-    // a single footnote). This DOM layout doesn't allow for easy rerendering.
-    // For other formats like HTML, we wouldn't know what elements to use as fragments.
-    if ( !hasCacheFile() ) {
-        // If no cache file, we won't be able to render in background
-        // and reload from the cache file quickly.
-        return false;
+// Enable partial rerendering with the fragments from this parent node: this
+// needs to be called after the document has been fully rendered once.
+void ldomDocument::startPartialRerendering( ldomNode * parent ) {
+    _partial_rerendering_enabled = true;
+    // Remember _nodeStyleHash as it was before enabling partial rendering, and keep using it.
+    // If no rendering setting has changed (no partial rerendering needed), ldomDocument::render()
+    // won't have done setCacheFileStale(false) and we can still save a valid cache with the DOM
+    // and the initial full rendering infos.
+    _partial_rerendering_fake_node_style_hash = _nodeStyleHash;
+    // Assume a full rendering has been done and no rerendering is needed at this point: update
+    // hashes and compute our reference _doc_rendering_hash for things already rendered:
+    updateRenderContext();
+    // Collect the fragments: the parent node children, and the following siblings
+    // of it and of its ancestors
+    _rerendering_fragments_parent = parent->getDataIndex();
+    _rerendering_fragments.clear();
+    int cnt = parent->getChildCount();
+    for ( int i=0; i<cnt; i++ ) {
+        ldomNode * child = parent->getChildNode(i);
+        if ( child->isElement() )
+            _rerendering_fragments.add( child->getDataIndex() );
     }
-    ldomNode * node = getRootNode()->getChildNode(0);
-    if ( node ) {
-        // We need at least 2 <DocFragment> for partial rerenderings to have some benefit
-        if ( node->getChildCount() >= 2 && node->getChildNode(0)->getNodeId() == el_DocFragment ) {
-            return true;
-            // Note: it may happen that the first DocFragment holds only a cover image, and
-            // a second the full book content, which makes partial rerendering quite useless,
-            // but this and similar ugly cases are hard to detect...
+    for ( ldomNode * node = parent; node->getParentNode(); node = node->getParentNode() ) {
+        ldomNode * grand_parent = node->getParentNode();
+        cnt = grand_parent->getChildCount();
+        for ( int i=node->getNodeIndex()+1; i<cnt; i++ ) {
+            ldomNode * sibling = grand_parent->getChildNode(i);
+            if ( sibling->isElement() )
+                _rerendering_fragments.add( sibling->getDataIndex() );
         }
     }
-    return false;
+    // Set all _rendered_fragments hash to be our current full rendering hash
+    // (We use the node DataIndex and not its index, as fragments may not be siblings.)
+    for ( int i=0; i<_rerendering_fragments.length(); i++ )
+        _rendered_fragments.set(_rerendering_fragments[i], _doc_rendering_hash);
 }
 
 bool ldomDocument::enablePartialRerendering( bool enable ) {
     if ( enable && !_partial_rerendering_enabled && canBePartiallyRerendered() && _rendered ) {
         // This needs to be called after the document has been fully rendered once.
-        _partial_rerendering_enabled = true;
-        // Remember _nodeStyleHash as it was before enabling partial rendering, and keep using it.
-        // If no rendering setting has changed (no partial rerendering needed), ldomDocument::render()
-        // won't have done setCacheFileStale(false) and we can still save a valid cache with the DOM
-        // and the initial full rendering infos.
-        _partial_rerendering_fake_node_style_hash = _nodeStyleHash;
-        // Assume a full rendering has been done and no rerendering is needed at this point: update
-        // hashes and compute our reference _doc_rendering_hash for things already rendered:
-        updateRenderContext();
-        // Set all _rendered_fragments hash to be our current full rendering hash
-        ldomNode * node = getRootNode()->getChildNode(0);
-        int nb_docfragments = node->getChildCount();
-        for (int idx = 0; idx < nb_docfragments; idx++) {
-            ldomNode * docfragment = node->getChildNode(idx);
-            _rendered_fragments.set(docfragment->getDataIndex(), _doc_rendering_hash);
-                // (We use the node DataIndex and not idx, in case we later are able
-                // to use other kind of fragments, possibly not siblings.)
-        }
+        startPartialRerendering( findRerenderingFragmentsParent( true ) );
     }
     else if ( !enable && _partial_rerendering_enabled ) {
         bool did_some_partial_rerenderings = _partial_rerenderings_count > 0;
@@ -5383,6 +7164,8 @@ bool ldomDocument::enablePartialRerendering( bool enable ) {
         _partial_rerenderings_count = 0;
         _rerendering_delayed = false;
         _rendered_fragments.clear();
+        _rerendering_fragments.clear();
+        _progressive_rendering = false;
         _nodeStyleHash = 0; // have it recomputed
         if ( did_some_partial_rerenderings ) {
             // Some partial rerenderings did happen: the rendering info
@@ -5399,6 +7182,57 @@ bool ldomDocument::enablePartialRerendering( bool enable ) {
     return _partial_rerendering_enabled;
 }
 
+// Progressive rendering is partial rerendering, driven by LVDocView: when rendering
+// settings change, only the fragment at the current position is rerendered, the
+// others being rerendered when drawn or by renderPendingFragments() calls when
+// the frontend is idle. It does not need a cache file, nor DocFragments.
+// Fragments must each start on a new page, so the pages are those a full rendering
+// would give, except that in-page footnotes are only those found in the same fragment.
+bool ldomDocument::enableProgressiveRendering( bool enable ) {
+    if ( enable && !_partial_rerendering_enabled && _rendered ) {
+        ldomNode * parent = findRerenderingFragmentsParent( false );
+        if ( parent ) {
+            _progressive_rendering = true;
+            startPartialRerendering( parent );
+        }
+    }
+    else if ( !enable && _progressive_rendering ) {
+        return enablePartialRerendering( false );
+    }
+    return _progressive_rendering;
+}
+
+int ldomDocument::getPendingFragmentsCount() {
+    int count = 0;
+    for ( int i=0; i<_rerendering_fragments.length(); i++ ) {
+        if ( _rendered_fragments.get(_rerendering_fragments[i]) != _doc_rendering_hash )
+            count++;
+    }
+    return count;
+}
+
+ContinuousOperationResult ldomDocument::renderPendingFragments( ldomNode * node, CRTimerUtil & maxTime ) {
+    int nb_fragments = _rerendering_fragments.length();
+    if ( !_partial_rerendering_enabled || !nb_fragments )
+        return CR_DONE;
+    // Start from the fragment containing node, as it or the ones just after
+    // are the most likely to be drawn next
+    int start = 0;
+    for ( ; node; node = node->getParentNode() ) {
+        int idx = _rerendering_fragments.indexOf( node->getDataIndex() );
+        if ( idx >= 0 ) {
+            start = idx;
+            break;
+        }
+    }
+    for ( int k=0; k<nb_fragments; k++ ) {
+        int idx = k < nb_fragments - start ? start + k : nb_fragments - 1 - k;
+        if ( partialRender( getTinyNode( _rerendering_fragments[idx] ) ) && maxTime.expired() )
+            return getPendingFragmentsCount() > 0 ? CR_TIMEOUT : CR_DONE;
+    }
+    return CR_DONE;
+}
+
 bool ldomDocument::partialRender( ldomNode * node ) {
     // printf("partialRender %x? %x != %x)\n", node->getDataIndex(), _rendered_fragments.get(node->getDataIndex()), _doc_rendering_hash);
     if ( _rendered_fragments.get(node->getDataIndex()) == _doc_rendering_hash ) {
@@ -5422,9 +7256,18 @@ bool ldomDocument::partialRender( ldomNode * node ) {
     lvRect orig_rc;
     node->getAbsRect(orig_rc); // Original absolute rectangle this DocFragment occupies
 
-    if ( node->getNodeIndex() > 0 ) { // Not the first DocFragment
-        ldomNode * parent = node->getParentNode();
-        ldomNode * prev_sibling = parent->getChildNode(node->getNodeIndex() - 1);
+    // (With progressive rendering, fragments may be other blocks than DocFragments,
+    // and may be preceded by invisible or text nodes, which we skip.)
+    ldomNode * prev_sibling = NULL;
+    ldomNode * parent = node->getParentNode();
+    for ( int i=node->getNodeIndex()-1; i>=0; i-- ) {
+        ldomNode * sibling = parent->getChildNode(i);
+        if ( sibling->isElement() && sibling->getRendMethod() != erm_invisible ) {
+            prev_sibling = sibling;
+            break;
+        }
+    }
+    if ( prev_sibling ) { // Not the first DocFragment
         lvRect prev_rc;
         prev_sibling->getAbsRect(prev_rc);
         base_y = prev_rc.bottom;
@@ -5454,21 +7297,59 @@ bool ldomDocument::partialRender( ldomNode * node ) {
         }
     }
 
+    // Locate this DocFragment's final blocks in the final blocks index, before
+    // styles and rendering methods change: they will be replaced in place
+    int final_blocks_start = -1;
+    int final_blocks_count = 0;
+    if ( _finalBlocksValid ) {
+        LVArray<ldomFinalBlockPos> old_blocks;
+        collectFinalBlocks( node, 0, old_blocks );
+        final_blocks_count = old_blocks.length();
+        if ( final_blocks_count > 0 ) {
+            for ( int i=0; i<_finalBlocks.length(); i++ ) {
+                if ( _finalBlocks[i].dataIndex == old_blocks[0].dataIndex ) {
+                    final_blocks_start = i;
+                    break;
+                }
+            }
+            int last = final_blocks_start + final_blocks_count - 1;
+            if ( final_blocks_start < 0 || last >= _finalBlocks.length()
+                    || _finalBlocks[last].dataIndex != old_blocks[final_blocks_count-1].dataIndex )
+                final_blocks_start = -1;
+        }
+        if ( final_blocks_start < 0 ) // not found: have it fully rebuilt when needed
+            _finalBlocksValid = false;
+    }
+
     // Init styles and rendering methods of this DocFragment and its content
     // (as done in ldomDocument::render())
     _renderedBlockCache.clear();
-    _stylesheet.push();
-    // applyDocumentStyleSheet(); // not needed (should only do something on FB2)
-    node->initNodeStyleRecursive(NULL); // (no callback)
-    _styleSheetCache.clear();
-    _stylesheet.pop();
+    if ( !_progressive_rendering ) { // (otherwise done for all fragments by render())
+        _stylesheet.push();
+        // applyDocumentStyleSheet(); // not needed (should only do something on FB2)
+        node->initNodeStyleRecursive(NULL); // (no callback)
+        _styleSheetCache.clear();
+        _stylesheet.pop();
+    }
     node->initNodeRendMethodRecursive();
 
     // Render this DocFragment, and build a new pages list (as if this DocFrament was a standalone document)
     _renderedBlockCache.reduceSize(1); // Reduce size to save some checking and trashing time
     LVRendPageList newpages;
     LVRendPageContext context( &newpages, _page_height, _def_font->getSize() );
-    renderBlockElement( context, node, 0, base_y, _page_width, _partial_rerendering_usable_left_overflow, _partial_rerendering_usable_right_overflow);
+    // With progressive rendering, all fragments after the first one start on a new page:
+    // the bottom margin of any fragment followed by a visible one is dropped
+    bool followed_by_page_break = false;
+    if ( _progressive_rendering ) {
+        for ( int i=_rerendering_fragments.indexOf( node->getDataIndex() )+1; i<_rerendering_fragments.length(); i++ ) {
+            if ( getTinyNode( _rerendering_fragments[i] )->getRendMethod() != erm_invisible ) {
+                followed_by_page_break = true;
+                break;
+            }
+        }
+    }
+    renderBlockElement( context, node, 0, base_y, _page_width, _partial_rerendering_usable_left_overflow, _partial_rerendering_usable_right_overflow,
+                            REND_DIRECTION_UNSET, NULL, getRenderBlockRenderingFlags(), followed_by_page_break );
     _renderedBlockCache.restoreSize(); // Restore original cache size
     context.Finalize(); // build the new pages
         // As-is, newpages may contain in-page footnotes, but only those found in this same
@@ -5504,22 +7385,23 @@ bool ldomDocument::partialRender( ldomNode * node ) {
     int next_fragments_shift_y = new_rc.bottom - orig_rc.bottom;
     // printf("fixing fragment %d (%d ~ %d => %d , +%d => +%d)\n", node->getNodeIndex(), base_y, orig_rc.top, new_rc.top, orig_h, new_h);
 
-    // Update all next DocFragments' relative y
-    ldomNode * parent = node->getParentNode();
-    int nb_siblings = parent->getChildCount();
-    for (int idx = node->getNodeIndex()+1; idx < nb_siblings; idx++) {
-        ldomNode * sibling = parent->getChildNode(idx);
-        RenderRectAccessor sfmt( sibling );
-        // printf("fixing sibling %d (%d => %d +%d)\n", idx, sfmt.getY(), sfmt.getY() + next_fragments_shift_y, sfmt.getHeight());
-        sfmt.setY(sfmt.getY() + next_fragments_shift_y);
-        sfmt.push();
-    }
-    while ( parent ) {
+    // Update all next DocFragments' relative y (and, with progressive rendering,
+    // the next siblings of our parents, ie. FB2 footnotes <body>)
+    for ( ldomNode * child = node; parent; child = parent, parent = parent->getParentNode() ) {
+        int nb_siblings = parent->getChildCount();
+        for (int idx = child->getNodeIndex()+1; idx < nb_siblings; idx++) {
+            ldomNode * sibling = parent->getChildNode(idx);
+            if ( !sibling->isElement() )
+                continue;
+            RenderRectAccessor sfmt( sibling );
+            // printf("fixing sibling %d (%d => %d +%d)\n", idx, sfmt.getY(), sfmt.getY() + next_fragments_shift_y, sfmt.getHeight());
+            sfmt.setY(sfmt.getY() + next_fragments_shift_y);
+            sfmt.push();
+        }
         // Update parents' heights
         RenderRectAccessor pfmt( parent );
         pfmt.setHeight(pfmt.getHeight() + next_fragments_shift_y);
         pfmt.push();
-        parent = parent->getParentNode();
     }
 
     // Replace the original pages this DocFragment previously rendered to,
@@ -5528,6 +7410,28 @@ bool ldomDocument::partialRender( ldomNode * node ) {
         _doc_pages->replacePages(base_y, orig_h, &newpages, next_fragments_shift_y);
     }
 
+    // Same with its final blocks, and shift the next ones
+    if ( _finalBlocksValid ) {
+        lvRect parent_rc;
+        node->getParentNode()->getAbsRect(parent_rc);
+        LVArray<ldomFinalBlockPos> new_blocks;
+        collectFinalBlocks( node, parent_rc.top, new_blocks );
+        LVArray<ldomFinalBlockPos> blocks;
+        blocks.reserve( _finalBlocks.length() - final_blocks_count + new_blocks.length() );
+        for ( int i=0; i<final_blocks_start; i++ )
+            blocks.add( _finalBlocks[i] );
+        blocks.add( new_blocks );
+        for ( int i=final_blocks_start+final_blocks_count; i<_finalBlocks.length(); i++ ) {
+            ldomFinalBlockPos pos = _finalBlocks[i];
+            pos.top += next_fragments_shift_y;
+            pos.bottom += next_fragments_shift_y;
+            blocks.add( pos );
+        }
+        _finalBlocks.clear();
+        _finalBlocks.add( blocks );
+        updateFinalBlockIndexLookups();
+    }
+
     _partial_rerenderings_count++;
     return true;
     // We don't do anything more: this should allow most of crengine features like
@@ -5589,15 +7493,25 @@ bool ldomDocument::render( LVRendPageList * pages, LVDocViewCallback * callback,
                 CRTimerUtil infinite;
                 _cacheFile->flush(false, infinite);
             }
+            // We need to init the styles of the root node and the parent node of the fragments
+            // (and those in between), so each fragment we will partially render can inherit
+            // updated styles from them.
+            initRerenderingFragmentsPathStyles();
+            if ( _progressive_rendering && !isRerenderingFragmentsPathUsable( getTinyNode(_rerendering_fragments_parent) ) ) {
+                // The new styles gave them some margin, border or padding, or removed page
+                // breaks between fragments: fragments can't be rendered independently, go on
+                // with a full rerendering (LVDocView will enable progressive rendering again
+                // after it).
+                CRLog::info("progressive rendering not possible with new styles - full render required...");
+                enablePartialRerendering( false );
+            }
+        }
+        if ( _rendered && _partial_rerendering_enabled && !was_just_rendered_from_cache ) {
             // Be sure we don't save a cache with partial rendering stuff: any previous cache (even
             // the one we opened from) will be fine if we are going to reload from it: the DOM will
             // be available, and if the rendering hash doesn't match, a full rerendering will be made.
             setCacheFileStale(false);
 
-            // We need to init the styles of the root node and the parent node of the DocFragments,
-            // so each DocFragment we will partially render can inherit updated styles from it.
-            getRootNode()->initNodeStyle();
-            getRootNode()->getChildNode(0)->initNodeStyle();
             // Resets list items info (ie. padding, which may depend on the font size). This affects
             // the whole document, but they will be recomputed when needed.
             resetNodeNumberingProps();
@@ -5613,6 +7527,10 @@ bool ldomDocument::render( LVRendPageList * pages, LVDocViewCallback * callback,
             return false;
         }
 
+        // Keep the layout we are leaving in the cache file, for when switching back to its settings
+        if ( _cacheFile )
+            saveLayoutProfile();
+
         if ( _nodeDisplayStyleHashInitial == NODE_DISPLAY_STYLE_HASH_UNINITIALIZED ) { // happen when just loaded
             // For knowing/debugging cases when node styles set up during loading
             // is invalid (should happen now only when EPUB has embedded fonts
@@ -5622,6 +7540,8 @@ bool ldomDocument::render( LVRendPageList * pages, LVDocViewCallback * callback,
         CRLog::info("rendering context is changed - full render required...");
         // Clear LFormattedTextRef cache
         _renderedBlockCache.clear();
+        // and widths measured with the styles we are about to drop
+        clearRenderedWidths();
         CRLog::trace("init format data...");
         //CRLog::trace("validate 1...");
         //validateDocument();
@@ -5674,6 +7594,16 @@ bool ldomDocument::render( LVRendPageList * pages, LVDocViewCallback * callback,
 //        CRLog::debug("Style hash: %x", styleHash);
 
         _rendered = false;
+
+        // With the node styles now set, the rendering hash is known: if a layout has been
+        // saved for it, restore it instead of formatting the document again
+        if ( _cacheFile && restoreLayoutProfile( pages ) ) {
+            _rendered = true;
+            setCacheFileStale(true); // restored layout: cache file will be updated
+            if ( callback )
+                callback->OnDocumentReady();
+            return true; // full (re-)rendering done
+        }
     }
     if ( !_rendered ) {
         if ( callback ) {
@@ -5707,6 +7637,8 @@ bool ldomDocument::render( LVRendPageList * pages, LVDocViewCallback * callback,
         updateRenderContext();
         _pagesData.reset();
         pages->serialize( _pagesData );
+        buildFinalBlockIndex();
+        serializeFinalBlockIndex( _pagesData );
         _renderedBlockCache.restoreSize(); // Restore original cache size
 
         if ( _nodeDisplayStyleHashInitial == NODE_DISPLAY_STYLE_HASH_UNINITIALIZED ) {
@@ -5740,6 +7672,7 @@ bool ldomDocument::render( LVRendPageList * pages, LVDocViewCallback * callback,
         if ( was_just_rendered_from_cache && _pagesData.pos() ) {
             _pagesData.setPos(0);
             pages->deserialize( _pagesData );
+            deserializeFinalBlockIndex( _pagesData );
         }
         CRLog::info("%d rendered pages found", pages->length() );
 
@@ -12448,9 +14381,10 @@ bool ldomDocument::findText( lString32 pattern, bool caseInsensitive, bool rever
     // Find a valid y near each of them that does resolve to a XPointer:
     // We also want to get start/end point to logical-order HTML nodes,
     // which might be different from visual-order in bidi text.
+    // (Instead of trying each y, we jump to the next final block edge.)
     ldomXPointer start;
     ldomXPointer end;
-    for (int y = minY; y >= 0; y--) {
+    for (int y = minY; y >= 0; y = getFinalBlockScanY(y, false)) {
         start = createXPointer( lvPoint(0, y), reverse ? PT_DIR_SCAN_BACKWARD_LOGICAL_FIRST
                                                        : PT_DIR_SCAN_FORWARD_LOGICAL_FIRST );
         if (!start.isNull())
@@ -12459,14 +14393,14 @@ bool ldomDocument::findText( lString32 pattern, bool caseInsensitive, bool rever
     if (start.isNull()) {
         // If none found (can happen when minY=0 and blank content at start
         // of document like a <br/>), scan forward from document start
-        for (int y = 0; y <= fh; y++) {
+        for (int y = 0; y <= fh; y = getFinalBlockScanY(y, true)) {
             start = createXPointer( lvPoint(0, y), reverse ? PT_DIR_SCAN_BACKWARD_LOGICAL_FIRST
                                                            : PT_DIR_SCAN_FORWARD_LOGICAL_FIRST );
             if (!start.isNull())
                 break;
         }
     }
-    for (int y = maxY; y <= fh; y++) {
+    for (int y = maxY; y <= fh; y = getFinalBlockScanY(y, true)) {
         end = createXPointer( lvPoint(10000, y), reverse ? PT_DIR_SCAN_BACKWARD_LOGICAL_LAST
                                                          : PT_DIR_SCAN_FORWARD_LOGICAL_LAST );
         if (!end.isNull())
@@ -12475,7 +14409,7 @@ bool ldomDocument::findText( lString32 pattern, bool caseInsensitive, bool rever
     if (end.isNull()) {
         // If none found (can happen when maxY=fh and blank content at end
         // of book like a <br/>), scan backward from document end
-        for (int y = fh; y >= 0; y--) {
+        for (int y = fh; y >= 0; y = getFinalBlockScanY(y, false)) {
             end = createXPointer( lvPoint(10000, y), reverse ? PT_DIR_SCAN_BACKWARD_LOGICAL_LAST
                                                              : PT_DIR_SCAN_FORWARD_LOGICAL_LAST );
             if (!end.isNull())
@@ -12624,8 +14558,8 @@ static int findRegex( const lString32 & str, int & pos, int & endpos, lString32
     if ( pos != 0 && searchPattern[0] == '^')
         return REGEX_NOT_FOUND;
 
-    static lString32 oldPattern;
-    static srell::u32regex regexp;
+    static CR_THREAD_LOCAL lString32 oldPattern;
+    static CR_THREAD_LOCAL srell::u32regex regexp;
     // poor mans cache of regexp and str_wo_hyphens across calls
     if (oldPattern != searchPattern || oldPattern == "") {
         if (generateRegex( searchPattern, regexp) != 0) {
@@ -12635,9 +14569,9 @@ static int findRegex( const lString32 & str, int & pos, int & endpos, lString32
         oldPattern = searchPattern;
     }
 
-    static lString32 old_str;
-    static lString32 str_wo_hyph;
-    static bool has_soft_hyphens;
+    static CR_THREAD_LOCAL lString32 old_str;
+    static CR_THREAD_LOCAL lString32 str_wo_hyph;
+    static CR_THREAD_LOCAL bool has_soft_hyphens;
     if (old_str != str) {
         str_wo_hyph = removeSoftHyphens(str);
         has_soft_hyphens = str_wo_hyph.length() != str.length();
@@ -12694,17 +14628,17 @@ static int findRegexRev( const lString32 & str, int & pos, int & endpos, lString
         return REGEX_NOT_FOUND;
 
     // poor mans cache of regexp and str_wo_hyphens across calls
-    static lString32 oldPattern;
-    static srell::u32regex regexp;
+    static CR_THREAD_LOCAL lString32 oldPattern;
+    static CR_THREAD_LOCAL srell::u32regex regexp;
     if (oldPattern != searchPattern) {
         if (generateRegex( searchPattern, regexp) != 0)
             return REGEX_NOT_FOUND;
         oldPattern = searchPattern;
     }
 
-    static lString32 old_str;
-    static lString32 str_wo_hyph;
-    static bool has_soft_hyphens;
+    static CR_THREAD_LOCAL lString32 old_str;
+    static CR_THREAD_LOCAL lString32 str_wo_hyph;
+    static CR_THREAD_LOCAL bool has_soft_hyphens;
     if (old_str != str) {
         str_wo_hyph = removeSoftHyphens(str);
         has_soft_hyphens = str_wo_hyph.length() != str.length();
@@ -13473,6 +15407,94 @@ static bool findTextEnhanced(const lString32 & pattern, bool caseInsensitive, bo
 }
 // findTextEnhanced() helpers end
 
+/// get text fragments any match must contain, for the text search index (false if any text may match)
+static bool getFindTextLiterals( const lString32 & pattern, bool patternIsRegex, lString32Collection & literals )
+{
+    #if USE_SRELL_REGEX == 1
+    if ( patternIsRegex ) {
+        // Only consider literal runs at top level, outside any group or
+        // character class, and not made optional by a quantifier.
+        lString32 run;
+        int depth = 0;
+        int len = pattern.length();
+        for ( int i=0; i<len; i++ ) {
+            lChar32 ch = pattern[i];
+            bool literal = false;
+            if ( ch == '\\' ) {
+                if ( i+1 >= len )
+                    break;
+                ch = pattern[++i];
+                if ( (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') ) {
+                    // a class or an assertion ends the run; stop on escapes
+                    // with arguments (\u, \x, \p, \c, \k...) or backreferences
+                    if ( strchr("dDwWsSbBnrtfv", (char)ch) == NULL )
+                        break;
+                }
+                else {
+                    literal = true;
+                }
+            }
+            else if ( ch == '[' ) {
+                // skip class
+                for ( i++; i<len && pattern[i] != ']'; i++ ) {
+                    if ( pattern[i] == '\\' )
+                        i++;
+                }
+            }
+            else if ( ch == '(' ) {
+                depth++;
+            }
+            else if ( ch == ')' ) {
+                depth--;
+            }
+            else if ( ch == '|' ) {
+                if ( depth <= 0 ) {
+                    // top level alternative: nothing required
+                    literals.clear();
+                    return false;
+                }
+            }
+            else if ( ch == '?' || ch == '*' || ch == '{' ) {
+                // previous char may be absent
+                if ( !run.empty() )
+                    run.erase( run.length()-1, 1 );
+                if ( ch == '{' ) {
+                    while ( i+1<len && pattern[i+1] != '}' )
+                        i++;
+                }
+            }
+            else if ( ch != '.' && ch != '^' && ch != '$' && ch != '+' && ch != '}' && ch != ']' ) {
+                literal = true;
+            }
+            if ( literal && depth == 0 ) {
+                run << ch;
+                continue;
+            }
+            // ('+': previous char is there at least once, kept in the run)
+            if ( run.length() >= 3 )
+                literals.add( run );
+            run.clear();
+        }
+        if ( run.length() >= 3 )
+            literals.add( run );
+        return literals.length() > 0;
+    }
+    #endif
+    CR_UNUSED(patternIsRegex);
+    literals.add( pattern );
+    return true;
+}
+
+/// returns text node length, in chars, without decoding it
+static int getTextNodeLength( ldomNode * node )
+{
+    ldomTextView view;
+    node->getTextView( view );
+    if ( view.empty() || !view.data()[0] ) // (as Utf8ToUnicode())
+        return 0;
+    return Utf8CharCount( view.data(), view.length() );
+}
+
 /// searches for specified text inside range
 bool ldomXRange::findText( lString32 pattern, bool caseInsensitive, bool reverse, ldomXRangeList & ranges, int maxCount, int maxHeight, int maxHeightCheckStartY, bool checkMaxFromStart, bool patternIsRegex, lUInt32 searchFlags )
 {
@@ -13524,17 +15546,29 @@ bool ldomXRange::findText( lString32 pattern, bool caseInsensitive, bool reverse
         // Enhanced search needs the block buffer/origin mapping path.
         return findTextEnhanced(pattern, caseInsensitive, reverse, _start, _end, ranges, maxCount, maxHeight, maxHeightCheckStartY, checkMaxFromStart, patternIsRegex, searchFlags);
     }
+    // With the text search index, only text nodes that may contain
+    // a match are decoded and searched
+    ldomTextSearchIndex * searchIndex = NULL;
+    LVArray<lUInt8> candidates;
+    if ( !_start.isNull() ) {
+        searchIndex = _start.getNode()->getDocument()->getTextSearchIndex();
+        lString32Collection literals;
+        if ( searchIndex && !( getFindTextLiterals( pattern, patternIsRegex, literals )
+                                && searchIndex->getCandidates( literals, candidates ) ) )
+            searchIndex = NULL;
+    }
+    // node text is decoded into the same buffer for all nodes
+    lString32 txt;
     if ( reverse ) {
         // reverse search
         if ( !_end.isText() ) {
             _end.prevVisibleText();
-            lString32 txt = _end.getNode()->getText();
-            _end.setOffset(txt.length());
+            _end.setOffset( getTextNodeLength(_end.getNode()) );
         }
         int firstFoundTextY = -1;
         while ( !isNull() ) {
 
-            lString32 txt = _end.getNode()->getText();
+            bool candidate = !searchIndex || searchIndex->mayContain( candidates, _end.getNode()->getDataIndex() >> 4 );
             int offs = _end.getOffset();
             int endpos;
 
@@ -13545,10 +15579,13 @@ bool ldomXRange::findText( lString32 pattern, bool caseInsensitive, bool reverse
                     return ranges.length()>0;
             }
 
-            if ( caseInsensitive )
-                txt.lowercase();
+            if ( candidate ) {
+                _end.getNode()->getText( txt );
+                if ( caseInsensitive )
+                    txt.lowercase();
+            }
 
-            while ( ::findTextRev( txt, offs, endpos, pattern, patternIsRegex ) ) {
+            while ( candidate && ::findTextRev( txt, offs, endpos, pattern, patternIsRegex ) ) {
                 if ( firstFoundTextY==-1 && maxHeight>0 ) {
                     ldomXPointer p( _end.getNode(), offs );
                     int currentTextY = p.toPoint().y;
@@ -13560,8 +15597,7 @@ bool ldomXRange::findText( lString32 pattern, bool caseInsensitive, bool reverse
             }
             if ( !_end.prevVisibleText() )
                 break;
-            txt = _end.getNode()->getText();
-            _end.setOffset(txt.length());
+            _end.setOffset( getTextNodeLength(_end.getNode()) );
             if ( ranges.length() >= maxCount )
                 break;
         }
@@ -13586,11 +15622,14 @@ bool ldomXRange::findText( lString32 pattern, bool caseInsensitive, bool reverse
                     return ranges.length()>0;
             }
 
-            lString32 txt = _start.getNode()->getText();
-            if ( caseInsensitive )
-                txt.lowercase();
+            bool candidate = !searchIndex || searchIndex->mayContain( candidates, _start.getNode()->getDataIndex() >> 4 );
+            if ( candidate ) {
+                _start.getNode()->getText( txt );
+                if ( caseInsensitive )
+                    txt.lowercase();
+            }
 
-            while ( ::findText( txt, offs, endpos, pattern, patternIsRegex ) ) {
+            while ( candidate && ::findText( txt, offs, endpos, pattern, patternIsRegex ) ) {
                 if ( firstFoundTextY==-1 && maxHeight>0 ) {
                     ldomXPointer p( _start.getNode(), offs );
                     int currentTextY = p.toPoint().y;
@@ -14844,13 +16883,13 @@ bool ldomXPointerEx::prevVisibleWordStart( bool thisBlockOnly )
             if ( !prevVisibleText(thisBlockOnly) )
                 return false;
             node = getNode();
-            text = node->getText();
+            node->getText( text );
             int textLen = text.length();
             _data->setOffset( textLen );
             moved = true;
         } else {
             node = getNode();
-            text = node->getText();
+            node->getText( text );
         }
 
         while ( _data->getOffset() >= 0 ) {
@@ -14894,13 +16933,13 @@ bool ldomXPointerEx::prevVisibleWordEnd( bool thisBlockOnly )
             if ( !prevVisibleText(thisBlockOnly) )
                 return false;
             node = getNode();
-            text = node->getText();
+            node->getText( text );
             int textLen = text.length();
             _data->setOffset( textLen );
             moved = true;
         } else {
             node = getNode();
-            text = node->getText();
+            node->getText( text );
         }
 
         // Note: end/right offset is excluding, so it's the previous char that
@@ -14943,14 +16982,14 @@ bool ldomXPointerEx::nextVisibleWordStart( bool thisBlockOnly )
             if ( !nextVisibleText(thisBlockOnly) )
                 return false;
             node = getNode();
-            text = node->getText();
+            node->getText( text );
             textLen = text.length();
             _data->setOffset( 0 );
             moved = true;
         } else {
             for (;;) {
                 node = getNode();
-                text = node->getText();
+                node->getText( text );
                 textLen = text.length();
                 if ( _data->getOffset() < textLen )
                     break;
@@ -15004,14 +17043,14 @@ bool ldomXPointerEx::nextVisibleWordEnd( bool thisBlockOnly )
             if ( !nextVisibleText(thisBlockOnly) )
                 return false;
             node = getNode();
-            text = node->getText();
+            node->getText( text );
             textLen = text.length();
             _data->setOffset( 0 );
             moved = true;
         } else {
             for (;;) {
                 node = getNode();
-                text = node->getText();
+                node->getText( text );
                 textLen = text.length();
                 if ( _data->getOffset() < textLen )
                     break;
@@ -15062,12 +17101,12 @@ bool ldomXPointerEx::prevVisibleWordStartInSentence(bool thisBlockOnly)
             if ( !prevVisibleText(thisBlockOnly) )
                 return false;
             node = getNode();
-            text = node->getText();
+            node->getText( text );
             int textLen = text.length();
             _data->setOffset( textLen );
         } else {
             node = getNode();
-            text = node->getText();
+            node->getText( text );
         }
         bool foundNonSpace = false;
         while ( _data->getOffset() > 0 && IsUnicodeSpace(text[_data->getOffset()-1]) )
@@ -15100,14 +17139,14 @@ bool ldomXPointerEx::nextVisibleWordStartInSentence(bool thisBlockOnly)
             if ( !nextVisibleText(thisBlockOnly) )
                 return false;
             node = getNode();
-            text = node->getText();
+            node->getText( text );
             textLen = text.length();
             _data->setOffset( 0 );
             moved = true;
         } else {
             for (;;) {
                 node = getNode();
-                text = node->getText();
+                node->getText( text );
                 textLen = text.length();
                 if ( _data->getOffset() < textLen )
                     break;
@@ -15155,7 +17194,7 @@ bool ldomXPointerEx::thisVisibleWordEndInSentence()
     if ( !isText() || !isVisible() )
         return false;
     node = getNode();
-    text = node->getText();
+    node->getText( text );
     textLen = text.length();
     if ( _data->getOffset() >= textLen )
         return false;
@@ -15189,14 +17228,14 @@ bool ldomXPointerEx::nextVisibleWordEndInSentence(bool thisBlockOnly)
             if ( !nextVisibleText(thisBlockOnly) )
                 return false;
             node = getNode();
-            text = node->getText();
+            node->getText( text );
             textLen = text.length();
             _data->setOffset( 0 );
             //moved = true;
         } else {
             for (;;) {
                 node = getNode();
-                text = node->getText();
+                node->getText( text );
                 textLen = text.length();
                 if ( _data->getOffset() < textLen )
                     break;
@@ -15250,13 +17289,13 @@ bool ldomXPointerEx::prevVisibleWordEndInSentence(bool thisBlockOnly)
             if ( !prevVisibleText(thisBlockOnly) )
                 return false;
             node = getNode();
-            text = node->getText();
+            node->getText( text );
             int textLen = text.length();
             _data->setOffset( textLen );
             moved = true;
         } else {
             node = getNode();
-            text = node->getText();
+            node->getText( text );
         }
         // skip spaces
         while ( _data->getOffset() > 0 && IsUnicodeSpace(text[_data->getOffset()-1]) ) {
@@ -15285,21 +17324,39 @@ bool ldomXPointerEx::prevVisibleWordEndInSentence(bool thisBlockOnly)
 }
 
 /// returns true if current position is visible word beginning
+// Gets the chars at offsets i-1 and i of a text node (0 if outside of its text),
+// decoding only them from its utf8 text
+static void getTextNodeCharsAround( ldomNode * node, int i, lChar32 & prevCh, lChar32 & currCh )
+{
+    prevCh = 0;
+    currCh = 0;
+    ldomTextView view;
+    node->getTextView( view );
+    int textLen = Utf8CharCount( view.data(), view.length() );
+    int first = i > 0 ? i-1 : 0;
+    int last = i < textLen ? i : i-1;
+    if ( first > last || last >= textLen )
+        return;
+    lChar32 chars[2];
+    Utf8DecodeChars( view.data(), first, chars, last-first+1 );
+    if ( i > 0 )
+        prevCh = chars[0];
+    if ( i < textLen )
+        currCh = chars[i-first];
+}
+
 bool ldomXPointerEx::isVisibleWordStart()
 {
    if ( isNull() )
         return false;
     if ( !isText() || !isVisible() )
         return false;
-    ldomNode * node = getNode();
-    lString32 text = node->getText();
-    int textLen = text.length();
-    int i = _data->getOffset();
     // We're actually testing the boundary between the char at i-1 and
     // the char at i. So, we return true when [i] is the first letter
     // of a word.
-    lChar32 currCh = i<textLen ? text[i] : 0;
-    lChar32 prevCh = i<=textLen && i>0 ? text[i-1] : 0;
+    lChar32 currCh;
+    lChar32 prevCh;
+    getTextNodeCharsAround( getNode(), _data->getOffset(), prevCh, currCh );
     if ( IsWordChar(currCh) && (IsWordBoundary(currCh) || IsWordBoundary(prevCh)) )
         return true;
     return false;
@@ -15312,15 +17369,12 @@ bool ldomXPointerEx::isVisibleWordEnd()
         return false;
     if ( !isText() || !isVisible() )
         return false;
-    ldomNode * node = getNode();
-    lString32 text = node->getText();
-    int textLen = text.length();
-    int i = _data->getOffset();
     // We're actually testing the boundary between the char at i-1 and
     // the char at i. So, we return true when [i-1] is the last letter
     // of a word.
-    lChar32 currCh = i>0 ? text[i-1] : 0;
-    lChar32 nextCh = i<textLen ? text[i] : 0;
+    lChar32 currCh;
+    lChar32 nextCh;
+    getTextNodeCharsAround( getNode(), _data->getOffset(), currCh, nextCh );
     if ( IsWordChar(currCh) && (IsWordBoundary(currCh) || IsWordBoundary(nextCh)) )
         return true;
     return false;
@@ -16005,6 +18059,7 @@ private:
     lChar32 imageReplacement;
     LVArray<ldomNode*> * imageNodes;
     lString32 text;
+    lString32 nodeText; // reused for decoding each text node
 public:
     ldomTextCollector( lChar32 blockDelimiter, lChar32 imageReplacementChar, LVArray<ldomNode*> * imageNodesArray )
         : newBlock(true), delimiter( blockDelimiter)
@@ -16019,11 +18074,13 @@ public:
         if ( newBlock && !text.empty()) {
             text << delimiter;
         }
-        lString32 txt = nodeRange->getStart().getNode()->getText();
+        nodeRange->getStart().getNode()->getText( nodeText );
         int start = nodeRange->getStart().getOffset();
         int end = nodeRange->getEnd().getOffset();
+        if ( end > nodeText.length() )
+            end = nodeText.length();
         if ( start < end ) {
-            text << txt.substr( start, end-start );
+            text.append( nodeText.c_str() + start, end-start );
         }
         newBlock = false;
     }
@@ -17976,6 +20033,20 @@ bool ldomDocument::loadCacheFileContent(CacheLoadingCallback * formatCallback, L
         CRLog::info("%d pages read from cache file", pages.length());
         //_pagesData.setPos( 0 );
 
+        // Text search index (optional: built on first search if missing or empty)
+        delete _textSearchIndex;
+        _textSearchIndex = NULL;
+        if ( _textSearchIndexEnabled ) {
+            SerialBuf indexbuf(0, true);
+            if ( _cacheFile->read( CBT_TEXT_SEARCH_INDEX, indexbuf ) ) {
+                ldomTextSearchIndex * index = new ldomTextSearchIndex();
+                if ( index->deserialize( indexbuf ) && !index->empty() )
+                    _textSearchIndex = index;
+                else
+                    delete index;
+            }
+        }
+
         if (progressCallback) progressCallback->OnLoadFileProgress(20);
         CRLog::trace("ldomDocument::loadCacheFileContent() - embedded font data");
         {
@@ -18234,6 +20305,23 @@ ContinuousOperationResult ldomDocument::saveChanges( CRTimerUtil & maxTime, LVDo
         CHECK_EXPIRATION("saving page data")
         if (progressCallback) progressCallback->OnSaveCacheFileProgress(60);
         // fall through
+    case 71:
+        _mapSavingStage = 71;
+        if ( !_textSearchIndex ) {
+            // disabled or dropped: no block, and no stale one to be loaded later
+            _cacheFile->remove( CBT_TEXT_SEARCH_INDEX, 0 );
+        } else if ( _textSearchIndex->isModified() ) {
+            CRLog::trace("ldomDocument::saveChanges() - text search index");
+            SerialBuf indexbuf(0, true);
+            _textSearchIndex->serialize( indexbuf );
+            if ( !_cacheFile->write( CBT_TEXT_SEARCH_INDEX, indexbuf, COMPRESS_TEXT_SEARCH_INDEX ) ) {
+                CRLog::error("Error while saving text search index");
+                return CR_ERROR;
+            }
+            _textSearchIndex->setModified( false );
+        }
+        CHECK_EXPIRATION("saving text search index")
+        // fall through
     case 8:
         _mapSavingStage = 8;
 
@@ -18976,8 +21064,8 @@ public:
         return writeIndex();
     }
 
-    // dir/filename.{crc32}.cr3
-    lString32 makeFileName( lString32 filename, lUInt32 crc, lUInt32 docFlags )
+    // dir/filename.{crc32}.cr3 or dir/filename.{fingerprint}.cr3
+    lString32 makeFileName( lString32 filename, const char * key, lUInt32 docFlags )
     {
         lString32 fn;
         lString8 filename8 = UnicodeToTranslit(filename);
@@ -19003,15 +21091,30 @@ public:
             fn << "_noname";
         if (fn.length() > 25)
             fn = fn.substr(0, 12) + "-" + fn.substr(fn.length()-12, 12);
-        char s[16];
-        sprintf(s, ".%08x.%d.cr3", (unsigned)crc, (int)docFlags);
+        char s[48];
+        sprintf(s, ".%s.%d.cr3", key, (int)docFlags);
         return fn + lString32( s ); //_cacheDir +
     }
 
+    // file key is 8 hex digits for crc32, 16 for fingerprint, so they don't clash
+    static lString8 crcKey( lUInt32 crc )
+    {
+        char s[16];
+        sprintf(s, "%08x", (unsigned)crc);
+        return lString8( s );
+    }
+
+    static lString8 fingerprintKey( lUInt64 fingerprint )
+    {
+        char s[24];
+        sprintf(s, "%08x%08x", (unsigned)(fingerprint >> 32), (unsigned)(fingerprint & 0xFFFFFFFF));
+        return lString8( s );
+    }
+
     /// open existing cache file stream
-    LVStreamRef openExisting( lString32 filename, lUInt32 crc, lUInt32 docFlags, lString32 &cachePath )
+    LVStreamRef openExisting( lString32 filename, const lString8 & key, lUInt32 docFlags, lString32 &cachePath )
     {
-        lString32 fn = makeFileName( filename, crc, docFlags );
+        lString32 fn = makeFileName( filename, key.c_str(), docFlags );
         CRLog::debug("ldomDocCache::openExisting(%s)", LCSTR(fn));
         // Try filename with ".keep" extension (that a user can manually add
         // to a .cr3 cache file, for it to no more be maintained by crengine
@@ -19061,9 +21164,9 @@ public:
     }
 
     /// create new cache file
-    LVStreamRef createNew( lString32 filename, lUInt32 crc, lUInt32 docFlags, lUInt32 fileSize, lString32 &cachePath )
+    LVStreamRef createNew( lString32 filename, const lString8 & key, lUInt32 docFlags, lUInt32 fileSize, lString32 &cachePath )
     {
-        lString32 fn = makeFileName( filename, crc, docFlags );
+        lString32 fn = makeFileName( filename, key.c_str(), docFlags );
         LVStreamRef res;
         lString32 pathname = _cacheDir + fn;
         // If this cache filename exists with a ".keep" extension (manually
@@ -19146,7 +21249,15 @@ LVStreamRef ldomDocCache::openExisting( lString32 filename, lUInt32 crc, lUInt32
 {
     if ( !_cacheInstance )
         return LVStreamRef();
-    return _cacheInstance->openExisting( filename, crc, docFlags, cachePath );
+    return _cacheInstance->openExisting( filename, ldomDocCacheImpl::crcKey( crc ), docFlags, cachePath );
+}
+
+/// open existing cache file stream, by content fingerprint
+LVStreamRef ldomDocCache::openExisting( lString32 filename, lUInt64 fingerprint, lUInt32 docFlags, lString32 &cachePath )
+{
+    if ( !_cacheInstance )
+        return LVStreamRef();
+    return _cacheInstance->openExisting( filename, ldomDocCacheImpl::fingerprintKey( fingerprint ), docFlags, cachePath );
 }
 
 /// create new cache file
@@ -19154,7 +21265,15 @@ LVStreamRef ldomDocCache::createNew( lString32 filename, lUInt32 crc, lUInt32 do
 {
     if ( !_cacheInstance )
         return LVStreamRef();
-    return _cacheInstance->createNew( filename, crc, docFlags, fileSize, cachePath );
+    return _cacheInstance->createNew( filename, ldomDocCacheImpl::crcKey( crc ), docFlags, fileSize, cachePath );
+}
+
+/// create new cache file, by content fingerprint
+LVStreamRef ldomDocCache::createNew( lString32 filename, lUInt64 fingerprint, lUInt32 docFlags, lUInt32 fileSize, lString32 &cachePath )
+{
+    if ( !_cacheInstance )
+        return LVStreamRef();
+    return _cacheInstance->createNew( filename, ldomDocCacheImpl::fingerprintKey( fingerprint ), docFlags, fileSize, cachePath );
 }
 
 /// delete all cache files
@@ -19429,6 +21548,7 @@ void ldomNode::destroy()
         {
 #if BUILD_LITE!=1
             getDocument()->clearNodeStyle(_handle._dataIndex);
+            getDocument()->dropRenderedWidths( this );
 #endif
             tinyElement * me = NPELEM;
             // delete children
@@ -19452,6 +21572,7 @@ void ldomNode::destroy()
             for ( int i=0; i<me->childCount; i++ )
                 getDocument()->getTinyNode( me->children[i] )->destroy();
             getDocument()->clearNodeStyle( _handle._dataIndex );
+            getDocument()->dropRenderedWidths( this );
 //            getDocument()->_styles.release( _data._pelem._styleIndex );
 //            getDocument()->_fonts.release( _data._pelem._fontIndex );
 //            _data._pelem._styleIndex = 0;
@@ -19919,11 +22040,13 @@ void ldomNode::setAttributeValue( lUInt16 nsid, lUInt16 id, const lChar32 * valu
         if ( attr ) {
             attr->index = valueIndex;
             modified();
+            getDocument()->dropRenderedWidths( this ); // (ie. colspan)
             return;
         }
         // else: convert to modifable and continue as non-persistent
         modify();
     }
+    getDocument()->dropRenderedWidths( this );
 #endif
     // element
     tinyElement * me = NPELEM;
@@ -20192,7 +22315,11 @@ lString32 ldomNode::getText( lChar32 blockDelimiter, int maxSize ) const
         break;
 #if BUILD_LITE!=1
     case NT_PTEXT:
-        return Utf8ToUnicode(getDocument()->_textStorage.getText( _data._ptext_addr ));
+        {
+            ldomTextView view;
+            getDocument()->_textStorage.getTextView( _data._ptext_addr, view );
+            return Utf8ToUnicode( view.data(), view.length() );
+        }
 #endif
     case NT_TEXT:
         return _data._text_ptr->getText32();
@@ -20235,10 +22362,60 @@ lString8 ldomNode::getText8( lChar8 blockDelimiter, int maxSize ) const
     return lString8::empty_str;
 }
 
+/// returns text node text into dst, reusing dst buffer
+void ldomNode::getText( lString32 & dst ) const
+{
+    ASSERT_NODE_NOT_NULL;
+    switch ( TNTYPE ) {
+#if BUILD_LITE!=1
+    case NT_PTEXT:
+        {
+            ldomTextView view;
+            getDocument()->_textStorage.getTextView( _data._ptext_addr, view );
+            view.decode( dst );
+        }
+        return;
+#endif
+    case NT_TEXT:
+        {
+            lString8 txt = _data._text_ptr->getText();
+            Utf8ToUnicode( txt.c_str(), txt.length(), dst );
+        }
+        return;
+    }
+    dst = getText();
+}
+
+/// sets view to text node utf8 text, without copying it
+void ldomNode::getTextView( ldomTextView & view ) const
+{
+    ASSERT_NODE_NOT_NULL;
+    switch ( TNTYPE ) {
+#if BUILD_LITE!=1
+    case NT_PTEXT:
+        getDocument()->_textStorage.getTextView( _data._ptext_addr, view );
+        return;
+#endif
+    case NT_TEXT:
+        view.reset();
+        view._holder = _data._text_ptr->getText();
+        view._text = view._holder.c_str();
+        view._len = view._holder.length();
+        return;
+    }
+    view.reset();
+}
+
 /// sets text node text as wide string
 void ldomNode::setText( lString32 str )
 {
     ASSERT_NODE_NOT_NULL;
+#if BUILD_LITE!=1
+    if ( isText() ) {
+        getDocument()->onTextNodeModified();
+        getDocument()->dropRenderedWidths( getParentNode() );
+    }
+#endif
     switch ( TNTYPE ) {
     case NT_ELEMENT:
         readOnlyError();
@@ -20270,6 +22447,12 @@ void ldomNode::setText( lString32 str )
 void ldomNode::setText8( lString8 utf8 )
 {
     ASSERT_NODE_NOT_NULL;
+#if BUILD_LITE!=1
+    if ( isText() ) {
+        getDocument()->onTextNodeModified();
+        getDocument()->dropRenderedWidths( getParentNode() );
+    }
+#endif
     switch ( TNTYPE ) {
     case NT_ELEMENT:
         readOnlyError();
@@ -20860,6 +23043,9 @@ void ldomNode::setRendMethod( lvdom_element_render_method method )
     if ( isElement() ) {
 #if BUILD_LITE!=1
         if ( !isPersistent() ) {
+            // (ie. erm_killed set on invalid tables while rendering)
+            if ( NPELEM->_rendMethod != method )
+                getDocument()->dropRenderedWidths( this );
 #endif
             NPELEM->_rendMethod = method;
 #if BUILD_LITE!=1
@@ -20868,6 +23054,7 @@ void ldomNode::setRendMethod( lvdom_element_render_method method )
             if ( me->rendMethod != method ) {
                 me->rendMethod = (lUInt8)method;
                 modified();
+                getDocument()->dropRenderedWidths( this );
             }
         }
 #endif
@@ -20899,7 +23086,10 @@ void ldomNode::setFont( font_ref_t font )
 {
     ASSERT_NODE_NOT_NULL;
     if  ( isElement() ) {
+        lUInt16 fontIndex = getDocument()->getNodeFontIndex( _handle._dataIndex );
         getDocument()->setNodeFont( _handle._dataIndex, font );
+        if ( getDocument()->getNodeFontIndex( _handle._dataIndex ) != fontIndex )
+            getDocument()->dropRenderedWidths( this );
     }
 }
 
@@ -20908,7 +23098,11 @@ void ldomNode::setStyle( css_style_ref_t & style )
 {
     ASSERT_NODE_NOT_NULL;
     if  ( isElement() ) {
+        lUInt16 styleIndex = getDocument()->getNodeStyleIndex( _handle._dataIndex );
         getDocument()->setNodeStyle( _handle._dataIndex, style );
+        // (ie. table cells borders collapsed while rendering)
+        if ( getDocument()->getNodeStyleIndex( _handle._dataIndex ) != styleIndex )
+            getDocument()->dropRenderedWidths( this );
     }
 }
 
@@ -21518,6 +23712,9 @@ void ldomNode::addChild( lInt32 childNodeIndex )
         modify(); // convert to mutable element
     tinyElement * me = NPELEM;
     me->_children.add( childNodeIndex );
+#if BUILD_LITE!=1
+    getDocument()->dropRenderedWidths( this );
+#endif
 }
 
 bool ldomNode::removeStandaloneWhitespaceTextChildrenInMixedContent( bool handleFloating )
@@ -21625,6 +23822,9 @@ void ldomNode::moveItemsTo( ldomNode * destination, int startChildIndex, int end
         item->setParentNode(destination);
         destination->addChild( item->getDataIndex() );
     }
+#if BUILD_LITE!=1
+    getDocument()->dropRenderedWidths( this );
+#endif
     destination->persist();
     // TODO: renumber rest of children in necessary
 /*#ifdef _DEBUG
@@ -21689,6 +23889,9 @@ ldomNode * ldomNode::insertChildElement( lUInt32 index, lUInt16 nsid, lUInt16 id
             index = me->_children.length();
         ldomNode * node = getDocument()->allocTinyElement( this, nsid, id );
         me->_children.insert( index, node->getDataIndex() );
+#if BUILD_LITE!=1
+        getDocument()->dropRenderedWidths( this );
+#endif
         return node;
     }
     readOnlyError();
@@ -21704,6 +23907,9 @@ ldomNode * ldomNode::insertChildElement( lUInt16 id )
             modify();
         ldomNode * node = getDocument()->allocTinyElement( this, LXML_NS_NONE, id );
         NPELEM->_children.insert( NPELEM->_children.length(), node->getDataIndex() );
+#if BUILD_LITE!=1
+        getDocument()->dropRenderedWidths( this );
+#endif
         return node;
     }
     readOnlyError();
@@ -21731,6 +23937,10 @@ ldomNode * ldomNode::insertChildText( lUInt32 index, const lString32 & value )
         node->_data._ptext_addr = getDocument()->_textStorage.allocText( node->_handle._dataIndex, _handle._dataIndex, s8 );
 #endif
         me->_children.insert( index, node->getDataIndex() );
+#if BUILD_LITE!=1
+        getDocument()->onTextNodeAdded( node, s8 );
+        getDocument()->dropRenderedWidths( this );
+#endif
         return node;
     }
     readOnlyError();
@@ -21755,6 +23965,10 @@ ldomNode * ldomNode::insertChildText( const lString32 & value )
         node->_data._ptext_addr = getDocument()->_textStorage.allocText( node->_handle._dataIndex, _handle._dataIndex, s8 );
 #endif
         me->_children.insert( me->_children.length(), node->getDataIndex() );
+#if BUILD_LITE!=1
+        getDocument()->onTextNodeAdded( node, s8 );
+        getDocument()->dropRenderedWidths( this );
+#endif
         return node;
     }
     readOnlyError();
@@ -21780,6 +23994,10 @@ ldomNode * ldomNode::insertChildText(const lString8 & s8, bool before_last_child
         if ( before_last_child && index > 0 )
             index--;
         me->_children.insert( index, node->getDataIndex() );
+#if BUILD_LITE!=1
+        getDocument()->onTextNodeAdded( node, s8 );
+        getDocument()->dropRenderedWidths( this );
+#endif
         return node;
     }
     readOnlyError();
@@ -21795,6 +24013,9 @@ ldomNode * ldomNode::removeChild( lUInt32 index )
             modify();
         lUInt32 removedIndex = NPELEM->_children.remove(index);
         ldomNode * node = getTinyNode( removedIndex );
+#if BUILD_LITE!=1
+        getDocument()->dropRenderedWidths( this );
+#endif
         return node;
     }
     readOnlyError();
@@ -22630,6 +24851,34 @@ bool LVTocItem::serialize( SerialBuf & buf )
     return !buf.error();
 }
 
+/// serialize page numbers only, for a layout profile
+void LVTocItem::serializePages( SerialBuf & buf )
+{
+    // (root _page is the alternative TOC flag, not related to the layout)
+    buf << (lUInt32)_page << (lUInt32)_percent << (lUInt32)_children.length();
+    for ( int i=0; i<_children.length() && !buf.error(); i++ )
+        _children[i]->serializePages( buf );
+}
+
+/// deserialize page numbers only, returns false if TOC structure doesn't match
+bool LVTocItem::deserializePages( SerialBuf & buf )
+{
+    lUInt32 page = 0;
+    lUInt32 percent = 0;
+    lUInt32 childCount = 0;
+    buf >> page >> percent >> childCount;
+    if ( buf.error() || (int)childCount != _children.length() )
+        return false;
+    if ( _level > 0 )
+        _page = (lInt32)page;
+    _percent = (lInt32)percent;
+    for ( int i=0; i<_children.length(); i++ ) {
+        if ( !_children[i]->deserializePages( buf ) )
+            return false;
+    }
+    return true;
+}
+
 /// deserialize from byte array (pointer will be incremented by number of bytes read)
 bool LVTocItem::deserialize( ldomDocument * doc, SerialBuf & buf )
 {
@@ -22967,6 +25216,35 @@ bool LVPageMap::serialize( SerialBuf & buf )
     return !buf.error();
 }
 
+/// serialize page info only, for a layout profile
+void LVPageMap::serializePages( SerialBuf & buf )
+{
+    buf << (lUInt32)_valid_for_visible_page_numbers << (lUInt32)_children.length();
+    for ( int i=0; i<_children.length(); i++ )
+        buf << (lUInt32)_children[i]->_page << (lUInt32)_children[i]->_doc_y;
+}
+
+/// deserialize page info only, returns false if page map doesn't match
+bool LVPageMap::deserializePages( SerialBuf & buf )
+{
+    lUInt32 validForVisiblePageNumbers = 0;
+    lUInt32 childCount = 0;
+    buf >> validForVisiblePageNumbers >> childCount;
+    if ( buf.error() || (int)childCount != _children.length() )
+        return false;
+    for ( int i=0; i<_children.length(); i++ ) {
+        lUInt32 page = 0;
+        lUInt32 docY = 0;
+        buf >> page >> docY;
+        _children[i]->_page = (lInt32)page;
+        _children[i]->_doc_y = (lInt32)docY;
+    }
+    if ( buf.error() )
+        return false;
+    _valid_for_visible_page_numbers = (int)validForVisiblePageNumbers;
+    return true;
+}
+
 /// deserialize from byte array (pointer will be incremented by number of bytes read)
 bool LVPageMap::deserialize( ldomDocument * doc, SerialBuf & buf )
 {
@@ -2,7 +2,11 @@
 
 #include "../include/pdbfmt.h"
 #include "../include/crtxtenc.h"
+#include "../include/lvthread.h"
 #include <ctype.h>
+#if (CR_THREAD_SAFE==1)
+#include <thread>
+#endif
 
 // uncomment following line to save PDB content streams to /tmp
 //#define DUMP_PDB_CONTENTS
@@ -28,13 +32,68 @@ struct MobiFileposResolver {
     MobiFileposResolver() : targetIds(256) {}
 };
 
+// Random access to the bytes of a stream, through a couple of cached blocks,
+// so that the (possibly huge) HTML of a MOBI book can be scanned without
+// being loaded whole.
+class MobiStreamBytes {
+    enum { BLOCK_SIZE = 0x10000 };
+    struct Block {
+        int start;
+        int length;
+        lUInt8 * data;
+    };
+    LVStreamRef _stream;
+    int _size;
+    mutable Block _blocks[2];
+    mutable int _last; // most recently used block
+    lUInt8 load(int pos) const {
+        if (pos < 0 || pos >= _size)
+            return 0;
+        _last ^= 1;
+        Block & block = _blocks[_last];
+        block.start = pos & ~(BLOCK_SIZE - 1);
+        block.length = 0;
+        lvsize_t bytesRead = 0;
+        int size = _size - block.start < BLOCK_SIZE ? _size - block.start : BLOCK_SIZE;
+        if (_stream->SetPos(block.start) == (lvpos_t)block.start && _stream->Read(block.data, size, &bytesRead) == LVERR_OK)
+            block.length = (int)bytesRead;
+        if (pos - block.start >= block.length)
+            return 0; // read error
+        return block.data[pos - block.start];
+    }
+public:
+    explicit MobiStreamBytes(LVStreamRef stream) : _stream(stream), _size((int)stream->GetSize()), _last(0) {
+        for (int i = 0; i < 2; i++) {
+            _blocks[i].start = 0;
+            _blocks[i].length = 0;
+            _blocks[i].data = (lUInt8 *)malloc(BLOCK_SIZE);
+        }
+    }
+    ~MobiStreamBytes() {
+        for (int i = 0; i < 2; i++)
+            free(_blocks[i].data);
+    }
+    int size() const { return _size; }
+    inline lUInt8 operator[](int pos) const {
+        const Block & block = _blocks[_last];
+        if ((unsigned)(pos - block.start) < (unsigned)block.length)
+            return block.data[pos - block.start];
+        const Block & other = _blocks[_last ^ 1];
+        if ((unsigned)(pos - other.start) < (unsigned)other.length) {
+            _last ^= 1;
+            return other.data[pos - other.start];
+        }
+        return load(pos);
+    }
+};
+
 static int compareUInt32(const void * left, const void * right) {
     lUInt32 a = *(const lUInt32 *)left, b = *(const lUInt32 *)right;
     return (a < b) ? -1 : (a > b) ? 1 : 0;
 }
 
 // Case-insensitive match of a fixed-length ASCII string at data[pos].
-static bool matchAscii(const lUInt8 * data, int pos, const char * str, int len) {
+static bool matchAscii(const MobiStreamBytes & data, int pos, const char * str, int len) {
     for (int i = 0; i < len; i++) {
         lUInt8 ch = data[pos + i];
         lUInt8 expected = (lUInt8)str[i];
@@ -45,7 +104,7 @@ static bool matchAscii(const lUInt8 * data, int pos, const char * str, int len)
 }
 
 // Quick case-insensitive check: does data[pos..pos+6] match "filepos"?
-static bool matchFileposBytes(const lUInt8 * data, int dataSize, int pos) {
+static bool matchFileposBytes(const MobiStreamBytes & data, int dataSize, int pos) {
     if (pos + 7 > dataSize) return false;
     return matchAscii(data, pos, "filepos", 7);
 }
@@ -55,7 +114,7 @@ static bool matchFileposBytes(const lUInt8 * data, int dataSize, int pos) {
 // true (so a link can point at it instead of us injecting a duplicate id).
 // Returns false if the tag has no such attribute, or if it is empty (id=""),
 // in which case the caller injects our own id="fileposNNNN" to override it.
-static bool tagGetIdAttr(const lUInt8 * data, int tagStart, int tagEnd, lString32 & idValue) {
+static bool tagGetIdAttr(const MobiStreamBytes & data, int tagStart, int tagEnd, lString32 & idValue) {
     for (int i = tagStart; i < tagEnd; i++) {
         // An attribute name is preceded by whitespace (or the tag name).
         bool atBoundary = (i == tagStart) || data[i-1] == ' ' || data[i-1] == '\t' || data[i-1] == '\r' || data[i-1] == '\n';
@@ -93,9 +152,12 @@ static bool tagGetIdAttr(const lUInt8 * data, int tagStart, int tagEnd, lString3
         while (p < tagEnd && data[p] != '"' && data[p] != '\'' && data[p] != ' ' && data[p] != '\t' && data[p] != '\r' && data[p] != '\n' && data[p] != '>') {
             p++;
         }
-        if (p > valStart)
-            idValue = lString32((const lChar8 *)(data + valStart), p - valStart);
-        else
+        if (p > valStart) {
+            lString8 value;
+            for (int k = valStart; k < p; k++)
+                value << (char)data[k];
+            idValue = lString32(value.c_str(), value.length());
+        } else
             return false; // empty id="": let the caller inject its own id
         return true;
     }
@@ -103,7 +165,7 @@ static bool tagGetIdAttr(const lUInt8 * data, int tagStart, int tagEnd, lString3
 }
 
 // Scan raw HTML bytes for filepos="NNNN" occurrences, record the numeric values.
-static void collectMobiFileposData(const lUInt8 * data, int dataSize,
+static void collectMobiFileposData(const MobiStreamBytes & data, int dataSize,
         LVArray<lUInt32> & fileposRefs) {
     for (int i = 0; i < dataSize - 8; ) {
         lUInt8 ch = data[i];
@@ -134,23 +196,130 @@ static void collectMobiFileposData(const lUInt8 * data, int dataSize,
     }
 }
 
-// Emit an id="fileposNNNN" attribute into the stream, to be placed inside a start tag.
-static void writeFileposIdAttr(LVStreamRef & out, lUInt32 filepos) {
+// An id="fileposNNNN" attribute, to be placed inside a start tag.
+static lString8 fileposIdAttr(lUInt32 filepos) {
     char buf[64];
     int len = snprintf(buf, sizeof(buf), " id=\"%s%u\"", MOBI_FILEPOS_ID_PREFIX, (unsigned)filepos);
-    out->Write(buf, len, NULL);
+    return lString8(buf, len);
 }
 
-// Emit a standalone <a id="fileposNNNN"></a> marker.
-static void writeFileposMarker(LVStreamRef & out, lUInt32 filepos) {
+// A standalone <a id="fileposNNNN"></a> marker.
+static lString8 fileposMarker(lUInt32 filepos) {
     char buf[64];
     int len = snprintf(buf, sizeof(buf), "<a id=\"%s%u\"></a>", MOBI_FILEPOS_ID_PREFIX, (unsigned)filepos);
-    out->Write(buf, len, NULL);
+    return lString8(buf, len);
 }
 
+// Stream reading another one with strings inserted at some of its offsets,
+// so that the rewritten MOBI HTML is produced while being parsed.
+class MobiInsertionStream : public LVNamedStream {
+    LVStreamRef _stream;
+    lvsize_t _streamSize;
+    LVArray<lUInt32> _offsets;     // offsets in _stream where strings are inserted, in order
+    LVArray<lUInt32> _starts;      // offsets in this stream of inserted strings
+    LVArray<lString8> _strings;
+    lvsize_t _size;
+    lvpos_t _pos;
+public:
+    explicit MobiInsertionStream(LVStreamRef stream) : _stream(stream), _streamSize(stream->GetSize()), _size(_streamSize), _pos(0) {
+        m_mode = LVOM_READ;
+    }
+    /// inserts str at offset (not less than offset of previous insertion)
+    void insert(lUInt32 offset, const lString8 & str) {
+        _offsets.add(offset);
+        _starts.add(offset + (lUInt32)(_size - _streamSize));
+        _strings.add(str);
+        _size += str.length();
+    }
+    virtual lverror_t Seek(lvoffset_t offset, lvseek_origin_t origin, lvpos_t * pNewPos) {
+        lvpos_t npos = 0;
+        switch (origin) {
+        case LVSEEK_SET:
+            npos = offset;
+            break;
+        case LVSEEK_CUR:
+            npos = _pos + offset;
+            break;
+        case LVSEEK_END:
+            npos = _size + offset;
+            break;
+        }
+        if (npos > _size)
+            return LVERR_FAIL;
+        _pos = npos;
+        if (pNewPos)
+            *pNewPos = _pos;
+        return LVERR_OK;
+    }
+    virtual lvpos_t GetPos() { return _pos; }
+    virtual lvsize_t GetSize() { return _size; }
+    virtual lverror_t GetSize(lvsize_t * pSize) {
+        *pSize = _size;
+        return LVERR_OK;
+    }
+    virtual lverror_t SetSize(lvsize_t size) {
+        CR_UNUSED(size);
+        return LVERR_NOTIMPL;
+    }
+    virtual lverror_t Read(void * buf, lvsize_t count, lvsize_t * nBytesRead) {
+        lUInt8 * dst = (lUInt8 *)buf;
+        lvsize_t bytesRead = 0;
+        // first insertion not entirely before _pos
+        int a = 0;
+        int b = _starts.length();
+        while (a < b) {
+            int m = (a + b) / 2;
+            if (_starts[m] + (lvpos_t)_strings[m].length() <= _pos)
+                a = m + 1;
+            else
+                b = m;
+        }
+        while (count > 0 && _pos < _size) {
+            lvsize_t sz;
+            if (a < _starts.length() && _pos >= _starts[a]) {
+                // in inserted string
+                const lString8 & str = _strings[a];
+                int offset = (int)(_pos - _starts[a]);
+                sz = str.length() - offset;
+                if (sz > count)
+                    sz = count;
+                memcpy(dst, str.c_str() + offset, sz);
+                a++;
+            } else {
+                // in source, up to next inserted string
+                lvpos_t end = a < _starts.length() ? _starts[a] : _size;
+                lvpos_t inserted = a < _starts.length() ? _starts[a] - _offsets[a] : _size - _streamSize;
+                sz = end - _pos;
+                if (sz > count)
+                    sz = count;
+                if (_stream->SetPos(_pos - inserted) != _pos - inserted)
+                    return LVERR_FAIL;
+                lvsize_t n = 0;
+                if (_stream->Read(dst, sz, &n) != LVERR_OK)
+                    return LVERR_FAIL;
+                if (n == 0)
+                    break;
+                sz = n;
+            }
+            _pos += sz;
+            dst += sz;
+            count -= sz;
+            bytesRead += sz;
+        }
+        if (nBytesRead)
+            *nBytesRead = bytesRead;
+        return LVERR_OK;
+    }
+    virtual lverror_t Write(const void * buf, lvsize_t count, lvsize_t * nBytesWritten) {
+        CR_UNUSED3(buf, count, nBytesWritten);
+        return LVERR_NOTIMPL;
+    }
+    virtual bool Eof() { return _pos >= _size; }
+};
+
 // Does the start tag spanning [tagStart, tagEnd] (with data[tagEnd] == '>')
 // close itself, i.e. end with '/>' possibly preceded by whitespace?
-static bool isSelfClosingTag(const lUInt8 * data, int tagStart, int tagEnd) {
+static bool isSelfClosingTag(const MobiStreamBytes & data, int tagStart, int tagEnd) {
     int i = tagEnd - 1;
     while (i > tagStart && (data[i] == ' ' || data[i] == '\t'))
         i--;
@@ -162,7 +331,7 @@ static bool isSelfClosingTag(const lUInt8 * data, int tagStart, int tagEnd) {
 // pos is immediately followed (after whitespace) by a start tag, return that
 // tag's span. Returns false (leaving tagStart/tagEnd untouched) if neither
 // applies, i.e. the offset lands in text/whitespace with no following start tag.
-static bool findStartTagAt(const lUInt8 * data, int dataSize, int pos, int & tagStart, int & tagEnd) {
+static bool findStartTagAt(const MobiStreamBytes & data, int dataSize, int pos, int & tagStart, int & tagEnd) {
     // Is pos inside a start tag? Find the nearest '<' before pos that is not
     // already closed by a '>'.
     if (pos > 0 && pos < dataSize) {
@@ -231,13 +400,11 @@ static bool findStartTagAt(const lUInt8 * data, int dataSize, int pos, int & tag
 // by any filepos= link (used for the TOC/NCX index targets).
 static LVStreamRef preprocessMobiHtmlStream(LVStreamRef stream, MobiFileposResolver & resolver, bool allowInjectStandaloneId, const LVArray<lUInt32> * extraFileposRefs = NULL) {
     stream->SetPos(0);
-    LVByteArrayRef rawData = stream->GetData();
-    stream->SetPos(0);
-    if (rawData.isNull() || rawData->empty()) {
+    MobiStreamBytes data(stream);
+    int dataSize = data.size();
+    if (dataSize <= 0) {
         return LVStreamRef();
     }
-    const lUInt8 * data = rawData->get();
-    int dataSize = rawData->length();
 
     LVArray<lUInt32> fileposRefs;
     collectMobiFileposData(data, dataSize, fileposRefs);
@@ -249,6 +416,7 @@ static LVStreamRef preprocessMobiHtmlStream(LVStreamRef stream, MobiFileposResol
         }
     }
     if (fileposRefs.empty()) {
+        stream->SetPos(0);
         return LVStreamRef();
     }
 
@@ -264,12 +432,9 @@ static LVStreamRef preprocessMobiHtmlStream(LVStreamRef stream, MobiFileposResol
     if (n < fileposRefs.length())
         fileposRefs.erase(n, fileposRefs.length() - n);
 
-    // Build the rewritten byte array with markers inserted at filepos offsets.
-    LVStreamRef rewritten = LVCreateMemoryStream(NULL, 0, false, LVOM_READWRITE);
-    if (rewritten.isNull()) {
-        stream->SetPos(0);
-        return LVStreamRef();
-    }
+    // Second pass: list the markers to insert at filepos offsets, which the
+    // rewritten stream inserts while it's read.
+    MobiInsertionStream * rewritten = new MobiInsertionStream(stream);
     int outPos = 0;
     for (int i = 0; i < fileposRefs.length(); i++) {
         lUInt32 filepos = fileposRefs[i];
@@ -292,32 +457,26 @@ static LVStreamRef preprocessMobiHtmlStream(LVStreamRef stream, MobiFileposResol
         if (insertPos < outPos)
             insertPos = outPos;
         if (injectIntoTag) {
-            // Copy up to (but not including) the closing '>', then emit the
-            // attribute, then the '>'. For a self-closing tag (<div/>), the
-            // attribute must go before the '/'.
+            // Insert the attribute before the closing '>'. For a self-closing
+            // tag (<div/>), the attribute must go before the '/'.
             bool selfClosing = (tagEndPos > outPos && data[tagEndPos - 1] == '/');
             int copyEnd = selfClosing ? tagEndPos - 1 : tagEndPos;
-            rewritten->Write(data + outPos, copyEnd - outPos, NULL);
-            writeFileposIdAttr(rewritten, filepos);
-            if (selfClosing)
-                *rewritten << "/";
+            if (copyEnd < outPos)
+                copyEnd = outPos;
+            rewritten->insert(copyEnd, fileposIdAttr(filepos));
             outPos = tagEndPos;
         } else if (allowInjectStandaloneId) {
             // Only inject a standalone <a> marker (which may split a text node
             // and break highlights) when a recent DOM version is requested.
-            rewritten->Write(data + outPos, insertPos - outPos, NULL);
-            writeFileposMarker(rewritten, filepos);
+            rewritten->insert(insertPos, fileposMarker(filepos));
             outPos = insertPos;
         } else {
             // Older DOM: skip the marker entirely to avoid splitting text nodes.
-            rewritten->Write(data + outPos, insertPos - outPos, NULL);
             outPos = insertPos;
         }
     }
-    rewritten->Write(data + outPos, dataSize - outPos, NULL);
-    rewritten->SetPos(0);
     stream->SetPos(0);
-    return rewritten;
+    return LVStreamRef(rewritten);
 }
 
 // Custom callback filter that rewrites MOBI-specific attributes during HTML parsing:
@@ -824,6 +983,14 @@ public:
     virtual ~LVPDBContainer() { }
 };
 
+// Compressed text records are unpacked in order by the reading thread, or when
+// reading them sequentially (on open, and while parsing), by worker threads:
+// records are compressed independently, so the next ones are read from the
+// file by the reading thread and queued to be unpacked ahead of it.
+
+#define PDB_UNPACK_MAX_THREADS 4   // max worker threads unpacking records
+#define PDB_UNPACK_AHEAD      16   // max records read and unpacked ahead
+
 static bool pattern_cmp( const lUInt8 * buf, const char * pattern ) {
     for ( int i=0; pattern[i]; i++ )
         if ( tolower(buf[i])!=pattern[i] )
@@ -864,11 +1031,16 @@ private:
     int _mobiNcxIdx;      // PDB record number of the TOC (INDX/NCX) header, -1 if none
     lUInt32 _mobiEncoding; // MOBI text encoding (65001 = UTF-8, 1252 = cp1252)
     CRPropRef m_doc_props;
+#if (CR_THREAD_SAFE==1)
+    class Unpacker;
+    LVAutoPtr<Unpacker> _unpacker; // sequential reading of records
+#endif
 
-    // c.f., lvtinydom.cpp's legacy ldomUnpack
+    // c.f., lvtinydom.cpp's legacy ldomUnpack, but inflating right into the
+    // returned buffer: this also runs on Unpacker worker threads, so no 256K
+    // buffer on their (default sized) stack
     bool zlibUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &dstbuf, lUInt32 & dstsize  )
     {
-        lUInt8 tmp[UNPACK_BUF_SIZE]; // 256K buffer for uncompressed data
         int ret;
         z_stream z = { 0 };
         z.zalloc = Z_NULL;
@@ -879,23 +1051,25 @@ private:
             return false;
         z.avail_in = compsize;
         z.next_in = (unsigned char *)compbuf;
+        // text records are 4096 bytes once uncompressed, grown if needed
+        lUInt32 buf_size = compsize < 1024 ? 4096 : compsize * 4;
+        lUInt8 *uncompressed_buf = cr_realloc((lUInt8 *)NULL, buf_size);
         lUInt32 uncompressed_size = 0;
-        lUInt8 *uncompressed_buf = NULL;
         while (true) {
-            z.avail_out = UNPACK_BUF_SIZE;
-            z.next_out = tmp;
+            if ( uncompressed_size == buf_size ) {
+                buf_size *= 2;
+                uncompressed_buf = cr_realloc(uncompressed_buf, buf_size);
+            }
+            z.avail_out = buf_size - uncompressed_size;
+            z.next_out = uncompressed_buf + uncompressed_size;
             ret = inflate( &z, Z_SYNC_FLUSH );
             if (ret != Z_OK && ret != Z_STREAM_END) { // some error occured while unpacking
                 inflateEnd(&z);
-                if (uncompressed_buf)
-                    free(uncompressed_buf);
+                free(uncompressed_buf);
                 // printf("inflate() error: %d (%d > %d)\n", ret, compsize, uncompressed_size);
                 return false;
             }
-            lUInt32 have = UNPACK_BUF_SIZE - z.avail_out;
-            uncompressed_buf = cr_realloc(uncompressed_buf, uncompressed_size + have);
-            memcpy(uncompressed_buf + uncompressed_size, tmp, have ); // cppcheck-suppress uninitvar
-            uncompressed_size += have;
+            uncompressed_size = buf_size - z.avail_out;
             if (ret == Z_STREAM_END) {
                 break;
             }
@@ -1049,23 +1223,171 @@ private:
             return false;
         return true;
     }
+    // read record, without its extra data
+    bool readRecordSource( int index, LVArray<lUInt8> * buf ) {
+        if (!readRecordNoUnpack(index, buf))
+            return false;
+
+        if (_mobiExtraDataFlags && index < _recordCount)
+            removeExtraData(index, *buf);
+        return true;
+    }
     bool readRecord( int index, LVArray<lUInt8> * dstbuf ) {
         if (index >= _records.length())
             return false;
         LVArray<lUInt8> srcbuf;
         LVArray<lUInt8> * buf = _compression ? &srcbuf : dstbuf;
-        if (!readRecordNoUnpack(index, buf))
+        if (!readRecordSource(index, buf))
             return false;
 
-        if (_mobiExtraDataFlags && index < _recordCount)
-            removeExtraData(index, *buf);
-
         if (!_compression)
             return true;
         // unpack
         return unpack(*dstbuf, srcbuf);
     }
 
+#if (CR_THREAD_SAFE==1)
+    /// Unpacks a sequence of compressed records, up to PDB_UNPACK_AHEAD ahead
+    /// of the one being read, on worker threads kept for the stream lifetime
+    class Unpacker {
+        class Worker : public LVThread {
+            Unpacker * _unpacker;
+        public:
+            Worker( Unpacker * unpacker ) : _unpacker(unpacker) { }
+            virtual void run() { _unpacker->run(); }
+        };
+        enum SlotState { SLOT_FREE, SLOT_QUEUED, SLOT_UNPACKING, SLOT_DONE };
+        struct Slot {
+            LVArray<lUInt8> src;
+            LVArray<lUInt8> dst;
+            SlotState state;
+            bool read;     // record read from file
+            bool unpacked; // record unpacked
+            Slot() : state(SLOT_FREE), read(false), unpacked(false) { }
+        };
+        PDBFile * _file;
+        LVPtrVector<Worker> _workers;
+        LVMutex _mutex;
+        LVCondition _cond; // signaled when a record is queued or unpacked
+        Slot _slots[PDB_UNPACK_AHEAD]; // ring of records being read ahead
+        int _next;         // next record to return
+        int _read;         // next record to read from file
+        int _end;
+        bool _stopped;
+
+        Slot * getQueuedSlot() {
+            for ( int i=_next; i<_read; i++ ) {
+                Slot * slot = &_slots[i % PDB_UNPACK_AHEAD];
+                if ( slot->state == SLOT_QUEUED )
+                    return slot;
+            }
+            return NULL;
+        }
+        void unpackSlot( Slot * slot ) {
+            slot->state = SLOT_UNPACKING;
+            _mutex.unlock();
+            bool unpacked = _file->unpack( slot->dst, slot->src );
+            _mutex.lock();
+            slot->unpacked = unpacked;
+            slot->state = SLOT_DONE;
+            _cond.notifyAll();
+        }
+        void run() {
+            _mutex.lock();
+            for (;;) {
+                Slot * slot = NULL;
+                while ( !_stopped && !(slot = getQueuedSlot()) )
+                    _cond.wait( _mutex );
+                if ( _stopped )
+                    break;
+                unpackSlot( slot );
+            }
+            _mutex.unlock();
+        }
+        Unpacker( PDBFile * file, int threads )
+            : _file(file), _next(0), _read(0), _end(0), _stopped(false)
+        {
+            for ( int i=0; i<threads; i++ ) {
+                Worker * worker = new Worker( this );
+                _workers.add( worker );
+                worker->start();
+            }
+        }
+        static int getThreadCount() {
+            int threads = (int)std::thread::hardware_concurrency() - 1;
+            if ( threads > PDB_UNPACK_MAX_THREADS )
+                threads = PDB_UNPACK_MAX_THREADS;
+            return threads;
+        }
+    public:
+        /// returns a new idle unpacker, or NULL if there is no other CPU to unpack records on
+        static Unpacker * create( PDBFile * file ) {
+            // looked up once: readBlock() tries again on each sequential read
+            static const int threads = getThreadCount();
+            if ( threads <= 0 )
+                return NULL;
+            return new Unpacker( file, threads );
+        }
+        ~Unpacker() {
+            {
+                LVLock lock( _mutex );
+                _stopped = true;
+                _cond.notifyAll();
+            }
+            for ( int i=0; i<_workers.length(); i++ )
+                _workers[i]->join();
+            _workers.clear();
+        }
+        /// drops records read ahead, next() will then return records [start, end)
+        void reset( int start, int end ) {
+            LVLock lock( _mutex );
+            for ( int i=_next; i<_read; i++ ) {
+                Slot * slot = &_slots[i % PDB_UNPACK_AHEAD];
+                // Let workers finish the ones they are unpacking
+                while ( slot->state == SLOT_UNPACKING )
+                    _cond.wait( _mutex );
+                slot->state = SLOT_FREE;
+            }
+            _next = _read = start;
+            _end = end;
+        }
+        /// returns index of the record next() returns
+        int getNextIndex() const { return _next; }
+        /// returns true if all records have been returned
+        bool isDone() const { return _next >= _end; }
+        /// reads next record, as readRecord() does
+        bool next( LVArray<lUInt8> & dst ) {
+            if ( _next >= _end )
+                return false;
+            // The file is only read by this thread
+            while ( _read < _end && _read < _next + PDB_UNPACK_AHEAD ) {
+                Slot * slot = &_slots[_read % PDB_UNPACK_AHEAD];
+                slot->src.clear();
+                slot->read = _file->readRecordSource( _read, &slot->src );
+                LVLock lock( _mutex );
+                slot->state = slot->read ? SLOT_QUEUED : SLOT_DONE;
+                _read++;
+                _cond.notifyAll();
+            }
+            Slot * slot = &_slots[_next % PDB_UNPACK_AHEAD];
+            _mutex.lock();
+            // Don't wait for a worker to pick it
+            if ( slot->state == SLOT_QUEUED )
+                unpackSlot( slot );
+            while ( slot->state != SLOT_DONE )
+                _cond.wait( _mutex );
+            slot->state = SLOT_FREE;
+            _next++;
+            _mutex.unlock();
+            if ( !slot->read )
+                return false;
+            dst.reset();
+            dst.add( slot->dst.get(), slot->dst.length() );
+            return slot->unpacked;
+        }
+    };
+#endif
+
     // --- MOBI TOC (INDX/NCX index) support ---
 
     // Read a big-endian u32 at byte offset off of an INDX record buffer.
@@ -1297,7 +1619,19 @@ public:
             return false;
         if ( index==_bufIndex )
             return true; // already read
-        bool res = readRecord( index+1, &_buf );
+        bool res;
+#if (CR_THREAD_SAFE==1)
+        // Have the next records unpacked ahead while they're read in order
+        bool sequential = index==_bufIndex+1;
+        if ( _unpacker.isNull() && _compression && sequential )
+            _unpacker = Unpacker::create( this );
+        if ( !_unpacker.isNull() && _unpacker->getNextIndex() != index+1 )
+            _unpacker->reset( index+1, sequential ? _recordCount+1 : index+1 );
+        if ( !_unpacker.isNull() && !_unpacker->isDone() )
+            res = _unpacker->next( _buf );
+        else
+#endif
+        res = readRecord( index+1, &_buf );
         if ( !res )
             return false;
         _bufIndex = index;
@@ -1309,10 +1643,20 @@ public:
     int findBlock( lvpos_t pos ) {
         if ( pos==_textSize )
             return _recordCount-1;
-        for ( int i=0; i<_recordCount; i++ ) {
-            if ( pos>=_records[i+1].unpoffset && pos<_records[i+1].unpoffset+_records[i+1].unpsize )
-                return i;
+        // first block ending after pos (blocks are in order, mostly read forward)
+        int a = 0;
+        int b = _recordCount;
+        if ( _bufIndex>=0 && _bufIndex<_recordCount && pos>=_records[_bufIndex+1].unpoffset )
+            a = _bufIndex;
+        while ( a<b ) {
+            int m = (a+b)/2;
+            if ( pos>=_records[m+1].unpoffset+_records[m+1].unpsize )
+                a = m+1;
+            else
+                b = m;
         }
+        if ( a<_recordCount && pos>=_records[a+1].unpoffset )
+            return a;
         return -1;
     }
 
@@ -1713,8 +2057,20 @@ public:
         LVArray<lUInt8> buf;
         lUInt32 unpoffset = 0;
         _crc = 0;
+#if (CR_THREAD_SAFE==1)
+        if ( _compression && _recordCount > 1 ) {
+            _unpacker = Unpacker::create( this );
+            if ( !_unpacker.isNull() )
+                _unpacker->reset( 1, _recordCount+1 );
+        }
+#endif
         for ( int k=0; k<_recordCount; k++ ) {
 
+#if (CR_THREAD_SAFE==1)
+            if ( !_unpacker.isNull() )
+                _unpacker->next(buf);
+            else
+#endif
             readRecord(k+1, &buf);
             _records[k+1].unpoffset = unpoffset;
             _records[k+1].unpsize = buf.length();
@@ -1866,8 +2222,7 @@ public:
             int sz = count;
             if ( sz>bytesLeft )
                 sz = bytesLeft;
-            for ( int i=0; i<sz; i++ )
-                dst[i] = _buf[_pos - _bufOffset + i];
+            memcpy( dst, _buf.get() + (_pos - _bufOffset), sz );
             _pos += sz;
             dst += sz;
             count -= sz;
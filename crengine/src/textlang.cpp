@@ -9,6 +9,7 @@
 #include "../include/fb2def.h"
 #include "../include/textlang.h"
 #include "../include/hyphman.h"
+#include "../include/lvthread.h"
 
 #if (USE_UTF8PROC==1)
 #include <utf8proc.h>
@@ -119,6 +120,7 @@ static struct {
 lString32 TextLangMan::_main_lang = TEXTLANG_DEFAULT_MAIN_LANG_32;
 bool TextLangMan::_embedded_langs_enabled = TEXTLANG_DEFAULT_EMBEDDED_LANGS_ENABLED;
 LVPtrVector<TextLangCfg> TextLangMan::_lang_cfg_list;
+static LVMutex _lang_cfg_list_mutex; // lookups reorder the list
 
 bool TextLangMan::_hyphenation_enabled = TEXTLANG_DEFAULT_HYPHENATION_ENABLED;
 bool TextLangMan::_hyphenation_soft_hyphens_only = TEXTLANG_DEFAULT_HYPH_SOFT_HYPHENS_ONLY;
@@ -208,6 +210,7 @@ TextLangCfg * TextLangMan::getTextLangCfg( lString32 lang_tag, bool force ) {
         // Drop provided lang_tag: always return main lang TextLangCfg
         lang_tag = _main_lang;
     }
+    LVLock lock(_lang_cfg_list_mutex);
     // Not sure if we can lowercase lang_tag and avoid duplicate (Harfbuzz might
     // need the proper lang tag with some parts starting with some uppercase letter)
     for ( int i=0; i<_lang_cfg_list.length(); i++ ) {
@@ -0,0 +1,164 @@
+/*
+    Compression ratio and unpack throughput of the cache file blocks, by
+    block type (see getBlockPackLevel() and CacheFilePackDict).
+
+    Each document of the corpus is loaded, rendered and saved to a cache
+    file in a new temporary directory (left in place, its path is printed).
+    The cache file is then opened again, and every block is read (unpacked)
+    n times. Totals by block type: blocks count, unpacked and stored size,
+    ratio, blocks packed with their type dictionary, and unpack throughput
+    (the first read, which also checks the block CRCs, is not timed).
+
+    This is not part of the build. It includes lvtinydom.cpp for CacheFile.
+    From the repository root, with crengine configured and built in
+    BUILD_DIR (for crsetup.h and libcrengine):
+
+        c++ -std=gnu++17 -O2 -include cstdint -I$BUILD_DIR -Icrengine/include \
+            $(pkg-config --cflags freetype2 libxxhash) tests/cache_compression_bench.cpp -o cache_compression_bench \
+            -L$BUILD_DIR -lcrengine -lz -Wl,-rpath,$BUILD_DIR
+        ./cache_compression_bench [-n reads] font.ttf... document...
+
+    Add -lzstd when crengine is built with USE_ZSTD.
+*/
+
+#include "../crengine/src/lvtinydom.cpp"
+#include "lvdocview.h"
+#include <stdlib.h>
+#include <time.h>
+
+static double now()
+{
+    timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+static const char * blockTypeNames[] = {
+    "free", "index", "text", "elem", "rect", "elem style", "maps", "pages", "props",
+    "node index", "elem node", "text node", "rend params", "toc", "page map", "style",
+    "blob index", "blob", "font", "pack dict", "search index", "profiles", "profile"
+};
+#define BLOCK_TYPES (CBT_LAYOUT_PROFILE + 1)
+
+struct BlockTypeStats {
+    int blocks;
+    int packed;   // compressed blocks
+    int withDict; // compressed with the block type dictionary
+    lInt64 size;  // unpacked
+    lInt64 stored;
+    double unpackTime;
+};
+
+static BlockTypeStats stats[BLOCK_TYPES];
+static int reads = 20;
+
+// saves document to a cache file in a new directory, returns the file path
+static lString32 saveToCache( const lString8 & fname )
+{
+    char dir[] = "/tmp/cache_compression_bench.XXXXXX";
+    if ( !mkdtemp( dir ) )
+        return lString32::empty_str;
+    ldomDocCache::init( Utf8ToUnicode( dir ), 0x40000000 );
+    {
+        LVDocView view( 8 );
+        view.setMinFileSizeToCache( 0 );
+        view.Resize( 600, 800 );
+        if ( !view.LoadDocument( fname.c_str() ) )
+            return lString32::empty_str;
+        view.checkRender();
+        view.swapToCache();
+        view.syncCache();
+    }
+    ldomDocCache::close();
+    LVContainerRef cont = LVOpenDirectory( Utf8ToUnicode( dir ) );
+    for ( int i=0; !cont.isNull() && i<cont->GetObjectCount(); i++ ) {
+        lString32 name = cont->GetObjectInfo( i )->GetName();
+        if ( name.endsWith( ".cr3" ) ) // (not the cache index)
+            return Utf8ToUnicode( dir ) + "/" + name;
+    }
+    return lString32::empty_str;
+}
+
+// adds the blocks of cache file to the stats
+static bool addCacheFile( const lString32 & path )
+{
+    CacheFile file( gDOMVersionCurrent );
+    if ( !file.open( path ) )
+        return false;
+    for ( int type=CBT_TEXT_DATA; type<BLOCK_TYPES; type++ ) {
+        BlockTypeStats & s = stats[type];
+        for ( int index=0; index<=0xFFFF; index++ ) {
+            const CacheFileItem * block = file.getBlockInfo( type, index );
+            if ( !block )
+                continue;
+            s.blocks++;
+            s.stored += block->_dataSize;
+            s.size += block->_uncompressedSize ? block->_uncompressedSize : block->_dataSize;
+            if ( block->_uncompressedSize )
+                s.packed++;
+            if ( block->_packMethod == CBP_DICT )
+                s.withDict++;
+            lUInt8 * buf = NULL;
+            int size = 0;
+            if ( !file.read( type, index, buf, size ) )
+                return false;
+            free( buf );
+            double t0 = now();
+            for ( int i=0; i<reads; i++ ) {
+                file.read( type, index, buf, size );
+                free( buf );
+            }
+            s.unpackTime += (now() - t0) / reads;
+        }
+    }
+    return true;
+}
+
+int main( int argc, char ** argv )
+{
+    lString8Collection documents;
+    InitFontManager( lString8() );
+    for ( int i=1; i<argc; i++ ) {
+        lString8 arg( argv[i] );
+        if ( arg == "-n" && i+1 < argc )
+            reads = atoi( argv[++i] );
+        else if ( arg.endsWith( ".ttf" ) || arg.endsWith( ".otf" ) )
+            fontMan->RegisterFont( arg );
+        else
+            documents.add( arg );
+    }
+    if ( documents.length() == 0 || fontMan->GetFontCount() == 0 || reads < 1 ) {
+        fprintf( stderr, "usage: %s [-n reads] font.ttf... document...\n", argv[0] );
+        return 2;
+    }
+    for ( int i=0; i<documents.length(); i++ ) {
+        lString32 path = saveToCache( documents[i] );
+        if ( path.empty() || !addCacheFile( path ) ) {
+            fprintf( stderr, "cannot save %s to a cache file\n", documents[i].c_str() );
+            return 2;
+        }
+        printf( "%s: %s\n", documents[i].c_str(), LCSTR( path ) );
+    }
+    printf( "%-12s %6s %6s %6s %10s %10s %6s %10s\n", "block type", "blocks", "packed", "dict",
+            "size", "stored", "ratio", "unpack");
+    BlockTypeStats total = {};
+    for ( int type=CBT_TEXT_DATA; type<BLOCK_TYPES; type++ ) {
+        BlockTypeStats & s = stats[type];
+        if ( !s.blocks )
+            continue;
+        printf( "%-12s %6d %6d %6d %10lld %10lld %6.2f %6.0f MB/s\n", blockTypeNames[type], s.blocks, s.packed,
+                s.withDict, (long long)s.size, (long long)s.stored, (double)s.size / s.stored,
+                s.unpackTime > 0 ? s.size / s.unpackTime / 1e3 : 0.0 );
+        total.blocks += s.blocks;
+        total.packed += s.packed;
+        total.withDict += s.withDict;
+        total.size += s.size;
+        total.stored += s.stored;
+        total.unpackTime += s.unpackTime;
+    }
+    printf( "%-12s %6d %6d %6d %10lld %10lld %6.2f %6.0f MB/s\n", "total", total.blocks, total.packed,
+            total.withDict, (long long)total.size, (long long)total.stored, (double)total.size / total.stored,
+            total.unpackTime > 0 ? total.size / total.unpackTime / 1e3 : 0.0 );
+    ShutdownFontManager();
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+    Check of saving documents to cache files (LVDocView::swapToCache(),
+    updateCache(), waitCacheWrites() and syncCache()), with the cache file
+    writer threads of the THREAD_SAFE build, or without them.
+
+    The document is loaded, rendered and saved with swapToCache() and
+    syncCache(). It is then rendered at another font size, which updates
+    the cache file, and updateCache() is called in 100 ms slices as a
+    frontend does, before waitCacheWrites(). It is then loaded again, which
+    must be done from the cache file, and must give the same pages at both
+    font sizes. Prints the time taken by each step, the number of
+    updateCache() calls and the longest one.
+
+    This is not part of the build. From the repository root, with crengine
+    configured and built in BUILD_DIR (for crsetup.h and libcrengine):
+
+        c++ -std=gnu++17 -O2 -include cstdint -I$BUILD_DIR -Icrengine/include \
+            $(pkg-config --cflags freetype2) tests/cache_writer_check.cpp -o cache_writer_check \
+            -L$BUILD_DIR -lcrengine -Wl,-rpath,$BUILD_DIR
+        ./cache_writer_check font.ttf document
+
+    The cache file is written in a new temporary directory, whose path is
+    printed. Exits with 1 on mismatch.
+*/
+
+#include "crsetup.h"
+#include "lvfntman.h"
+#include "lvdocview.h"
+#include "lvstring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cstdio>
+
+static double now()
+{
+    timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+static const int sizes[2] = { 22, 30 };
+
+// tells whether the document was loaded from its cache file, which is
+// only logged: "Document is found in cache, will reuse" by LVDocView, or
+// "Loaded from cache" (debug) by ImportEpubDocument()
+class CacheHitLog : public CRLog {
+public:
+    static bool fromCache;
+    CacheHitLog() { curr_level = LL_DEBUG; }
+protected:
+    virtual void log( const char * level, const char * msg, va_list args ) {
+        CR_UNUSED2( level, args );
+        if ( !strcmp( msg, "Document is found in cache, will reuse" ) || !strcmp( msg, "Loaded from cache" ) )
+            fromCache = true;
+    }
+};
+bool CacheHitLog::fromCache = false;
+
+static lUInt64 hashPages( LVDocView & view )
+{
+    LVRendPageList * pages = view.getPageList();
+    lUInt64 h = 14695981039346656037ULL;
+    for ( int i=0; i<pages->length(); i++ ) {
+        h = (h ^ (lUInt32)(*pages)[i]->start) * 1099511628211ULL;
+        h = (h ^ (lUInt32)(*pages)[i]->height) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static void setFontSize( LVDocView & view, int size )
+{
+    CRPropRef props = LVCreatePropsContainer();
+    props->setInt( PROP_FONT_SIZE, size );
+    view.propsApply( props );
+    view.checkRender();
+}
+
+// loads and renders the document at both sizes, saves it to the cache file
+static bool save( const char * fname, lUInt64 hashes[2] )
+{
+    LVDocView view( 8 );
+    view.setMinFileSizeToCache( 0 );
+    view.Resize( 600, 800 );
+    double t0 = now();
+    CacheHitLog::fromCache = false;
+    if ( !view.LoadDocument( fname ) )
+        return false;
+    setFontSize( view, sizes[0] );
+    hashes[0] = hashPages( view );
+    double t1 = now();
+    view.swapToCache();
+    double t2 = now();
+    ContinuousOperationResult res = view.syncCache();
+    double t3 = now();
+    printf( "load and render: %.0f ms, swapToCache: %.0f ms, syncCache: %.0f ms (%d)\n", t1 - t0, t2 - t1, t3 - t2, res );
+    if ( CacheHitLog::fromCache || res != CR_DONE )
+        return false;
+
+    setFontSize( view, sizes[1] );
+    hashes[1] = hashPages( view );
+    int calls = 0;
+    double longest = 0;
+    t0 = now();
+    do {
+        CRTimerUtil timeout( 100 );
+        double t = now();
+        res = view.updateCache( timeout );
+        if ( now() - t > longest )
+            longest = now() - t;
+        calls++;
+    } while ( res == CR_TIMEOUT && calls < 1000 );
+    t1 = now();
+    CRTimerUtil wait( 10000 );
+    ContinuousOperationResult writes = view.waitCacheWrites( wait );
+    t2 = now();
+    printf( "updateCache: %d calls, %.0f ms (longest %.0f ms, %d), waitCacheWrites: %.0f ms (%d)\n",
+            calls, t1 - t0, longest, res, t2 - t1, writes );
+    return res == CR_DONE && writes == CR_DONE;
+}
+
+// loads the document from its cache file, checks its pages at both sizes
+static bool check( const char * fname, const lUInt64 hashes[2] )
+{
+    LVDocView view( 8 );
+    view.setMinFileSizeToCache( 0 );
+    view.Resize( 600, 800 );
+    double t0 = now();
+    CacheHitLog::fromCache = false;
+    if ( !view.LoadDocument( fname ) )
+        return false;
+    setFontSize( view, sizes[0] );
+    double t1 = now();
+    bool ok = CacheHitLog::fromCache && hashPages( view ) == hashes[0];
+    setFontSize( view, sizes[1] );
+    ok = ok && hashPages( view ) == hashes[1];
+    printf( "load%s and render: %.0f ms, pages at both sizes: %s\n", CacheHitLog::fromCache ? " from cache" : "",
+            t1 - t0, ok ? "same" : "DIFFERENT" );
+    return ok;
+}
+
+int main( int argc, char ** argv )
+{
+    if ( argc != 3 ) {
+        fprintf( stderr, "usage: %s font.ttf document\n", argv[0] );
+        return 2;
+    }
+    CRLog::setLogger( new CacheHitLog() );
+    InitFontManager( lString8() );
+    if ( !fontMan->RegisterFont( lString8( argv[1] ) ) ) {
+        fprintf( stderr, "cannot register font %s\n", argv[1] );
+        return 2;
+    }
+    char dir[] = "/tmp/cache_writer_check.XXXXXX";
+    if ( !mkdtemp( dir ) )
+        return 2;
+    printf( "cache directory: %s\n", dir );
+    ldomDocCache::init( Utf8ToUnicode( dir ), 0x40000000 );
+    lUInt64 hashes[2];
+    bool ok = save( argv[2], hashes ) && check( argv[2], hashes );
+    printf( "%s\n", ok ? "ok" : "FAILED" );
+    ldomDocCache::close();
+    ShutdownFontManager();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+/*
+    Check and benchmark of the LVStyleSheet selector index (see
+    LVStyleSheet::apply()), on a generated book styled like the output of
+    Calibre: thousands of class rules, with id, attribute, tag and
+    descendant rules.
+
+    Every paragraph matches rules of each kind, some of them overridden by
+    later rules of the same specificity: its computed margins, indent and
+    padding are checked against the values the generator expects. Then the
+    load time and the number of selectors tested per styled node (from
+    getApplyStats()) are printed, to compare with another build.
+
+    This is not part of the build. From the repository root, with crengine
+    configured and built in BUILD_DIR (for crsetup.h and libcrengine):
+
+        c++ -std=gnu++17 -O2 -include cstdint -I$BUILD_DIR -Icrengine/include \
+            $(pkg-config --cflags freetype2) tests/css_rule_index_check.cpp -o css_rule_index_check \
+            -L$BUILD_DIR -lcrengine -Wl,-rpath,$BUILD_DIR
+        ./css_rule_index_check [-r rules] [-p paragraphs] font.ttf
+
+    Defaults: 1500 class rules, 3000 paragraphs. Exits with 1 on mismatch.
+*/
+
+#include "crsetup.h"
+#include "lvfntman.h"
+#include "lvdocview.h"
+#include "lvstsheet.h"
+#include "lvstring.h"
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+
+static double now()
+{
+    timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+static int rules = 1500;
+static int paragraphs = 3000;
+
+static lString8 makeBook()
+{
+    lString8 css;
+    for ( int k=0; k<rules; k++ ) {
+        css << ".c" << lString8::itoa(k) << " { margin-left: " << lString8::itoa(k % 97) << "px }\n";
+        if ( k % 2 == 0 ) // tag and class: wins over the class rule
+            css << "p.c" << lString8::itoa(k) << " { margin-right: " << lString8::itoa(k % 89) << "px }\n";
+        css << ".c" << lString8::itoa(k) << " { margin-right: 1px }\n";
+    }
+    for ( int k=0; k<rules; k+=5 ) // same specificity, later: wins
+        css << ".c" << lString8::itoa(k) << " { margin-left: " << lString8::itoa(k % 97 + 100) << "px }\n";
+    for ( int n=0; n<paragraphs; n+=3 )
+        css << "#p" << lString8::itoa(n) << " { text-indent: " << lString8::itoa(n % 71) << "px }\n";
+    css << "p[title] { padding-left: 7px }\n";
+    css << "p[title=\"b\"] { padding-left: 9px }\n";
+    css << "div.sec p { margin-top: 3px }\n";
+    css << "p { margin-top: 1px; text-indent: 2px }\n";
+
+    lString8 html;
+    html << "<html><head><title>css</title><style>\n" << css << "</style></head><body>\n";
+    for ( int n=0; n<paragraphs; n++ ) {
+        if ( n % 100 == 0 )
+            html << ( n ? "</div>\n" : "" ) << "<div" << ( n % 200 ? "" : " class=\"sec\"" ) << ">\n";
+        html << "<p class=\"x" << lString8::itoa(n % 13) << " c" << lString8::itoa(n % rules) << "\" id=\"p" << lString8::itoa(n) << "\"";
+        if ( n % 4 )
+            html << " title=\"" << ( n % 4 == 1 ? "a" : "b" ) << "\"";
+        html << ">Paragraph " << lString8::itoa(n) << ".</p>\n";
+    }
+    html << "</div>\n</body></html>\n";
+    return html;
+}
+
+static bool isPx( const css_length_t & len, int px )
+{
+    return len.type == css_val_px && len.value == px * 256;
+}
+
+// checks the style of paragraph n, returns false on mismatch
+static bool checkParagraph( ldomNode * node, int n )
+{
+    css_style_ref_t style = node->getStyle();
+    int k = n % rules;
+    int marginLeft = k % 5 == 0 ? k % 97 + 100 : k % 97;
+    int marginRight = k % 2 == 0 ? k % 89 : 1;
+    int marginTop = (n / 100) % 2 == 0 ? 3 : 1;
+    int indent = n % 3 == 0 ? n % 71 : 2;
+    int paddingLeft = n % 4 == 0 ? 0 : n % 4 == 1 ? 7 : 9;
+    bool ok = isPx( style->margin[0], marginLeft ) && isPx( style->margin[1], marginRight )
+           && isPx( style->margin[2], marginTop ) && isPx( style->text_indent, indent )
+           && ( paddingLeft ? isPx( style->padding[0], paddingLeft ) : style->padding[0].value == 0 );
+    if ( !ok )
+        printf( "paragraph %d: margins %d %d %d, indent %d, padding %d\n", n, style->margin[0].value / 256,
+                style->margin[1].value / 256, style->margin[2].value / 256, style->text_indent.value / 256,
+                style->padding[0].value / 256 );
+    return ok;
+}
+
+// checks the paragraphs under node, returns the number of mismatches
+static int checkNode( ldomNode * node, int & n )
+{
+    int bad = 0;
+    for ( int i=0; i<(int)node->getChildCount(); i++ ) {
+        ldomNode * child = node->getChildNode( i );
+        if ( !child->isElement() )
+            continue;
+        if ( child->getNodeName() == "p" ) {
+            if ( !checkParagraph( child, n ) )
+                bad++;
+            n++;
+        } else {
+            bad += checkNode( child, n );
+        }
+    }
+    return bad;
+}
+
+// loads the generated book, checks its styles, returns the number of mismatches
+static int checkBook()
+{
+    lString8 html = makeBook();
+    LVDocView view( 8 );
+    view.Resize( 600, 800 );
+    double t0 = now();
+    if ( !view.LoadDocument( LVCreateStringStream( html ) ) ) {
+        fprintf( stderr, "cannot load the generated book\n" );
+        return 1;
+    }
+    double loadTime = now() - t0;
+    ldomDocument * doc = view.getDocument();
+    lUInt32 nodes, selectors;
+    doc->getStyleSheet()->getApplyStats( nodes, selectors );
+    int n = 0;
+    int bad = checkNode( doc->getRootNode(), n );
+    if ( n != paragraphs ) {
+        printf( "%d paragraphs found, %d expected\n", n, paragraphs );
+        bad++;
+    }
+    printf( "%d rules, %d paragraphs: load %.0f ms, %.1f selectors tested per node (%u nodes): %s\n",
+            rules, paragraphs, loadTime, nodes ? (double)selectors / nodes : 0.0, nodes, bad ? "MISMATCH" : "ok" );
+    return bad;
+}
+
+int main( int argc, char ** argv )
+{
+    InitFontManager( lString8() );
+    for ( int i=1; i<argc; i++ ) {
+        lString8 arg( argv[i] );
+        if ( arg == "-r" && i+1 < argc )
+            rules = atoi( argv[++i] );
+        else if ( arg == "-p" && i+1 < argc )
+            paragraphs = atoi( argv[++i] );
+        else
+            fontMan->RegisterFont( arg );
+    }
+    if ( fontMan->GetFontCount() == 0 || rules < 1 || paragraphs < 1 ) {
+        fprintf( stderr, "usage: %s [-r rules] [-p paragraphs] font.ttf\n", argv[0] );
+        return 2;
+    }
+    int bad = checkBook();
+    ShutdownFontManager();
+    return bad ? 1 : 0;
+}
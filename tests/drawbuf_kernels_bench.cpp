@@ -0,0 +1,150 @@
+/*
+    Exactness check and microbenchmark of the LVDrawBuf row kernels
+    (glyph blending, ARGB to gray conversion, ordered dithering).
+
+    Each kernel is called on whole rows, where the vector loop is used, and
+    on 1-pixel spans, which only go through the scalar tail: results must be
+    identical. Then each kernel is timed over 2000 rows of 1264 pixels.
+
+    This is not part of the build. From the repository root, with crengine
+    configured and built in BUILD_DIR (for crsetup.h and libcrengine):
+
+        c++ -std=gnu++17 -O3 -include cstdint -I$BUILD_DIR -Icrengine/include \
+            $(pkg-config --cflags freetype2) tests/drawbuf_kernels_bench.cpp -o drawbuf_kernels_bench \
+            -L$BUILD_DIR -lcrengine -Wl,-rpath,$BUILD_DIR
+        ./drawbuf_kernels_bench [iterations]
+
+    Add -DCR_DRAWBUF_NO_SIMD to time the scalar code.
+*/
+
+#include "../crengine/src/lvdrawbuf.cpp"
+#include <time.h>
+#include <random>
+#include <vector>
+
+static double now()
+{
+    timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+static std::mt19937 rng( 42 );
+
+// glyph coverage: mostly blank or fully covered, some antialiased edges
+static lUInt8 glyphOpacity()
+{
+    int r = rng() % 10;
+    return r < 5 ? 0 : r < 7 ? 0xFF : rng() & 0xFF;
+}
+
+int main( int argc, char ** argv )
+{
+    const int W = 1264;
+    const int ROWS = 2000;
+    const int ITER = argc > 1 ? atoi(argv[1]) : 20;
+    std::vector<lUInt8> op(W*ROWS), g8(W*ROWS), g8r(W*ROWS);
+    std::vector<lUInt16> c16(W*ROWS), c16r(W*ROWS);
+    std::vector<lUInt32> c32(W*ROWS), c32r(W*ROWS), img(W*ROWS);
+    for ( size_t i=0; i<op.size(); i++ )
+        op[i] = glyphOpacity();
+    for ( size_t i=0; i<g8.size(); i++ ) {
+        g8[i] = rng();
+        c16[i] = rng();
+        c32[i] = rng();
+        img[i] = rng() & 0x00FFFFFF;
+        if ( i % 3 == 0 )
+            img[i] = (img[i] & 0xFF) * 0x010101; // some gray pixels
+    }
+    std::vector<lUInt8> out(W*ROWS), outr(W*ROWS);
+    int bad = 0;
+
+    // glyph blending, with several global opacities
+    const lUInt8 bops[] = { 0xFF, 0x80, 0x01 };
+    for ( int b=0; b<3; b++ ) {
+        lUInt8 bop = bops[b];
+        std::vector<lUInt8> g8v = g8;
+        std::vector<lUInt16> c16v = c16;
+        std::vector<lUInt32> c32v = c32;
+        g8r = g8;
+        c16r = c16;
+        c32r = c32;
+        for ( int y=0; y<ROWS; y++ ) {
+            int off = y*W;
+            int n = W - (y % 17);
+            blendGlyphRowGray8( &g8v[off], &op[off], n, 0x35, bop );
+            blendGlyphRowRGB565( &c16v[off], &op[off], n, 0x1234, bop );
+            blendGlyphRowARGB( &c32v[off], &op[off], n, 0x00A0B0C0, bop );
+            for ( int i=0; i<n; i++ ) {
+                blendGlyphRowGray8( &g8r[off+i], &op[off+i], 1, 0x35, bop );
+                blendGlyphRowRGB565( &c16r[off+i], &op[off+i], 1, 0x1234, bop );
+                blendGlyphRowARGB( &c32r[off+i], &op[off+i], 1, 0x00A0B0C0, bop );
+            }
+        }
+        bad += g8r != g8v;
+        bad += c16r != c16v;
+        bad += c32r != c32v;
+    }
+
+    // gray conversion and dithering: { bpp, shift, mask for bpp<3 }
+    const int cfg[][3] = { {8,0,0}, {4,0,0}, {3,0,0}, {2,6,3}, {1,7,1} };
+    const lUInt32 colorxors[] = { 0, 0xFFFFFF };
+    const lUInt8 outxors[] = { 0, 0xFF };
+    for ( int c=0; c<5; c++ ) {
+        int bpp = cfg[c][0];
+        lUInt8 mask = bpp >= 3 ? (((1<<bpp)-1) << (8-bpp)) : cfg[c][2];
+        for ( int cx=0; cx<2; cx++ ) {
+            for ( int ox=0; ox<2; ox++ ) {
+                for ( int y=0; y<64; y++ ) {
+                    int off = y*W + (y % 5);
+                    int n = W - (y % 23);
+                    grayRow( &out[off], &img[off], n, colorxors[cx], cfg[c][1], mask, outxors[ox] );
+                    for ( int i=0; i<n; i++ )
+                        grayRow( &outr[off+i], &img[off+i], 1, colorxors[cx], cfg[c][1], mask, outxors[ox] );
+                    ditherRow( &out[off+W*64], &img[off], n, 3+y, y, bpp, colorxors[cx], outxors[ox] );
+                    for ( int i=0; i<n; i++ )
+                        ditherRow( &outr[off+W*64+i], &img[off+i], 1, 3+y+i, y, bpp, colorxors[cx], outxors[ox] );
+                }
+            }
+        }
+    }
+    bad += out != outr;
+
+    // every gray level through the dithers, at each threshold map position
+    const int dbpps[] = { 1, 2, 3, 4, 8 };
+    for ( int d=0; d<5; d++ ) {
+        for ( int y=0; y<8; y++ ) {
+            for ( int x0=0; x0<8; x0++ ) {
+                lUInt32 px[256];
+                lUInt8 a[256], b[256];
+                for ( int i=0; i<256; i++ )
+                    px[i] = (rng() % 2) ? i*0x010101 : (lUInt32)rng() & 0xFFFFFF;
+                ditherRow( a, px, 256, x0, y, dbpps[d], 0, 0 );
+                for ( int i=0; i<256; i++ )
+                    ditherRow( b+i, px+i, 1, x0+i, y, dbpps[d], 0, 0 );
+                bad += memcmp( a, b, 256 ) != 0;
+            }
+        }
+    }
+#if (CR_DRAWBUF_SIMD==1)
+    printf( "vector kernels, mismatches: %d\n", bad );
+#else
+    printf( "scalar kernels, mismatches: %d\n", bad );
+#endif
+
+    #define BENCH(name, body) { \
+        double t0 = now(); \
+        for ( int it=0; it<ITER; it++ ) \
+            for ( int y=0; y<ROWS; y++ ) { int off = y*W; body; } \
+        printf( "%-20s %6.2f ns/px\n", name, (now()-t0)*1e6/((double)ITER*ROWS*W) ); \
+    }
+    BENCH( "glyph gray8", blendGlyphRowGray8( &g8[off], &op[off], W, 0x35, 0xFF ) );
+    BENCH( "glyph rgb565", blendGlyphRowRGB565( &c16[off], &op[off], W, 0x1234, 0xFF ) );
+    BENCH( "glyph argb8888", blendGlyphRowARGB( &c32[off], &op[off], W, 0x00A0B0C0, 0xFF ) );
+    BENCH( "argb to gray8", grayRow( &out[off], &img[off], W, 0, 0, 0xFF, 0 ) );
+    BENCH( "dither 8bpp", ditherRow( &out[off], &img[off], W, 0, y, 8, 0, 0 ) );
+    BENCH( "dither 4bpp", ditherRow( &out[off], &img[off], W, 0, y, 4, 0, 0 ) );
+    BENCH( "dither 2bpp", ditherRow( &out[off], &img[off], W, 0, y, 2, 0, 0 ) );
+    BENCH( "dither 1bpp", ditherRow( &out[off], &img[off], W, 0, y, 1, 0, 0 ) );
+    return bad != 0;
+}
@@ -0,0 +1,108 @@
+/*
+    Microbenchmark of the glyph caches, driven by the glyph stream of real
+    document pages.
+
+    The document is loaded and rendered, then its first pages are drawn
+    again and again into a gray buffer (LFormattedText::Draw, getting each
+    glyph from the font glyph caches). The first pass starts from empty
+    caches (cold), the next ones are averaged (warm). With several font
+    sizes (-s), pages are drawn with each of them in turn, and the glyphs
+    of all sizes may not fit in the global glyph cache, which then evicts.
+
+    This is not part of the build. From the repository root, with crengine
+    configured and built in BUILD_DIR (for crsetup.h and libcrengine):
+
+        c++ -std=gnu++17 -O2 -include cstdint -I$BUILD_DIR -Icrengine/include \
+            $(pkg-config --cflags freetype2) tests/glyph_cache_bench.cpp -o glyph_cache_bench \
+            -L$BUILD_DIR -lcrengine -Wl,-rpath,$BUILD_DIR
+        ./glyph_cache_bench [-p pages] [-n passes] [-s size]... font.ttf... document
+*/
+
+#include "crsetup.h"
+#include "lvfntman.h"
+#include "lvdrawbuf.h"
+#include "lvdocview.h"
+#include "lvstring.h"
+#include <time.h>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+static double now()
+{
+    timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+// draws the first pages of each view, returns the average time per page
+static double drawPages( std::vector<LVDocView *> & views, int pages )
+{
+    LVGrayDrawBuf buf( 600, 800, 8 );
+    int drawn = 0;
+    double t0 = now();
+    for ( int p=0; p<pages; p++ ) {
+        for ( size_t i=0; i<views.size(); i++ ) {
+            if ( p >= views[i]->getPageCount() )
+                continue;
+            views[i]->goToPage( p );
+            buf.Clear( 0xFFFFFF );
+            views[i]->Draw( buf, false );
+            drawn++;
+        }
+    }
+    return drawn ? (now() - t0) / drawn : 0;
+}
+
+int main( int argc, char ** argv )
+{
+    int pages = 10;
+    int passes = 20;
+    std::vector<int> sizes;
+    lString8 document;
+    InitFontManager( lString8() );
+    for ( int i=1; i<argc; i++ ) {
+        lString8 arg( argv[i] );
+        if ( arg == "-p" && i+1 < argc )
+            pages = atoi( argv[++i] );
+        else if ( arg == "-n" && i+1 < argc )
+            passes = atoi( argv[++i] );
+        else if ( arg == "-s" && i+1 < argc )
+            sizes.push_back( atoi( argv[++i] ) );
+        else if ( arg.endsWith( ".ttf" ) || arg.endsWith( ".otf" ) )
+            fontMan->RegisterFont( arg );
+        else
+            document = arg;
+    }
+    if ( document.empty() || fontMan->GetFontCount() == 0 ) {
+        fprintf( stderr, "usage: %s [-p pages] [-n passes] [-s size]... font.ttf... document\n", argv[0] );
+        return 2;
+    }
+    if ( sizes.empty() )
+        sizes.push_back( 22 );
+
+    // one view per font size, to draw pages without rendering again
+    std::vector<LVDocView *> views;
+    for ( size_t i=0; i<sizes.size(); i++ ) {
+        LVDocView * view = new LVDocView( 8 );
+        view->Resize( 600, 800 );
+        view->setFontSize( sizes[i] );
+        if ( !view->LoadDocument( document.c_str() ) ) {
+            fprintf( stderr, "cannot load %s\n", document.c_str() );
+            return 2;
+        }
+        view->checkRender();
+        views.push_back( view );
+    }
+    fontMan->clearGlyphCache();
+    double cold = drawPages( views, pages );
+    double warm = 0;
+    for ( int pass=0; pass<passes; pass++ )
+        warm += drawPages( views, pages );
+    printf( "%d pages, %d sizes: cold %.2f ms/page, warm %.2f ms/page\n", pages, (int)sizes.size(),
+            cold, warm / passes );
+    for ( size_t i=0; i<views.size(); i++ )
+        delete views[i];
+    ShutdownFontManager();
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+    Check and benchmark of the decoded image bitmap cache (see
+    LVGetCachedScaledImage()), on the pages of a document with images.
+
+    The first pages are drawn three times, for each buffer depth and with
+    smooth scaling off and on: from an empty image cache (cold), again
+    with the images cached (warm), and with the cache disabled. The drawn
+    pages must be the same in the three passes. Prints the average time
+    per page of each pass.
+
+    This is not part of the build. From the repository root, with crengine
+    configured and built in BUILD_DIR (for crsetup.h and libcrengine):
+
+        c++ -std=gnu++17 -O2 -include cstdint -I$BUILD_DIR -Icrengine/include \
+            $(pkg-config --cflags freetype2) tests/image_cache_check.cpp -o image_cache_check \
+            -L$BUILD_DIR -lcrengine -Wl,-rpath,$BUILD_DIR
+        ./image_cache_check [-p pages] font.ttf document
+
+    Defaults: 12 pages of 600x800. Exits with 1 on mismatch.
+*/
+
+#include "crsetup.h"
+#include "lvfntman.h"
+#include "lvdrawbuf.h"
+#include "lvdocview.h"
+#include "lvstring.h"
+#include <time.h>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+static double now()
+{
+    timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+static int pages = 12;
+
+static lUInt64 hashBuf( LVDrawBuf & buf )
+{
+    lUInt64 hash = 14695981039346656037ULL;
+    int rowBytes = (buf.GetWidth() * buf.GetBitsPerPixel() + 7) / 8;
+    for ( int y=0; y<buf.GetHeight(); y++ ) {
+        const lUInt8 * row = buf.GetScanLine( y );
+        for ( int x=0; x<rowBytes; x++ )
+            hash = (hash ^ row[x]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// draws the pages, adds their hashes to hashes, returns the time per page
+static double drawPages( LVDocView & view, LVDrawBuf & buf, std::vector<lUInt64> & hashes )
+{
+    int count = pages < view.getPageCount() ? pages : view.getPageCount();
+    double time = 0;
+    for ( int p=0; p<count; p++ ) {
+        view.goToPage( p );
+        buf.Clear( 0xFFFFFF );
+        double t0 = now();
+        view.Draw( buf );
+        time += now() - t0;
+        hashes.push_back( hashBuf( buf ) );
+    }
+    return count ? time / count : 0;
+}
+
+// draws the pages with each buffer depth, returns the number of mismatches
+static int checkDocument( const char * fname )
+{
+    LVDocView view( 8 );
+    view.setPageHeaderInfo( 0 );
+    view.Resize( 600, 800 );
+    if ( !view.LoadDocument( fname ) ) {
+        fprintf( stderr, "cannot open document %s\n", fname );
+        return 1;
+    }
+    view.checkRender();
+    static const int bpps[] = { 2, 8, 16, 32 };
+    int bad = 0;
+    for ( int i=0; i<4; i++ ) {
+        for ( int smooth=0; smooth<2; smooth++ ) {
+            int bpp = bpps[i];
+            LVDrawBuf * buf;
+            if ( bpp > 8 )
+                buf = new LVColorDrawBuf( 600, 800, bpp );
+            else
+                buf = new LVGrayDrawBuf( 600, 800, bpp );
+            buf->setSmoothScalingImages( smooth );
+            std::vector<lUInt64> cold, warm, off;
+            LVSetImageBitmapCacheSize( IMAGE_BITMAP_CACHE_SIZE );
+            LVClearImageBitmapCache();
+            double coldTime = drawPages( view, *buf, cold );
+            double warmTime = drawPages( view, *buf, warm );
+            LVSetImageBitmapCacheSize( 0 );
+            double offTime = drawPages( view, *buf, off );
+            bool same = cold == warm && cold == off;
+            if ( !same )
+                bad++;
+            printf( "%2d bpp%s: cold %.2f, warm %.2f, no cache %.2f ms/page: %s\n", bpp, smooth ? " (smooth)" : "",
+                    coldTime, warmTime, offTime, same ? "same" : "DIFFERENT" );
+            delete buf;
+        }
+    }
+    LVSetImageBitmapCacheSize( IMAGE_BITMAP_CACHE_SIZE );
+    return bad;
+}
+
+int main( int argc, char ** argv )
+{
+    const char * fname = NULL;
+    InitFontManager( lString8() );
+    for ( int i=1; i<argc; i++ ) {
+        lString8 arg( argv[i] );
+        if ( arg == "-p" && i+1 < argc )
+            pages = atoi( argv[++i] );
+        else if ( arg.endsWith( ".ttf" ) || arg.endsWith( ".otf" ) )
+            fontMan->RegisterFont( arg );
+        else
+            fname = argv[i];
+    }
+    if ( !fname || fontMan->GetFontCount() == 0 || pages < 1 ) {
+        fprintf( stderr, "usage: %s [-p pages] font.ttf document\n", argv[0] );
+        return 2;
+    }
+    int bad = checkDocument( fname );
+    printf( "%s\n", bad ? "MISMATCH" : "ok" );
+    ShutdownFontManager();
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,107 @@
+/*
+    Decode time and peak memory of an image drawn to fit a page, as done
+    by LVDrawBuf::Draw() for a full page image (e.g. a comic or manga
+    page): JPEG, PNG and WebP images are shrunk while decoding when drawn
+    smaller (see LVImageDecoderCallback::GetTargetSize()).
+
+    The image is drawn n times, from an empty decoded image cache each
+    time. Prints the average time, the peak RSS of the process, and a hash
+    of the drawn buffer (to compare the output of two builds).
+
+    This is not part of the build. From the repository root, with crengine
+    configured and built in BUILD_DIR (for crsetup.h and libcrengine):
+
+        c++ -std=gnu++17 -O2 -include cstdint -I$BUILD_DIR -Icrengine/include \
+            $(pkg-config --cflags freetype2) tests/image_decode_bench.cpp -o image_decode_bench \
+            -L$BUILD_DIR -lcrengine -Wl,-rpath,$BUILD_DIR
+        ./image_decode_bench [-w width] [-h height] [-b bpp] [-s] [-n runs] image
+
+    Defaults: a 1264x1680 gray (8 bpp) page, no smooth scaling (-s), 5 runs.
+    Run it once per image, as the peak RSS is the one of the process.
+*/
+
+#include "crsetup.h"
+#include "lvdrawbuf.h"
+#include "lvimg.h"
+#include "lvstream.h"
+#include "lvstring.h"
+#include <sys/resource.h>
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+
+static double now()
+{
+    timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+int main( int argc, char ** argv )
+{
+    int width = 1264;
+    int height = 1680;
+    int bpp = 8;
+    bool smooth = false;
+    int runs = 5;
+    const char * fname = NULL;
+    for ( int i=1; i<argc; i++ ) {
+        lString8 arg( argv[i] );
+        if ( arg == "-w" && i+1 < argc )
+            width = atoi( argv[++i] );
+        else if ( arg == "-h" && i+1 < argc )
+            height = atoi( argv[++i] );
+        else if ( arg == "-b" && i+1 < argc )
+            bpp = atoi( argv[++i] );
+        else if ( arg == "-s" )
+            smooth = true;
+        else if ( arg == "-n" && i+1 < argc )
+            runs = atoi( argv[++i] );
+        else
+            fname = argv[i];
+    }
+    if ( !fname || runs < 1 ) {
+        fprintf( stderr, "usage: %s [-w width] [-h height] [-b bpp] [-s] [-n runs] image\n", argv[0] );
+        return 2;
+    }
+    LVImageSourceRef img = LVCreateStreamImageSource( LVOpenFileStream( fname, LVOM_READ ) );
+    if ( img.isNull() || img->GetWidth() <= 0 || img->GetHeight() <= 0 ) {
+        fprintf( stderr, "cannot open image %s\n", fname );
+        return 2;
+    }
+    // fit the page, keeping the aspect ratio
+    int dw = width;
+    int dh = (int)((lInt64)img->GetHeight() * width / img->GetWidth());
+    if ( dh > height ) {
+        dh = height;
+        dw = (int)((lInt64)img->GetWidth() * height / img->GetHeight());
+    }
+    LVDrawBuf * buf;
+    if ( bpp == 32 || bpp == 16 )
+        buf = new LVColorDrawBuf( width, height, bpp );
+    else
+        buf = new LVGrayDrawBuf( width, height, bpp );
+    buf->setSmoothScalingImages( smooth );
+    double total = 0;
+    for ( int run=0; run<runs; run++ ) {
+        LVClearImageBitmapCache();
+        buf->Clear( 0xFFFFFF );
+        double t0 = now();
+        buf->Draw( img, (width - dw) / 2, (height - dh) / 2, dw, dh, false );
+        total += now() - t0;
+    }
+    struct rusage ru;
+    getrusage( RUSAGE_SELF, &ru );
+    lUInt64 hash = 14695981039346656037ULL;
+    int rowBytes = (width * buf->GetBitsPerPixel() + 7) / 8;
+    for ( int y=0; y<height; y++ ) {
+        const lUInt8 * row = buf->GetScanLine( y );
+        for ( int x=0; x<rowBytes; x++ )
+            hash = (hash ^ row[x]) * 1099511628211ULL;
+    }
+    printf( "%s: %dx%d drawn %dx%d at %d bpp%s: %.1f ms, peak RSS %ld KB, hash %016llx\n", fname,
+            img->GetWidth(), img->GetHeight(), dw, dh, bpp, smooth ? " (smooth)" : "", total / runs,
+            ru.ru_maxrss, (unsigned long long)hash );
+    delete buf;
+    return 0;
+}
@@ -0,0 +1,384 @@
+/*
+    Check and benchmark of the import of MOBI books (see pdbfmt.cpp): the
+    PalmDoc records unpacked ahead on worker threads, and the streamed
+    rewrite of filepos links.
+
+    A MOBI book is generated: PalmDoc (LZ77) compressed records of HTML
+    with chapters, a table of contents and links into the text made of
+    <a filepos=...> links, some of them to paragraphs with their own id.
+    It is then loaded, and every link must point to its target: the
+    chapter heading, the paragraph with its own id, or an anchor inserted
+    in the text. Prints the load time, the peak RSS of the process and a
+    hash of the document saved as XML (to compare the output of two
+    builds).
+
+    This is not part of the build. From the repository root, with crengine
+    configured and built in BUILD_DIR (for crsetup.h and libcrengine):
+
+        c++ -std=gnu++17 -O2 -include cstdint -I$BUILD_DIR -Icrengine/include \
+            $(pkg-config --cflags freetype2) tests/mobi_import_check.cpp -o mobi_import_check \
+            -L$BUILD_DIR -lcrengine -Wl,-rpath,$BUILD_DIR
+        ./mobi_import_check [-s size] [-k] font.ttf
+
+    Defaults: 3000 KB of HTML. The book is written to a temporary file,
+    removed unless -k is given. Exits with 1 on mismatch.
+*/
+
+#include "crsetup.h"
+#include "lvfntman.h"
+#include "lvdocview.h"
+#include "lvstring.h"
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static double now()
+{
+    timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+#define RECORD_SIZE 4096
+
+static lUInt32 seed = 1;
+static int rnd( int n )
+{
+    seed = seed * 1103515245 + 12345;
+    return (int)((seed >> 8) % (lUInt32)n);
+}
+
+// an <a filepos=...> link, and the target the document must have for it
+struct Link {
+    int slot;      // offset of the 10 digits in the HTML
+    int filepos;   // target offset
+    lString8 id;   // expected target id
+    lString8 kind; // expected target: "h2", "p" or "a" (inserted anchor)
+    int chapter;   // for "h2": expected heading number
+};
+
+static Link makeLink( int slot, int filepos, const char * id, const char * kind, int chapter )
+{
+    Link link;
+    link.slot = slot;
+    link.filepos = filepos;
+    link.id = id;
+    link.kind = kind;
+    link.chapter = chapter;
+    return link;
+}
+
+static const char * words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit", "sed", "do",
+    "eiusmod", "tempor", "incididunt", "ut", "labore", "et", "dolore", "magna", "aliqua",
+    "\xC3\xA9t\xC3\xA9", "na\xC3\xAFve", "\xE2\x80\x94"
+};
+
+// generates the HTML of the book, with about size bytes of chapters,
+// adds its links to links in document order
+static lString8 makeHtml( int size, std::vector<Link> & links )
+{
+    // chapters, with offsets relative to their start until the table of
+    // contents that comes before them is made
+    lString8 body;
+    std::vector<Link> toc, inBody, inText;
+    int chapter = 0;
+    while ( body.length() < size ) {
+        chapter++;
+        if ( chapter % 3 == 0 )
+            body << "<mbp:pagebreak/>";
+        toc.push_back( makeLink( 0, body.length(), "", "h2", chapter ) );
+        body << "<h2>Chapter " << lString8::itoa( chapter ) << "</h2>\n";
+        int paragraphs = 3 + rnd( 10 );
+        for ( int i=0; i<paragraphs; i++ ) {
+            if ( i == 1 && chapter % 5 == 0 ) {
+                // link to the next paragraph, which has its own id: the
+                // link is rewritten to it
+                lString8 id = lString8( "own" ) + lString8::itoa( chapter );
+                body << "<p>see <a filepos=";
+                Link link = makeLink( body.length(), 0, id.c_str(), "p", 0 );
+                body << "0000000000>below</a></p>\n";
+                link.filepos = body.length();
+                inBody.push_back( link );
+                body << "<p id=\"" << id << "\">";
+            } else {
+                body << "<p>";
+            }
+            int count = 10 + rnd( 70 );
+            for ( int w=0; w<count; w++ ) {
+                if ( w )
+                    body << " ";
+                if ( w == count / 2 && rnd( 4 ) == 0 ) // target of a note, in the text
+                    inText.push_back( makeLink( 0, body.length(), "", "a", 0 ) );
+                body << words[ rnd( sizeof(words) / sizeof(words[0]) ) ];
+            }
+            body << "</p>\n";
+        }
+    }
+    lString8 html( "<html><head><title>MOBI import check</title></head><body>\n" );
+    // the table of contents size only depends on the number of chapters (10 digit offsets)
+    for ( size_t i=0; i<toc.size(); i++ ) {
+        html << "<p><a filepos=";
+        toc[i].slot = html.length();
+        html << "0000000000>Chapter " << lString8::itoa( toc[i].chapter ) << "</a></p>\n";
+    }
+    int shift = html.length();
+    html << body;
+    for ( size_t i=0; i<toc.size(); i++ )
+        toc[i].filepos += shift;
+    for ( size_t i=0; i<inBody.size(); i++ ) {
+        inBody[i].slot += shift;
+        inBody[i].filepos += shift;
+    }
+    // notes at the end of the book, linking into the text
+    for ( size_t i=0; i<inText.size(); i++ ) {
+        inText[i].filepos += shift;
+        html << "<p><a filepos=";
+        inText[i].slot = html.length();
+        html << "0000000000>note " << lString8::itoa( (int)i ) << "</a></p>\n";
+    }
+    html << "</body></html>\n";
+    links = toc;
+    links.insert( links.end(), inBody.begin(), inBody.end() );
+    links.insert( links.end(), inText.begin(), inText.end() );
+    for ( size_t i=0; i<links.size(); i++ ) {
+        if ( links[i].id.empty() ) // inserted: named after the offset
+            links[i].id = lString8( "filepos" ) + lString8::itoa( links[i].filepos );
+        char digits[11];
+        snprintf( digits, sizeof(digits), "%010d", links[i].filepos );
+        memcpy( html.modify() + links[i].slot, digits, 10 );
+    }
+    return html;
+}
+
+// PalmDoc compression of a record: LZ77 matches of 3 to 10 bytes up to
+// 2047 bytes back, space + ASCII pairs, and literal runs of other bytes
+static void palmDocPack( const lUInt8 * data, int n, std::vector<lUInt8> & out )
+{
+    std::vector<int> head( 4096, -1 );
+    std::vector<int> prev( n, -1 );
+    int i = 0;
+    while ( i < n ) {
+        int bestLen = 0;
+        int bestOff = 0;
+        if ( i + 3 <= n ) {
+            int h = ((data[i] << 8) ^ (data[i+1] << 4) ^ data[i+2]) & 4095;
+            for ( int j = head[h], depth = 0; j >= 0 && i - j <= 2047 && depth < 32; j = prev[j], depth++ ) {
+                int len = 0;
+                while ( len < 10 && i + len < n && data[j + len] == data[i + len] )
+                    len++;
+                if ( len > bestLen ) {
+                    bestLen = len;
+                    bestOff = i - j;
+                }
+            }
+        }
+        int advance;
+        if ( bestLen >= 3 ) {
+            int v = 0x8000 | (bestOff << 3) | (bestLen - 3);
+            out.push_back( (lUInt8)(v >> 8) );
+            out.push_back( (lUInt8)v );
+            advance = bestLen;
+        } else if ( data[i] == ' ' && i + 1 < n && data[i+1] >= 0x40 && data[i+1] < 0x80 ) {
+            out.push_back( data[i+1] ^ 0x80 );
+            advance = 2;
+        } else if ( data[i] == 0 || (data[i] >= 0x09 && data[i] < 0x80) ) {
+            out.push_back( data[i] );
+            advance = 1;
+        } else {
+            int run = 0;
+            while ( run < 8 && i + run < n && !(data[i + run] == 0 || (data[i + run] >= 0x09 && data[i + run] < 0x80)) )
+                run++;
+            out.push_back( (lUInt8)run );
+            out.insert( out.end(), data + i, data + i + run );
+            advance = run;
+        }
+        for ( int k=0; k<advance; k++, i++ ) {
+            if ( i + 3 <= n ) {
+                int h = ((data[i] << 8) ^ (data[i+1] << 4) ^ data[i+2]) & 4095;
+                prev[i] = head[h];
+                head[h] = i;
+            }
+        }
+    }
+}
+
+static void put16( std::vector<lUInt8> & buf, int pos, lUInt32 v )
+{
+    buf[pos] = (lUInt8)(v >> 8);
+    buf[pos+1] = (lUInt8)v;
+}
+
+static void put32( std::vector<lUInt8> & buf, int pos, lUInt32 v )
+{
+    put16( buf, pos, v >> 16 );
+    put16( buf, pos + 2, v & 0xFFFF );
+}
+
+// writes html as a MOBI book
+static bool writeMobi( const char * fname, const lString8 & html )
+{
+    std::vector< std::vector<lUInt8> > records;
+    for ( int i=0; i<html.length(); i+=RECORD_SIZE ) {
+        int n = html.length() - i < RECORD_SIZE ? html.length() - i : RECORD_SIZE;
+        records.push_back( std::vector<lUInt8>() );
+        palmDocPack( (const lUInt8 *)html.c_str() + i, n, records.back() );
+        records.back().push_back( 0 ); // multibyte trailing entry (extra data flag 1): none
+    }
+    int count = (int)records.size();
+    const char * name = "MOBI import check";
+    // record 0: PalmDOC header, MOBI header, full name
+    std::vector<lUInt8> rec0( 16 + 232, 0 );
+    put16( rec0, 0, 2 );              // PalmDoc compression
+    put32( rec0, 4, html.length() );
+    put16( rec0, 8, count );
+    put16( rec0, 10, RECORD_SIZE );
+    memcpy( &rec0[16], "MOBI", 4 );
+    put32( rec0, 16 + 4, 232 );       // header length
+    put32( rec0, 16 + 8, 2 );         // book
+    put32( rec0, 16 + 12, 65001 );    // UTF-8
+    put32( rec0, 16 + 16, 1234 );     // unique id
+    put32( rec0, 16 + 20, 6 );        // file version
+    for ( int k=0; k<10; k++ )
+        put32( rec0, 16 + 24 + 4*k, 0xFFFFFFFF );
+    put32( rec0, 16 + 64, count + 1 ); // first non book record
+    put32( rec0, 16 + 68, 16 + 232 ); // full name offset
+    put32( rec0, 16 + 72, strlen( name ) );
+    put32( rec0, 16 + 92, count + 1 ); // first image record: none
+    put32( rec0, 16 + 148, 0xFFFFFFFF );
+    put32( rec0, 16 + 152, 0xFFFFFFFF );
+    put16( rec0, 16 + 226, 1 );       // extra data flags: multibyte
+    put32( rec0, 16 + 228, 0xFFFFFFFF ); // no NCX
+    rec0.insert( rec0.end(), name, name + strlen( name ) );
+    rec0.push_back( 0 );
+    rec0.push_back( 0 );
+    records.insert( records.begin(), rec0 );
+
+    std::vector<lUInt8> pdb( 78 + 8 * records.size() + 2, 0 );
+    memcpy( &pdb[0], "MOBIImportCheck", 15 );
+    memcpy( &pdb[60], "BOOKMOBI", 8 );
+    put16( pdb, 76, records.size() );
+    lUInt32 offset = pdb.size();
+    for ( size_t i=0; i<records.size(); i++ ) {
+        put32( pdb, 78 + 8*i, offset );
+        put32( pdb, 78 + 8*i + 4, i ); // attributes 0, unique id
+        offset += records[i].size();
+    }
+    FILE * f = fopen( fname, "wb" );
+    if ( !f )
+        return false;
+    bool ok = fwrite( &pdb[0], 1, pdb.size(), f ) == pdb.size();
+    for ( size_t i=0; ok && i<records.size(); i++ )
+        ok = fwrite( &records[i][0], 1, records[i].size(), f ) == records[i].size();
+    return fclose( f ) == 0 && ok;
+}
+
+// collects the href of the links under node, in document order
+static void collectLinks( ldomNode * node, lUInt16 aId, lUInt16 hrefId, std::vector<lString32> & hrefs )
+{
+    for ( int i=0; i<(int)node->getChildCount(); i++ ) {
+        ldomNode * child = node->getChildNode( i );
+        if ( !child->isElement() )
+            continue;
+        if ( child->getNodeId() == aId && child->hasAttribute( hrefId ) )
+            hrefs.push_back( child->getAttributeValue( hrefId ) );
+        collectLinks( child, aId, hrefId, hrefs );
+    }
+}
+
+// checks the links and their targets, returns the number of mismatches
+static int checkLinks( ldomDocument * doc, const std::vector<Link> & links )
+{
+    std::vector<lString32> hrefs;
+    collectLinks( doc->getRootNode(), doc->getElementNameIndex( U"a" ), doc->getAttrNameIndex( U"href" ), hrefs );
+    int bad = 0;
+    if ( hrefs.size() != links.size() ) {
+        printf( "%d links found, %d expected\n", (int)hrefs.size(), (int)links.size() );
+        return 1;
+    }
+    for ( size_t i=0; i<links.size(); i++ ) {
+        const Link & link = links[i];
+        lString32 id = Utf8ToUnicode( link.id );
+        ldomNode * target = doc->getElementById( id.c_str() );
+        bool ok = hrefs[i] == U"#" + id && target && target->getNodeName() == Utf8ToUnicode( link.kind );
+        if ( ok && link.kind == "h2" )
+            ok = target->getText() == U"Chapter " + lString32::itoa( link.chapter );
+        if ( !ok ) {
+            if ( bad < 10 )
+                printf( "link %d to %d: href %s, target %s expected\n", (int)i, link.filepos,
+                        LCSTR( hrefs[i] ), link.id.c_str() );
+            bad++;
+        }
+    }
+    return bad;
+}
+
+// loads the book, checks its links, returns the number of mismatches
+static int checkBook( const char * fname, const std::vector<Link> & links )
+{
+    LVDocView view( 8 );
+    view.Resize( 600, 800 );
+    double t0 = now();
+    if ( !view.LoadDocument( fname ) ) {
+        fprintf( stderr, "cannot load %s\n", fname );
+        return 1;
+    }
+    double loadTime = now() - t0;
+    struct rusage ru;
+    getrusage( RUSAGE_SELF, &ru );
+    int bad = checkLinks( view.getDocument(), links );
+    LVStreamRef xml = LVCreateMemoryStream();
+    view.getDocument()->saveToStream( xml, "utf-8", false );
+    std::vector<lUInt8> data( xml->GetSize() );
+    lvsize_t bytesRead = 0;
+    xml->SetPos( 0 );
+    xml->Read( data.data(), data.size(), &bytesRead );
+    lUInt64 hash = 14695981039346656037ULL;
+    for ( lvsize_t i=0; i<bytesRead; i++ )
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    printf( "%d links: load %.0f ms, peak RSS %ld KB, XML hash %016llx: %s\n", (int)links.size(), loadTime,
+            ru.ru_maxrss, (unsigned long long)hash, bad ? "MISMATCH" : "ok" );
+    return bad;
+}
+
+int main( int argc, char ** argv )
+{
+    int size = 3000;
+    bool keep = false;
+    InitFontManager( lString8() );
+    for ( int i=1; i<argc; i++ ) {
+        lString8 arg( argv[i] );
+        if ( arg == "-s" && i+1 < argc )
+            size = atoi( argv[++i] );
+        else if ( arg == "-k" )
+            keep = true;
+        else
+            fontMan->RegisterFont( arg );
+    }
+    if ( fontMan->GetFontCount() == 0 || size < 1 ) {
+        fprintf( stderr, "usage: %s [-s size] [-k] font.ttf\n", argv[0] );
+        return 2;
+    }
+    std::vector<Link> links;
+    lString8 html = makeHtml( size * 1024, links );
+    char fname[] = "/tmp/mobi_import_check.XXXXXX.mobi";
+    int fd = mkstemps( fname, 5 );
+    if ( fd < 0 )
+        return 2;
+    close( fd );
+    if ( !writeMobi( fname, html ) ) {
+        fprintf( stderr, "cannot write %s\n", fname );
+        return 2;
+    }
+    printf( "%s: %d KB of HTML in %d records\n", fname, html.length() / 1024,
+            (html.length() + RECORD_SIZE - 1) / RECORD_SIZE );
+    int bad = checkBook( fname, links );
+    if ( !keep )
+        remove( fname );
+    ShutdownFontManager();
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+/*
+    Check and benchmark of drawing pages in horizontal bands on several
+    threads (see LVDocView::setPageDrawBands()).
+
+    The first pages of the document are drawn for each buffer depth, with
+    image inversion, dithering and smooth scaling off and on: without
+    bands, then in bands. The drawn pages must be the same pixel for pixel.
+    Prints the average time per page of both.
+
+    This is not part of the build. From the repository root, with crengine
+    configured with -DTHREAD_SAFE=ON and built in BUILD_DIR (for crsetup.h
+    and libcrengine):
+
+        c++ -std=gnu++17 -O2 -include cstdint -I$BUILD_DIR -Icrengine/include \
+            $(pkg-config --cflags freetype2) tests/page_bands_check.cpp -o page_bands_check \
+            -L$BUILD_DIR -lcrengine -Wl,-rpath,$BUILD_DIR
+        ./page_bands_check [-b bands] [-p pages] [-w width] [-h height] font.ttf... document
+
+    Defaults: 4 bands, 12 pages of 1404x1872. Exits with 1 on mismatch.
+*/
+
+#include "crsetup.h"
+#include "lvfntman.h"
+#include "lvdrawbuf.h"
+#include "lvdocview.h"
+#include "lvstring.h"
+#include <time.h>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#if (CR_THREAD_SAFE!=1)
+#error crengine must be configured with -DTHREAD_SAFE=ON
+#endif
+
+static double now()
+{
+    timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+static int bands = 4;
+static int pages = 12;
+static int width = 1404;
+static int height = 1872;
+
+static lUInt64 hashBuf( LVDrawBuf & buf )
+{
+    lUInt64 hash = 14695981039346656037ULL;
+    int rowBytes = (buf.GetWidth() * buf.GetBitsPerPixel() + 7) / 8;
+    for ( int y=0; y<buf.GetHeight(); y++ ) {
+        const lUInt8 * row = buf.GetScanLine( y );
+        for ( int x=0; x<rowBytes; x++ )
+            hash = (hash ^ row[x]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// draws the pages in n bands, adds their hashes to hashes, returns the time per page
+static double drawPages( LVDocView & view, LVDrawBuf & buf, int n, std::vector<lUInt64> & hashes )
+{
+    view.setPageDrawBands( n );
+    int count = pages < view.getPageCount() ? pages : view.getPageCount();
+    double time = 0;
+    for ( int p=0; p<count; p++ ) {
+        view.goToPage( p );
+        buf.Clear( 0xFFFFFF );
+        double t0 = now();
+        view.Draw( buf );
+        time += now() - t0;
+        hashes.push_back( hashBuf( buf ) );
+    }
+    return count ? time / count : 0;
+}
+
+// draws the pages with and without bands, returns the number of mismatches
+static int checkDocument( const char * fname )
+{
+    LVDocView view( 8 );
+    view.Resize( width, height );
+    if ( !view.LoadDocument( fname ) ) {
+        fprintf( stderr, "cannot open document %s\n", fname );
+        return 1;
+    }
+    view.checkRender();
+    static const int bpps[] = { 1, 2, 3, 4, 8, 16, 32 };
+    int bad = 0;
+    for ( int i=0; i<7; i++ ) {
+        for ( int options=0; options<8; options++ ) {
+            int bpp = bpps[i];
+            LVDrawBuf * buf;
+            if ( bpp > 8 )
+                buf = new LVColorDrawBuf( width, height, bpp );
+            else
+                buf = new LVGrayDrawBuf( width, height, bpp );
+            buf->setInvertImages( options & 1 );
+            buf->setDitherImages( options & 2 );
+            buf->setSmoothScalingImages( options & 4 );
+            std::vector<lUInt64> direct, banded;
+            double directTime = drawPages( view, *buf, 1, direct );
+            double bandedTime = drawPages( view, *buf, bands, banded );
+            bool same = direct == banded;
+            if ( !same )
+                bad++;
+            printf( "%2d bpp%s%s%s: %.1f ms/page, in %d bands %.1f ms/page: %s\n", bpp,
+                    options & 1 ? " inverted" : "", options & 2 ? " dithered" : "", options & 4 ? " smooth" : "",
+                    directTime, bands, bandedTime, same ? "same" : "DIFFERENT" );
+            delete buf;
+        }
+    }
+    return bad;
+}
+
+int main( int argc, char ** argv )
+{
+    const char * fname = NULL;
+    InitFontManager( lString8() );
+    for ( int i=1; i<argc; i++ ) {
+        lString8 arg( argv[i] );
+        if ( arg == "-b" && i+1 < argc )
+            bands = atoi( argv[++i] );
+        else if ( arg == "-p" && i+1 < argc )
+            pages = atoi( argv[++i] );
+        else if ( arg == "-w" && i+1 < argc )
+            width = atoi( argv[++i] );
+        else if ( arg == "-h" && i+1 < argc )
+            height = atoi( argv[++i] );
+        else if ( arg.endsWith( ".ttf" ) || arg.endsWith( ".otf" ) )
+            fontMan->RegisterFont( arg );
+        else
+            fname = argv[i];
+    }
+    if ( !fname || fontMan->GetFontCount() == 0 || bands < 2 || pages < 1 || width < 1 || height < 1 ) {
+        fprintf( stderr, "usage: %s [-b bands] [-p pages] [-w width] [-h height] font.ttf... document\n", argv[0] );
+        return 2;
+    }
+    int bad = checkDocument( fname );
+    printf( "%s\n", bad ? "MISMATCH" : "ok" );
+    ShutdownFontManager();
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+/*
+    Stress test of the THREAD_SAFE build (see crlocks.h).
+
+    Several threads share the same font instances: they copy and release
+    references to them, get fonts from the font manager, measure and draw
+    text with them (sharing the global glyph cache, with enough font sizes
+    to make it evict), and copy and release a shared string. Then each
+    thread loads, renders and draws its own document. Every result (text
+    widths, drawn buffer hashes, page counts) is compared with the results
+    of the same work done first by a single thread.
+
+    This is not part of the build. From the repository root, with crengine
+    configured with -DTHREAD_SAFE=ON and built in BUILD_DIR (for crsetup.h
+    and libcrengine), preferably with -fsanitize=thread in CMAKE_CXX_FLAGS:
+
+        c++ -std=gnu++17 -O1 -g -fsanitize=thread -include cstdint -I$BUILD_DIR -Icrengine/include \
+            $(pkg-config --cflags freetype2) tests/thread_safe_stress.cpp -o thread_safe_stress \
+            -L$BUILD_DIR -lcrengine -Wl,-rpath,$BUILD_DIR
+        ./thread_safe_stress [-t threads] [-i iterations] font.ttf... [document...]
+
+    Arguments ending with .ttf or .otf are registered as fonts, others are
+    loaded as documents (one per thread, cycling). Exits with 1 on mismatch.
+*/
+
+#include "crsetup.h"
+#include "lvfntman.h"
+#include "lvdrawbuf.h"
+#include "lvdocview.h"
+#include "lvstring.h"
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if (CR_THREAD_SAFE!=1)
+#error crengine must be configured with -DTHREAD_SAFE=ON
+#endif
+
+static int iterations = 400;
+static std::vector<LVFontRef> fonts;
+static std::vector<lString8> documents;
+static lString32 sharedText;
+
+static lUInt32 hashBuf( LVDrawBuf & buf )
+{
+    lUInt32 h = 2166136261u;
+    for ( int y=0; y<buf.GetHeight(); y++ ) {
+        const lUInt8 * row = buf.GetScanLine( y );
+        for ( int x=0; x<buf.GetRowSize(); x++ )
+            h = (h ^ row[x]) * 16777619u;
+    }
+    return h;
+}
+
+// results of the work done by one thread, in order
+typedef std::vector<lUInt32> Results;
+
+static void fontWork( int t, Results & res )
+{
+    static const char * words[] = { "The quick brown fox", " jumps over", " the lazy dog", " 0123456789",
+                                    " ÀÉÎõü", " АБВгд", ", fi fl", " WAVE" };
+    LVGrayDrawBuf buf( 800, 120, 8 );
+    for ( int it=0; it<iterations; it++ ) {
+        int n = it * 7 + t * 5;
+        LVFontRef font = fonts[n % fonts.size()]; // shared refcount
+        lString32 text = sharedText; // shared string buffer
+        for ( int i=0; i<4; i++ )
+            text << Utf8ToUnicode( words[(n + i*3) % 8] );
+        if ( it % 16 == 0 ) {
+            // font manager lookup, returns an instance shared with other threads
+            LVFontRef f = fontMan->GetFont( 12 + n % 40, n % 2 ? 700 : 400, n % 3 == 0, css_ff_sans_serif, font->getTypeFace() );
+            res.push_back( f->getHeight() );
+        }
+        buf.Clear( 0xFFFFFF );
+        res.push_back( font->getTextWidth( text.c_str(), text.length() ) );
+        font->DrawTextString( &buf, 0, 10, text.c_str(), text.length(), '?', NULL, false, NULL, 0, 0, 0, 0 );
+        res.push_back( hashBuf( buf ) );
+    }
+}
+
+static void documentWork( int t, Results & res )
+{
+    if ( documents.empty() )
+        return;
+    LVDocView view( 8 );
+    view.Resize( 600, 800 );
+    if ( !view.LoadDocument( documents[t % documents.size()].c_str() ) ) {
+        res.push_back( 0xFFFFFFFF );
+        return;
+    }
+    int pages = view.getPageCount();
+    res.push_back( pages );
+    LVGrayDrawBuf buf( 600, 800, 8 );
+    for ( int p=0; p<pages && p<20; p+=3 ) {
+        view.goToPage( p );
+        buf.Clear( 0xFFFFFF );
+        view.Draw( buf, false );
+        res.push_back( hashBuf( buf ) );
+    }
+}
+
+static void work( int t, Results & res )
+{
+    fontWork( t, res );
+    documentWork( t, res );
+}
+
+int main( int argc, char ** argv )
+{
+    int threads = 4;
+    InitFontManager( lString8() );
+    for ( int i=1; i<argc; i++ ) {
+        lString8 arg( argv[i] );
+        if ( arg == "-t" && i+1 < argc )
+            threads = atoi( argv[++i] );
+        else if ( arg == "-i" && i+1 < argc )
+            iterations = atoi( argv[++i] );
+        else if ( arg.endsWith( ".ttf" ) || arg.endsWith( ".otf" ) ) {
+            if ( !fontMan->RegisterFont( arg ) ) {
+                fprintf( stderr, "cannot register font %s\n", argv[i] );
+                return 2;
+            }
+        } else
+            documents.push_back( arg );
+    }
+    lString32Collection faces;
+    fontMan->getFaceList( faces );
+    if ( faces.length() == 0 ) {
+        fprintf( stderr, "usage: %s [-t threads] [-i iterations] font.ttf... [document...]\n", argv[0] );
+        return 2;
+    }
+    for ( int sz=10; sz<80; sz+=3 ) {
+        for ( int i=0; i<faces.length(); i++ )
+            fonts.push_back( fontMan->GetFont( sz, 400, false, css_ff_sans_serif, UnicodeToUtf8( faces[i] ) ) );
+    }
+    sharedText = cs32( "Shared: " );
+
+    // reference results, one thread at a time
+    std::vector<Results> expected( threads );
+    for ( int t=0; t<threads; t++ )
+        work( t, expected[t] );
+    fontMan->clearGlyphCache();
+
+    std::vector<Results> results( threads );
+    std::vector<std::thread> th;
+    for ( int t=0; t<threads; t++ )
+        th.emplace_back( work, t, std::ref( results[t] ) );
+    for ( auto & x : th )
+        x.join();
+
+    int bad = 0;
+    for ( int t=0; t<threads; t++ ) {
+        if ( results[t] != expected[t] ) {
+            size_t i = 0;
+            while ( i < results[t].size() && i < expected[t].size() && results[t][i] == expected[t][i] )
+                i++;
+            printf( "thread %d: result %d differs\n", t, (int)i );
+            bad++;
+        }
+    }
+    printf( "%d threads, %d fonts, %d documents, %d results each: %s\n", threads, (int)fonts.size(),
+            (int)documents.size(), (int)expected[0].size(), bad ? "MISMATCH" : "ok" );
+    fonts.clear();
+    ShutdownFontManager();
+    return bad ? 1 : 0;
+}